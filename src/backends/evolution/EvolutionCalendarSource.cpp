@@ -31,6 +31,7 @@ using namespace std;
 #include <syncevo/SyncContext.h>
 #include <syncevo/SmartPtr.h>
 #include <syncevo/Logging.h>
+#include <syncevo/TimezoneCache.h>
 
 #include "EvolutionCalendarSource.h"
 #include "EvolutionMemoSource.h"
@@ -38,6 +39,7 @@ using namespace std;
 
 
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
 
 #include <syncevo/declarations.h>
 SE_BEGIN_CXX
@@ -131,6 +133,10 @@ EvolutionCalendarSource::EvolutionCalendarSource(EvolutionCalendarSourceType typ
         SyncContext::throwError("internal error, invalid calendar type");
         break;
     }
+
+#ifdef USE_ECAL_CLIENT
+    m_operations.m_watchChanges = boost::bind(&EvolutionCalendarSource::watchChanges, this, _1);
+#endif
 }
 
 SyncSource::Databases EvolutionCalendarSource::getDatabases()
@@ -354,6 +360,13 @@ void EvolutionCalendarSource::open()
         }
     }
 
+#endif
+
+    // The database might have been removed and created again since
+    // time zones were added to it by this process.
+    TimezoneCache::instance().clear(getTimezoneScope());
+#ifdef USE_ECAL_CLIENT
+    m_timezones.clear();
 #endif
 
     g_signal_connect_after(m_calendar,
@@ -362,6 +375,11 @@ void EvolutionCalendarSource::open()
                            (void *)"Evolution Data Server has died unexpectedly, database no longer available.");
 }
 
+std::string EvolutionCalendarSource::getTimezoneScope()
+{
+    return StringPrintf("EDS %s %s", m_typeName.c_str(), getDatabaseID().c_str());
+}
+
 bool EvolutionCalendarSource::isEmpty()
 {
     // TODO: add more efficient implementation which does not
@@ -461,7 +479,20 @@ void EvolutionCalendarSource::listAllItems(RevisionMap_t &revisions)
     }
     ECalClientViewCXX viewPtr = ECalClientViewCXX::steal(view);
 
-    // TODO: Optimization: use set fields_of_interest (UID / REV / LAST-MODIFIED)
+    // Only the properties needed for the LUID and revision, so that
+    // EDS does not have to send the complete calendar over D-Bus.
+    // Backends which ignore this send complete items, which works
+    // just as well.
+    GListCXX<const char, GSList> fields;
+    fields.push_back("UID");
+    fields.push_back("RECURRENCE-ID");
+    fields.push_back("LAST-MODIFIED");
+    e_cal_client_view_set_fields_of_interest(viewPtr, fields, gerror);
+    if (gerror) {
+        SE_LOG_DEBUG(this, NULL, "restricting view to UID/RECURRENCE-ID/LAST-MODIFIED failed: %s",
+                     (const char *)gerror);
+        gerror.clear();
+    }
 
     ECalClientViewSyncHandler handler(viewPtr, list_revisions, &revisions);
     if (!handler.processSync(gerror)) {
@@ -498,11 +529,69 @@ void EvolutionCalendarSource::listAllItems(RevisionMap_t &revisions)
 #endif
 }
 
+#ifdef USE_ECAL_CLIENT
+std::string EvolutionCalendarSource::databaseRevision()
+{
+    return getBackendRevision(E_CLIENT((ECalClient *)m_calendar));
+}
+#endif
+
+void EvolutionCalendarSource::setAllItems(const RevisionMap_t &revisions)
+{
+    // listAllItems() was skipped, m_allLUIDs must be
+    // rebuilt from the cached information instead
+    m_allLUIDs.clear();
+    BOOST_FOREACH(const RevisionMap_t::value_type &entry, revisions) {
+        m_allLUIDs.insertLUID(entry.first);
+    }
+}
+
 void EvolutionCalendarSource::close()
 {
+    TimezoneCache::instance().logStatistics();
+#ifdef USE_ECAL_CLIENT
+    m_itemCache.clear();
+    m_timezones.clear();
+    if (m_watchedView) {
+        e_cal_client_view_stop(m_watchedView, NULL);
+        unwatchView(m_watchedView.get());
+        m_watchedView = NULL;
+    }
+#endif
     m_calendar = NULL;
 }
 
+#ifdef USE_ECAL_CLIENT
+void EvolutionCalendarSource::watchChanges(const Operations::ChangeCallback_t &callback)
+{
+    GErrorCXX gerror;
+    ECalClientView *view;
+
+    if (!e_cal_client_get_view_sync(m_calendar, "#t", &view, NULL, gerror)) {
+        throwError("getting the view", gerror);
+    }
+    ECalClientViewCXX viewPtr = ECalClientViewCXX::steal(view);
+
+    // The content of the items does not matter.
+    GListCXX<const char, GSList> fields;
+    fields.push_back("UID");
+    e_cal_client_view_set_fields_of_interest(viewPtr, fields, gerror);
+    if (gerror) {
+        SE_LOG_DEBUG(this, NULL, "restricting view to UID failed: %s",
+                     (const char *)gerror);
+        gerror.clear();
+    }
+
+    watchView(viewPtr.get(), callback);
+    e_cal_client_view_start(viewPtr, gerror);
+    if (gerror) {
+        unwatchView(viewPtr.get());
+        throwError("watching view", gerror);
+    }
+    m_watchedView = viewPtr;
+}
+#endif
+
 void EvolutionCalendarSource::readItem(const string &luid, std::string &item, bool raw)
 {
     ItemID id(luid);
@@ -511,15 +600,44 @@ void EvolutionCalendarSource::readItem(const string &luid, std::string &item, bo
 
 #ifdef USE_ECAL_CLIENT
 icaltimezone *
-my_tzlookup(const gchar *tzid,
-            gconstpointer ecalclient,
-            GCancellable *cancellable,
-            GError **error)
+EvolutionCalendarSource::lookupTimezone(const gchar *tzid,
+                                        gconstpointer source,
+                                        GCancellable *cancellable,
+                                        GError **error)
 {
+    EvolutionCalendarSource *me = static_cast<EvolutionCalendarSource *>(const_cast<gpointer>(source));
+
+    // created from the cache earlier?
+    Timezones_t::const_iterator it = me->m_timezones.find(tzid);
+    if (it != me->m_timezones.end()) {
+        return it->second->get();
+    }
+
+    // Resolved by this process before? The zones returned by
+    // ECalClient belong to the client, so create our own copy.
+    TimezoneCache &tzcache = TimezoneCache::instance();
+    std::string tzscope = me->getTimezoneScope();
+    std::string definition;
+    if (tzcache.lookupResolved(tzscope, tzid, definition)) {
+        if (definition.empty()) {
+            return NULL;
+        }
+        icalcomponent *comp = icalcomponent_new_from_string((char *)definition.c_str()); // hack for old libical
+        if (comp) {
+            boost::shared_ptr< eptr<icaltimezone> > zone(new eptr<icaltimezone>(icaltimezone_new(), "icaltimezone"));
+            icaltimezone_set_component(zone->get(), comp);
+            me->m_timezones[tzid] = zone;
+            return zone->get();
+        }
+        // fall through to asking the database
+    }
+
     icaltimezone *zone = NULL;
     GError *local_error = NULL;
 
-    if (e_cal_client_get_timezone_sync((ECalClient *)ecalclient, tzid, &zone, cancellable, &local_error)) {
+    if (e_cal_client_get_timezone_sync(me->m_calendar, tzid, &zone, cancellable, &local_error)) {
+        eptr<char> icalstr(ical_strdup(icalcomponent_as_ical_string(icaltimezone_get_component(zone))));
+        tzcache.storeResolved(tzscope, tzid, icalstr.get());
         return zone;
     } else if (local_error && local_error->domain == E_CAL_CLIENT_ERROR) {
         // Ignore *all* E_CAL_CLIENT_ERROR errors, e_cal_client_get_timezone_sync() does
@@ -527,6 +645,7 @@ my_tzlookup(const gchar *tzid,
         // See the 'e_cal_client_check_timezones() + e_cal_client_tzlookup() + Could not retrieve calendar time zone: Invalid object'
         // mail thread.
         g_clear_error (&local_error);
+        tzcache.storeResolved(tzscope, tzid, "");
     } else if (local_error) {
         g_propagate_error (error, local_error);
     }
@@ -587,8 +706,8 @@ EvolutionCalendarSource::InsertItemResult EvolutionCalendarSource::insertItem(co
 #ifdef USE_ECAL_CLIENT
         !e_cal_client_check_timezones(icomp,
                                       NULL,
-                                      my_tzlookup,
-                                      (const void *)m_calendar.get(),
+                                      lookupTimezone,
+                                      (const void *)this,
                                       NULL,
                                       gerror)
 #else
@@ -605,30 +724,49 @@ EvolutionCalendarSource::InsertItemResult EvolutionCalendarSource::insertItem(co
 
     // insert before adding/updating the event so that the new VTIMEZONE is
     // immediately available should anyone want it
+    //
+    // Adding the same definition again is a no-op, so skip the call
+    // for definitions which were already added to this database by
+    // the process. Imports typically use a handful of time zones in
+    // thousands of events. After adding, the TZID resolves to the
+    // new definition, which saves the lookup for the next event.
+    TimezoneCache &tzcache = TimezoneCache::instance();
+    string tzscope = getTimezoneScope();
     for (icalcomponent *tcomp = icalcomponent_get_first_component(icomp, ICAL_VTIMEZONE_COMPONENT);
          tcomp;
          tcomp = icalcomponent_get_next_component(icomp, ICAL_VTIMEZONE_COMPONENT)) {
+        icalproperty *tzidprop = icalcomponent_get_first_property(tcomp, ICAL_TZID_PROPERTY);
+        const char *tzid = tzidprop ? icalproperty_get_tzid(tzidprop) : NULL;
+        if (!tzid || !tzid[0]) {
+            // cannot add a VTIMEZONE without TZID
+            SE_LOG_DEBUG(this, NULL, "skipping VTIMEZONE without TZID");
+            continue;
+        }
+        eptr<char> definition(ical_strdup(icalcomponent_as_ical_string(tcomp)));
+        if (tzcache.lookup(tzscope, tzid, definition.get())) {
+            continue;
+        }
+
         eptr<icaltimezone> zone(icaltimezone_new(), "icaltimezone");
         icaltimezone_set_component(zone, tcomp);
 
         GErrorCXX gerror;
-        const char *tzid = icaltimezone_get_tzid(zone);
-        if (!tzid || !tzid[0]) {
-            // cannot add a VTIMEZONE without TZID
-            SE_LOG_DEBUG(this, NULL, "skipping VTIMEZONE without TZID");
-        } else {
-            gboolean success =
+        gboolean success =
 #ifdef USE_ECAL_CLIENT
-                e_cal_client_add_timezone_sync(m_calendar, zone, NULL, gerror)
+            e_cal_client_add_timezone_sync(m_calendar, zone, NULL, gerror)
 #else
-                e_cal_add_timezone(m_calendar, zone, gerror)
+            e_cal_add_timezone(m_calendar, zone, gerror)
 #endif
-                ;
-            if (!success) {
-                throwError(string("error adding VTIMEZONE ") + tzid,
-                           gerror);
-            }
+            ;
+        if (!success) {
+            throwError(string("error adding VTIMEZONE ") + tzid,
+                       gerror);
         }
+        tzcache.store(tzscope, tzid, definition.get());
+#ifdef USE_ECAL_CLIENT
+        tzcache.storeResolved(tzscope, tzid, definition.get());
+        m_timezones.erase(tzid);
+#endif
     }
 
     // the component to update/add must be the
@@ -640,6 +778,14 @@ EvolutionCalendarSource::InsertItemResult EvolutionCalendarSource::insertItem(co
         throwError("extracting event");
     }
 
+#ifdef USE_ECAL_CLIENT
+    // Read-ahead items with the same UID might get modified below.
+    m_itemCache.erase(getItemID(subcomp).m_uid);
+    if (update) {
+        m_itemCache.erase(ItemID(luid).m_uid);
+    }
+#endif
+
     // Remove LAST-MODIFIED: the Evolution Exchange Connector does not
     // properly update this property if it is already present in the
     // incoming data.
@@ -919,6 +1065,9 @@ void EvolutionCalendarSource::removeItem(const string &luid)
 {
     GErrorCXX gerror;
     ItemID id(luid);
+#ifdef USE_ECAL_CLIENT
+    m_itemCache.erase(id.m_uid);
+#endif
 
     if (id.m_rid.empty()) {
         /*
@@ -1021,11 +1170,116 @@ void EvolutionCalendarSource::removeItem(const string &luid)
     }
 }
 
-icalcomponent *EvolutionCalendarSource::retrieveItem(const ItemID &id)
+#ifdef USE_ECAL_CLIENT
+void EvolutionCalendarSource::fetchItems(const std::vector<std::string> &uids, ItemCache_t &items)
+{
+    if (uids.empty()) {
+        return;
+    }
+
+    std::string sexp = "(or";
+    BOOST_FOREACH(const std::string &uid, uids) {
+        sexp += " (uid? \"";
+        BOOST_FOREACH(char c, uid) {
+            if (c == '"' || c == '\\') {
+                sexp += '\\';
+            }
+            sexp += c;
+        }
+        sexp += "\")";
+    }
+    sexp += ")";
+
+    GErrorCXX gerror;
+    GSList *list;
+    if (!e_cal_client_get_object_list_sync(m_calendar, sexp.c_str(), &list, NULL, gerror)) {
+        throwError(StringPrintf("reading %lu items", (unsigned long)uids.size()), gerror);
+    }
+    // The list contains the parent and the detached recurrences
+    // as individual components.
+    GListCXX<icalcomponent, GSList> compList(list);
+    BOOST_FOREACH(icalcomponent *icomp, compList) {
+        ItemCache_t::mapped_type::mapped_type comp(new eptr<icalcomponent>(icomp));
+        ItemID id = getItemID(icomp);
+        if (!id.m_uid.empty()) {
+            items[id.m_uid][id.m_rid] = comp;
+        }
+    }
+}
+
+icalcomponent *EvolutionCalendarSource::readAheadItem(const ItemID &id)
+{
+    ItemCache_t::iterator it = m_itemCache.find(id.m_uid);
+    if (it == m_itemCache.end()) {
+        // Same approach as in EvolutionContactSource: the engine
+        // reads items in the order in which they are listed in
+        // getAllItems(), and in an incremental sync only those which
+        // were added or updated. Fetch all items with the UIDs of the
+        // next batch with one D-Bus call. Whatever remains in the
+        // cache from the previous batch was not needed after all.
+        static const size_t batchSize = 50;
+        const Items_t &all = getAllItems();
+        const Items_t &added = getNewItems();
+        const Items_t &updated = getUpdatedItems();
+        std::string luid = id.getLUID();
+        bool changedOnly = added.count(luid) || updated.count(luid);
+        std::set<std::string> seen;
+        std::vector<std::string> uids;
+        seen.insert(id.m_uid);
+        uids.push_back(id.m_uid);
+        for (Items_t::const_iterator next = all.upper_bound(luid);
+             next != all.end() && uids.size() < batchSize;
+             ++next) {
+            if (!changedOnly ||
+                added.count(*next) ||
+                updated.count(*next)) {
+                ItemID nextid(*next);
+                if (seen.insert(nextid.m_uid).second) {
+                    uids.push_back(nextid.m_uid);
+                }
+            }
+        }
+        m_itemCache.clear();
+        fetchItems(uids, m_itemCache);
+        SE_LOG_DEBUG(this, NULL, "read ahead: %lu of %lu UIDs found",
+                     (unsigned long)m_itemCache.size(), (unsigned long)uids.size());
+        it = m_itemCache.find(id.m_uid);
+        if (it == m_itemCache.end()) {
+            return NULL;
+        }
+    }
+
+    ItemCache_t::mapped_type::iterator rid = it->second.find(id.m_rid);
+    if (rid == it->second.end()) {
+        return NULL;
+    }
+    // Hand over the component. Each one was created by fetchItems()
+    // and is not shared.
+    icalcomponent *comp = rid->second->release();
+    it->second.erase(rid);
+    if (it->second.empty()) {
+        m_itemCache.erase(it);
+    }
+    return comp;
+}
+#endif
+
+icalcomponent *EvolutionCalendarSource::retrieveItem(const ItemID &id, bool readAhead)
 {
     GErrorCXX gerror;
     icalcomponent *comp = NULL;
 
+#ifdef USE_ECAL_CLIENT
+    if (readAhead) {
+        comp = readAheadItem(id);
+        if (comp) {
+            return comp;
+        }
+        // Not found: fall back to getting the item individually,
+        // which also takes care of reporting the error.
+    }
+#endif
+
     if (
 #ifdef USE_ECAL_CLIENT
         !e_cal_client_get_object_sync(m_calendar,
@@ -1070,7 +1324,7 @@ icalcomponent *EvolutionCalendarSource::retrieveItem(const ItemID &id)
 
 string EvolutionCalendarSource::retrieveItemAsString(const ItemID &id)
 {
-    eptr<icalcomponent> comp(retrieveItem(id));
+    eptr<icalcomponent> comp(retrieveItem(id, true));
     eptr<char> icalstr;
 
 #ifdef USE_ECAL_CLIENT
@@ -147,6 +147,10 @@ class EvolutionCalendarSource : public EvolutionSyncSource,
     // implementation of TrackingSyncSource callbacks
     //
     virtual void listAllItems(RevisionMap_t &revisions);
+#ifdef USE_ECAL_CLIENT
+    virtual std::string databaseRevision();
+#endif
+    virtual void setAllItems(const RevisionMap_t &revisions);
     virtual InsertItemResult insertItem(const string &uid, const std::string &item, bool raw);
     void readItem(const std::string &luid, std::string &item, bool raw);
     virtual void removeItem(const string &uid);
@@ -158,6 +162,12 @@ class EvolutionCalendarSource : public EvolutionSyncSource,
     /** valid after open(): the calendar that this source references */
 #ifdef USE_ECAL_CLIENT
     ECalClientCXX m_calendar;
+
+    /** view used by watchChanges(), stopped in close() */
+    ECalClientViewCXX m_watchedView;
+
+    /** implements the m_watchChanges operation */
+    void watchChanges(const Operations::ChangeCallback_t &callback);
 #else
     eptr<ECal, GObject> m_calendar;
     ECal *(*m_newSystem)(void);    /**< e_cal_new_system_calendar, etc. */
@@ -180,12 +190,59 @@ class EvolutionCalendarSource : public EvolutionSyncSource,
      * retrieve the item with the given id - may throw exception
      *
      * caller has to free result
+     *
+     * @param readAhead    true when called by readItem(): the item may come
+     *                     from m_itemCache and other items which are going to be
+     *                     read get fetched together with it
      */
-    icalcomponent *retrieveItem(const ItemID &id);
+    icalcomponent *retrieveItem(const ItemID &id, bool readAhead = false);
 
-    /** retrieve the item with the given luid as VCALENDAR string - may throw exception */
+    /** retrieve the item with the given luid as VCALENDAR string, using read-ahead - may throw exception */
     string retrieveItemAsString(const ItemID &id);
 
+    /** scope of the time zones added to the database in TimezoneCache */
+    std::string getTimezoneScope();
+
+#ifdef USE_ECAL_CLIENT
+    /**
+     * Items which were fetched in advance by readAheadItem(), indexed by
+     * UID and RID. Only valid during a session: entries are removed when
+     * read, when the item gets modified or removed, and in close().
+     */
+    typedef std::map< std::string, std::map< std::string, boost::shared_ptr< eptr<icalcomponent> > > > ItemCache_t;
+    ItemCache_t m_itemCache;
+
+    /** get all items with the given UIDs with one call, missing ones are skipped */
+    void fetchItems(const std::vector<std::string> &uids, ItemCache_t &items);
+
+    /**
+     * take item from m_itemCache, filling it with the next batch of
+     * items if necessary
+     *
+     * @return item which has to be freed by the caller, NULL if not found
+     */
+    icalcomponent *readAheadItem(const ItemID &id);
+
+    /**
+     * Time zones created from definitions in the TimezoneCache,
+     * indexed by TZID. They are returned by lookupTimezone() and
+     * freed in open() and close().
+     */
+    typedef std::map< std::string, boost::shared_ptr< eptr<icaltimezone> > > Timezones_t;
+    Timezones_t m_timezones;
+
+    /**
+     * TZID lookup for e_cal_client_check_timezones(): the database
+     * is only asked for a TZID which is not in the TimezoneCache.
+     *
+     * @param source    the EvolutionCalendarSource
+     */
+    static icaltimezone *lookupTimezone(const gchar *tzid,
+                                        gconstpointer source,
+                                        GCancellable *cancellable,
+                                        GError **error);
+#endif
+
 
     /** returns the type which the ical library uses for our components */
     icalcomponent_kind getCompType() {
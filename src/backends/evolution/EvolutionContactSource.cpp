@@ -39,6 +39,8 @@ using namespace std;
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+#include <boost/scoped_array.hpp>
 
 #include <syncevo/declarations.h>
 
@@ -74,6 +76,9 @@ EvolutionContactSource::EvolutionContactSource(const SyncSourceParams &params,
     SyncSourceLogging::init(InitList<std::string>("N_FIRST") + "N_MIDDLE" + "N_LAST",
                             " ",
                             m_operations);
+#ifdef USE_EBOOK_CLIENT
+    m_operations.m_watchChanges = boost::bind(&EvolutionContactSource::watchChanges, this, _1);
+#endif
 }
 
 EvolutionSyncSource::Databases EvolutionContactSource::getDatabases()
@@ -490,11 +495,60 @@ void EvolutionContactSource::listAllItems(RevisionMap_t &revisions)
 #endif
 }
 
+#ifdef USE_EBOOK_CLIENT
+std::string EvolutionContactSource::databaseRevision()
+{
+    return getBackendRevision(E_CLIENT((EBookClient *)m_addressbook));
+}
+#endif
+
 void EvolutionContactSource::close()
 {
+#ifdef USE_EBOOK_CLIENT
+    m_contactCache.clear();
+    if (m_watchedView) {
+        e_book_client_view_stop(m_watchedView, NULL);
+        unwatchView(m_watchedView.get());
+        m_watchedView = NULL;
+    }
+#endif
     m_addressbook = NULL;
 }
 
+#ifdef USE_EBOOK_CLIENT
+void EvolutionContactSource::watchChanges(const Operations::ChangeCallback_t &callback)
+{
+    GErrorCXX gerror;
+    EBookClientView *view;
+
+    EBookQueryCXX allItemsQuery(e_book_query_any_field_contains(""), false);
+    PlainGStr sexp(e_book_query_to_string (allItemsQuery.get()));
+
+    if (!e_book_client_get_view_sync(m_addressbook, sexp, &view, NULL, gerror)) {
+        throwError("getting the view", gerror);
+    }
+    EBookClientViewCXX viewPtr = EBookClientViewCXX::steal(view);
+
+    // The content of the contacts does not matter.
+    GListCXX<const char, GSList> fields;
+    fields.push_back(e_contact_field_name(E_CONTACT_UID));
+    e_book_client_view_set_fields_of_interest(viewPtr, fields, gerror);
+    if (gerror) {
+        SE_LOG_DEBUG(this, NULL, "restricting view to UID failed: %s",
+                     (const char *)gerror);
+        gerror.clear();
+    }
+
+    watchView(viewPtr.get(), callback);
+    e_book_client_view_start(viewPtr, gerror);
+    if (gerror) {
+        unwatchView(viewPtr.get());
+        throwError("watching view", gerror);
+    }
+    m_watchedView = viewPtr;
+}
+#endif
+
 string EvolutionContactSource::getRevision(const string &luid)
 {
     EContact *contact;
@@ -529,24 +583,102 @@ string EvolutionContactSource::getRevision(const string &luid)
     return rev;
 }
 
-void EvolutionContactSource::readItem(const string &luid, std::string &item, bool raw)
+#ifdef USE_EBOOK_CLIENT
+void EvolutionContactSource::fetchContacts(const std::vector<std::string> &uids, ContactCache &contacts)
 {
-    EContact *contact;
+    if (uids.empty()) {
+        return;
+    }
+
+    // e_book_query_or() takes ownership of the individual queries
+    boost::scoped_array<EBookQuery *> queries(new EBookQuery *[uids.size()]);
+    for (size_t i = 0; i < uids.size(); i++) {
+        queries[i] = e_book_query_field_test(E_CONTACT_UID, E_BOOK_QUERY_IS, uids[i].c_str());
+    }
+    EBookQueryCXX query(e_book_query_or(uids.size(), queries.get(), TRUE), false);
+    PlainGStr sexp(e_book_query_to_string(query.get()));
+
     GErrorCXX gerror;
-    if (
+    GSList *list;
+    if (!e_book_client_get_contacts_sync(m_addressbook, sexp, &list, NULL, gerror)) {
+        throwError(StringPrintf("reading %lu contacts", (unsigned long)uids.size()), gerror);
+    }
+    GListCXX<EContact, GSList> contactList(list);
+    BOOST_FOREACH(EContact *contact, contactList) {
+        EContactCXX contactptr = EContactCXX::steal(contact);
+        const char *uid = (const char *)e_contact_get_const(contact, E_CONTACT_UID);
+        if (uid && uid[0]) {
+            contacts[uid] = contactptr;
+        }
+    }
+}
+
+EContactCXX EvolutionContactSource::getContact(const std::string &luid)
+{
+    ContactCache::iterator it = m_contactCache.find(luid);
+    if (it == m_contactCache.end()) {
+        // The engine reads items in the order in which they are
+        // listed in getAllItems(), and in an incremental sync only
+        // those which were added or updated. Fetch the next batch of
+        // those with one D-Bus call. Whatever remains in the cache
+        // from the previous batch was not needed after all.
+        static const size_t batchSize = 50;
+        const Items_t &all = getAllItems();
+        const Items_t &added = getNewItems();
+        const Items_t &updated = getUpdatedItems();
+        bool changedOnly = added.count(luid) || updated.count(luid);
+        std::vector<std::string> uids;
+        uids.push_back(luid);
+        for (Items_t::const_iterator next = all.upper_bound(luid);
+             next != all.end() && uids.size() < batchSize;
+             ++next) {
+            if (!changedOnly ||
+                added.count(*next) ||
+                updated.count(*next)) {
+                uids.push_back(*next);
+            }
+        }
+        m_contactCache.clear();
+        fetchContacts(uids, m_contactCache);
+        SE_LOG_DEBUG(this, NULL, "read ahead: %lu of %lu contacts found",
+                     (unsigned long)m_contactCache.size(), (unsigned long)uids.size());
+        it = m_contactCache.find(luid);
+        if (it == m_contactCache.end()) {
+            throwError(STATUS_NOT_FOUND, string("reading contact: ") + luid);
+        }
+    }
+    EContactCXX contact = it->second;
+    m_contactCache.erase(it);
+    return contact;
+}
+
+void EvolutionContactSource::readItemsRaw(const std::vector<std::string> &luids,
+                                          std::vector<std::string> &items)
+{
+    ContactCache contacts;
+    fetchContacts(luids, contacts);
+    items.resize(luids.size());
+    for (size_t i = 0; i < luids.size(); i++) {
+        ContactCache::iterator it = contacts.find(luids[i]);
+        if (it == contacts.end()) {
+            throwError(STATUS_NOT_FOUND, string("reading contact: ") + luids[i]);
+        }
+        items[i] = contactToItem(it->second, luids[i], true);
+    }
+}
+#endif
+
+void EvolutionContactSource::readItem(const string &luid, std::string &item, bool raw)
+{
 #ifdef USE_EBOOK_CLIENT
-        !e_book_client_get_contact_sync(m_addressbook,
-                                        luid.c_str(),
-                                        &contact,
-                                        NULL,
-                                        gerror)
+    item = contactToItem(getContact(luid), luid, raw);
 #else
-        !e_book_get_contact(m_addressbook,
+    EContact *contact;
+    GErrorCXX gerror;
+    if (!e_book_get_contact(m_addressbook,
                             luid.c_str(),
                             &contact,
-                            gerror)
-#endif
-        ) {
+                            gerror)) {
         if (IsContactNotFound(gerror)) {
             throwError(STATUS_NOT_FOUND, string("reading contact: ") + luid);
         } else {
@@ -556,6 +688,13 @@ void EvolutionContactSource::readItem(const string &luid, std::string &item, boo
     }
 
     eptr<EContact, GObject> contactptr(contact, "contact");
+    item = contactToItem(contact, luid, raw);
+#endif
+}
+
+std::string EvolutionContactSource::contactToItem(EContact *contact, const std::string &luid, bool raw)
+{
+    GErrorCXX gerror;
 
     // Inline PHOTO data if exporting, leave VALUE=uri references unchanged
     // when processing inside engine (will be inlined by engine as needed).
@@ -568,19 +707,19 @@ void EvolutionContactSource::readItem(const string &luid, std::string &item, boo
 #endif
         ) {
 #if defined(EVOLUTION_COMPATIBILITY) || defined(HAVE_E_CONTACT_INLINE_LOCAL_PHOTOS)
-        if (!e_contact_inline_local_photos(contactptr, gerror)) {
+        if (!e_contact_inline_local_photos(contact, gerror)) {
             throwError(string("inlining PHOTO file data in ") + luid, gerror);
         }
 #endif
     }
 
-    eptr<char> vcardstr(e_vcard_to_string(&contactptr->parent,
+    eptr<char> vcardstr(e_vcard_to_string(&contact->parent,
                                           EVC_FORMAT_VCARD_30));
     if (!vcardstr) {
         throwError(string("failure extracting contact from Evolution " ) + luid);
     }
 
-    item = vcardstr.get();
+    return vcardstr.get();
 }
 
 TrackingSyncSource::InsertItemResult
@@ -594,6 +733,7 @@ EvolutionContactSource::insertItem(const string &uid, const std::string &item, b
                       const_cast<char *>(uid.c_str()));
         GErrorCXX gerror;
 #ifdef USE_EBOOK_CLIENT
+        m_contactCache.erase(uid);
         if (uid.empty()) {
             gchar* newuid;
             if (!e_book_client_add_contact_sync(m_addressbook, contact, &newuid, NULL, gerror)) {
@@ -633,9 +773,96 @@ EvolutionContactSource::insertItem(const string &uid, const std::string &item, b
     return InsertItemResult("", "", ITEM_OKAY);
 }
 
+#if defined(USE_EBOOK_CLIENT) && defined(HAVE_E_BOOK_CLIENT_ADD_CONTACTS)
+void EvolutionContactSource::insertItems(const std::vector<std::string> &luids,
+                                         const std::vector<std::string> &items,
+                                         bool raw,
+                                         std::vector<InsertItemResult> &results)
+{
+    results.clear();
+    results.reserve(luids.size());
+    size_t start = 0;
+    while (start < luids.size()) {
+        // Consecutive additions resp. updates are stored with one
+        // call. Items which come before an invalid one still get
+        // stored, so that results is correct when throwing the error.
+        bool add = luids[start].empty();
+        std::vector<EContactCXX> contacts;
+        GListCXX<EContact, GSList> contactList;
+        size_t end = start;
+        while (end < luids.size() &&
+               luids[end].empty() == add) {
+            EContactCXX contact = EContactCXX::steal(e_contact_new_from_vcard(items[end].c_str()));
+            if (!contact) {
+                break;
+            }
+            e_contact_set(contact, E_CONTACT_UID,
+                          add ?
+                          NULL :
+                          const_cast<char *>(luids[end].c_str()));
+            contacts.push_back(contact);
+            contactList.push_back(contact.get());
+            m_contactCache.erase(luids[end]);
+            end++;
+        }
+        if (contacts.empty()) {
+            throwError(string("failure parsing vcard " ) + items[start]);
+        }
+
+        GErrorCXX gerror;
+        std::vector<std::string> uids;
+        if (add) {
+            GListCXX<char, GSList, GFreeDestructor<char> > newuids;
+            if (!e_book_client_add_contacts_sync(m_addressbook, contactList, newuids, NULL, gerror)) {
+                throwError(StringPrintf("adding %lu new contacts", (unsigned long)contacts.size()), gerror);
+            }
+            BOOST_FOREACH(const char *newuid, newuids) {
+                uids.push_back(newuid);
+            }
+            if (uids.size() != contacts.size()) {
+                throwError(StringPrintf("adding %lu new contacts: got %lu UIDs",
+                                        (unsigned long)contacts.size(), (unsigned long)uids.size()));
+            }
+        } else {
+            if (!e_book_client_modify_contacts_sync(m_addressbook, contactList, NULL, gerror)) {
+                throwError(StringPrintf("updating %lu contacts", (unsigned long)contacts.size()), gerror);
+            }
+            uids.assign(luids.begin() + start, luids.begin() + end);
+        }
+
+        // The contacts are stored now. One more call for the new
+        // revisions instead of getRevision() per contact. If that
+        // fails, fall back to getRevision(), so that all contacts
+        // before a failure still end up in results and get tracked.
+        ContactCache stored;
+        try {
+            fetchContacts(uids, stored);
+        } catch (...) {
+            std::string explanation;
+            Exception::handle(explanation, HANDLE_EXCEPTION_NO_ERROR);
+            SE_LOG_DEBUG(this, NULL, "reading new revisions failed, reading them one by one: %s",
+                         explanation.c_str());
+        }
+        BOOST_FOREACH(const std::string &uid, uids) {
+            ContactCache::iterator it = stored.find(uid);
+            const char *rev = it == stored.end() ?
+                NULL :
+                (const char *)e_contact_get_const(it->second, E_CONTACT_REV);
+            results.push_back(InsertItemResult(uid,
+                                               (rev && rev[0]) ? std::string(rev) : getRevision(uid),
+                                               ITEM_OKAY));
+        }
+        start = end;
+    }
+}
+#endif
+
 void EvolutionContactSource::removeItem(const string &uid)
 {
     GErrorCXX gerror;
+#ifdef USE_EBOOK_CLIENT
+    m_contactCache.erase(uid);
+#endif
     if (
 #ifdef USE_EBOOK_CLIENT
         !e_book_client_remove_contact_by_uid_sync(m_addressbook, uid.c_str(), NULL, gerror)
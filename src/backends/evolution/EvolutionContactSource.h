@@ -31,12 +31,15 @@
 #ifdef ENABLE_EBOOK
 
 #include <set>
+#include <map>
+#include <vector>
 
 #include <syncevo/declarations.h>
 
 #ifdef USE_EBOOK_CLIENT
 SE_GOBJECT_TYPE(EBookClient)
 SE_GOBJECT_TYPE(EBookClientView)
+SE_GOBJECT_TYPE(EContact)
 #endif
 
 SE_BEGIN_CXX
@@ -68,8 +71,21 @@ class EvolutionContactSource : public EvolutionSyncSource,
     // implementation of TrackingSyncSource callbacks
     //
     virtual void listAllItems(RevisionMap_t &revisions);
+#ifdef USE_EBOOK_CLIENT
+    virtual std::string databaseRevision();
+#endif
     virtual InsertItemResult insertItem(const string &uid, const std::string &item, bool raw);
+#if defined(USE_EBOOK_CLIENT) && defined(HAVE_E_BOOK_CLIENT_ADD_CONTACTS)
+    virtual void insertItems(const std::vector<std::string> &luids,
+                             const std::vector<std::string> &items,
+                             bool raw,
+                             std::vector<InsertItemResult> &results);
+#endif
     void readItem(const std::string &luid, std::string &item, bool raw);
+#ifdef USE_EBOOK_CLIENT
+    virtual void readItemsRaw(const std::vector<std::string> &luids,
+                              std::vector<std::string> &items);
+#endif
     virtual void removeItem(const string &uid);
 
     // implementation of SyncSourceLogging callback
@@ -97,6 +113,42 @@ class EvolutionContactSource : public EvolutionSyncSource,
     eptr<EBook, GObject> m_addressbook;
 #endif
 
+#ifdef USE_EBOOK_CLIENT
+    /** view used by watchChanges(), stopped in close() */
+    EBookClientViewCXX m_watchedView;
+
+    /** implements the m_watchChanges operation */
+    void watchChanges(const Operations::ChangeCallback_t &callback);
+#endif
+
+#ifdef USE_EBOOK_CLIENT
+    /** contacts indexed by UID */
+    typedef std::map<std::string, EContactCXX> ContactCache;
+
+    /**
+     * Contacts fetched in advance by readItem(). An entry is removed
+     * when it gets read or the contact gets modified.
+     */
+    ContactCache m_contactCache;
+
+    /**
+     * Reads the given contacts with a single
+     * e_book_client_get_contacts_sync() call. Contacts which do
+     * not exist are silently skipped.
+     */
+    void fetchContacts(const std::vector<std::string> &uids, ContactCache &contacts);
+
+    /**
+     * Returns the requested contact, either from m_contactCache or by
+     * fetching it together with the contacts that the engine is
+     * going to ask for next.
+     */
+    EContactCXX getContact(const std::string &luid);
+#endif
+
+    /** turns contact into vCard 3.0, with inlined photo data if raw */
+    std::string contactToItem(EContact *contact, const std::string &luid, bool raw);
+
     /** the format of vcards that new items are expected to have */
     const EVCardFormat m_vcardFormat;
 
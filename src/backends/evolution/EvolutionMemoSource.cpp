@@ -40,7 +40,7 @@ void EvolutionMemoSource::readItem(const string &luid, std::string &item, bool r
     }
 
     ItemID id(luid);
-    eptr<icalcomponent> comp(retrieveItem(id));
+    eptr<icalcomponent> comp(retrieveItem(id, true));
     icalcomponent *cal = icalcomponent_get_first_component(comp, ICAL_VCALENDAR_COMPONENT);
     if (!cal) {
         cal = comp;
@@ -60,6 +60,60 @@ ESource *EvolutionSyncSource::findSource( ESourceList *list, const string &id )
     return NULL;
 }
 
+#if defined(USE_EBOOK_CLIENT) || defined(USE_ECAL_CLIENT)
+std::string EvolutionSyncSource::getBackendRevision(EClient *client)
+{
+    GErrorCXX gerror;
+    gchar *value = NULL;
+    if (!e_client_get_backend_property_sync(client, "revision", &value, NULL, gerror)) {
+        // older backends do not have it, fall back to listing items
+        SE_LOG_DEBUG(this, NULL, "no database revision: %s",
+                     gerror ? gerror->message : "unknown error");
+        return "";
+    }
+    PlainGStr revision(value);
+    return revision ? revision.get() : "";
+}
+
+void EvolutionSyncSource::watchView(gpointer view, const Operations::ChangeCallback_t &callback)
+{
+    m_viewCallback = callback;
+    m_viewComplete = false;
+    g_signal_connect(view, "objects-added", G_CALLBACK(viewChanged), this);
+    g_signal_connect(view, "objects-modified", G_CALLBACK(viewChanged), this);
+    g_signal_connect(view, "objects-removed", G_CALLBACK(viewChanged), this);
+    g_signal_connect(view, "complete", G_CALLBACK(viewComplete), this);
+}
+
+void EvolutionSyncSource::unwatchView(gpointer view)
+{
+    g_signal_handlers_disconnect_matched(view, G_SIGNAL_MATCH_DATA,
+                                         0, 0, NULL, NULL, this);
+    m_viewCallback.clear();
+}
+
+void EvolutionSyncSource::viewChanged(gpointer view, const GSList *objects, gpointer userdata)
+{
+    EvolutionSyncSource *that = static_cast<EvolutionSyncSource *>(userdata);
+    try {
+        if (that->m_viewComplete && that->m_viewCallback) {
+            that->m_viewCallback();
+        }
+    } catch (...) {
+        Exception::handle();
+    }
+}
+
+void EvolutionSyncSource::viewComplete(gpointer view, const GError *error, gpointer userdata)
+{
+    EvolutionSyncSource *that = static_cast<EvolutionSyncSource *>(userdata);
+    if (error) {
+        SE_LOG_DEBUG(that, NULL, "watching view: %s", error->message);
+    }
+    that->m_viewComplete = true;
+}
+#endif
+
 void EvolutionSyncSource::throwError(const string &action, GErrorCXX &gerror)
 {
     string gerrorstr;
@@ -69,6 +69,37 @@ class EvolutionSyncSource : public TrackingSyncSource
      * @return   pointer to source or NULL if not found
      */
     ESource *findSource( ESourceList *list, const string &id );
+
+#if defined(USE_EBOOK_CLIENT) || defined(USE_ECAL_CLIENT)
+    /**
+     * Reads the "revision" backend property, which the backend changes
+     * whenever the content of the database changes. Suitable as
+     * databaseRevision(). Returns an empty string if the backend does
+     * not support the property.
+     */
+    std::string getBackendRevision(EClient *client);
+
+    /**
+     * Helper for implementing the m_watchChanges operation with a
+     * view on all items: EBookClientView and ECalClientView emit the
+     * same signals. Items which the view reports while it starts up
+     * are ignored, later additions, modifications and removals
+     * invoke the callback.
+     *
+     * The caller starts the view after calling watchView() and must
+     * call unwatchView() before the view gets destroyed.
+     */
+    void watchView(gpointer view, const Operations::ChangeCallback_t &callback);
+    void unwatchView(gpointer view);
+
+ private:
+    Operations::ChangeCallback_t m_viewCallback;
+    /** true once the view has reported the existing items */
+    bool m_viewComplete;
+
+    static void viewChanged(gpointer view, const GSList *objects, gpointer userdata);
+    static void viewComplete(gpointer view, const GError *error, gpointer userdata);
+#endif
 #endif
 
  public:
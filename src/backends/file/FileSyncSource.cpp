@@ -33,6 +33,7 @@
 #include <boost/algorithm/string/case_conv.hpp>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -43,21 +44,56 @@
 #include <boost/algorithm/string/predicate.hpp>
 
 #include <sstream>
-#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <time.h>
 
 #include <syncevo/SyncContext.h>
 #include <syncevo/declarations.h>
 SE_BEGIN_CXX
 
+/**
+ * Files are written under this prefix plus their final name first.
+ * Such files are not items and get removed when found while
+ * listing items, because then they were left behind by an
+ * interrupted write.
+ */
+static const char tmpPrefix[] = ".syncevolution-tmp-";
+
+/**
+ * Makes the temporary names of new items unique inside the process,
+ * in case that several sources write into the same directory.
+ * Backends are only called by the main thread.
+ */
+static unsigned long tmpCounter;
+
 FileSyncSource::FileSyncSource(const SyncSourceParams &params,
                                const string &dataformat) :
     TrackingSyncSource(params),
     m_mimeType(dataformat),
-    m_entryCounter(0)
+    m_entryCounter(0),
+    m_fsyncMode(FSYNC_NONE),
+    m_useDirRevision(false),
+    m_dirModified(false)
 {
     if (dataformat.empty()) {
         throwError("a database format must be specified");
     }
+
+    std::string fsyncMode = FileFsync().getProperty(*getNode(FileFsync()));
+    if (fsyncMode == "item") {
+        m_fsyncMode = FSYNC_ITEM;
+    } else if (fsyncMode == "batch") {
+        m_fsyncMode = FSYNC_BATCH;
+    } else if (fsyncMode != "none") {
+        throwError(string("fileFsync: unknown value ") + fsyncMode +
+                   ", must be one of none, batch, item");
+    }
+    m_useDirRevision = FileDirRevision().getPropertyValue(*getNode(FileDirRevision()));
+
+#ifdef HAVE_GLIB
+    m_operations.m_watchChanges = boost::bind(&FileSyncSource::watchChanges, this, _1);
+#endif
 }
 
 std::string FileSyncSource::getMimeType() const
@@ -107,6 +143,33 @@ void FileSyncSource::open()
 
     // success!
     m_basedir = basedir;
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+    // If the file system stores sub-second modification times,
+    // then revision strings include them and the end of a sync
+    // only has to be delayed until the file system clock
+    // advances. That precision is derived from the trailing
+    // zeros of a time stamp (exFAT: 10ms) and the resolution of
+    // the kernel clock used for time stamps (Linux: one tick).
+    struct stat buf;
+    if (!stat(m_basedir.c_str(), &buf) &&
+        buf.st_mtim.tv_nsec) {
+        long granularity = 1;
+        while (buf.st_mtim.tv_nsec % (granularity * 10) == 0) {
+            granularity *= 10;
+        }
+        double accuracy = granularity / 1e9;
+# ifdef CLOCK_REALTIME_COARSE
+        Timespec res;
+        if (!clock_getres(CLOCK_REALTIME_COARSE, &res) &&
+            res.duration() > accuracy) {
+            accuracy = res.duration();
+        }
+# endif
+        SE_LOG_DEBUG(this, NULL, "modification time accuracy %fs", accuracy);
+        setRevisionAccuracy(accuracy);
+    }
+#endif
 }
 
 bool FileSyncSource::isEmpty()
@@ -145,9 +208,32 @@ bool FileSyncSource::isEmpty()
 
 void FileSyncSource::close()
 {
+#ifdef HAVE_GLIB
+    m_notify.reset();
+#endif
+    if (!m_basedir.empty()) {
+        try {
+            flush();
+        } catch (...) {
+            // close() must not fail, the data was written
+            // and only forcing it to disk did not work
+            Exception::handle(HANDLE_EXCEPTION_NO_ERROR);
+        }
+    }
     m_basedir.clear();
 }
 
+#ifdef HAVE_GLIB
+void FileSyncSource::watchChanges(const Operations::ChangeCallback_t &callback)
+{
+    // Creating, writing, renaming or removing a file in the
+    // directory is reported by the directory monitor. The
+    // details do not matter.
+    m_notify.reset(new GLibNotify(m_basedir.c_str(),
+                                  boost::bind(callback)));
+}
+#endif
+
 FileSyncSource::Databases FileSyncSource::getDatabases()
 {
     Databases result;
@@ -159,17 +245,50 @@ FileSyncSource::Databases FileSyncSource::getDatabases()
 
 void FileSyncSource::listAllItems(RevisionMap_t &revisions)
 {
-    ReadDir dirContent(m_basedir);
-
-    BOOST_FOREACH(const string &entry, dirContent) {
-        string filename = createFilename(entry);
-        string revision = getATimeString(filename);
-        long entrynum = atoll(entry.c_str());
-        if (entrynum >= m_entryCounter) {
-            m_entryCounter = entrynum + 1;
+    // Same as ReadDir, but the revision of each entry is determined
+    // relative to the open directory while reading it. Avoids
+    // storing all names first and resolving the full path of each
+    // one again.
+    DIR *dir = opendir(m_basedir.c_str());
+    if (!dir) {
+        throwError(m_basedir, errno);
+    }
+
+    try {
+        int fd = dirfd(dir);
+        errno = 0;
+        struct dirent *entry = readdir(dir);
+        while (entry) {
+            const char *name = entry->d_name;
+            if (!strcmp(name, ".") ||
+                !strcmp(name, "..")) {
+                // skip
+            } else if (boost::starts_with(name, tmpPrefix)) {
+                SE_LOG_DEBUG(this, NULL, "removing incomplete file %s", name);
+                unlinkat(fd, name, 0);
+            } else {
+                struct stat buf;
+                if (fstatat(fd, name, &buf, 0)) {
+                    throwError(createFilename(name), errno);
+                }
+                long entrynum = atoll(name);
+                if (entrynum >= m_entryCounter) {
+                    m_entryCounter = entrynum + 1;
+                }
+                revisions[name] = getATimeString(buf);
+            }
+            errno = 0;
+            entry = readdir(dir);
+        }
+        if (errno) {
+            throwError(m_basedir, errno);
         }
-        revisions[entry] = revision;
+    } catch(...) {
+        closedir(dir);
+        throw;
     }
+
+    closedir(dir);
 }
 
 void FileSyncSource::readItem(const string &uid, std::string &item, bool raw)
@@ -200,35 +319,56 @@ TrackingSyncSource::InsertItemResult FileSyncSource::insertItem(const string &ui
     if (uid.size()) {
         // valid local ID: update that file
         filename = createFilename(uid);
+        writeItem(uid, item);
     } else {
-        // no local ID: create new file
+        // no local ID: write the data under a temporary name, then
+        // claim the next free name with link(), which fails instead
+        // of overwriting an existing entry; m_entryCounter is beyond
+        // all existing entries after listAllItems(), so this usually
+        // succeeds at once
+        ostringstream tmpentry;
+        tmpentry << "new-" << getpid() << "-" << ++tmpCounter;
+        string tmpfilename = writeTmpFile(tmpentry.str(), item);
         while (true) {
             ostringstream buff;
-            buff << m_entryCounter;
+            buff << m_entryCounter++;
             filename = createFilename(buff.str());
 
-            // only create and truncate if file does not
-            // exist yet, otherwise retry with next counter
-            struct stat dummy;
-            if (stat(filename.c_str(), &dummy)) {
-                if (errno == ENOENT) {
-                    newuid = buff.str();
-                    break;
-                } else {
-                    throwError(filename, errno);
+            if (!link(tmpfilename.c_str(), filename.c_str())) {
+                unlink(tmpfilename.c_str());
+                newuid = buff.str();
+                break;
+            } else if (errno == EEXIST) {
+                continue;
+            } else if (errno == EPERM || errno == ENOTSUP || errno == ENOSYS) {
+                // file system without hard links (FAT): claim the
+                // name by creating it empty and replace that at
+                // once; the empty file must not be left behind
+                int fd = ::open(filename.c_str(), O_WRONLY|O_CREAT|O_EXCL, 0666);
+                if (fd < 0) {
+                    if (errno == EEXIST) {
+                        continue;
+                    }
+                    int error = errno;
+                    unlink(tmpfilename.c_str());
+                    throwError(filename, error);
+                }
+                ::close(fd);
+                if (rename(tmpfilename.c_str(), filename.c_str())) {
+                    int error = errno;
+                    unlink(filename.c_str());
+                    unlink(tmpfilename.c_str());
+                    throwError(filename, error);
                 }
+                newuid = buff.str();
+                break;
+            } else {
+                int error = errno;
+                unlink(tmpfilename.c_str());
+                throwError(filename, error);
             }
-
-            m_entryCounter++;
         }
-    }
-
-    ofstream out;
-    out.open(filename.c_str());
-    out.write(item.c_str(), item.size());
-    out.close();
-    if (!out.good()) {
-        throwError(filename + ": writing failed", errno);
+        itemWritten(filename);
     }
 
     return InsertItemResult(newuid,
@@ -244,6 +384,104 @@ void FileSyncSource::removeItem(const string &uid)
     if (unlink(filename.c_str())) {
         throwError(filename, errno);
     }
+    m_unsynced.erase(filename);
+    if (m_fsyncMode == FSYNC_ITEM) {
+        syncFile(m_basedir);
+    } else {
+        m_dirModified = true;
+    }
+}
+
+string FileSyncSource::writeTmpFile(const string &entry, const std::string &item)
+{
+    string tmpfilename = createFilename(tmpPrefix + entry);
+
+    int fd = ::open(tmpfilename.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (fd < 0) {
+        throwError(tmpfilename, errno);
+    }
+    const char *data = item.c_str();
+    size_t remaining = item.size();
+    while (remaining > 0) {
+        ssize_t written = write(fd, data, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        data += written;
+        remaining -= written;
+    }
+    int error = 0;
+    if (remaining ||
+        (m_fsyncMode == FSYNC_ITEM && fsync(fd))) {
+        error = errno;
+    }
+    if (::close(fd) && !error) {
+        error = errno;
+    }
+    if (error) {
+        unlink(tmpfilename.c_str());
+        throwError(tmpfilename + ": writing failed", error);
+    }
+    return tmpfilename;
+}
+
+void FileSyncSource::writeItem(const string &entry, const std::string &item)
+{
+    string filename = createFilename(entry);
+    string tmpfilename = writeTmpFile(entry, item);
+
+    if (rename(tmpfilename.c_str(), filename.c_str())) {
+        int error = errno;
+        unlink(tmpfilename.c_str());
+        throwError(filename, error);
+    }
+    itemWritten(filename);
+}
+
+void FileSyncSource::itemWritten(const string &filename)
+{
+    switch (m_fsyncMode) {
+    case FSYNC_ITEM:
+        syncFile(m_basedir);
+        break;
+    case FSYNC_BATCH:
+        m_unsynced.insert(filename);
+        m_dirModified = true;
+        break;
+    case FSYNC_NONE:
+        break;
+    }
+}
+
+void FileSyncSource::syncFile(const string &filename)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throwError(filename, errno);
+    }
+    if (fsync(fd)) {
+        int error = errno;
+        ::close(fd);
+        throwError(filename + ": fsync failed", error);
+    }
+    ::close(fd);
+}
+
+void FileSyncSource::flush()
+{
+    // Calling fsync() for the files only now leaves the kernel time
+    // to write most of the data in the background.
+    BOOST_FOREACH(const string &filename, m_unsynced) {
+        syncFile(filename);
+    }
+    m_unsynced.clear();
+    if (m_dirModified) {
+        syncFile(m_basedir);
+        m_dirModified = false;
+    }
 }
 
 string FileSyncSource::getATimeString(const string &filename)
@@ -252,14 +490,58 @@ string FileSyncSource::getATimeString(const string &filename)
     if (stat(filename.c_str(), &buf)) {
         throwError(filename, errno);
     }
+    return getATimeString(buf);
+}
+
+string FileSyncSource::getATimeString(const struct stat &buf)
+{
     time_t mtime = buf.st_mtime;
 
     ostringstream revision;
     revision << mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+    revision << "." << std::setw(9) << std::setfill('0') << buf.st_mtim.tv_nsec;
+#endif
 
     return revision.str();
 }
 
+std::string FileSyncSource::databaseRevision()
+{
+    if (!m_useDirRevision) {
+        return "";
+    }
+
+    // stat() first: a change made while reading the directory
+    // then alters the next revision
+    struct stat buf;
+    if (stat(m_basedir.c_str(), &buf)) {
+        throwError(m_basedir, errno);
+    }
+    if (buf.st_mtime >= time(NULL)) {
+        return "";
+    }
+    ReadDir dir(m_basedir);
+    size_t entries = std::distance(dir.begin(), dir.end());
+    return StringPrintf("%lu-%s",
+                        (unsigned long)entries,
+                        getATimeString(buf).c_str());
+}
+
+bool FileSyncSource::sameRevision(const std::string &tracked,
+                                  const std::string &current)
+{
+    // Revisions recorded before sub-second precision was added
+    // only have the seconds, which is enough to detect changes
+    // made after that sync. All newer revisions include the
+    // nanoseconds, even when they are zero, and must match
+    // exactly.
+    if (tracked.find('.') != tracked.npos) {
+        return false;
+    }
+    return boost::starts_with(current, tracked + ".");
+}
+
 string FileSyncSource::createFilename(const string &entry)
 {
     string filename = m_basedir + "/" + entry;
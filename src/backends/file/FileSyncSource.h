@@ -22,10 +22,24 @@
 
 #include <syncevo/TrackingSyncSource.h>
 
+#include <syncevo/declarations.h>
+SE_BEGIN_CXX
+/** "fileFsync" source property, registered by the backend */
+extern StringConfigProperty &FileFsync();
+/** "fileDirRevision" source property, registered by the backend */
+extern BoolConfigProperty &FileDirRevision();
+SE_END_CXX
+
 #ifdef ENABLE_FILE
 
+#include <syncevo/GLibSupport.h>
+
 #include <memory>
+#include <set>
 #include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <sys/stat.h>
 
 #include <syncevo/declarations.h>
 SE_BEGIN_CXX
@@ -40,12 +54,28 @@ SE_BEGIN_CXX
  * Change tracking is done via the file systems modification time
  * stamp: editing a file treats it as modified and then sends it to
  * the server in the next sync. Removing and adding files also works.
+ * Sub-second precision is used where the file system provides it.
+ *
+ * If the "fileDirRevision" source property is set, listing all files
+ * is skipped when the modification time of the directory and the
+ * number of entries in it are the same as at the end of the last sync
+ * (see databaseRevision()). Adding, removing and replacing files
+ * changes the directory, but rewriting a file in place does not.
+ * Therefore this is off by default.
  *
  * The local unique identifier for each item is its name in the
  * directory. New files are created using a running count which 
  * initialized based on the initial content of the directory to
  * "highest existing number + 1" and incremented to avoid collisions.
  *
+ * Files are written under a temporary name and then renamed (updates)
+ * or linked (new items), so other processes see either the old or the
+ * complete new content. When the data is forced to disk is controlled
+ * by the "fileFsync" source property:
+ * - "none" (default): never, left to the operating system
+ * - "batch": once at the end of a sync, in flush()
+ * - "item": before making each change visible
+ *
  * Although this sync source itself does not care about the content of
  * each item/file, the server needs to know what each item sent to it
  * contains and what items the source is able to receive. Therefore
@@ -75,6 +105,19 @@ class FileSyncSource : public TrackingSyncSource, private boost::noncopyable
     virtual InsertItemResult insertItem(const string &luid, const std::string &item, bool raw);
     void readItem(const std::string &luid, std::string &item, bool raw);
     virtual void removeItem(const string &uid);
+    virtual void flush();
+
+    /* implementation of SyncSourceRevisions interface */
+    virtual bool sameRevision(const std::string &tracked,
+                              const std::string &current);
+
+    /**
+     * Modification time of the directory plus number of entries if
+     * enabled by "fileDirRevision", otherwise empty. Also empty while
+     * the directory was modified in the current second, because
+     * another change in that second might not alter the time stamp.
+     */
+    virtual std::string databaseRevision();
 
  private:
     /**
@@ -92,12 +135,58 @@ class FileSyncSource : public TrackingSyncSource, private boost::noncopyable
     /** a counter which is used to name new files */
     long m_entryCounter;
 
+    /** when to force data to disk, see "fileFsync" property */
+    enum FsyncMode {
+        FSYNC_NONE,
+        FSYNC_BATCH,
+        FSYNC_ITEM
+    } m_fsyncMode;
+
+    /** databaseRevision() enabled, see "fileDirRevision" property */
+    bool m_useDirRevision;
+
+    /** FSYNC_BATCH: files written since the last flush() */
+    std::set<std::string> m_unsynced;
+    /** FSYNC_BATCH: entries were added or removed since the last flush() */
+    bool m_dirModified;
+
+#ifdef HAVE_GLIB
+    /** monitors m_basedir after watchChanges(), reset in close() */
+    boost::shared_ptr<GLibNotify> m_notify;
+
+    /** implements the m_watchChanges operation */
+    void watchChanges(const Operations::ChangeCallback_t &callback);
+#endif
+
     /**
      * get access time for file, formatted as revision string
      * @param filename    absolute path or path relative to current directory
      */
     string getATimeString(const string &filename);
 
+    /** format modification time of a file as revision string */
+    static string getATimeString(const struct stat &buf);
+
+    /**
+     * replace content of entry (created if necessary) atomically by
+     * writing a temporary file and renaming it
+     */
+    void writeItem(const string &entry, const std::string &item);
+
+    /**
+     * write item into a temporary file derived from entry,
+     * removed again if writing fails
+     *
+     * @return full name of the temporary file
+     */
+    string writeTmpFile(const string &entry, const std::string &item);
+
+    /** file was replaced or created, fsync() according to m_fsyncMode */
+    void itemWritten(const string &filename);
+
+    /** force file or directory to disk, throw error if that fails */
+    void syncFile(const string &filename);
+
     /**
      * create full filename from basedir and entry name
      */
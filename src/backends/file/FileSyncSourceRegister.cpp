@@ -52,31 +52,76 @@ static SyncSource *createSource(const SyncSourceParams &params)
 #endif
 }
 
-static RegisterSyncSource registerMe("Files in one directory",
+StringConfigProperty &FileFsync()
+{
+    static StringConfigProperty fsync("fileFsync",
+                                      "when to force written items to disk with fsync():\n"
+                                      "none = never, batch = once at the end of a sync,\n"
+                                      "item = before making each change visible",
+                                      "none",
+                                      "",
+                                      Values() +
+                                      Aliases("none") +
+                                      Aliases("batch") +
+                                      Aliases("item"));
+    return fsync;
+}
+
+BoolConfigProperty &FileDirRevision()
+{
+    static BoolConfigProperty revision("fileDirRevision",
+                                       "skip listing all files when the modification time of the\n"
+                                       "directory and the number of files in it are unchanged;\n"
+                                       "only safe if files are never rewritten in place",
+                                       "FALSE");
+    return revision;
+}
+
+static class RegisterFileSyncSource : public RegisterSyncSource
+{
+public:
+    RegisterFileSyncSource() :
+        RegisterSyncSource("Files in one directory",
 #ifdef ENABLE_FILE
-                                     true,
+                           true,
 #else
-                                     false,
+                           false,
 #endif
-                                     createSource,
-                                     "Files in one directory = file\n"
-                                     "   Stores items in one directory as one file per item.\n"
-                                     "   The directory is selected via database=[file://]<path>.\n"
-                                     "   It will only be created if the prefix is given, otherwise\n"
-                                     "   it must exist already.\n"
-                                     "   The database format *must* be specified explicitly. It may be\n"
-                                     "   different from the sync format, as long as there are\n"
-                                     "   conversion rules (for example, vCard 2.1 <-> vCard 3.0). If\n"
-                                     "   the sync format is empty, the database format is used.\n"
-                                     "   Examples for databaseFormat + syncFormat:\n"
-                                     "      text/plain + text/plain\n"
-                                     "      text/x-vcard + text/vcard\n"
-                                     "      text/calendar\n"
-                                     "   Examples for evolutionsource:\n"
-                                     "      /home/joe/datadir - directory must exist\n"
-                                     "      file:///tmp/scratch - directory is created\n",
-                                     Values() +
-                                     (Aliases("file") + "Files in one directory"));
+                           createSource,
+                           "Files in one directory = file\n"
+                           "   Stores items in one directory as one file per item.\n"
+                           "   The directory is selected via database=[file://]<path>.\n"
+                           "   It will only be created if the prefix is given, otherwise\n"
+                           "   it must exist already.\n"
+                           "   The database format *must* be specified explicitly. It may be\n"
+                           "   different from the sync format, as long as there are\n"
+                           "   conversion rules (for example, vCard 2.1 <-> vCard 3.0). If\n"
+                           "   the sync format is empty, the database format is used.\n"
+                           "   Examples for databaseFormat + syncFormat:\n"
+                           "      text/plain + text/plain\n"
+                           "      text/x-vcard + text/vcard\n"
+                           "      text/calendar\n"
+                           "   Examples for evolutionsource:\n"
+                           "      /home/joe/datadir - directory must exist\n"
+                           "      file:///tmp/scratch - directory is created\n"
+                           "   The fileFsync source property controls when\n"
+                           "   written items are forced to disk: none (default),\n"
+                           "   batch (at the end of a sync) or item (after each change).\n"
+                           "   fileDirRevision=1 skips listing all files when the directory\n"
+                           "   itself did not change. Not suitable when files are edited\n"
+                           "   in place, because that does not modify the directory.\n",
+                           Values() +
+                           (Aliases("file") + "Files in one directory"))
+    {
+        // configure and register our own property;
+        // do this regardless whether the backend is enabled,
+        // so that config migration always includes this property
+        FileFsync().setHidden(true);
+        SyncSourceConfig::getRegistry().push_back(&FileFsync());
+        FileDirRevision().setHidden(true);
+        SyncSourceConfig::getRegistry().push_back(&FileDirRevision());
+    }
+} registerMe;
 
 #ifdef ENABLE_FILE
 #ifdef ENABLE_UNIT_TESTS
@@ -75,6 +75,8 @@ enum {
     PERSON_BLOG_URL,
     PERSON_VIDEO_URL,
 
+    PERSON_SYNC_REVISION,
+
     LAST_COL
 };
 
@@ -117,6 +119,8 @@ void SQLiteContactSource::open()
         { "BlogURL", "ABPerson", "BLOGURL" },
         { "VideoURL", "ABPerson", "VIDEOURL" },
 
+        { "SyncRevision", "ABPerson", "" },
+
         { NULL }
     };
     static const char *schema = 
@@ -156,21 +160,72 @@ void SQLiteContactSource::open()
         "URL TEXT, "
         "BlogURL TEXT, "
         "VideoURL TEXT, "
-        "FileAs TEXT);"
+        "FileAs TEXT, "
+        "SyncRevision INTEGER);"
+        // Every insert or update of a contact, also by other
+        // programs, gets a new, higher SyncRevision. It comes from
+        // a counter which only grows, because the highest
+        // SyncRevision in ABPerson goes down again when that
+        // contact gets deleted or replaced.
+        "CREATE TABLE SyncRevisionCounter (Revision INTEGER);"
+        "INSERT INTO SyncRevisionCounter VALUES (0);"
+        "CREATE TRIGGER ABPersonInserted AFTER INSERT ON ABPerson BEGIN "
+        "UPDATE SyncRevisionCounter SET Revision = Revision + 1; "
+        "UPDATE ABPerson SET SyncRevision = (SELECT Revision FROM SyncRevisionCounter) "
+        "WHERE ROWID = NEW.ROWID; "
+        "END;"
+        "CREATE TRIGGER ABPersonUpdated AFTER UPDATE ON ABPerson "
+        "WHEN NEW.SyncRevision IS OLD.SyncRevision BEGIN "
+        "UPDATE SyncRevisionCounter SET Revision = Revision + 1; "
+        "UPDATE ABPerson SET SyncRevision = (SELECT Revision FROM SyncRevisionCounter) "
+        "WHERE ROWID = NEW.ROWID; "
+        "END;"
         "COMMIT;";
 
     string id = getDatabaseID();
     m_sqlite.open(getName(),
                   id.c_str(),
                   mapping,
-                  schema);
+                  schema,
+                  SQLiteWAL().getPropertyValue(*getNode(SQLiteWAL())));
+
+    // Databases created by older releases have no SyncRevision and
+    // need the modification time, which only has a resolution of
+    // one second.
+    setRevisionAccuracy(haveSyncRevision() ? 0 : 1);
+}
+
+bool SQLiteContactSource::haveSyncRevision()
+{
+    return m_sqlite.getMapping(PERSON_SYNC_REVISION).colindex >= 0;
 }
 
 void SQLiteContactSource::close()
 {
+#ifdef HAVE_GLIB
+    m_notify.reset();
+    m_walNotify.reset();
+#endif
     m_sqlite.close();
 }
 
+#ifdef HAVE_GLIB
+void SQLiteContactSource::watchChanges(const Operations::ChangeCallback_t &callback)
+{
+    // Committing a transaction writes the database file or, in
+    // WAL mode, the <db>-wal file next to it; the database file
+    // itself only changes during checkpoints. Watching both is
+    // cheaper than polling the database and works with all SQLite
+    // versions (PRAGMA data_version needs 3.8.8). The -wal file
+    // need not exist yet.
+    std::string filename = m_sqlite.getFilename();
+    m_notify.reset(new GLibNotify(filename.c_str(),
+                                  boost::bind(callback)));
+    m_walNotify.reset(new GLibNotify((filename + "-wal").c_str(),
+                                     boost::bind(callback)));
+}
+#endif
+
 void SQLiteContactSource::getSynthesisInfo(SynthesisInfo &info, XMLConfigFragments &fragment)
 {
     SourceType sourceType = getSourceType();
@@ -227,19 +282,57 @@ bool SQLiteContactSource::isEmpty()
 
 void SQLiteContactSource::listAllItems(RevisionMap_t &revisions)
 {
-    sqliteptr all(m_sqlite.prepareSQL("SELECT ROWID, CreationDate, ModificationDate FROM ABPerson;"));
+    bool syncRevision = haveSyncRevision();
+    sqliteptr all(m_sqlite.prepareSQL("SELECT ROWID, %s FROM ABPerson;",
+                                      syncRevision ? "SyncRevision" : "ModificationDate"));
     while (m_sqlite.checkSQL(sqlite3_step(all)) == SQLITE_ROW) {
         string uid = m_sqlite.toString(SQLITE3_COLUMN_KEY(all, 0));
-        string modTime = m_sqlite.time2str(m_sqlite.getTimeColumn(all, 2));
-        revisions.insert(RevisionMap_t::value_type(uid, modTime));
+        string revision = syncRevision ?
+            m_sqlite.getTextColumn(all, 1) :
+            m_sqlite.time2str(m_sqlite.getTimeColumn(all, 1));
+        revisions.insert(RevisionMap_t::value_type(uid, revision));
+    }
+}
+
+std::string SQLiteContactSource::databaseRevision()
+{
+    if (haveSyncRevision()) {
+        sqliteptr stat(m_sqlite.prepareSQL("SELECT COUNT(*), MAX(SyncRevision), "
+                                           "(SELECT SEQ FROM SQLITE_SEQUENCE WHERE NAME = 'ABPerson') "
+                                           "FROM ABPerson;"));
+        if (m_sqlite.checkSQL(sqlite3_step(stat)) != SQLITE_ROW) {
+            return "";
+        }
+        return StringPrintf("%lld-%s-%s",
+                            (long long)sqlite3_column_int64(stat, 0),
+                            m_sqlite.getTextColumn(stat, 2, "0").c_str(),
+                            m_sqlite.getTextColumn(stat, 1, "0").c_str());
+    }
+
+    sqliteptr stat(m_sqlite.prepareSQL("SELECT COUNT(*), MAX(ModificationDate), "
+                                       "(SELECT SEQ FROM SQLITE_SEQUENCE WHERE NAME = 'ABPerson') "
+                                       "FROM ABPerson;"));
+    if (m_sqlite.checkSQL(sqlite3_step(stat)) != SQLITE_ROW) {
+        return "";
     }
+    SQLiteUtil::syncml_time_t modTime = m_sqlite.getTimeColumn(stat, 1);
+    if (modTime >= (SQLiteUtil::syncml_time_t)time(NULL)) {
+        // another change in the current second would go unnoticed
+        return "";
+    }
+    return StringPrintf("%lld-%s-%s",
+                        (long long)sqlite3_column_int64(stat, 0),
+                        m_sqlite.getTextColumn(stat, 2, "0").c_str(),
+                        m_sqlite.time2str(modTime).c_str());
 }
 
 sysync::TSyError SQLiteContactSource::readItemAsKey(sysync::cItemID aID, sysync::KeyH aItemKey)
 {
     string uid = aID->item;
 
-    sqliteptr contact(m_sqlite.prepareSQL("SELECT * FROM ABPerson WHERE ROWID = '%s';", uid.c_str()));
+    sqlite3_stmt *contact = m_sqlite.getStatement("SELECT * FROM ABPerson WHERE ROWID = ?;");
+    SQLiteStatementReset reset(contact);
+    m_sqlite.checkSQL(sqlite3_bind_text(contact, 1, uid.c_str(), -1, SQLITE_TRANSIENT));
     if (m_sqlite.checkSQL(sqlite3_step(contact)) != SQLITE_ROW) {
         throwError(STATUS_NOT_FOUND, string("contact not found: ") + uid);
     }
@@ -312,15 +405,18 @@ sysync::TSyError SQLiteContactSource::insertItemAsKey(sysync::KeyH aItemKey, sys
 
     // delete complete row so that we can recreate it
     if (uid.size()) {
-        sqliteptr remove(m_sqlite.prepareSQL("DELETE FROM ABPerson WHERE ROWID == ?;"));
+        sqlite3_stmt *remove = m_sqlite.getStatement("DELETE FROM ABPerson WHERE ROWID == ?;");
+        SQLiteStatementReset reset(remove);
         m_sqlite.checkSQL(sqlite3_bind_text(remove, 1, uid.c_str(), -1, SQLITE_TRANSIENT));
         m_sqlite.checkSQL(sqlite3_step(remove));
     }
 
-    string cols_str = cols.str();
-    string values_str = values.str();
-
-    sqliteptr insert(m_sqlite.prepareSQL("INSERT INTO ABPerson( %s ) VALUES( %s );", cols.str().c_str(), values.str().c_str()));
+    // The set of columns depends on the fields set in the item,
+    // but only a few different combinations occur in practice,
+    // so caching the statement by its text pays off.
+    sqlite3_stmt *insert = m_sqlite.getStatement(StringPrintf("INSERT INTO ABPerson( %s ) VALUES( %s );",
+                                                              cols.str().c_str(), values.str().c_str()));
+    SQLiteStatementReset reset(insert);
 
     // now bind parameter values in the same order as the columns specification above
     int param = 1;
@@ -340,21 +436,23 @@ sysync::TSyError SQLiteContactSource::insertItemAsKey(sysync::KeyH aItemKey, sys
                       
     if (!uid.size()) {
         // figure out which UID was assigned to the new contact
-        newuid = m_sqlite.findColumn("SQLITE_SEQUENCE", "NAME", "ABPerson", "SEQ", "");
+        newuid = m_sqlite.toString(m_sqlite.lastInsertRowID());
     }
     newID->item = StrAlloc(newuid.c_str());
 
-    updateRevision(*m_trackingNode, uid, newuid, m_sqlite.time2str(modificationTime));
+    string revision = haveSyncRevision() ?
+        m_sqlite.findColumn("ABPerson", "ROWID", newuid.c_str(), "SyncRevision", "") :
+        m_sqlite.time2str(modificationTime);
+    updateRevision(*m_trackingNode, uid, newuid, revision);
     return sysync::LOCERR_OK;
 }
 
 
 void SQLiteContactSource::deleteItem(const string& uid)
 {
-    sqliteptr del;
-
-    del.set(m_sqlite.prepareSQL("DELETE FROM ABPerson WHERE "
-                                "ABPerson.ROWID = ?;"));
+    sqlite3_stmt *del = m_sqlite.getStatement("DELETE FROM ABPerson WHERE "
+                                              "ABPerson.ROWID = ?;");
+    SQLiteStatementReset reset(del);
     m_sqlite.checkSQL(sqlite3_bind_text(del, 1, uid.c_str(), -1, SQLITE_TRANSIENT));
     m_sqlite.checkSQL(sqlite3_step(del));
     // TODO: throw STATUS_NOT_FOUND exception when nothing was deleted
@@ -375,22 +473,44 @@ bool SQLiteContactSource::serverModeEnabled() const
 
 void SQLiteContactSource::beginSync(const std::string &lastToken, const std::string &resumeToken)
 {
-    detectChanges(*m_trackingNode, CHANGES_FULL);
+    ChangeMode mode;
+    std::string token = resumeToken.empty() ? lastToken : resumeToken;
+    if (token.empty()) {
+        SE_LOG_DEBUG(this, NULL, "slow sync or testing, do full item scan to detect changes");
+        mode = CHANGES_SLOW;
+    } else {
+        // Resets the old revision. If anything goes wrong, then we
+        // don't want to rely on a possibly incorrect optimization.
+        mode = checkDatabaseRevision(*m_metaNode, true);
+    }
+    detectChanges(*m_trackingNode, mode);
+
+    // All writes during the sync are stored with one commit in
+    // endSync() instead of one implicit transaction per statement.
+    m_sqlite.begin();
 }
 
 
 std::string SQLiteContactSource::endSync(bool success)
 {
+    // The Synthesis docs say that we should rollback in case of
+    // failure. The peer might already consider the changes as
+    // stored, so commit them also in that case. Data must be on
+    // disk before the revision map refers to it.
+    m_sqlite.commit();
     if (success) {
+        storeDatabaseRevision(*m_metaNode);
         m_trackingNode->flush();
+        m_metaNode->flush();
     } else {
-        // The Synthesis docs say that we should rollback in case of
-        // failure. Cannot do that for data, so lets at least keep
-        // the revision map unchanged.
+        // keep the revision map unchanged, so that the next sync
+        // compares against the last successful one
     }
 
-    // no token handling at the moment (not needed for clients)
-    return "";
+    // no token handling at the moment (not needed for clients):
+    // return a non-empty token to distinguish an incremental
+    // sync from a slow sync in beginSync()
+    return "1";
 }
 
 SE_END_CXX
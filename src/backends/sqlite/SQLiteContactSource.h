@@ -23,6 +23,7 @@
 #include <syncevo/SyncSource.h>
 #include <syncevo/PrefixConfigNode.h>
 #include <syncevo/SafeConfigNode.h>
+#include <syncevo/GLibSupport.h>
 #include <SQLiteUtil.h>
 
 #include <boost/bind.hpp>
@@ -30,6 +31,9 @@
 #include <syncevo/declarations.h>
 SE_BEGIN_CXX
 
+/** "sqliteWAL" source property, registered by the backend */
+extern BoolConfigProperty &SQLiteWAL();
+
 #ifdef ENABLE_SQLITE
 
 /**
@@ -46,8 +50,10 @@ SE_BEGIN_CXX
  * email and phone numbers are not supported. They would have to be
  * stored in additional tables.
  *
- * Change tracking is done by implementing a modification date as part
- * of each contact and using that as the revision string.
+ * Change tracking is done with a SyncRevision column which triggers
+ * set to the next value of a counter table for each modified contact. Databases without that column
+ * (created by older releases) use the modification date of each
+ * contact as revision string instead.
  * The database file is created automatically if the database ID is
  * file:///<path>.
  */
@@ -62,16 +68,21 @@ class SQLiteContactSource : public SyncSource,
 {
   public:
     SQLiteContactSource(const SyncSourceParams &params) :
-        SyncSource(params),
-        m_trackingNode(new PrefixConfigNode("item-",
-                                            boost::shared_ptr<ConfigNode>(new SafeConfigNode(params.m_nodes.getTrackingNode()))))
+        SyncSource(params)
         {
+            boost::shared_ptr<ConfigNode> safeNode(new SafeConfigNode(params.m_nodes.getTrackingNode()));
+            m_trackingNode.reset(new PrefixConfigNode("item-", safeNode));
+            m_metaNode = safeNode;
+
             SyncSourceSession::init(m_operations);
             SyncSourceDelete::init(m_operations);
             SyncSourceRevisions::init(NULL, NULL, 1, m_operations);
             SyncSourceChanges::init(m_operations);
 
             m_operations.m_isEmpty = boost::bind(&SQLiteContactSource::isEmpty, this);
+#ifdef HAVE_GLIB
+            m_operations.m_watchChanges = boost::bind(&SQLiteContactSource::watchChanges, this, _1);
+#endif
             m_operations.m_readItemAsKey = boost::bind(&SQLiteContactSource::readItemAsKey, this, _1, _2);
             m_operations.m_insertItemAsKey = boost::bind(&SQLiteContactSource::insertItemAsKey, this, _1, (sysync::cItemID)NULL, _2);
             m_operations.m_updateItemAsKey = boost::bind(&SQLiteContactSource::insertItemAsKey, this, _1, _2, _3);
@@ -101,13 +112,40 @@ class SQLiteContactSource : public SyncSource,
 
     /* Methods in SyncSourceRevisions */
     virtual void listAllItems(RevisionMap_t &revisions);
+
+    /**
+     * Number of contacts, highest ROWID ever handed out and the latest
+     * modification time. Adding a contact increases the ROWID, deleting
+     * one decreases the count and updating one moves the modification
+     * time forward, so any change is reflected unless it happened in
+     * the same second as the latest modification. Empty in that case.
+     * With SyncRevision, its maximum replaces the modification time
+     * and the result is never empty.
+     */
+    virtual std::string databaseRevision();
+
+    /** true if the database has the SyncRevision column */
+    bool haveSyncRevision();
+
  private:
     /** encapsulates access to database */
     boost::shared_ptr<ConfigNode> m_trackingNode;
+    /** stores "databaseRevision", in the same file as m_trackingNode */
+    boost::shared_ptr<ConfigNode> m_metaNode;
     SQLiteUtil m_sqlite;
 
     /** implements the m_isEmpty operation */
     bool isEmpty();
+
+#ifdef HAVE_GLIB
+    /** monitors the database file after watchChanges(), reset in close() */
+    boost::shared_ptr<GLibNotify> m_notify;
+    /** same for the write-ahead log of the database */
+    boost::shared_ptr<GLibNotify> m_walNotify;
+
+    /** implements the m_watchChanges operation */
+    void watchChanges(const Operations::ChangeCallback_t &callback);
+#endif
 };
 
 #endif // ENABLE_SQLITE
@@ -49,17 +49,42 @@ static SyncSource *createSource(const SyncSourceParams &params)
 #endif
 }
 
-static RegisterSyncSource registerMe("SQLite Address Book",
+BoolConfigProperty &SQLiteWAL()
+{
+    static BoolConfigProperty wal("sqliteWAL",
+                                  "switch the database file to write-ahead logging,\n"
+                                  "permanently; other applications using the file\n"
+                                  "must support it (SQLite >= 3.7.0)",
+                                  "FALSE");
+    return wal;
+}
+
+static class RegisterSQLiteContactSource : public RegisterSyncSource
+{
+public:
+    RegisterSQLiteContactSource() :
+        RegisterSyncSource("SQLite Address Book",
 #ifdef ENABLE_SQLITE
-                                     true,
+                           true,
 #else
-                                     false,
+                           false,
 #endif
-                                     createSource,
-                                     "SQLite Address Book = addressbook = contacts = sqlite-contacts\n"
-                                     "   vCard 2.1 (default) = text/x-vcard\n",
-                                     Values() +
-                                     (Aliases("SQLite Address Book") + "sqlite-contacts" + "sqlite"));
+                           createSource,
+                           "SQLite Address Book = addressbook = contacts = sqlite-contacts\n"
+                           "   vCard 2.1 (default) = text/x-vcard\n"
+                           "   The sqliteWAL source property enables write-ahead logging,\n"
+                           "   which makes syncs faster but permanently changes the database\n"
+                           "   file such that older SQLite versions cannot open it.\n",
+                           Values() +
+                           (Aliases("SQLite Address Book") + "sqlite-contacts" + "sqlite"))
+    {
+        // configure and register our own property;
+        // do this regardless whether the backend is enabled,
+        // so that config migration always includes this property
+        SQLiteWAL().setHidden(true);
+        SyncSourceConfig::getRegistry().push_back(&SQLiteWAL());
+    }
+} registerMe;
 
 #ifdef ENABLE_SQLITE
 #ifdef ENABLE_UNIT_TESTS
@@ -25,11 +25,14 @@
 
 #include "SQLiteUtil.h"
 #include <syncevo/util.h>
+#include <syncevo/Logging.h>
 
 #include <stdarg.h>
 #include <sstream>
 #include <cstring>
 
+#include <boost/foreach.hpp>
+
 #include <syncevo/declarations.h>
 SE_BEGIN_CXX
 
@@ -64,10 +67,54 @@ sqlite3_stmt *SQLiteUtil::prepareSQL(const char *sqlfmt, ...)
     return prepareSQLWrapper(s.c_str());
 }
 
+sqlite3_stmt *SQLiteUtil::getStatement(const string &sql)
+{
+    Statements_t::iterator it = m_statements.find(sql);
+    if (it == m_statements.end()) {
+        boost::shared_ptr<sqlite3_stmt> stmt(prepareSQLWrapper(sql.c_str()), sqlite3_finalize);
+        m_statements[sql] = stmt;
+        return stmt.get();
+    }
+
+    sqlite3_stmt *stmt = it->second.get();
+    // error codes of the previous step were already checked then
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return stmt;
+}
+
+void SQLiteUtil::exec(const char *sql, const char *operation)
+{
+    sqlite3_stmt *stmt = getStatement(sql);
+    SQLiteStatementReset reset(stmt);
+    checkSQL(sqlite3_step(stmt), operation);
+}
+
+void SQLiteUtil::begin()
+{
+    if (!m_transaction) {
+        exec("BEGIN TRANSACTION;", "starting transaction");
+        m_transaction = true;
+    }
+}
+
+void SQLiteUtil::commit()
+{
+    if (m_transaction) {
+        // pending reads would delay the commit
+        BOOST_FOREACH(const Statements_t::value_type &entry, m_statements) {
+            sqlite3_reset(entry.second.get());
+        }
+        exec("COMMIT;", "committing transaction");
+        m_transaction = false;
+    }
+}
 
 SQLiteUtil::key_t SQLiteUtil::findKey(const char *database, const char *keyname, const char *key)
 {
-    sqliteptr query(prepareSQL("SELECT ROWID FROM %s WHERE %s = '%s';", database, keyname, key));
+    sqlite3_stmt *query = getStatement(StringPrintf("SELECT ROWID FROM %s WHERE %s = ?;", database, keyname));
+    SQLiteStatementReset reset(query);
+    checkSQL(sqlite3_bind_text(query, 1, key, -1, SQLITE_TRANSIENT));
 
     int res = checkSQL(sqlite3_step(query), "getting key");
     if (res == SQLITE_ROW) {
@@ -79,7 +126,9 @@ SQLiteUtil::key_t SQLiteUtil::findKey(const char *database, const char *keyname,
 
 string SQLiteUtil::findColumn(const char *database, const char *keyname, const char *key, const char *column, const char *def)
 {
-    sqliteptr query(prepareSQL("SELECT %s FROM %s WHERE %s = '%s';", column, database, keyname, key));
+    sqlite3_stmt *query = getStatement(StringPrintf("SELECT %s FROM %s WHERE %s = ?;", column, database, keyname));
+    SQLiteStatementReset reset(query);
+    checkSQL(sqlite3_bind_text(query, 1, key, -1, SQLITE_TRANSIENT));
 
     int res = checkSQL(sqlite3_step(query), "getting key");
     if (res == SQLITE_ROW) {
@@ -113,7 +162,8 @@ string SQLiteUtil::time2str(SQLiteUtil::syncml_time_t t)
 void SQLiteUtil::open(const string &name,
                       const string &fileid,
                       const SQLiteUtil::Mapping *mapping,
-                      const char *schema)
+                      const char *schema,
+                      bool wal)
 {
     close();
     m_name = name;
@@ -132,6 +182,26 @@ void SQLiteUtil::open(const string &name,
     m_db = db;
     checkSQL(res, "opening");
 
+    // Write-ahead logging makes each commit cheaper and allows
+    // readers to continue while a sync holds the write
+    // transaction. Older SQLite versions ignore the pragma and
+    // return the old mode, which is also okay. Some file systems
+    // do not support it; continue with the old mode then.
+    if (wal) {
+        sqlite3_stmt *walstmt = NULL;
+        res = sqlite3_prepare(m_db, "PRAGMA journal_mode = WAL;", -1, &walstmt, NULL);
+        sqliteptr walptr(walstmt);
+        while (res == SQLITE_OK || res == SQLITE_ROW) {
+            res = sqlite3_step(walptr);
+        }
+        if (res != SQLITE_DONE) {
+            const char *error = sqlite3_errmsg(m_db);
+            SE_LOG_INFO(NULL, NULL, "%s: '%s': enabling WAL mode failed, using old journal mode: %s",
+                        m_name.c_str(), m_fileid.c_str(),
+                        error ? error : "unspecified error");
+        }
+    }
+
     // check whether file is empty = newly created, define schema if that's the case
     sqliteptr check(prepareSQLWrapper("SELECT * FROM sqlite_master;"));
     switch (sqlite3_step(check)) {
@@ -190,8 +260,22 @@ void SQLiteUtil::open(const string &name,
     memset(&m_mapping[i], 0, sizeof(m_mapping[i]));
 }
 
+string SQLiteUtil::getFilename() const
+{
+    const string prefix("file://");
+    return m_fileid.substr(0, prefix.size()) == prefix ?
+        m_fileid.substr(prefix.size()) :
+        m_fileid;
+}
+
 void SQLiteUtil::close()
 {
+    if (m_db) {
+        commit();
+    }
+    m_transaction = false;
+    // statements must be finalized before closing the database
+    m_statements.clear();
     m_db = NULL;
 }
 
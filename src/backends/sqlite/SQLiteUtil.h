@@ -26,6 +26,9 @@
 #include <syncevo/SmartPtr.h>
 
 #include <string>
+#include <map>
+
+#include <boost/shared_ptr.hpp>
 
 #include <syncevo/declarations.h>
 SE_BEGIN_CXX
@@ -39,16 +42,33 @@ class SQLiteUnref {
 
 typedef eptr<sqlite3_stmt, sqlite3_stmt, SQLiteUnref> sqliteptr;
 
+/**
+ * Resets a statement returned by SQLiteUtil::getStatement() when
+ * going out of scope. A statement which is not reset keeps its read
+ * transaction open, which prevents WAL checkpoints.
+ */
+class SQLiteStatementReset
+{
+    sqlite3_stmt *m_stmt;
+ public:
+    SQLiteStatementReset(sqlite3_stmt *stmt) : m_stmt(stmt) {}
+    ~SQLiteStatementReset() { sqlite3_reset(m_stmt); }
+};
+
 /**
  * This class implements access to SQLite database files:
  * - opening the database file
  * - error reporting
  * - creating a database file
  * - converting to and from a VObject via a simple property<->column name mapping
+ * - caching prepared statements
+ * - grouping writes into one transaction
  */
 class SQLiteUtil
 {
   public:
+    SQLiteUtil() : m_transaction(false) {}
+
     /** information about the database mapping */
     struct Mapping {
         const char *colname;        /**< column name in SQL table */
@@ -65,14 +85,22 @@ class SQLiteUtil
      *                    currently valid syntax is file:// followed by path
      * @param mapping     array with database mapping, terminated by NULL colname
      * @param schema      database schema to use when creating new databases, may be NULL
+     * @param wal         switch the database to write-ahead logging; this is
+     *                    stored permanently in the file and older SQLite
+     *                    versions cannot open it anymore, otherwise the
+     *                    journal mode of the file is left unchanged
      */
     void open(const string &name,
               const string &fileid,
               const Mapping *mapping,
-              const char *schema);
+              const char *schema,
+              bool wal = false);
 
     void close();
 
+    /** path of the database file, valid after open() */
+    string getFilename() const;
+
     /**
      * throw error for a specific sqlite3 operation on m_db
      * @param operation   a description of the operation which failed
@@ -96,6 +124,29 @@ class SQLiteUtil
      */
     sqlite3_stmt *prepareSQLWrapper(const char *sql, const char **nextsql = NULL);
 
+    /**
+     * Returns a prepared statement for the given SQL statement,
+     * reset and with all parameters unbound. The statement is
+     * prepared only once and then reused until close(); it is owned
+     * by SQLiteUtil and must not be finalized by the caller. Reset
+     * it after use with SQLiteStatementReset.
+     *
+     * @param sql        exactly one SQL statement, with ? for parameters
+     */
+    sqlite3_stmt *getStatement(const string &sql);
+
+    /**
+     * Starts a transaction, so that all following writes are stored
+     * together when calling commit(). Does nothing if a transaction
+     * is already active.
+     */
+    void begin();
+
+    /** stores all changes made since begin(), does nothing without a transaction */
+    void commit();
+
+    /** true between begin() and commit() */
+    bool inTransaction() const { return m_transaction; }
 
     /** checks the result of an sqlite3 call, throws an error if faulty, otherwise returns the result */
     int checkSQL(int res, const char *operation = "SQLite call") {
@@ -110,6 +161,9 @@ class SQLiteUtil
     string toString(key_t key) { char buffer[32]; sprintf(buffer, "%lld", key); return buffer; }
 #define SQLITE3_COLUMN_KEY sqlite3_column_int64
 
+    /** row ID assigned to the row inserted most recently */
+    key_t lastInsertRowID() { return sqlite3_last_insert_rowid(m_db); }
+
     /** return row ID for a certain row */
     key_t findKey(const char *database, const char *keyname, const char *key);
 
@@ -134,6 +188,16 @@ class SQLiteUtil
 
     /** current database */
     eptr<sqlite3, sqlite3, SQLiteUnref> m_db;
+
+    /** statements returned by getStatement(), indexed by SQL text */
+    typedef std::map<std::string, boost::shared_ptr<sqlite3_stmt> > Statements_t;
+    Statements_t m_statements;
+
+    /** true after begin() */
+    bool m_transaction;
+
+    /** executes a statement which returns no rows */
+    void exec(const char *sql, const char *operation);
 };
 
 SE_END_CXX
@@ -12,8 +12,11 @@
 #include "CalDAVSource.h"
 
 #include <boost/bind.hpp>
+#include <boost/foreach.hpp>
 #include <boost/algorithm/string/replace.hpp>
 
+#include <stdlib.h>
+
 #include <syncevo/declarations.h>
 SE_BEGIN_CXX
 
@@ -54,12 +57,25 @@ CalDAVSource::CalDAVSource(const SyncSourceParams &params,
                                             this, _1, _2, _3);
     m_operations.m_restoreData = boost::bind(&CalDAVSource::restoreData,
                                              this, _1, _2, _3);
+    m_cache.setBudget((size_t)CalDAVCacheSize().getPropertyValue(*getNode(CalDAVCacheSize())) * 1024);
 }
 
 void CalDAVSource::listAllSubItems(SubRevisionMap_t &revisions)
 {
     revisions.clear();
 
+    if (!getItemStore().empty()) {
+        // Most items are probably still stored locally from a
+        // previous run, so only list ETags and download the rest.
+        updateAllSubItems(revisions);
+        m_cache.m_initialized = true;
+        return;
+    }
+
+    // Remember the state of the collection before listing it, so
+    // that the next sync can ask for changes made since then.
+    prepareFullListing();
+
     const std::string query =
         "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
         "<C:calendar-query xmlns:D=\"DAV:\"\n"
@@ -132,9 +148,11 @@ void CalDAVSource::addResource(StringMap &items,
     items[davLUID] = ETag2Rev(etag);
 }
 
-void CalDAVSource::updateAllSubItems(SubRevisionMap_t &revisions)
+void CalDAVSource::listAllResources(StringMap &items)
 {
-    // list items to identify new, updated and removed ones
+    // Remember the state of the collection before listing it.
+    prepareFullListing();
+
     const std::string query =
         "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
         "<C:calendar-query xmlns:D=\"DAV:\"\n"
@@ -151,7 +169,6 @@ void CalDAVSource::updateAllSubItems(SubRevisionMap_t &revisions)
         "</C:filter>\n"
         "</C:calendar-query>\n";
     Timespec deadline = createDeadline();
-    StringMap items;
     getSession()->startOperation("updateAllSubItems REPORT 'list items'", deadline);
     while (true) {
         string data;
@@ -166,6 +183,28 @@ void CalDAVSource::updateAllSubItems(SubRevisionMap_t &revisions)
             break;
         }
     }
+}
+
+void CalDAVSource::updateAllSubItems(SubRevisionMap_t &revisions)
+{
+    StringMap items;
+
+    // Ask only for changes since the last sync if the server
+    // supports that. The token only describes the difference to
+    // the revisions of that sync, so an empty set (listAllSubItems())
+    // always needs the full listing.
+    bool updated = false;
+    if (!revisions.empty()) {
+        BOOST_FOREACH(const SubRevisionMap_t::value_type &entry, revisions) {
+            items[entry.first] = entry.second.m_revision;
+        }
+        updated = updateWithSyncToken(items);
+    }
+    if (!updated) {
+        // list items to identify new, updated and removed ones
+        listAllResources(items);
+    }
+    getItemStore().setRevisions(items);
 
     // remove obsolete entries
     SubRevisionMap_t::iterator it = revisions.begin();
@@ -182,14 +221,13 @@ void CalDAVSource::updateAllSubItems(SubRevisionMap_t &revisions)
     // copy others to cache
     m_cache.clear();
     m_cache.m_initialized = false;
-    std::list<std::string> mustRead;
+    std::vector<std::string> mustRead;
     BOOST_FOREACH(const StringPair &item, items) {
         SubRevisionMap_t::iterator it = revisions.find(item.first);
         if (it == revisions.end() ||
             it->second.m_revision != item.second) {
             // read current information below
             SE_LOG_DEBUG(NULL, NULL, "updateAllSubItems(): read new or modified item %s", item.first.c_str());
-            mustRead.push_back(item.first);
             // The server told us that the item exists. We still need
             // to deal with the situation that the server might fail
             // to deliver the item data when we ask for it below.
@@ -208,6 +246,9 @@ void CalDAVSource::updateAllSubItems(SubRevisionMap_t &revisions)
                 revisions.erase(it);
             }
             m_cache.erase(item.first);
+            if (!addStoredItem(revisions, item.first, item.second)) {
+                mustRead.push_back(item.first);
+            }
         } else {
             // copy still relevant information
             SE_LOG_DEBUG(NULL, NULL, "updateAllSubItems(): unmodified item %s", it->first.c_str());
@@ -232,60 +273,26 @@ void CalDAVSource::updateAllSubItems(SubRevisionMap_t &revisions)
     // record retrieved or failed responses, then follow up with
     // individual requests for anything that wasn't mentioned.
     if (!mustRead.empty()) {
-        std::stringstream buffer;
-        buffer << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
-            "<C:calendar-multiget xmlns:D=\"DAV:\"\n"
-            "   xmlns:C=\"urn:ietf:params:xml:ns:caldav\">\n"
-            "<D:prop>\n"
-            "   <D:getetag/>\n"
-            "   <C:calendar-data/>\n"
-            "</D:prop>\n";
-        BOOST_FOREACH(const std::string &luid, mustRead) {
-            buffer << "<D:href>" << luid2path(luid) << "</D:href>\n";
-        }
-        buffer << "</C:calendar-multiget>";
-        std::string query = buffer.str();
         std::set<std::string> results; // LUIDs of all hrefs returned by report
-        getSession()->startOperation("updateAllSubItems REPORT 'multiget new/updated items'", deadline);
-        while (true) {
-            string data;
-            Neon::XMLParser parser;
-            parser.initReportParser(boost::bind(&CalDAVSource::appendMultigetResult, this,
-                                                boost::ref(revisions),
-                                                boost::ref(results),
-                                                _1, _2, boost::ref(data)));
-            parser.pushHandler(boost::bind(Neon::XMLParser::accept, "urn:ietf:params:xml:ns:caldav", "calendar-data", _2, _3),
-                               boost::bind(Neon::XMLParser::append, boost::ref(data), _2, _3));
-            Neon::Request report(*getSession(), "REPORT", getCalendar().m_path,
-                                 query, parser);
-            report.addHeader("Depth", "1");
-            report.addHeader("Content-Type", "application/xml; charset=\"utf-8\"");
-            if (report.run()) {
-                break;
-            }
-        }
+        multiget("updateAllSubItems REPORT 'multiget new/updated items'",
+                 mustRead,
+                 boost::bind(&CalDAVSource::appendMultigetResult, this,
+                             boost::ref(revisions),
+                             boost::ref(results),
+                             _1, _2, _3));
         // Workaround for Radicale 0.6.4: it simply returns nothing (no error, no data).
         // Fall back to GET of items with no response.
+        std::vector<std::string> missing;
         BOOST_FOREACH(const std::string &luid, mustRead) {
             if (results.find(luid) == results.end()) {
-                getSession()->startOperation(StringPrintf("GET item %s not returned by 'multiget new/updated items'", luid.c_str()),
-                                             deadline);
-                std::string path = luid2path(luid);
-                std::string data;
-                std::string etag;
-                while (true) {
-                    data.clear();
-                    Neon::Request req(*getSession(), "GET", path,
-                                      "", data);
-                    req.addHeader("Accept", contentType());
-                    if (req.run()) {
-                        etag = getETag(req);
-                        break;
-                    }
-                }
-                appendItem(revisions, path, etag, data);
+                missing.push_back(luid);
             }
         }
+        getItems("GET items not returned by 'multiget new/updated items'",
+                 missing,
+                 boost::bind(&CalDAVSource::appendItem, this,
+                             boost::ref(revisions),
+                             _1, _2, _3));
     }
 }
 
@@ -316,6 +323,12 @@ int CalDAVSource::appendItem(SubRevisionMap_t &revisions,
         return 0;
     }
 
+    // original data for the item store
+    std::string raw;
+    if (getItemStore().isEnabled()) {
+        raw = data;
+    }
+
     Event::unescapeRecurrenceID(data);
     eptr<icalcomponent> calendar(icalcomponent_new_from_string((char *)data.c_str()), // cast is a hack for broken definition in old libical
                                  "iCalendar 2.0");
@@ -350,6 +363,13 @@ int CalDAVSource::appendItem(SubRevisionMap_t &revisions,
         return 0;
     }
 
+    WebDAVItemStore::Entry stored;
+    stored.m_revision = entry.m_revision;
+    stored.m_uid = uid;
+    stored.m_sequence = maxSequence;
+    stored.m_subids = entry.m_subids;
+    getItemStore().write(davLUID, raw, stored);
+
     if (!m_cache.m_initialized) {
         boost::shared_ptr<Event> event(new Event);
         event->m_DAVluid = davLUID;
@@ -363,9 +383,11 @@ int CalDAVSource::appendItem(SubRevisionMap_t &revisions,
              comp;
              comp = icalcomponent_get_next_component(calendar, ICAL_VEVENT_COMPONENT)) {
         }
-        event->m_calendar = calendar;
 #endif
-        m_cache.insert(make_pair(davLUID, event));
+        m_cache.insert(event);
+#ifndef SHORT_ALL_SUB_ITEMS_DATA
+        m_cache.setCalendar(*event, calendar, data.size());
+#endif
     }
 
     // reset data for next item
@@ -373,11 +395,42 @@ int CalDAVSource::appendItem(SubRevisionMap_t &revisions,
     return 0;
 }
 
+bool CalDAVSource::addStoredItem(SubRevisionMap_t &revisions,
+                                 const std::string &luid,
+                                 const std::string &revision)
+{
+    WebDAVItemStore::Entry stored;
+    std::string item;
+    if (!getItemStore().read(luid, revision, item, &stored) ||
+        stored.m_subids.empty()) {
+        // not stored or not by appendItem()
+        return false;
+    }
+
+    SubRevisionEntry &entry = revisions[luid];
+    entry.m_revision = revision;
+    entry.m_uid = stored.m_uid;
+    entry.m_subids = stored.m_subids;
+
+    if (!m_cache.m_initialized) {
+        // parsed by loadItem() when needed
+        boost::shared_ptr<Event> event(new Event);
+        event->m_DAVluid = luid;
+        event->m_UID = stored.m_uid;
+        event->m_etag = revision;
+        event->m_subids = stored.m_subids;
+        event->m_sequence = stored.m_sequence;
+        Event::unescapeRecurrenceID(item);
+        event->m_item.swap(item);
+        m_cache.insert(event);
+    }
+    return true;
+}
+
 void CalDAVSource::addSubItem(const std::string &luid,
                               const SubRevisionEntry &entry)
 {
-    boost::shared_ptr<Event> &event = m_cache[luid];
-    event.reset(new Event);
+    boost::shared_ptr<Event> event(new Event);
     event->m_DAVluid = luid;
     event->m_etag = entry.m_revision;
     event->m_UID = entry.m_uid;
@@ -385,6 +438,7 @@ void CalDAVSource::addSubItem(const std::string &luid,
     // information will have to be filled in by loadItem()
     // when some operation on this event needs it.
     event->m_subids = entry.m_subids;
+    m_cache.insert(event);
 }
 
 void CalDAVSource::setAllSubItems(const SubRevisionMap_t &revisions)
@@ -535,6 +589,7 @@ SubSyncSource::SubItemResult CalDAVSource::insertSubItem(const std::string &luid
             }
             icalcomponent_merge_component(event.m_calendar,
                                           newEvent->m_calendar.release()); // function destroys merged calendar
+            m_cache.touch(event, event.m_size + item.size());
         } else {
             // Google Calendar adds a default alarm each time a VEVENT is added
             // anew. Avoid that by resending our data if necessary (= no alarm set).
@@ -543,12 +598,14 @@ SubSyncSource::SubItemResult CalDAVSource::insertSubItem(const std::string &luid
                 // add to cache, then update it
                 newEvent->m_DAVluid = res.m_luid;
                 newEvent->m_etag = res.m_revision;
-                m_cache[newEvent->m_DAVluid] = newEvent;
+                m_cache.insert(newEvent);
+                m_cache.touch(*newEvent, item.size());
 
                 // potentially need to know sequence and mod time on server:
                 // keep pointer (clears pointer in newEvent),
                 // then get and parse new copy from server
-                eptr<icalcomponent> calendar = newEvent->m_calendar;
+                eptr<icalcomponent> calendar;
+                m_cache.takeCalendar(*newEvent, calendar);
 
                 if (settings().googleUpdateHack()) {
                     loadItem(*newEvent);
@@ -582,12 +639,13 @@ SubSyncSource::SubItemResult CalDAVSource::insertSubItem(const std::string &luid
                 res = insertItem(name, *data, true);
                 newEvent->m_etag =
                     subres.m_revision = res.m_revision;
-                newEvent->m_calendar = calendar;
+                m_cache.setCalendar(*newEvent, calendar, data->size());
             } else {
                 // add to cache without further changes
                 newEvent->m_DAVluid = res.m_luid;
                 newEvent->m_etag = res.m_revision;
-                m_cache[newEvent->m_DAVluid] = newEvent;
+                m_cache.insert(newEvent);
+                m_cache.touch(*newEvent, item.size());
             }
         }
     } else {
@@ -710,6 +768,7 @@ SubSyncSource::SubItemResult CalDAVSource::insertSubItem(const std::string &luid
                                       newEvent->m_calendar.release()); // function destroys merged calendar
         eptr<char> icalstr(ical_strdup(icalcomponent_as_ical_string(event.m_calendar)));
         std::string data = icalstr.get();
+        m_cache.touch(event, data.size());
 
         // Google gets confused when adding a child without parent,
         // replace in that case.
@@ -766,12 +825,13 @@ SubSyncSource::SubItemResult CalDAVSource::insertSubItem(const std::string &luid
                 // An attempt with splitting the PUT in advance worked for some cases,
                 // but then it still happened for others. So let's use brute force and
                 // try again once more after reading the updated event anew.
-                eptr<icalcomponent> fullcal = event.m_calendar;
+                eptr<icalcomponent> fullcal;
+                size_t size = m_cache.takeCalendar(event, fullcal);
                 loadItem(event);
                 event.m_sequence++;
                 lastmodtime = icaltime_from_timet(event.m_lastmodtime, false);
                 lastmodtime.is_utc = 1;
-                event.m_calendar = fullcal;
+                m_cache.setCalendar(event, fullcal, size);
                 for (icalcomponent *comp = icalcomponent_get_first_component(event.m_calendar, ICAL_VEVENT_COMPONENT);
                      comp;
                      comp = icalcomponent_get_next_component(event.m_calendar, ICAL_VEVENT_COMPONENT)) {
@@ -929,6 +989,7 @@ std::string CalDAVSource::removeSubItem(const string &davLUID, const std::string
                     // HTTP/1.1 409 Can't delete a recurring event except on its organizer's calendar
                     //
                     // Workaround: remove RRULE and EXDATE before deleting
+                    loadItem(event);
                     bool updated = false;
                     icalcomponent *comp = icalcomponent_get_first_component(event.m_calendar, ICAL_VEVENT_COMPONENT);
                     if (comp) {
@@ -1011,8 +1072,9 @@ std::string CalDAVSource::removeSubItem(const string &davLUID, const std::string
             // again.
             string item = icalstr.get();
             Event::escapeRecurrenceID(item);
-            event.m_calendar.set(icalcomponent_new_from_string((char *)item.c_str()), // hack for old libical
-                                 "parsing iCalendar 2.0");
+            eptr<icalcomponent> calendar(icalcomponent_new_from_string((char *)item.c_str()), // hack for old libical
+                                         "parsing iCalendar 2.0");
+            m_cache.setCalendar(event, calendar, item.size());
             res = insertItem(davLUID, item, true);
         } else {
             res = insertItem(davLUID, icalstr.get(), true);
@@ -1067,7 +1129,7 @@ void CalDAVSource::flushItem(const string &davLUID)
     // TODO: currently we always flush immediately, so no need to send data here
     EventCache::iterator it = m_cache.find(davLUID);
     if (it != m_cache.end()) {
-        it->second->m_calendar.set(NULL);
+        m_cache.flush(*it->second);
     }
 }
 
@@ -1153,7 +1215,15 @@ int CalDAVSource::storeItem(const std::string &wantedLuid,
 
 CalDAVSource::Event &CalDAVSource::loadItem(Event &event)
 {
-    if (!event.m_calendar) {
+    size_t size = 0;
+    if (!event.m_calendar && !event.m_item.empty()) {
+        // Dropped by m_cache earlier or found in the item store.
+        event.m_calendar.set(icalcomponent_new_from_string((char *)event.m_item.c_str()), // hack for old libical
+                             "parsing iCalendar 2.0");
+        Event::fixIncomingCalendar(event.m_calendar.get());
+        size = event.m_item.size();
+        event.m_item.clear();
+    } else if (!event.m_calendar) {
         std::string item;
         try {
             readItem(event.m_DAVluid, item, true);
@@ -1242,15 +1312,19 @@ CalDAVSource::Event &CalDAVSource::loadItem(Event &event)
                              "parsing iCalendar 2.0");
         Event::fixIncomingCalendar(event.m_calendar.get());
 
-        // Sequence number/last-modified might have been increased by last save.
-        // Or the cache was populated by setAllSubItems(), which doesn't give
-        // us the information. In that case, UID might also still be unknown.
-        // Either way, check it again.
+        size = item.size();
+    }
+
+    if (size) {
+        // Just parsed. Sequence number/last-modified might have been increased by last save.
+        // Or the cache was populated by setAllSubItems() or from the item
+        // store, which don't give us (all of) the information. In that case,
+        // UID might also still be unknown. Either way, check it again.
         for (icalcomponent *comp = icalcomponent_get_first_component(event.m_calendar, ICAL_VEVENT_COMPONENT);
              comp;
              comp = icalcomponent_get_next_component(event.m_calendar, ICAL_VEVENT_COMPONENT)) {
             if (event.m_UID.empty()) {
-                event.m_UID = Event::getUID(comp);
+                m_cache.setUID(event, Event::getUID(comp));
             }
             long sequence = Event::getSequence(comp);
             if (sequence > event.m_sequence) {
@@ -1266,6 +1340,7 @@ CalDAVSource::Event &CalDAVSource::loadItem(Event &event)
             }
         }
     }
+    m_cache.touch(event, size);
     return event;
 }
 
@@ -1395,16 +1470,162 @@ void CalDAVSource::Event::setSequence(icalcomponent *comp, int sequence)
     }
 }
 
+CalDAVSource::EventCache::EventCache() :
+    m_initialized(false),
+    m_parsedSize(0),
+    m_budget(0)
+{
+}
+
+void CalDAVSource::EventCache::insert(const boost::shared_ptr<Event> &event)
+{
+    iterator it = Map_t::find(event->m_DAVluid);
+    if (it == end()) {
+        Map_t::insert(std::make_pair(event->m_DAVluid, event));
+    } else if (it->second != event) {
+        removeUID(*it->second);
+        removeLRU(*it->second);
+        it->second = event;
+    } else {
+        return;
+    }
+    addUID(*event);
+}
+
+void CalDAVSource::EventCache::erase(const std::string &davLUID)
+{
+    iterator it = Map_t::find(davLUID);
+    if (it != end()) {
+        removeUID(*it->second);
+        removeLRU(*it->second);
+        Map_t::erase(it);
+    }
+}
+
+void CalDAVSource::EventCache::clear()
+{
+    // events might still be referenced elsewhere
+    BOOST_FOREACH (Event *event, m_lru) {
+        event->m_inLRU = false;
+        event->m_size = 0;
+    }
+    m_lru.clear();
+    m_parsedSize = 0;
+    m_uids.clear();
+    Map_t::clear();
+}
+
+void CalDAVSource::EventCache::setUID(Event &event, const std::string &uid)
+{
+    removeUID(event);
+    event.m_UID = uid;
+    addUID(event);
+}
+
 CalDAVSource::EventCache::iterator CalDAVSource::EventCache::findByUID(const std::string &uid)
 {
-    for (iterator it = begin();
-         it != end();
+    UIDs_t::const_iterator it = m_uids.find(uid);
+    return it == m_uids.end() ? end() : Map_t::find(it->second);
+}
+
+void CalDAVSource::EventCache::touch(Event &event, size_t size)
+{
+    if (event.m_inLRU) {
+        m_lru.splice(m_lru.end(), m_lru, event.m_lru);
+    } else if (event.m_calendar) {
+        event.m_lru = m_lru.insert(m_lru.end(), &event);
+        event.m_inLRU = true;
+    } else {
+        return;
+    }
+    if (size) {
+        m_parsedSize -= event.m_size;
+        event.m_size = size;
+        m_parsedSize += size;
+    }
+    trim(event);
+}
+
+void CalDAVSource::EventCache::setCalendar(Event &event, eptr<icalcomponent> &calendar, size_t size)
+{
+    // transfers ownership
+    event.m_calendar = calendar;
+    if (event.m_calendar) {
+        touch(event, size);
+    } else {
+        removeLRU(event);
+    }
+}
+
+size_t CalDAVSource::EventCache::takeCalendar(Event &event, eptr<icalcomponent> &calendar)
+{
+    size_t size = event.m_size;
+    // transfers ownership
+    calendar = event.m_calendar;
+    removeLRU(event);
+    return size;
+}
+
+void CalDAVSource::EventCache::flush(Event &event)
+{
+    event.m_calendar.set(NULL);
+    event.m_item.clear();
+    removeLRU(event);
+}
+
+void CalDAVSource::EventCache::addUID(const Event &event)
+{
+    if (!event.m_UID.empty()) {
+        m_uids.insert(std::make_pair(event.m_UID, event.m_DAVluid));
+    }
+}
+
+void CalDAVSource::EventCache::removeUID(const Event &event)
+{
+    std::pair<UIDs_t::iterator, UIDs_t::iterator> range = m_uids.equal_range(event.m_UID);
+    for (UIDs_t::iterator it = range.first;
+         it != range.second;
          ++it) {
-        if (it->second->m_UID == uid) {
-            return it;
+        if (it->second == event.m_DAVluid) {
+            m_uids.erase(it);
+            break;
+        }
+    }
+}
+
+void CalDAVSource::EventCache::removeLRU(Event &event)
+{
+    if (event.m_inLRU) {
+        m_parsedSize -= event.m_size;
+        m_lru.erase(event.m_lru);
+        event.m_inLRU = false;
+        event.m_size = 0;
+    }
+}
+
+void CalDAVSource::EventCache::trim(const Event &keep)
+{
+    if (!m_budget || m_parsedSize <= m_budget) {
+        return;
+    }
+
+    size_t dropped = 0;
+    while (m_parsedSize > m_budget &&
+           m_lru.front() != &keep) {
+        // Keeping the text avoids sending a GET when the event is
+        // needed again. It is considerably smaller than the parsed
+        // representation.
+        Event &event = *m_lru.front();
+        if (event.m_calendar) {
+            eptr<char> icalstr(ical_strdup(icalcomponent_as_ical_string(event.m_calendar)));
+            event.m_item = icalstr.get();
+            event.m_calendar.set(NULL);
         }
+        removeLRU(event);
+        dropped++;
     }
-    return end();
+    SE_LOG_DEBUG(NULL, NULL, "CalDAV cache: dropped %ld parsed items, %ld of %ld KB in use",
+                 (long)dropped, (long)(m_parsedSize / 1024), (long)(m_budget / 1024));
 }
 
 void CalDAVSource::backupData(const SyncSource::Operations::ConstBackupInfo &oldBackup,
@@ -17,6 +17,9 @@
 #include <boost/utility.hpp>
 #include <boost/shared_ptr.hpp>
 
+#include <map>
+#include <list>
+
 #include <syncevo/declarations.h>
 SE_BEGIN_CXX
 
@@ -32,8 +35,8 @@ class CalDAVSource : public WebDAVSource,
     virtual std::string getMimeVersion() const { return "2.0"; }
 
     /* implementation of SubSyncSource interface */
-    virtual void begin() { contactServer(); }
-    virtual void endSubSync(bool success) { if (success) { storeServerInfos(); } }
+    virtual void begin() { contactServer(); resetSyncToken(); }
+    virtual void endSubSync(bool success) { if (success) { storeServerInfos(); storeSyncToken(); } }
     virtual std::string subDatabaseRevision() { return databaseRevision(); }
     virtual void listAllSubItems(SubRevisionMap_t &revisions);
     virtual void updateAllSubItems(SubRevisionMap_t &revisions);
@@ -93,7 +96,9 @@ class CalDAVSource : public WebDAVSource,
     public:
         Event() :
             m_sequence(0),
-            m_lastmodtime(0)
+            m_lastmodtime(0),
+            m_size(0),
+            m_inLRU(false)
         {}
 
         /** the ID used by WebDAVSource */
@@ -125,6 +130,24 @@ class CalDAVSource : public WebDAVSource,
          */
         eptr<icalcomponent> m_calendar;
 
+        /**
+         * estimated memory consumed by m_calendar (= size of the
+         * iCalendar 2.0 text it was created from), as accounted for
+         * by EventCache
+         */
+        size_t m_size;
+
+        /**
+         * m_calendar as iCalendar 2.0 text, set instead of m_calendar
+         * when EventCache dropped the parsed item to save memory or
+         * the item was found in the item store; loadItem() parses it
+         */
+        std::string m_item;
+
+        /** position in EventCache::m_lru, only valid if m_inLRU */
+        std::list<Event *>::iterator m_lru;
+        bool m_inLRU;
+
         /**
          * clean up calendar directly after receiving it from peer:
          * RECURRENCE-ID in UTC, remove X-LIC-ERROR
@@ -164,14 +187,85 @@ class CalDAVSource : public WebDAVSource,
      * When retrieving an EVENT from the server this is substituted
      * again before parsing (depends on server preserving X-
      * extensions, see Event::unescapeRecurrenceID()).
+     *
+     * All modifications must go through the methods of this class
+     * because it also maintains an index of UIDs and limits the
+     * number of parsed items which are kept in memory: when the
+     * estimated size of all parsed items exceeds the budget set via
+     * the "calDAVCacheSize" source property (in KB, default is unlimited),
+     * the least recently used items are converted back to plain text.
      */
-    class EventCache : public std::map<std::string, boost::shared_ptr<Event> >
+    class EventCache : private std::map<std::string, boost::shared_ptr<Event> >
     {
+        typedef std::map<std::string, boost::shared_ptr<Event> > Map_t;
+
       public:
-        EventCache() : m_initialized(false) {}
+        EventCache();
         bool m_initialized;
 
+        using Map_t::iterator;
+        using Map_t::begin;
+        using Map_t::end;
+        using Map_t::find;
+
+        /** add event or replace the one with the same m_DAVluid */
+        void insert(const boost::shared_ptr<Event> &event);
+        void erase(const std::string &davLUID);
+        void clear();
+
+        /** set UID of an event which is in the cache */
+        void setUID(Event &event, const std::string &uid);
+
         iterator findByUID(const std::string &uid);
+
+        /** maximum size of parsed items in bytes, 0 for unlimited */
+        void setBudget(size_t budget) { m_budget = budget; }
+
+        /**
+         * Mark m_calendar of an event in the cache as recently used,
+         * then drop other parsed items if over budget.
+         *
+         * @param size    size of the text that m_calendar was just
+         *                parsed from, 0 if m_calendar was only used
+         */
+        void touch(Event &event, size_t size = 0);
+
+        /**
+         * Replace m_calendar of an event in the cache (takes over
+         * calendar) and update the LRU list accordingly. Cached
+         * events must not get a new m_calendar any other way.
+         *
+         * @param size    size of the text representation of the calendar
+         */
+        void setCalendar(Event &event, eptr<icalcomponent> &calendar, size_t size);
+
+        /**
+         * Move m_calendar of an event in the cache into calendar,
+         * for setCalendar() later on.
+         *
+         * @return size of the calendar as recorded in the LRU list
+         */
+        size_t takeCalendar(Event &event, eptr<icalcomponent> &calendar);
+
+        /** event no longer has m_calendar nor m_item */
+        void flush(Event &event);
+
+      private:
+        /** UID -> DAV luid; a multimap because UIDs are not guaranteed to be unique */
+        typedef std::multimap<std::string, std::string> UIDs_t;
+        UIDs_t m_uids;
+
+        /** events with m_calendar, least recently used first */
+        std::list<Event *> m_lru;
+        /** sum of Event::m_size in m_lru */
+        size_t m_parsedSize;
+        /** maximum for m_parsedSize, 0 for unlimited */
+        size_t m_budget;
+
+        void addUID(const Event &event);
+        void removeUID(const Event &event);
+        void removeLRU(Event &event);
+        void trim(const Event &keep);
     } m_cache;
 
     Event &findItem(const std::string &davLUID);
@@ -206,6 +300,14 @@ class CalDAVSource : public WebDAVSource,
                   std::string &data,
                   const std::string &href);
 
+    /**
+     * add item with the given revision from the item store to
+     * revisions and m_cache, return false if not stored
+     */
+    bool addStoredItem(SubRevisionMap_t &revisions,
+                       const std::string &luid,
+                       const std::string &revision);
+
     /** add to m_cache */
     void addSubItem(const std::string &luid,
                     const SubRevisionEntry &entry);
@@ -214,6 +316,9 @@ class CalDAVSource : public WebDAVSource,
     void addResource(StringMap &items,
                      const std::string &href,
                      const std::string &etag);
+
+    /** luid + revision of all events, without data */
+    void listAllResources(StringMap &items);
 };
 
 SE_END_CXX
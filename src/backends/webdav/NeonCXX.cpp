@@ -13,9 +13,11 @@
 #include <ne_string.h>
 
 #include <list>
+#include <algorithm>
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/bind.hpp>
+#include <boost/foreach.hpp>
 
 #include <syncevo/util.h>
 #include <syncevo/Logging.h>
@@ -26,6 +28,7 @@
 #include <sstream>
 
 #include <dlfcn.h>
+#include <pthread.h>
 
 #include <syncevo/declarations.h>
 SE_BEGIN_CXX
@@ -190,6 +193,9 @@ std::string Status2String(const ne_status *status)
 Session::Session(const boost::shared_ptr<Settings> &settings) :
     m_forceAuthorizationOnce(false),
     m_credentialsSent(false),
+    m_threaded(false),
+    m_threadVerifySSLHost(true),
+    m_threadVerifySSLCertificate(true),
     m_settings(settings),
     m_debugging(false),
     m_session(NULL),
@@ -289,6 +295,88 @@ boost::shared_ptr<Session> Session::create(const boost::shared_ptr<Settings> &se
     return m_cachedSession;
 }
 
+Session::HostPools_t Session::m_hostPools;
+
+std::string Session::getPoolKey() const
+{
+    return StringPrintf("%s://%s:%u %s",
+                        m_uri.m_scheme.c_str(),
+                        m_uri.m_host.c_str(),
+                        m_uri.m_port,
+                        m_proxyURL.c_str());
+}
+
+boost::shared_ptr<Session> Session::acquire()
+{
+    boost::shared_ptr<Session> session;
+
+    if (m_uri.m_scheme == "https" &&
+        !ne_has_support(NE_FEATURE_TS_SSL)) {
+        // SSL library not initialized for use by several threads
+        return session;
+    }
+
+    // this session counts as one
+    HostPool &pool = m_hostPools[getPoolKey()];
+    if (pool.m_busy + 1 >= m_settings->maxConnections()) {
+        return session;
+    }
+
+    if (!pool.m_idle.empty()) {
+        session = pool.m_idle.front();
+        pool.m_idle.pop_front();
+        SE_LOG_DEBUG(NULL, NULL, "reusing additional session for %s, %d in use",
+                     getURL().c_str(), pool.m_busy + 1);
+    } else {
+        SE_LOG_DEBUG(NULL, NULL, "creating additional session for %s, %d in use",
+                     getURL().c_str(), pool.m_busy + 1);
+        session.reset(new Session(m_settings));
+        // Do not rely on credentials being sent again by neon after
+        // a 401 error. This is what contactServer() does for the
+        // main session, too.
+        std::string username, password;
+        m_settings->getCredentials("", username, password);
+        session->forceAuthorization(username, password);
+    }
+    pool.m_busy++;
+    session->m_settings = m_settings;
+    session->m_requestStats = m_requestStats;
+    return session;
+}
+
+void Session::release(const boost::shared_ptr<Session> &session)
+{
+    HostPool &pool = m_hostPools[session->getPoolKey()];
+    pool.m_busy--;
+    session->m_requestStats.reset();
+    pool.m_idle.push_back(session);
+}
+
+void Session::setThreaded(bool threaded)
+{
+    if (threaded) {
+        m_settings->getCredentials("", m_threadUsername, m_threadPassword);
+        m_threadVerifySSLHost = m_settings->verifySSLHost();
+        m_threadVerifySSLCertificate = m_settings->verifySSLCertificate();
+        m_threaded = true;
+    } else {
+        m_threaded = false;
+        BOOST_FOREACH(const std::string &msg, m_threadLog) {
+            SE_LOG_DEBUG(NULL, NULL, "%s", msg.c_str());
+        }
+        m_threadLog.clear();
+    }
+}
+
+void Session::debug(const std::string &msg)
+{
+    if (m_threaded) {
+        m_threadLog.push_back(msg);
+    } else {
+        SE_LOG_DEBUG(NULL, NULL, "%s", msg.c_str());
+    }
+}
+
 
 int Session::getCredentials(void *userdata, const char *realm, int attempt, char *username, char *password) throw()
 {
@@ -297,11 +385,16 @@ int Session::getCredentials(void *userdata, const char *realm, int attempt, char
             // try again with credentials
             Session *session = static_cast<Session *>(userdata);
             std::string user, pw;
-            session->m_settings->getCredentials(realm, user, pw);
+            if (session->m_threaded) {
+                user = session->m_threadUsername;
+                pw = session->m_threadPassword;
+            } else {
+                session->m_settings->getCredentials(realm, user, pw);
+            }
             SyncEvo::Strncpy(username, user.c_str(), NE_ABUFSIZ);
             SyncEvo::Strncpy(password, pw.c_str(), NE_ABUFSIZ);
             session->m_credentialsSent = true;
-            SE_LOG_DEBUG(NULL, NULL, "retry request with credentials");
+            session->debug("retry request with credentials");
             return 0;
         } else {
             // give up
@@ -351,7 +444,7 @@ void Session::preSend(ne_request *req, ne_buffer *header)
 
         // check for acceptance of credentials later
         m_credentialsSent = true;
-        SE_LOG_DEBUG(NULL, NULL, "forced sending credentials");
+        debug("forced sending credentials");
     }
 }
 
@@ -369,17 +462,20 @@ int Session::sslVerify(void *userdata, int failures, const ne_ssl_certificate *c
             { 0, NULL }
         };
 
-        SE_LOG_DEBUG(NULL, NULL,
-                     "%s: SSL verification problem: %s",
-                     session->getURL().c_str(),
-                     Flags2String(failures, descr).c_str());
-        if (!session->m_settings->verifySSLCertificate()) {
-            SE_LOG_DEBUG(NULL, NULL, "ignoring bad certificate");
+        session->debug(StringPrintf("%s: SSL verification problem: %s",
+                                    session->getURL().c_str(),
+                                    Flags2String(failures, descr).c_str()));
+        if (!(session->m_threaded ?
+              session->m_threadVerifySSLCertificate :
+              session->m_settings->verifySSLCertificate())) {
+            session->debug("ignoring bad certificate");
             return 0;
         }
         if (failures == NE_SSL_IDMISMATCH &&
-            !session->m_settings->verifySSLHost()) {
-            SE_LOG_DEBUG(NULL, NULL, "ignoring hostname mismatch");
+            !(session->m_threaded ?
+              session->m_threadVerifySSLHost :
+              session->m_settings->verifySSLHost())) {
+            session->debug("ignoring hostname mismatch");
             return 0;
         }
         return 1;
@@ -414,6 +510,7 @@ void Session::propfindURI(const std::string &path, int depth,
  retry:
     boost::shared_ptr<ne_propfind_handler> handler;
     int error;
+    Timespec start = Timespec::monotonic();
 
     handler = boost::shared_ptr<ne_propfind_handler>(ne_propfind_create(m_session, path.c_str(), depth),
                                                      PropFindDeleter());
@@ -424,6 +521,7 @@ void Session::propfindURI(const std::string &path, int depth,
 	error = ne_propfind_allprop(handler.get(),
                                     propsResult, const_cast<void *>(static_cast<const void *>(&callback)));
     }
+    addRequestStats("PROPFIND", (Timespec::monotonic() - start).duration());
 
     // remain valid as long as "handler" is valid
     ne_request *req = ne_propfind_get_request(handler.get());
@@ -503,6 +601,32 @@ void Session::startOperation(const string &operation, const Timespec &deadline)
     m_attempt = 0;
 }
 
+void Session::addRequestStats(const std::string &method, double duration)
+{
+    if (!m_requestStats) {
+        return;
+    }
+    RequestStats &stats = (*m_requestStats)[method];
+    stats.m_count++;
+    stats.m_total += duration;
+    if (duration > stats.m_max) {
+        stats.m_max = duration;
+    }
+}
+
+void Session::logRequestStats(const RequestStatsMap_t &requestStats)
+{
+    BOOST_FOREACH(const RequestStatsMap_t::value_type &entry, requestStats) {
+        const RequestStats &stats = entry.second;
+        SE_LOG_DEBUG(NULL, NULL, "%s: %lu requests, %.3lfs total, %.3lfs average, %.3lfs max",
+                     entry.first.c_str(),
+                     stats.m_count,
+                     stats.m_total,
+                     stats.m_count ? stats.m_total / stats.m_count : 0.0,
+                     stats.m_max);
+    }
+}
+
 void Session::flush()
 {
     if (m_debugging &&
@@ -787,6 +911,26 @@ int XMLParser::accept(const std::string &nspaceExpected,
     }
 }
 
+int XMLParser::search(const std::string &needle,
+                      bool &found,
+                      std::string &buffer,
+                      const char *data,
+                      size_t len)
+{
+    if (found) {
+        return 0;
+    }
+    buffer.append(data, len);
+    if (buffer.find(needle) != buffer.npos) {
+        found = true;
+        buffer.clear();
+    } else if (buffer.size() >= needle.size()) {
+        // keep only what might be the start of a match
+        buffer.erase(0, buffer.size() - needle.size() + 1);
+    }
+    return 0;
+}
+
 int XMLParser::append(std::string &buffer,
                       const char *data,
                       size_t len)
@@ -825,7 +969,9 @@ Request::Request(Session &session,
     m_method(method),
     m_session(session),
     m_result(&result),
-    m_parser(NULL)
+    m_parser(NULL),
+    m_error(NE_OK),
+    m_duration(0)
 {
     m_req = ne_request_create(session.getSession(), m_method.c_str(), path.c_str());
     ne_set_request_body_buffer(m_req, body.c_str(), body.size());
@@ -839,7 +985,9 @@ Request::Request(Session &session,
     m_method(method),
     m_session(session),
     m_result(NULL),
-    m_parser(&parser)
+    m_parser(&parser),
+    m_error(NE_OK),
+    m_duration(0)
 {
     m_req = ne_request_create(session.getSession(), m_method.c_str(), path.c_str());
     ne_set_request_body_buffer(m_req, body.c_str(), body.size());
@@ -863,18 +1011,29 @@ static int ne_accept_2xx(void *userdata, ne_request *req, const ne_status *st)
 
 bool Request::run()
 {
-    int error;
+    dispatch();
+    return check();
+}
+
+void Request::dispatch()
+{
+    Timespec start = Timespec::monotonic();
 
     if (m_result) {
         m_result->clear();
         ne_add_response_body_reader(m_req, ne_accept_2xx,
                                     addResultData, this);
-        error = ne_request_dispatch(m_req);
+        m_error = ne_request_dispatch(m_req);
     } else {
-        error = ne_xml_dispatch_request(m_req, m_parser->get());
+        m_error = ne_xml_dispatch_request(m_req, m_parser->get());
     }
+    m_duration = (Timespec::monotonic() - start).duration();
+}
 
-    return checkError(error);
+bool Request::check()
+{
+    m_session.addRequestStats(m_method, m_duration);
+    return checkError(m_error);
 }
 
 int Request::addResultData(void *userdata, const char *buf, size_t len)
@@ -889,6 +1048,98 @@ bool Request::checkError(int error)
     return m_session.checkError(error, getStatus()->code, getStatus(), getResponseHeader("Location"));
 }
 
+RequestBatch::RequestBatch(const boost::shared_ptr<Session> &session)
+{
+    m_sessions.push_back(session);
+}
+
+RequestBatch::~RequestBatch()
+{
+    for (size_t i = 1; i < m_sessions.size(); i++) {
+        Session::release(m_sessions[i]);
+    }
+}
+
+void RequestBatch::add(const std::string &operation,
+                       const Create_t &create,
+                       const Done_t &done)
+{
+    Entry entry;
+    entry.m_operation = operation;
+    entry.m_create = create;
+    entry.m_done = done;
+    m_entries.push_back(entry);
+}
+
+void *RequestBatch::dispatchThread(void *request) throw()
+{
+    try {
+        static_cast<Request *>(request)->dispatch();
+    } catch (...) {
+        // not expected, neon callbacks catch their exceptions;
+        // the request then fails in check()
+    }
+    return NULL;
+}
+
+void RequestBatch::run(const Timespec &deadline)
+{
+    // get additional sessions, as many as useful and allowed
+    while (m_sessions.size() < m_entries.size()) {
+        boost::shared_ptr<Session> session = m_sessions.front()->acquire();
+        if (!session) {
+            break;
+        }
+        m_sessions.push_back(session);
+    }
+
+    while (!m_entries.empty()) {
+        // one request per session, the first one is sent by this thread
+        size_t count = std::min(m_sessions.size(), m_entries.size());
+        std::vector<Entry> entries;
+        std::vector< boost::shared_ptr<Request> > requests;
+        for (size_t i = 0; i < count; i++) {
+            entries.push_back(m_entries.front());
+            m_entries.pop_front();
+            Session &session = *m_sessions[i];
+            session.startOperation(entries[i].m_operation, deadline);
+            requests.push_back(entries[i].m_create(session));
+        }
+
+        std::vector<pthread_t> threads(count);
+        std::vector<bool> started(count, false);
+        for (size_t i = 1; i < count; i++) {
+            m_sessions[i]->setThreaded(true);
+            started[i] = !pthread_create(&threads[i], NULL, dispatchThread, requests[i].get());
+        }
+        requests[0]->dispatch();
+        for (size_t i = 1; i < count; i++) {
+            if (started[i]) {
+                pthread_join(threads[i], NULL);
+            } else {
+                // could not start thread, send it here
+                requests[i]->dispatch();
+            }
+            m_sessions[i]->setThreaded(false);
+        }
+
+        // Check all results. Resending, if needed, is done
+        // sequentially.
+        for (size_t i = 0; i < count; i++) {
+            Session &session = *m_sessions[i];
+            boost::shared_ptr<Request> request = requests[i];
+            if (!request->check()) {
+                do {
+                    request = entries[i].m_create(session);
+                } while (!request->run());
+            }
+            if (entries[i].m_done) {
+                entries[i].m_done(*request);
+            }
+        }
+    }
+}
+
 }
 
 SE_END_CXX
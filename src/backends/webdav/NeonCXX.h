@@ -18,12 +18,15 @@
 
 #include <string>
 #include <list>
+#include <map>
+#include <vector>
 
 // TODO: remove this again
 using namespace std;
 
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
 
 #include <syncevo/util.h>
 #include <syncevo/declarations.h>
@@ -117,6 +120,14 @@ class Settings {
      */
     virtual int retrySeconds() const = 0;
 
+    /**
+     * maximum number of sessions, and thus HTTP connections, which
+     * are used for the same server at the same time, see
+     * Session::acquire(); values <= 1 disable sending requests
+     * concurrently, which is the default
+     */
+    virtual int maxConnections() const { return 1; }
+
     /**
      * use this to create a boost_shared pointer for a
      * Settings instance which needs to be freed differently
@@ -200,6 +211,11 @@ std::string Status2String(const ne_status *status);
 /**
  * Wraps all session related activities.
  * Throws transport errors for fatal problems.
+ *
+ * Requests are sent one at a time per session and neon keeps the
+ * HTTP connection alive between them. To have several requests in
+ * flight, additional sessions for the same server are taken from a
+ * per-host pool (see acquire()) and driven by a RequestBatch.
  */
 class Session {
     /**
@@ -230,6 +246,34 @@ class Session {
      */
     Timespec m_deadline;
 
+    /**
+     * True while the session is used by a thread other than the
+     * main thread, see setThreaded().
+     */
+    bool m_threaded;
+    std::string m_threadUsername, m_threadPassword;
+    bool m_threadVerifySSLHost, m_threadVerifySSLCertificate;
+    /** debug messages produced while m_threaded was set */
+    std::list<std::string> m_threadLog;
+
+    /**
+     * Idle sessions and number of sessions in use for one
+     * server, see acquire().
+     */
+    struct HostPool {
+        HostPool() : m_busy(0) {}
+        std::list< boost::shared_ptr<Session> > m_idle;
+        int m_busy;
+    };
+    typedef std::map<std::string, HostPool> HostPools_t;
+    static HostPools_t m_hostPools;
+
+    /** scheme, host, port and proxy: sessions with the same key can be used interchangeably */
+    std::string getPoolKey() const;
+
+    /** SE_LOG_DEBUG() or store in m_threadLog, depending on m_threaded */
+    void debug(const std::string &msg);
+
  public:
     /**
      * Create or reuse Session instance.
@@ -241,6 +285,33 @@ class Session {
     static boost::shared_ptr<Session> create(const boost::shared_ptr<Settings> &settings);
     ~Session();
 
+    /**
+     * Get an additional session for the same server and with the
+     * same settings and request statistics as this one. Sessions
+     * are kept in a per-host pool when released, so their
+     * connections are reused.
+     *
+     * Together with the session returned by create(), at most
+     * Settings::maxConnections() sessions are in use for a host at
+     * the same time. Returns NULL when that limit is reached or
+     * the SSL library cannot be used by several threads.
+     */
+    boost::shared_ptr<Session> acquire();
+
+    /** give a session obtained via acquire() back to the pool */
+    static void release(const boost::shared_ptr<Session> &session);
+
+    /**
+     * Prepare the session for sending requests in a thread other
+     * than the main thread (true) or back in the main thread (false).
+     *
+     * SyncEvolution logging and Settings must not be used by other
+     * threads. Therefore credentials and SSL settings are copied
+     * before entering threaded mode, and debug messages produced
+     * by neon callbacks are logged when leaving it.
+     */
+    void setThreaded(bool threaded);
+
 #ifdef HAVE_LIBNEON_OPTIONS
     /** ne_options2() for a specific path*/
     unsigned int options(const std::string &path);
@@ -325,6 +396,33 @@ class Session {
      */
     void forceAuthorization(const std::string &username, const std::string &password);
 
+    /**
+     * Statistics about requests, per HTTP method. A duration covers
+     * sending one request and reading its response; waiting before
+     * resending is not included.
+     */
+    struct RequestStats {
+        RequestStats() : m_count(0), m_total(0), m_max(0) {}
+        unsigned long m_count;
+        double m_total;   /**< sum of all durations in seconds */
+        double m_max;     /**< longest duration in seconds */
+    };
+    typedef std::map<std::string, RequestStats> RequestStatsMap_t;
+
+    /**
+     * The session is shared by all users of the same server, so
+     * statistics are recorded in a map provided by the current user
+     * of the session. NULL disables recording.
+     */
+    void setRequestStats(const boost::shared_ptr<RequestStatsMap_t> &stats) { m_requestStats = stats; }
+    const boost::shared_ptr<RequestStatsMap_t> &getRequestStats() const { return m_requestStats; }
+
+    /** record one completed request which took the given number of seconds */
+    void addRequestStats(const std::string &method, double duration);
+
+    /** print statistics as debug output */
+    static void logRequestStats(const RequestStatsMap_t &stats);
+
  private:
     boost::shared_ptr<Settings> m_settings;
     bool m_debugging;
@@ -335,6 +433,8 @@ class Session {
     Timespec m_lastRequestEnd;
     /** number of times a request was sent, maintained by startOperation(), the credentials callback, and checkError() */
     int m_attempt;
+    /** maintained by addRequestStats(), may be NULL */
+    boost::shared_ptr<RequestStatsMap_t> m_requestStats;
 
     /** ne_set_server_auth() callback */
     static int getCredentials(void *userdata, const char *realm, int attempt, char *username, char *password) throw();
@@ -414,6 +514,22 @@ class XMLParser
                       const char *nspace,
                       const char *name);
 
+    /**
+     * DataCB_t: check whether the data contains a certain string,
+     * without storing all of it. Only a tail shorter than the
+     * string is kept between calls, to find matches which span
+     * several chunks of data.
+     *
+     * @param needle   string to search for
+     * @retval found   set to true once the string was found
+     * @param buffer   tail of previous data, empty before the first call
+     */
+    static int search(const std::string &needle,
+                      bool &found,
+                      std::string &buffer,
+                      const char *data,
+                      size_t len);
+
     /**
      * DataCB_t: append to std::string
      */
@@ -530,6 +646,16 @@ class Request
      */
     bool run();
 
+    /**
+     * The two parts of run(): dispatch() only sends the request and
+     * reads the response, without logging or throwing errors, and
+     * thus may be called by a thread other than the main thread
+     * (see Session::setThreaded()). check() must be called in the
+     * main thread afterwards.
+     */
+    void dispatch();
+    bool check();
+
     std::string getResponseHeader(const std::string &name) {
         const char *value = ne_get_response_header(m_req, name.c_str());
         return value ? value : "";
@@ -548,6 +674,10 @@ class Request
     std::string *m_result;
     XMLParser *m_parser;
 
+    /** result of dispatch() */
+    int m_error;
+    double m_duration;
+
     /** ne_block_reader implementation */
     static int addResultData(void *userdata, const char *buf, size_t len);
 
@@ -555,6 +685,63 @@ class Request
     bool checkError(int error);
 };
 
+/**
+ * Sends independent requests concurrently, one per session, using
+ * the main session plus additional sessions from Session::acquire().
+ * Only neon runs in the additional threads. Errors are checked,
+ * resending is done and results are handed over in the main thread,
+ * in the order in which requests were added.
+ */
+class RequestBatch : private boost::noncopyable
+{
+ public:
+    RequestBatch(const boost::shared_ptr<Session> &session);
+    ~RequestBatch();
+
+    /**
+     * Creates the request for the given session, called in the
+     * main thread for each attempt at sending it. Buffers for the
+     * result must be owned by the caller and reset by this
+     * callback.
+     */
+    typedef boost::function<boost::shared_ptr<Request> (Session &)> Create_t;
+
+    /** called in the main thread after the request succeeded */
+    typedef boost::function<void (Request &)> Done_t;
+
+    /**
+     * @param operation   passed to Session::startOperation()
+     */
+    void add(const std::string &operation,
+             const Create_t &create,
+             const Done_t &done = Done_t());
+
+    /**
+     * Send all requests added so far and wait for their
+     * completion. Requests are sent in rounds of one request per
+     * session. After all requests of a round were sent, their
+     * results are checked in the order in which they were added,
+     * resending them if necessary. A fatal error is thrown while
+     * checking its request: the done callbacks of the requests
+     * before it in the round were invoked, those of the requests
+     * after it are not, and later rounds are not sent.
+     */
+    void run(const Timespec &deadline);
+
+ private:
+    struct Entry {
+        std::string m_operation;
+        Create_t m_create;
+        Done_t m_done;
+    };
+    std::list<Entry> m_entries;
+    /** main session first, then those from Session::acquire() */
+    std::vector< boost::shared_ptr<Session> > m_sessions;
+
+    /** pthread start routine: calls Request::dispatch() */
+    static void *dispatchThread(void *request) throw();
+};
+
 /** thrown for 301 HTTP status */
 class RedirectException : public TransportException
 {
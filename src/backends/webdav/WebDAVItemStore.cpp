@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2012 Intel Corporation
+ */
+
+#include "WebDAVItemStore.h"
+
+#ifdef ENABLE_DAV
+
+#include <syncevo/IniConfigNode.h>
+#include <syncevo/SafeConfigNode.h>
+#include <syncevo/Logging.h>
+
+#include <boost/foreach.hpp>
+
+#include <sstream>
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <syncevo/declarations.h>
+SE_BEGIN_CXX
+
+StringEscape WebDAVItemStore::m_escape('%', "/");
+
+WebDAVItemStore::WebDAVItemStore(const std::string &dir, const std::string &collection)
+{
+    if (dir.empty()) {
+        return;
+    }
+
+    try {
+        mkdir_p(dir + "/items");
+        IniFileConfigNode store(dir, "store.ini", false);
+        boost::shared_ptr<ConfigNode> index(new SafeConfigNode(boost::shared_ptr<ConfigNode>(new IniFileConfigNode(dir, "index.ini", false))));
+        if (store.readProperty("collection") != collection) {
+            // Items might have the same luid and even the same ETag
+            // in the new collection, but they are not the same.
+            SE_LOG_DEBUG(NULL, NULL, "%s: new collection %s, discarding stored items",
+                         dir.c_str(), collection.c_str());
+            rm_r(dir + "/items");
+            mkdir_p(dir + "/items");
+            index->clear();
+            index->flush();
+            store.setProperty("collection", collection);
+            store.flush();
+        }
+
+        ConfigProps props;
+        index->readProperties(props);
+        BOOST_FOREACH(const StringPair &prop, props) {
+            Entry entry;
+            if (fromString(prop.second, entry)) {
+                m_entries[prop.first] = entry;
+            } else {
+                SE_LOG_DEBUG(NULL, NULL, "%s: ignoring corrupt entry %s = %s",
+                             dir.c_str(), prop.first.c_str(), prop.second.c_str());
+                index->removeProperty(prop.first);
+            }
+        }
+        m_index = index;
+        m_dir = dir;
+
+        // Files without entry were left behind by an interrupted
+        // write() or belong to entries dropped above.
+        std::set<std::string> filenames;
+        BOOST_FOREACH(const Entries_t::value_type &entry, m_entries) {
+            filenames.insert(StringEscape::escape(entry.first, '%', StringEscape::STRICT));
+        }
+        ReadDir items(dir + "/items");
+        BOOST_FOREACH(const std::string &filename, items) {
+            if (filenames.find(filename) == filenames.end()) {
+                SE_LOG_DEBUG(NULL, NULL, "%s: removing obsolete file %s",
+                             dir.c_str(), filename.c_str());
+                unlink((dir + "/items/" + filename).c_str());
+            }
+        }
+        SE_LOG_DEBUG(NULL, NULL, "%s: %ld stored items",
+                     dir.c_str(), (long)m_entries.size());
+    } catch (...) {
+        // not fatal, continue without stored items
+        Exception::handle();
+        m_entries.clear();
+        m_index.reset();
+        m_dir.clear();
+    }
+}
+
+WebDAVItemStore::~WebDAVItemStore()
+{
+    try {
+        flush();
+    } catch (...) {
+        Exception::handle();
+    }
+}
+
+void WebDAVItemStore::setRevisions(const StringMap &revisions)
+{
+    if (m_dir.empty()) {
+        return;
+    }
+    m_revisions = revisions;
+
+    Entries_t::iterator it = m_entries.begin();
+    while (it != m_entries.end()) {
+        Entries_t::iterator next = it;
+        ++next;
+        StringMap::const_iterator rev = revisions.find(it->first);
+        if (rev == revisions.end() ||
+            rev->second != it->second.m_revision) {
+            remove(it->first);
+        }
+        it = next;
+    }
+}
+
+bool WebDAVItemStore::read(const std::string &luid, std::string &item)
+{
+    StringMap::const_iterator it = m_revisions.find(luid);
+    return it != m_revisions.end() &&
+        read(luid, it->second, item);
+}
+
+bool WebDAVItemStore::read(const std::string &luid, const std::string &revision,
+                           std::string &item, Entry *entry)
+{
+    Entries_t::const_iterator it = m_entries.find(luid);
+    if (it == m_entries.end() ||
+        revision.empty() ||
+        it->second.m_revision != revision) {
+        return false;
+    }
+    if (!ReadFile(getFilename(luid), item)) {
+        SE_LOG_DEBUG(NULL, NULL, "%s: stored item %s not found", m_dir.c_str(), luid.c_str());
+        remove(luid);
+        return false;
+    }
+    if (entry) {
+        *entry = it->second;
+    }
+    SE_LOG_DEBUG(NULL, NULL, "%s: using stored item %s, revision %s",
+                 m_dir.c_str(), luid.c_str(), revision.c_str());
+    return true;
+}
+
+void WebDAVItemStore::write(const std::string &luid, const std::string &item, const Entry &entry)
+{
+    if (m_dir.empty() ||
+        entry.m_revision.empty()) {
+        return;
+    }
+
+    // Write to a temporary file first, so that a crash never leaves
+    // behind a truncated item under the real name.
+    std::string filename = getFilename(luid);
+    std::string tmpfilename = filename + ".tmp";
+    int fd = ::open(tmpfilename.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    if (fd < 0) {
+        SE_LOG_DEBUG(NULL, NULL, "%s: %s", tmpfilename.c_str(), strerror(errno));
+        return;
+    }
+    const char *data = item.c_str();
+    size_t remaining = item.size();
+    while (remaining > 0) {
+        ssize_t written = ::write(fd, data, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        data += written;
+        remaining -= written;
+    }
+    int error = remaining ? errno : 0;
+    if (::close(fd) && !error) {
+        error = errno;
+    }
+    if (error ||
+        rename(tmpfilename.c_str(), filename.c_str())) {
+        SE_LOG_DEBUG(NULL, NULL, "%s: writing failed: %s", filename.c_str(),
+                     strerror(error ? error : errno));
+        unlink(tmpfilename.c_str());
+        remove(luid);
+        return;
+    }
+
+    m_entries[luid] = entry;
+    m_revisions[luid] = entry.m_revision;
+    m_index->setProperty(luid, toString(entry));
+}
+
+void WebDAVItemStore::remove(const std::string &luid)
+{
+    m_revisions.erase(luid);
+    Entries_t::iterator it = m_entries.find(luid);
+    if (it != m_entries.end()) {
+        m_entries.erase(it);
+        m_index->removeProperty(luid);
+        unlink(getFilename(luid).c_str());
+    }
+}
+
+void WebDAVItemStore::flush()
+{
+    if (m_index) {
+        m_index->flush();
+    }
+}
+
+std::string WebDAVItemStore::getFilename(const std::string &luid) const
+{
+    return m_dir + "/items/" + StringEscape::escape(luid, '%', StringEscape::STRICT);
+}
+
+std::string WebDAVItemStore::toString(const Entry &entry) const
+{
+    // same format as in MapSyncSource, plus the sequence number
+    std::stringstream buffer;
+    buffer << '/' << m_escape.escape(entry.m_revision) << '/';
+    buffer << entry.m_sequence << '/';
+    buffer << m_escape.escape(entry.m_uid) << '/';
+    BOOST_FOREACH(const std::string &subid, entry.m_subids) {
+        buffer << m_escape.escape(subid) << '/';
+    }
+    return buffer.str();
+}
+
+bool WebDAVItemStore::fromString(const std::string &value, Entry &entry) const
+{
+    if (value.empty() || value[0] != '/') {
+        return false;
+    }
+    std::vector<std::string> fields;
+    size_t pos = 0, nextpos;
+    while ((nextpos = value.find('/', pos + 1)) != value.npos) {
+        fields.push_back(m_escape.unescape(value.substr(pos + 1, nextpos - pos - 1)));
+        pos = nextpos;
+    }
+    if (fields.size() < 3 ||
+        fields[0].empty()) {
+        return false;
+    }
+    entry.m_revision = fields[0];
+    entry.m_sequence = atol(fields[1].c_str());
+    entry.m_uid = fields[2];
+    entry.m_subids.clear();
+    entry.m_subids.insert(fields.begin() + 3, fields.end());
+    return true;
+}
+
+SE_END_CXX
+
+#endif // ENABLE_DAV
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2012 Intel Corporation
+ */
+
+#ifndef INCL_WEBDAVITEMSTORE
+#define INCL_WEBDAVITEMSTORE
+
+#include <config.h>
+
+#ifdef ENABLE_DAV
+
+#include <syncevo/util.h>
+#include <syncevo/ConfigNode.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <set>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <syncevo/declarations.h>
+SE_BEGIN_CXX
+
+/**
+ * Keeps the data of WebDAV resources in the file system, together
+ * with the revision (= ETag) it belongs to and some meta data
+ * extracted from it. Survives the process, so the next sync, backup
+ * or restore only needs to download items whose revision changed.
+ *
+ * The data is stored exactly as sent by the server. Items are never
+ * returned for a revision other than the one they were stored for.
+ *
+ * Directory layout:
+ * - store.ini = collection URL
+ * - index.ini = luid -> meta data
+ * - items/<escaped luid> = item data
+ *
+ * Item files are removed together with their entry in index.ini, when
+ * the item is gone from the server or has a different revision there.
+ * Files without entry are removed when opening the store.
+ */
+class WebDAVItemStore : private boost::noncopyable
+{
+ public:
+    /** meta data about a stored item */
+    struct Entry {
+        Entry() : m_sequence(0) {}
+
+        /** revision string as used by WebDAVSource */
+        std::string m_revision;
+        /** UID, empty if unknown */
+        std::string m_uid;
+        /** highest SEQUENCE, CalDAV only */
+        long m_sequence;
+        /** simplified RECURRENCE-IDs as in CalDAVSource::Event, CalDAV only */
+        std::set<std::string> m_subids;
+    };
+
+    /**
+     * @param dir          directory for the store, created if necessary;
+     *                     empty disables storing items
+     * @param collection   URL of the collection; the content of the
+     *                     store is discarded if it was created for a
+     *                     different collection
+     */
+    WebDAVItemStore(const std::string &dir, const std::string &collection);
+    ~WebDAVItemStore();
+
+    bool isEnabled() const { return !m_dir.empty(); }
+
+    /** true if nothing is stored */
+    bool empty() const { return m_entries.empty(); }
+
+    /**
+     * Remember which resources exist on the server in which
+     * revision. Stored items which are not mentioned or have a
+     * different revision are removed.
+     */
+    void setRevisions(const StringMap &revisions);
+
+    /**
+     * Get data of an item, if stored for the current revision as set
+     * by setRevisions().
+     *
+     * @return true if found
+     */
+    bool read(const std::string &luid, std::string &item);
+
+    /**
+     * Get data and meta data of an item, if stored for the given
+     * revision.
+     *
+     * @return true if found
+     */
+    bool read(const std::string &luid, const std::string &revision,
+              std::string &item, Entry *entry = NULL);
+
+    /**
+     * Store item data as received from the server for the revision
+     * in the entry. Failures are logged and otherwise ignored.
+     */
+    void write(const std::string &luid, const std::string &item, const Entry &entry);
+
+    /** forget about an item, for example because it was modified locally */
+    void remove(const std::string &luid);
+
+    /** write index to disk */
+    void flush();
+
+ private:
+    std::string m_dir;
+    boost::shared_ptr<ConfigNode> m_index;
+    typedef std::map<std::string, Entry> Entries_t;
+    Entries_t m_entries;
+    StringMap m_revisions;
+
+    static StringEscape m_escape;
+
+    std::string getFilename(const std::string &luid) const;
+    std::string toString(const Entry &entry) const;
+    bool fromString(const std::string &value, Entry &entry) const;
+};
+
+SE_END_CXX
+
+#endif // ENABLE_DAV
+#endif // INCL_WEBDAVITEMSTORE
@@ -13,6 +13,8 @@
 
 #include <syncevo/LogRedirect.h>
 
+#include <algorithm>
+
 #include <stdio.h>
 #include <errno.h>
 
@@ -24,6 +26,33 @@ BoolConfigProperty &WebDAVCredentialsOkay()
     return okay;
 }
 
+UIntConfigProperty &CalDAVCacheSize()
+{
+    static UIntConfigProperty size("calDAVCacheSize",
+                                   "upper limit in KB for parsed events kept in memory,\n"
+                                   "0 for unlimited",
+                                   "0");
+    return size;
+}
+
+BoolConfigProperty &WebDAVUseItemStore()
+{
+    static BoolConfigProperty store("webDAVItemStore",
+                                    "keep a copy of downloaded items in the cache directory\n"
+                                    "of the source and only download modified items again",
+                                    "FALSE");
+    return store;
+}
+
+UIntConfigProperty &WebDAVMaxConnections()
+{
+    static UIntConfigProperty connections("webDAVMaxConnections",
+                                          "number of HTTP connections used at the same time\n"
+                                          "for downloading items, 1 sends one request at a time",
+                                          "1");
+    return connections;
+}
+
 #ifdef ENABLE_DAV
 
 /**
@@ -41,6 +70,8 @@ class ContextSettings : public Neon::Settings {
     bool m_googleAlarmHack;
     // credentials were valid in the past: stored persistently in tracking node
     bool m_credentialsOkay;
+    // webDAVMaxConnections of the source, 1 without source config
+    int m_maxConnections;
 
 public:
     ContextSettings(const boost::shared_ptr<SyncConfig> &context,
@@ -51,12 +82,14 @@ public:
         m_googleUpdateHack(false),
         m_googleChildHack(false),
         m_googleAlarmHack(false),
-        m_credentialsOkay(false)
+        m_credentialsOkay(false),
+        m_maxConnections(1)
     {
         std::string url;
 
         // check source config first
         if (m_sourceConfig) {
+            m_maxConnections = WebDAVMaxConnections().getPropertyValue(*m_sourceConfig->getNode(WebDAVMaxConnections()));
             url = m_sourceConfig->getDatabaseID();
             std::string username = m_sourceConfig->getUser();
             boost::replace_all(url, "%u", Neon::URI::escape(username));
@@ -115,6 +148,7 @@ public:
     virtual bool googleAlarmHack() const { return m_googleChildHack; }
 
     virtual int timeoutSeconds() const { return m_context->getRetryDuration(); }
+    virtual int maxConnections() const { return m_maxConnections; }
     virtual int retrySeconds() const {
         int seconds = m_context->getRetryInterval();
         if (seconds >= 0) {
@@ -223,12 +257,17 @@ void ContextSettings::initializeFlags(const std::string &url)
 WebDAVSource::WebDAVSource(const SyncSourceParams &params,
                            const boost::shared_ptr<Neon::Settings> &settings) :
     TrackingSyncSource(params),
-    m_settings(settings)
+    m_settings(settings),
+    m_requestStats(new Neon::Session::RequestStatsMap_t),
+    m_useItemStore(false),
+    m_itemStoreOpened(false),
+    m_detectingChanges(false)
 {
     if (!m_settings) {
         m_contextSettings.reset(new ContextSettings(params.m_context, this));
         m_settings = m_contextSettings;
     }
+    m_useItemStore = WebDAVUseItemStore().getPropertyValue(*getNode(WebDAVUseItemStore()));
 
     /* insert contactServer() into BackupData_t and RestoreData_t (implemented by SyncSourceRevisions) */
     m_operations.m_backupData = boost::bind(&WebDAVSource::backupData,
@@ -477,7 +516,7 @@ void WebDAVSource::contactServer()
         // force authentication
         std::string user, pw;
         m_settings->getCredentials("", user, pw);
-        m_session->forceAuthorization(user, pw);
+        getSession()->forceAuthorization(user, pw);
         return;
     }
 
@@ -498,8 +537,8 @@ void WebDAVSource::contactServer()
     if (LoggerBase::instance().getLevel() >= Logger::DEV) {
         try {
             SE_LOG_DEBUG(NULL, NULL, "read capabilities of %s", m_calendar.toURL().c_str());
-            m_session->startOperation("OPTIONS", Timespec());
-            int caps = m_session->options(m_calendar.m_path);
+            getSession()->startOperation("OPTIONS", Timespec());
+            int caps = getSession()->options(m_calendar.m_path);
             static const Flag descr[] = {
                 { NE_CAP_DAV_CLASS1, "Class 1 WebDAV (RFC 2518)" },
                 { NE_CAP_DAV_CLASS2, "Class 2 WebDAV (RFC 2518)" },
@@ -520,7 +559,7 @@ void WebDAVSource::contactServer()
                 { 0, NULL }
             };
             SE_LOG_DEBUG(NULL, NULL, "%s WebDAV capabilities: %s",
-                         m_session->getURL().c_str(),
+                         getSession()->getURL().c_str(),
                          Flags2String(caps, descr).c_str());
         } catch (...) {
             Exception::handle();
@@ -654,7 +693,7 @@ bool WebDAVSource::findCollections(const boost::function<bool (const std::string
         }
     } tried;
     std::list<std::string> candidates;
-    std::string path = m_session->getURI().m_path;
+    std::string path = getSession()->getURI().m_path;
     Neon::Session::PropfindPropCallback_t callback =
         boost::bind(&WebDAVSource::openPropCallback,
                     this, _1, _2, _3, _4);
@@ -737,7 +776,7 @@ bool WebDAVSource::findCollections(const boost::function<bool (const std::string
                     Neon::Session::PropfindPropCallback_t callback =
                         boost::bind(&WebDAVSource::openPropCallback,
                                     this, _1, _2, _3, _4);
-                    m_session->propfindProp(path, 0, NULL, callback, Timespec());
+                    getSession()->propfindProp(path, 0, NULL, callback, Timespec());
                 } catch (...) {
                     handleException();
                 }
@@ -771,7 +810,7 @@ bool WebDAVSource::findCollections(const boost::function<bool (const std::string
             // http://thread.gmane.org/gmane.comp.web.webdav.neon.general/717/focus=719
             std::string user, pw;
             m_settings->getCredentials("", user, pw);
-            m_session->forceAuthorization(user, pw);
+            getSession()->forceAuthorization(user, pw);
             m_davProps.clear();
             static const ne_propname caldav[] = {
                 // WebDAV ACL
@@ -802,12 +841,12 @@ bool WebDAVSource::findCollections(const boost::function<bool (const std::string
                 { NULL, NULL }
             };
             SE_LOG_DEBUG(NULL, NULL, "read relevant properties of %s", path.c_str());
-            m_session->propfindProp(path, 0, caldav, callback, deadline);
+            getSession()->propfindProp(path, 0, caldav, callback, deadline);
             success = true;
         } catch (const Neon::RedirectException &ex) {
             // follow to new location
             Neon::URI next = Neon::URI::parse(ex.getLocation(), true);
-            Neon::URI old = m_session->getURI();
+            Neon::URI old = getSession()->getURI();
             // keep old host + scheme + port if not set in next location
             if (next.m_scheme.empty()) {
                 next.m_scheme = old.m_scheme;
@@ -902,7 +941,7 @@ bool WebDAVSource::findCollections(const boost::function<bool (const std::string
                 // found something
                 found = true;
                 it = props.find("DAV::displayname");
-                Neon::URI uri = m_session->getURI();
+                Neon::URI uri = getSession()->getURI();
                 uri.m_path = path;
                 std::string name;
                 if (it != props.end()) {
@@ -966,7 +1005,7 @@ bool WebDAVSource::findCollections(const boost::function<bool (const std::string
                         { NULL, NULL }
                     };
                     m_davProps.clear();
-                    m_session->propfindProp(path, 1, props, callback, finalDeadline);
+                    getSession()->propfindProp(path, 1, props, callback, finalDeadline);
                     std::set<std::string> subs;
                     BOOST_FOREACH(Props_t::value_type &entry, m_davProps) {
                         const std::string &sub = entry.first;
@@ -1109,7 +1148,41 @@ bool WebDAVSource::isEmpty()
 
 void WebDAVSource::close()
 {
+    if (m_session &&
+        m_session->getRequestStats() == m_requestStats) {
+        m_session->setRequestStats(boost::shared_ptr<Neon::Session::RequestStatsMap_t>());
+    }
+    Neon::Session::logRequestStats(*m_requestStats);
+    m_requestStats->clear();
     m_session.reset();
+    m_itemStore.reset();
+    m_itemStoreOpened = false;
+}
+
+WebDAVItemStore &WebDAVSource::getItemStore()
+{
+    // Without a collection the store would be discarded, so it
+    // remains disabled until contactServer() is done. Once it was
+    // opened for the collection, it is not opened again, even if
+    // that failed.
+    std::string cacheDir = getCacheDir();
+    bool enable = m_useItemStore && !cacheDir.empty() && !m_calendar.empty();
+    if (!m_itemStore &&
+        !m_useItemStore &&
+        !cacheDir.empty() &&
+        isDir(cacheDir + "/webdav")) {
+        // items stored while the store was turned on would be
+        // kept forever otherwise
+        SE_LOG_DEBUG(this, NULL, "item store turned off, removing %s/webdav", cacheDir.c_str());
+        rm_r(cacheDir + "/webdav");
+    }
+    if (!m_itemStore ||
+        (enable && !m_itemStoreOpened)) {
+        m_itemStore.reset(new WebDAVItemStore(enable ? cacheDir + "/webdav" : "",
+                                              m_calendar.toURL()));
+        m_itemStoreOpened = enable;
+    }
+    return *m_itemStore;
 }
 
 static bool storeCollection(SyncSource::Databases &result,
@@ -1202,6 +1275,39 @@ void WebDAVSource::getSynthesisInfo(SynthesisInfo &info,
     }
 }
 
+void WebDAVSource::beginSync(const std::string &lastToken, const std::string &resumeToken)
+{
+    contactServer();
+    resetSyncToken();
+    m_detectingChanges = true;
+    try {
+        TrackingSyncSource::beginSync(lastToken, resumeToken);
+    } catch (...) {
+        m_detectingChanges = false;
+        throw;
+    }
+    m_detectingChanges = false;
+}
+
+std::string WebDAVSource::endSync(bool success)
+{
+    if (success) {
+        storeServerInfos();
+        storeSyncToken();
+    }
+    return TrackingSyncSource::endSync(success);
+}
+
+void WebDAVSource::storeSyncToken()
+{
+    if (!m_syncToken.empty()) {
+        // Flushed together with the tracking node. Not stored
+        // after a failed sync, in which case the older token
+        // simply reports more changes than necessary.
+        getMetaNode().setProperty("syncToken", m_syncToken);
+    }
+}
+
 void WebDAVSource::storeServerInfos()
 {
     if (getDatabaseID().empty()) {
@@ -1232,7 +1338,7 @@ std::string WebDAVSource::databaseRevision()
         boost::bind(&WebDAVSource::openPropCallback,
                     this, _1, _2, _3, _4);
     m_davProps[m_calendar.m_path]["http://calendarserver.org/ns/:getctag"] = "";
-    m_session->propfindProp(m_calendar.m_path, 0, getctag, callback, deadline);
+    getSession()->propfindProp(m_calendar.m_path, 0, getctag, callback, deadline);
     // Fatal communication problems will be reported via exceptions.
     // Once we get here, invalid or incomplete results can be
     // treated as "don't have revision string".
@@ -1241,6 +1347,224 @@ std::string WebDAVSource::databaseRevision()
 }
 
 
+static const ne_propname synctoken[] = {
+    { "DAV:", "sync-token" },
+    { NULL, NULL }
+};
+
+std::string WebDAVSource::getSyncToken()
+{
+    std::string collection = m_calendar.toURL();
+    if (getMetaNode().readProperty("noSyncToken") == collection) {
+        // checked in an earlier sync, don't ask again
+        return "";
+    }
+
+    Timespec deadline = createDeadline();
+    Neon::Session::PropfindPropCallback_t callback =
+        boost::bind(&WebDAVSource::openPropCallback,
+                    this, _1, _2, _3, _4);
+    m_davProps[m_calendar.m_path]["DAV::sync-token"] = "";
+    getSession()->propfindProp(m_calendar.m_path, 0, synctoken, callback, deadline);
+    std::string token = m_davProps[m_calendar.m_path]["DAV::sync-token"];
+    if (token.empty()) {
+        // Remembered per collection, so a different collection
+        // (perhaps on a different server) gets probed again.
+        SE_LOG_DEBUG(this, NULL, "%s: no DAV:sync-token, using full listings",
+                     collection.c_str());
+        getMetaNode().setProperty("noSyncToken", collection);
+    } else {
+        getMetaNode().removeProperty("noSyncToken");
+    }
+    return token;
+}
+
+void WebDAVSource::updateAllItems(RevisionMap_t &revisions)
+{
+    if (updateWithSyncToken(revisions)) {
+        getItemStore().setRevisions(revisions);
+        return;
+    }
+    TrackingSyncSource::updateAllItems(revisions);
+}
+
+bool WebDAVSource::updateWithSyncToken(RevisionMap_t &revisions)
+{
+    std::string token = getMetaNode().readProperty("syncToken");
+    if (!token.empty()) {
+        try {
+            RevisionMap_t updated = revisions;
+            std::string newToken;
+            if (syncCollection(token, updated, newToken)) {
+                revisions.swap(updated);
+                m_syncToken = newToken;
+                return true;
+            }
+            SE_LOG_DEBUG(this, NULL, "sync-collection REPORT returned no token, doing full listing");
+        } catch (const TransportStatusException &ex) {
+            // token not valid anymore or REPORT not supported
+            SE_LOG_DEBUG(this, NULL, "sync-collection REPORT failed, doing full listing: %s",
+                         ex.what());
+        }
+        // Don't try the old token again. The full listing below
+        // stores a new one if the server provides it, otherwise the
+        // next sync also does a full listing.
+        getMetaNode().removeProperty("syncToken");
+    }
+    return false;
+}
+
+bool WebDAVSource::syncCollection(const std::string &token,
+                                  RevisionMap_t &revisions,
+                                  std::string &newToken)
+{
+    // new items in a collection with mixed content, must be checked
+    // before adding them to revisions
+    RevisionMap_t unknown;
+    bool truncated;
+
+    newToken = token;
+    do {
+        std::string escapedToken = newToken;
+        boost::replace_all(escapedToken, "&", "&amp;");
+        boost::replace_all(escapedToken, "<", "&lt;");
+        const std::string query =
+            "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+            "<D:sync-collection xmlns:D=\"DAV:\">\n"
+            "<D:sync-token>" + escapedToken + "</D:sync-token>\n"
+            "<D:sync-level>1</D:sync-level>\n"
+            "<D:prop>\n"
+            "<D:getetag/>\n"
+            "</D:prop>\n"
+            "</D:sync-collection>\n";
+        Timespec deadline = createDeadline();
+        getSession()->startOperation("REPORT 'sync-collection'", deadline);
+        while (true) {
+            std::string href, etag, status;
+            truncated = false;
+            newToken = "";
+            Neon::XMLParser parser;
+            parser.pushHandler(boost::bind(Neon::XMLParser::accept, "DAV:", "multistatus", _2, _3));
+            parser.pushHandler(boost::bind(Neon::XMLParser::accept, "DAV:", "response", _2, _3),
+                               Neon::XMLParser::DataCB_t(),
+                               boost::bind(&WebDAVSource::syncCollectionResponse, this,
+                                           boost::ref(revisions), boost::ref(unknown),
+                                           boost::ref(truncated),
+                                           boost::ref(href), boost::ref(etag), boost::ref(status)));
+            parser.pushHandler(boost::bind(Neon::XMLParser::accept, "DAV:", "href", _2, _3),
+                               boost::bind(Neon::XMLParser::append, boost::ref(href), _2, _3));
+            // only the status of the response itself matters, not the one of its properties
+            parser.pushHandler(boost::bind(Neon::XMLParser::accept, "DAV:", "propstat", _2, _3),
+                               Neon::XMLParser::DataCB_t(),
+                               boost::bind(Neon::XMLParser::reset, boost::ref(status)));
+            parser.pushHandler(boost::bind(Neon::XMLParser::accept, "DAV:", "status", _2, _3),
+                               boost::bind(Neon::XMLParser::append, boost::ref(status), _2, _3));
+            parser.pushHandler(boost::bind(Neon::XMLParser::accept, "DAV:", "prop", _2, _3));
+            parser.pushHandler(boost::bind(Neon::XMLParser::accept, "DAV:", "getetag", _2, _3),
+                               boost::bind(Neon::XMLParser::append, boost::ref(etag), _2, _3));
+            parser.pushHandler(boost::bind(Neon::XMLParser::accept, "DAV:", "sync-token", _2, _3),
+                               boost::bind(Neon::XMLParser::append, boost::ref(newToken), _2, _3));
+            Neon::Request report(*getSession(), "REPORT", getCalendar().m_path, query, parser);
+            report.addHeader("Depth", "0");
+            report.addHeader("Content-Type", "application/xml; charset=\"utf-8\"");
+            if (report.run()) {
+                break;
+            }
+        }
+        boost::trim(newToken);
+        if (newToken.empty()) {
+            return false;
+        }
+        if (truncated) {
+            SE_LOG_DEBUG(this, NULL, "sync-collection REPORT truncated, continuing");
+        }
+    } while (truncated);
+
+    if (!unknown.empty()) {
+        // Same check as in listAllItems(), limited to the new items.
+        std::stringstream buffer;
+        buffer << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+            "<C:calendar-multiget xmlns:D=\"DAV:\"\n"
+            "   xmlns:C=\"urn:ietf:params:xml:ns:caldav\">\n"
+            "<D:prop>\n"
+            "<D:getetag/>\n"
+            "<C:calendar-data>\n"
+            "<C:comp name=\"VCALENDAR\">\n"
+            "<C:comp name=\"" << getContent() << "\">\n"
+            "<C:prop name=\"UID\"/>\n"
+            "</C:comp>\n"
+            "</C:comp>\n"
+            "</C:calendar-data>\n"
+            "</D:prop>\n";
+        BOOST_FOREACH(const StringPair &entry, unknown) {
+            buffer << "<D:href>" << luid2path(entry.first) << "</D:href>\n";
+        }
+        buffer << "</C:calendar-multiget>";
+        std::string query = buffer.str();
+        const std::string needle = "\nBEGIN:" + getContent();
+        Timespec deadline = createDeadline();
+        getSession()->startOperation("REPORT 'check new items'", deadline);
+        while (true) {
+            bool found = false;
+            string data;
+            Neon::XMLParser parser;
+            parser.initReportParser(boost::bind(&WebDAVSource::checkItem, this,
+                                                boost::ref(revisions),
+                                                _1, _2, boost::ref(found), boost::ref(data)));
+            parser.pushHandler(boost::bind(Neon::XMLParser::accept, "urn:ietf:params:xml:ns:caldav", "calendar-data", _2, _3),
+                               boost::bind(Neon::XMLParser::search, boost::cref(needle),
+                                           boost::ref(found), boost::ref(data), _2, _3));
+            Neon::Request report(*getSession(), "REPORT", getCalendar().m_path, query, parser);
+            report.addHeader("Depth", "1");
+            report.addHeader("Content-Type", "application/xml; charset=\"utf-8\"");
+            if (report.run()) {
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+int WebDAVSource::syncCollectionResponse(RevisionMap_t &revisions,
+                                         RevisionMap_t &unknown,
+                                         bool &truncated,
+                                         std::string &href,
+                                         std::string &etag,
+                                         std::string &status)
+{
+    std::string luid = path2luid(Neon::URI::parse(href).m_path);
+    if (luid.empty() || boost::ends_with(luid, "/")) {
+        // The collection itself is only mentioned when the server
+        // truncated the result; sub-collections are ignored.
+        if (luid.empty() &&
+            status.find(" 507") != status.npos) {
+            truncated = true;
+        }
+    } else if (!etag.empty()) {
+        // added or updated
+        std::string rev = ETag2Rev(etag);
+        RevisionMap_t::iterator it = revisions.find(luid);
+        if (it != revisions.end()) {
+            it->second = rev;
+        } else if (getContentMixed()) {
+            unknown[luid] = rev;
+        } else {
+            revisions[luid] = rev;
+        }
+    } else if (status.find(" 404") != status.npos) {
+        // removed
+        revisions.erase(luid);
+        unknown.erase(luid);
+    }
+
+    // reset for next response
+    href.clear();
+    etag.clear();
+    status.clear();
+    return 0;
+}
+
 static const ne_propname getetag[] = {
     { "DAV:", "getetag" },
     { "DAV:", "resourcetype" },
@@ -1249,16 +1573,22 @@ static const ne_propname getetag[] = {
 
 void WebDAVSource::listAllItems(RevisionMap_t &revisions)
 {
+    if (m_detectingChanges) {
+        // Remember the state of the collection before listing it, so
+        // that changes made while listing are reported next time.
+        prepareFullListing();
+    }
+
     if (!getContentMixed()) {
         // Can use simple PROPFIND because we do not have to
         // double-check that each item really contains the right data.
         bool failed = false;
         Timespec deadline = createDeadline();
-        m_session->propfindURI(m_calendar.m_path, 1, getetag,
-                               boost::bind(&WebDAVSource::listAllItemsCallback,
-                                           this, _1, _2, boost::ref(revisions),
-                                           boost::ref(failed)),
-                               deadline);
+        getSession()->propfindURI(m_calendar.m_path, 1, getetag,
+                                  boost::bind(&WebDAVSource::listAllItemsCallback,
+                                              this, _1, _2, boost::ref(revisions),
+                                              boost::ref(failed)),
+                                  deadline);
         if (failed) {
             SE_THROW("incomplete listing of all items");
         }
@@ -1291,16 +1621,22 @@ void WebDAVSource::listAllItems(RevisionMap_t &revisions)
             "</C:comp-filter>\n"
             "</C:filter>\n"
             "</C:calendar-query>\n";
+        // No need to parse or store the item data, user content
+        // cannot start at start of line in iCalendar 2.0. Only
+        // check for the component while the data comes in.
+        const std::string needle = "\nBEGIN:" + getContent();
         Timespec deadline = createDeadline();
         getSession()->startOperation("REPORT 'meta data'", deadline);
         while (true) {
-            string data;
+            bool found = false;
+            string buffer;
             Neon::XMLParser parser;
             parser.initReportParser(boost::bind(&WebDAVSource::checkItem, this,
                                                 boost::ref(revisions),
-                                                _1, _2, boost::ref(data)));
+                                                _1, _2, boost::ref(found), boost::ref(buffer)));
             parser.pushHandler(boost::bind(Neon::XMLParser::accept, "urn:ietf:params:xml:ns:caldav", "calendar-data", _2, _3),
-                               boost::bind(Neon::XMLParser::append, boost::ref(data), _2, _3));
+                               boost::bind(Neon::XMLParser::search, boost::cref(needle),
+                                           boost::ref(found), boost::ref(buffer), _2, _3));
             Neon::Request report(*getSession(), "REPORT", getCalendar().m_path, query, parser);
             report.addHeader("Depth", "1");
             report.addHeader("Content-Type", "application/xml; charset=\"utf-8\"");
@@ -1309,6 +1645,8 @@ void WebDAVSource::listAllItems(RevisionMap_t &revisions)
             }
         }
     }
+
+    getItemStore().setRevisions(revisions);
 }
 
 void WebDAVSource::listAllItemsCallback(const Neon::URI &uri,
@@ -1353,28 +1691,25 @@ void WebDAVSource::listAllItemsCallback(const Neon::URI &uri,
 int WebDAVSource::checkItem(RevisionMap_t &revisions,
                             const std::string &href,
                             const std::string &etag,
-                            std::string &data)
+                            bool &found,
+                            std::string &buffer)
 {
-    // Ignore responses with no data: this is not perfect (should better
+    // Ignore responses without the right component, including
+    // those with no data at all. This is not perfect (should better
     // try to figure out why there is no data), but better than
     // failing.
     //
     // One situation is the response for the collection itself,
     // which comes with a 404 status and no data with Google Calendar.
-    if (data.empty()) {
-        return 0;
-    }
-
-    // No need to parse, user content cannot start at start of line in
-    // iCalendar 2.0.
-    if (data.find("\nBEGIN:" + getContent()) != data.npos) {
+    if (found) {
         std::string davLUID = path2luid(Neon::URI::parse(href).m_path);
         std::string rev = ETag2Rev(etag);
         revisions[davLUID] = rev;
     }
 
-    // reset data for next item
-    data.clear();
+    // reset for next item
+    found = false;
+    buffer.clear();
     return 0;
 }
 
@@ -1403,16 +1738,24 @@ std::string WebDAVSource::luid2path(const std::string &luid)
 
 void WebDAVSource::readItem(const string &uid, std::string &item, bool raw)
 {
+    if (getItemStore().read(uid, item)) {
+        return;
+    }
+
     Timespec deadline = createDeadline();
-    m_session->startOperation("GET", deadline);
+    getSession()->startOperation("GET", deadline);
     while (true) {
         item.clear();
-        Neon::Request req(*m_session, "GET", luid2path(uid),
+        Neon::Request req(*getSession(), "GET", luid2path(uid),
                           "", item);
         // useful with CardDAV: server might support more than vCard 3.0, but we don't
         req.addHeader("Accept", contentType());
         try {
             if (req.run()) {
+                WebDAVItemStore::Entry entry;
+                entry.m_revision = getETag(req);
+                entry.m_uid = extractUID(item);
+                getItemStore().write(uid, item, entry);
                 break;
             }
         } catch (const TransportStatusException &ex) {
@@ -1428,6 +1771,251 @@ void WebDAVSource::readItem(const string &uid, std::string &item, bool raw)
     }
 }
 
+void WebDAVSource::readItemsRaw(const std::vector<std::string> &luids,
+                                std::vector<std::string> &items)
+{
+    if (luids.size() <= 1) {
+        // not worth the REPORT
+        SyncSourceRaw::readItemsRaw(luids, items);
+        return;
+    }
+
+    items.clear();
+    items.resize(luids.size());
+    std::vector<bool> found(luids.size(), false);
+    std::map<std::string, size_t> luid2index;
+    for (size_t i = 0; i < luids.size(); i++) {
+        if (getItemStore().read(luids[i], items[i])) {
+            found[i] = true;
+        } else {
+            luid2index[luids[i]] = i;
+        }
+    }
+    if (luid2index.empty()) {
+        return;
+    }
+
+    std::vector<std::string> mustRead;
+    for (std::map<std::string, size_t>::const_iterator it = luid2index.begin();
+         it != luid2index.end();
+         ++it) {
+        mustRead.push_back(it->first);
+    }
+    multiget("REPORT 'multiget items'", mustRead,
+             boost::bind(&WebDAVSource::storeMultigetResult, this,
+                         boost::cref(luid2index),
+                         boost::ref(items),
+                         boost::ref(found),
+                         _1, _2, _3));
+
+    // Same workaround as in CalDAVSource::updateAllSubItems(): some
+    // servers return neither data nor errors for some hrefs. Fall
+    // back to GET, which also reports missing items properly.
+    mustRead.clear();
+    for (size_t i = 0; i < luids.size(); i++) {
+        if (!found[i]) {
+            mustRead.push_back(luids[i]);
+        }
+    }
+    getItems("GET items not returned by 'multiget items'", mustRead,
+             boost::bind(&WebDAVSource::storeMultigetResult, this,
+                         boost::cref(luid2index),
+                         boost::ref(items),
+                         boost::ref(found),
+                         _1, _2, _3));
+}
+
+void WebDAVSource::storeMultigetResult(const std::map<std::string, size_t> &luid2index,
+                                       std::vector<std::string> &items,
+                                       std::vector<bool> &found,
+                                       const std::string &href,
+                                       const std::string &etag,
+                                       std::string &data)
+{
+    // ignore responses with no data, readItemsRaw() will
+    // retry those with GET
+    if (!data.empty()) {
+        std::map<std::string, size_t>::const_iterator it =
+            luid2index.find(path2luid(Neon::URI::parse(href).m_path));
+        if (it != luid2index.end()) {
+            WebDAVItemStore::Entry entry;
+            entry.m_revision = ETag2Rev(etag);
+            entry.m_uid = extractUID(data);
+            getItemStore().write(it->first, data, entry);
+            items[it->second].swap(data);
+            found[it->second] = true;
+        }
+    }
+}
+
+/**
+ * One REPORT sent by WebDAVSource::multiget(). Responses are
+ * buffered while the request runs, possibly in a different thread,
+ * and handed over afterwards.
+ */
+class MultigetRequest
+{
+public:
+    MultigetRequest(const std::string &path,
+                    const std::string &query,
+                    const std::string &ns,
+                    const std::string &dataProp) :
+        m_path(path),
+        m_query(query),
+        m_ns(ns),
+        m_dataProp(dataProp)
+    {}
+
+    boost::shared_ptr<Neon::Request> create(Neon::Session &session)
+    {
+        m_responses.clear();
+        m_data.clear();
+        m_parser.reset(new Neon::XMLParser);
+        m_parser->initReportParser(boost::bind(&MultigetRequest::storeResponse, this, _1, _2));
+        m_parser->pushHandler(boost::bind(Neon::XMLParser::accept, m_ns, m_dataProp, _2, _3),
+                              boost::bind(Neon::XMLParser::append, boost::ref(m_data), _2, _3));
+        boost::shared_ptr<Neon::Request> req(new Neon::Request(session, "REPORT", m_path,
+                                                               m_query, *m_parser));
+        req->addHeader("Depth", "1");
+        req->addHeader("Content-Type", "application/xml; charset=\"utf-8\"");
+        return req;
+    }
+
+    void done(const boost::function<void (const std::string &, const std::string &, std::string &)> &callback)
+    {
+        BOOST_FOREACH(Response &response, m_responses) {
+            callback(response.m_href, response.m_etag, response.m_data);
+        }
+        m_responses.clear();
+    }
+
+private:
+    std::string m_path, m_query, m_ns, m_dataProp;
+    boost::shared_ptr<Neon::XMLParser> m_parser;
+    std::string m_data;
+    struct Response {
+        std::string m_href, m_etag, m_data;
+    };
+    std::list<Response> m_responses;
+
+    void storeResponse(const std::string &href, const std::string &etag)
+    {
+        m_responses.push_back(Response());
+        Response &response = m_responses.back();
+        response.m_href = href;
+        response.m_etag = etag;
+        response.m_data.swap(m_data);
+    }
+};
+
+/** one GET sent by WebDAVSource::getItems() */
+class GetRequest
+{
+public:
+    GetRequest(const std::string &path, const std::string &accept) :
+        m_path(path),
+        m_accept(accept)
+    {}
+
+    boost::shared_ptr<Neon::Request> create(Neon::Session &session)
+    {
+        m_data.clear();
+        boost::shared_ptr<Neon::Request> req(new Neon::Request(session, "GET", m_path,
+                                                               "", m_data));
+        req->addHeader("Accept", m_accept);
+        return req;
+    }
+
+    void done(const boost::function<void (const std::string &, const std::string &, std::string &)> &callback,
+              Neon::Request &req)
+    {
+        callback(m_path, req.getResponseHeader("ETag"), m_data);
+        m_data.clear();
+    }
+
+private:
+    std::string m_path, m_accept;
+    std::string m_data;
+};
+
+void WebDAVSource::multiget(const std::string &operation,
+                            const std::vector<std::string> &luids,
+                            const ItemCallback_t &callback)
+{
+    if (luids.empty()) {
+        return;
+    }
+
+    bool vcard = getContent() == "VCARD";
+    std::string ns = vcard ?
+        "urn:ietf:params:xml:ns:carddav" :
+        "urn:ietf:params:xml:ns:caldav";
+    std::string report = vcard ? "addressbook-multiget" : "calendar-multiget";
+    std::string dataProp = vcard ? "address-data" : "calendar-data";
+
+    // Split so that all connections have something to do, but
+    // without making the REPORTs too small. Only the responses of
+    // the REPORTs currently in flight are kept in memory.
+    size_t connections = std::max(1, m_settings->maxConnections());
+    size_t chunkSize = luids.size();
+    if (connections > 1) {
+        chunkSize = std::max((size_t)10,
+                             std::min((size_t)100,
+                                      (luids.size() + connections - 1) / connections));
+    }
+
+    Neon::RequestBatch batch(getSession());
+    std::list< boost::shared_ptr<MultigetRequest> > requests;
+    for (size_t start = 0; start < luids.size(); start += chunkSize) {
+        std::stringstream buffer;
+        buffer << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+            "<C:" << report << " xmlns:D=\"DAV:\"\n"
+            "   xmlns:C=\"" << ns << "\">\n"
+            "<D:prop>\n"
+            "   <D:getetag/>\n"
+            "   <C:" << dataProp << "/>\n"
+            "</D:prop>\n";
+        for (size_t i = start; i < luids.size() && i < start + chunkSize; i++) {
+            buffer << "<D:href>" << luid2path(luids[i]) << "</D:href>\n";
+        }
+        buffer << "</C:" << report << ">";
+        boost::shared_ptr<MultigetRequest> request(new MultigetRequest(getCalendar().m_path,
+                                                                       buffer.str(),
+                                                                       ns, dataProp));
+        requests.push_back(request);
+        batch.add(operation,
+                  boost::bind(&MultigetRequest::create, request.get(), _1),
+                  boost::bind(&MultigetRequest::done, request.get(), boost::cref(callback)));
+    }
+    batch.run(createDeadline());
+}
+
+void WebDAVSource::getItems(const std::string &operation,
+                            const std::vector<std::string> &luids,
+                            const ItemCallback_t &callback)
+{
+    Neon::RequestBatch batch(getSession());
+    std::list< boost::shared_ptr<GetRequest> > requests;
+    BOOST_FOREACH(const std::string &luid, luids) {
+        boost::shared_ptr<GetRequest> request(new GetRequest(luid2path(luid), contentType()));
+        requests.push_back(request);
+        batch.add(operation,
+                  boost::bind(&GetRequest::create, request.get(), _1),
+                  boost::bind(&GetRequest::done, request.get(), boost::cref(callback), _1));
+    }
+    try {
+        batch.run(createDeadline());
+    } catch (const TransportStatusException &ex) {
+        if (ex.syncMLStatus() == 410) {
+            // same as in readItem()
+            SE_THROW_EXCEPTION_STATUS(TransportStatusException,
+                                      "object not found (was 410 'Gone')",
+                                      SyncMLStatus(404));
+        }
+        throw;
+    }
+}
+
 TrackingSyncSource::InsertItemResult WebDAVSource::insertItem(const string &uid, const std::string &item, bool raw)
 {
     std::string new_uid;
@@ -1435,7 +2023,7 @@ TrackingSyncSource::InsertItemResult WebDAVSource::insertItem(const string &uid,
     InsertItemResultState state = ITEM_OKAY;
 
     Timespec deadline = createDeadline(); // no resending if left empty
-    m_session->startOperation("PUT", deadline);
+    getSession()->startOperation("PUT", deadline);
     std::string result;
     int counter = 0;
  retry:
@@ -1446,7 +2034,7 @@ TrackingSyncSource::InsertItemResult WebDAVSource::insertItem(const string &uid,
         // catch unexpected conflicts via If-None-Match: *.
         std::string buffer;
         const std::string *data = createResourceName(item, buffer, new_uid);
-        Neon::Request req(*m_session, "PUT", luid2path(new_uid),
+        Neon::Request req(*getSession(), "PUT", luid2path(new_uid),
                           *data, result);
         // Clearing the idempotent flag would allow us to clearly
         // distinguish between a connection error (no changes made
@@ -1511,11 +2099,11 @@ TrackingSyncSource::InsertItemResult WebDAVSource::insertItem(const string &uid,
             // checking whether the item really exists.
             RevisionMap_t revisions;
             bool failed = false;
-            m_session->propfindURI(luid2path(new_uid), 0, getetag,
-                                   boost::bind(&WebDAVSource::listAllItemsCallback,
-                                               this, _1, _2, boost::ref(revisions),
-                                               boost::ref(failed)),
-                                   deadline);
+            getSession()->propfindURI(luid2path(new_uid), 0, getetag,
+                                      boost::bind(&WebDAVSource::listAllItemsCallback,
+                                                  this, _1, _2, boost::ref(revisions),
+                                                  boost::ref(failed)),
+                                      deadline);
             // Turns out we get a result for our original path even in
             // the case of a merge, although the original path is not
             // listed when looking at the collection.  Let's use that
@@ -1533,7 +2121,7 @@ TrackingSyncSource::InsertItemResult WebDAVSource::insertItem(const string &uid,
         new_uid = uid;
         std::string buffer;
         const std::string *data = setResourceName(item, buffer, new_uid);
-        Neon::Request req(*m_session, "PUT", luid2path(new_uid),
+        Neon::Request req(*getSession(), "PUT", luid2path(new_uid),
                           *data, result);
         // See above for discussion of idempotent and PUT.
         // req.setFlag(NE_REQFLAG_IDEMPOTENT, 0);
@@ -1583,17 +2171,20 @@ TrackingSyncSource::InsertItemResult WebDAVSource::insertItem(const string &uid,
         // so any kind of caching of ETag would not work either.
         bool failed = false;
         RevisionMap_t revisions;
-        m_session->propfindURI(luid2path(new_uid), 0, getetag,
-                               boost::bind(&WebDAVSource::listAllItemsCallback,
-                                           this, _1, _2, boost::ref(revisions),
-                                           boost::ref(failed)),
-                               deadline);
+        getSession()->propfindURI(luid2path(new_uid), 0, getetag,
+                                  boost::bind(&WebDAVSource::listAllItemsCallback,
+                                              this, _1, _2, boost::ref(revisions),
+                                              boost::ref(failed)),
+                                  deadline);
         rev = revisions[new_uid];
         if (failed || rev.empty()) {
             SE_THROW("could not retrieve ETag");
         }
     }
 
+    // whatever we had stored for the resource is outdated now
+    getItemStore().remove(new_uid);
+
     return InsertItemResult(new_uid, rev, state);
 }
 
@@ -1655,12 +2246,14 @@ Timespec WebDAVSource::createDeadline() const
 
 void WebDAVSource::removeItem(const string &uid)
 {
+    getItemStore().remove(uid);
+
     Timespec deadline = createDeadline();
-    m_session->startOperation("DELETE", deadline);
+    getSession()->startOperation("DELETE", deadline);
     std::string item, result;
     boost::scoped_ptr<Neon::Request> req;
     while (true) {
-        req.reset(new Neon::Request(*m_session, "DELETE", luid2path(uid),
+        req.reset(new Neon::Request(*getSession(), "DELETE", luid2path(uid),
                                     item, result));
         // TODO: match exactly the expected revision, aka ETag,
         // or implement locking.
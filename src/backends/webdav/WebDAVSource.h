@@ -12,6 +12,12 @@
 #include <syncevo/declarations.h>
 SE_BEGIN_CXX
 extern BoolConfigProperty &WebDAVCredentialsOkay();
+/** "calDAVCacheSize" source property, read by CalDAVSource */
+extern UIntConfigProperty &CalDAVCacheSize();
+/** "webDAVItemStore" source property, see WebDAVSource::getItemStore() */
+extern BoolConfigProperty &WebDAVUseItemStore();
+/** "webDAVMaxConnections" source property, see Neon::Settings::maxConnections() */
+extern UIntConfigProperty &WebDAVMaxConnections();
 SE_END_CXX
 
 #ifdef ENABLE_DAV
@@ -19,6 +25,7 @@ SE_END_CXX
 #include <syncevo/TrackingSyncSource.h>
 #include <boost/noncopyable.hpp>
 #include "NeonCXX.h"
+#include "WebDAVItemStore.h"
 
 SE_BEGIN_CXX
 
@@ -77,25 +84,23 @@ class WebDAVSource : public TrackingSyncSource, private boost::noncopyable
                           XMLConfigFragments &fragments);
 
     /** intercept TrackingSyncSource::beginSync() to do the expensive initialization */
-    virtual void beginSync(const std::string &lastToken, const std::string &resumeToken) {
-        contactServer();
-        TrackingSyncSource::beginSync(lastToken, resumeToken);
-    }
+    virtual void beginSync(const std::string &lastToken, const std::string &resumeToken);
     /** hook into session to store infos */
-    virtual std::string endSync(bool success) {
-        if (success) {
-             storeServerInfos();
-	}
-	return TrackingSyncSource::endSync(success);
-    }
+    virtual std::string endSync(bool success);
 
     /* implementation of TrackingSyncSource interface */
     virtual std::string databaseRevision();
     virtual void listAllItems(RevisionMap_t &revisions);
+    /** uses a sync-collection REPORT (RFC 6578) if possible */
+    virtual void updateAllItems(RevisionMap_t &revisions);
     virtual InsertItemResult insertItem(const string &luid, const std::string &item, bool raw);
     void readItem(const std::string &luid, std::string &item, bool raw);
     virtual void removeItem(const string &uid);
 
+    /** fetches several items with one addressbook-multiget or calendar-multiget REPORT */
+    virtual void readItemsRaw(const std::vector<std::string> &luids,
+                              std::vector<std::string> &items);
+
     /**
      * A resource path is turned into a locally unique ID by
      * stripping the calendar path prefix, or keeping the full
@@ -125,13 +130,72 @@ class WebDAVSource : public TrackingSyncSource, private boost::noncopyable
      */
     Timespec createDeadline() const;
 
-    // access to neon session and calendar, valid between open() and close()
-    boost::shared_ptr<Neon::Session> getSession() { return m_session; }
+    /**
+     * access to neon session and calendar, valid between open() and close();
+     * the session may be shared with other sources, so getSession() also
+     * directs its request statistics to this source
+     */
+    boost::shared_ptr<Neon::Session> getSession() {
+        if (m_session) {
+            m_session->setRequestStats(m_requestStats);
+        }
+        return m_session;
+    }
     Neon::URI &getCalendar() { return m_calendar; }
 
     // access to settings owned by this instance
     Neon::Settings &settings() { return *m_settings; }
 
+    /**
+     * Items of the current collection stored locally, valid after
+     * contactServer(). Disabled unless turned on with the
+     * "webDAVItemStore" property, if the source has no cache directory
+     * or if opening the store failed.
+     */
+    WebDAVItemStore &getItemStore();
+
+    /**
+     * Called for each item read by multiget() and getItems(): path,
+     * ETag as sent by the server and item data (empty if the server
+     * returned none).
+     */
+    typedef boost::function<void (const std::string &, const std::string &, std::string &)> ItemCallback_t;
+
+    /**
+     * Reads items with addressbook-multiget resp. calendar-multiget
+     * REPORTs. Larger sets are split into several REPORTs which are
+     * sent concurrently, see Neon::RequestBatch. The callback is
+     * invoked in the calling thread for each response.
+     */
+    void multiget(const std::string &operation,
+                  const std::vector<std::string> &luids,
+                  const ItemCallback_t &callback);
+
+    /** reads items with GET, several at once */
+    void getItems(const std::string &operation,
+                  const std::vector<std::string> &luids,
+                  const ItemCallback_t &callback);
+
+    /**
+     * Incremental change detection with a sync-collection REPORT
+     * (RFC 6578), based on the DAV:sync-token stored by the last
+     * successful sync. Revisions must be those of that sync.
+     *
+     * @return false if there is no usable token, in which case
+     *         the caller must list all items after calling
+     *         prepareFullListing()
+     */
+    bool updateWithSyncToken(RevisionMap_t &revisions);
+
+    /** remembers the current sync-token before listing all items */
+    void prepareFullListing() { m_syncToken = getSyncToken(); }
+
+    /** forgets the sync-token of a previous change detection */
+    void resetSyncToken() { m_syncToken = ""; }
+
+    /** stores the sync-token for the next sync, after a successful sync */
+    void storeSyncToken();
+
     /**
      * SRV type to be used for finding URL (caldav, carddav, ...)
      */
@@ -210,13 +274,61 @@ class WebDAVSource : public TrackingSyncSource, private boost::noncopyable
     boost::shared_ptr<ContextSettings> m_contextSettings;
     boost::shared_ptr<Neon::Session> m_session;
 
+    /** requests sent by this source, logged and reset by close() */
+    boost::shared_ptr<Neon::Session::RequestStatsMap_t> m_requestStats;
+
     /** normalized path: including backslash, URI encoded */
     Neon::URI m_calendar;
 
+    /** created on demand by getItemStore(), flushed and freed by close() */
+    boost::shared_ptr<WebDAVItemStore> m_itemStore;
+
+    /** "webDAVItemStore" source property */
+    bool m_useItemStore;
+
+    /** m_itemStore was created for the current collection, successfully or not */
+    bool m_itemStoreOpened;
+
     /** information about certain paths (path->property->value)*/
     typedef std::map<std::string, std::map<std::string, std::string> > Props_t;
     Props_t m_davProps;
 
+    /**
+     * DAV:sync-token for the state of the collection when changes
+     * were detected in beginSync(), empty if unknown. Stored for
+     * the next sync by endSync().
+     */
+    std::string m_syncToken;
+
+    /** true while beginSync() detects changes */
+    bool m_detectingChanges;
+
+    /**
+     * PROPFIND of DAV:sync-token, empty if not supported. A server
+     * which does not return a token for the collection is remembered
+     * in the "noSyncToken" meta property and not asked again.
+     */
+    std::string getSyncToken();
+
+    /**
+     * Update revisions with the changes reported by the server since
+     * the given token.
+     *
+     * @retval newToken    sync-token for the new state of the collection
+     * @return false if the server did not provide a new token
+     */
+    bool syncCollection(const std::string &token,
+                        RevisionMap_t &revisions,
+                        std::string &newToken);
+
+    /** callback for sync-collection REPORT: handles one response */
+    int syncCollectionResponse(RevisionMap_t &revisions,
+                               RevisionMap_t &unknown,
+                               bool &truncated,
+                               std::string &href,
+                               std::string &etag,
+                               std::string &status);
+
     /** extract value from first <DAV:href>value</DAV:href>, empty string if not inside propval */
     std::string extractHREF(const std::string &propval);
     /** extract all <DAV:href>value</DAV:href> values from a set, empty if none */
@@ -235,7 +347,16 @@ class WebDAVSource : public TrackingSyncSource, private boost::noncopyable
     int checkItem(RevisionMap_t &revisions,
                   const std::string &href,
                   const std::string &etag,
-                  std::string &data);
+                  bool &found,
+                  std::string &buffer);
+
+    /** callback for multiget() in readItemsRaw(): stores data of the requested item */
+    void storeMultigetResult(const std::map<std::string, size_t> &luid2index,
+                             std::vector<std::string> &items,
+                             std::vector<bool> &found,
+                             const std::string &href,
+                             const std::string &etag,
+                             std::string &data);
 
     void backupData(const boost::function<Operations::BackupData_t> &op,
                     const Operations::ConstBackupInfo &oldBackup,
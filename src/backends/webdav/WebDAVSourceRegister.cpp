@@ -101,13 +101,20 @@ public:
 #endif
                            createSource,
                            "CalDAV\n"
-                           "   calendar events\n"
+                           "   calendar events; the calDAVCacheSize source property\n"
+                           "   limits the memory for parsed events (KB, 0 = unlimited)\n"
                            "CalDAVTodo\n"
                            "   tasks\n"
                            "CalDAVJournal\n"
                            "   memos\n"
                            "CardDAV\n"
                            "   contacts\n"
+                           "The webDAVItemStore source property keeps downloaded items\n"
+                           "in the cache directory, so that later syncs only download\n"
+                           "modified ones (default is off).\n"
+                           "The webDAVMaxConnections source property allows sending\n"
+                           "several requests at once over that many HTTP connections\n"
+                           "(default is 1).\n"
                            ,
                            Values() +
                            Aliases("CalDAV")
@@ -121,6 +128,12 @@ public:
         // so that config migration always includes this property
         WebDAVCredentialsOkay().setHidden(true);
         SyncConfig::getRegistry().push_back(&WebDAVCredentialsOkay());
+        CalDAVCacheSize().setHidden(true);
+        SyncSourceConfig::getRegistry().push_back(&CalDAVCacheSize());
+        WebDAVUseItemStore().setHidden(true);
+        SyncSourceConfig::getRegistry().push_back(&WebDAVUseItemStore());
+        WebDAVMaxConnections().setHidden(true);
+        SyncSourceConfig::getRegistry().push_back(&WebDAVMaxConnections());
     }
 } registerMe;
 
@@ -131,6 +144,7 @@ class WebDAVTest : public CppUnit::TestFixture {
     CPPUNIT_TEST_SUITE(WebDAVTest);
     CPPUNIT_TEST(testInstantiate);
     CPPUNIT_TEST(testHTMLEntities);
+    CPPUNIT_TEST(testSearch);
     CPPUNIT_TEST_SUITE_END();
 
 protected:
@@ -198,6 +212,31 @@ protected:
         CPPUNIT_ASSERT_EQUAL(std::string("&#quot ;"),
                              decode("&#quot ;"));
     }
+
+    /** feed data in chunks of the given size to Neon::XMLParser::search() */
+    bool search(const std::string &needle, const std::string &data, size_t chunksize) {
+        bool found = false;
+        std::string buffer;
+        for (size_t offset = 0; offset < data.size(); offset += chunksize) {
+            Neon::XMLParser::search(needle, found, buffer,
+                                    data.c_str() + offset,
+                                    std::min(chunksize, data.size() - offset));
+            CPPUNIT_ASSERT(buffer.size() < needle.size() + chunksize);
+        }
+        return found;
+    }
+
+    void testSearch() {
+        const std::string needle = "\nBEGIN:VEVENT";
+        const std::string event = "BEGIN:VCALENDAR\nBEGIN:VEVENT\nEND:VEVENT\nEND:VCALENDAR\n";
+        const std::string todo = "BEGIN:VCALENDAR\nBEGIN:VTODO\nEND:VTODO\nEND:VCALENDAR\n";
+        for (size_t chunksize = 1; chunksize <= event.size(); chunksize++) {
+            CPPUNIT_ASSERT(search(needle, event, chunksize));
+            CPPUNIT_ASSERT(!search(needle, todo, chunksize));
+        }
+        CPPUNIT_ASSERT(!search(needle, "", 1));
+        CPPUNIT_ASSERT(!search(needle, "BEGIN:VEVENT", 1));
+    }
 };
 
 SYNCEVOLUTION_TEST_SUITE_REGISTRATION(WebDAVTest);
@@ -35,6 +35,20 @@ AutoSyncManager::AutoSyncManager(Server &server) :
 {
 }
 
+void AutoSyncManager::AutoSyncTask::stopWatching()
+{
+    BOOST_FOREACH (const boost::shared_ptr<SyncSource> &source, m_sources) {
+        try {
+            source->close();
+        } catch (...) {
+            Exception::handle();
+        }
+    }
+    m_sources.clear();
+    m_watched.clear();
+    m_changeTimeout.deactivate();
+}
+
 static void updatePresence(Timespec *t, bool present)
 {
     *t = present ?
@@ -169,6 +183,7 @@ void AutoSyncManager::initConfig(const std::string &configName)
         }
         task->m_interval = config.getAutoSyncInterval();
         task->m_delay = config.getAutoSyncDelay();
+        task->m_changeDelay = config.getAutoSyncChangeDelay();
         task->m_remoteDeviceId = config.getRemoteDevID();
         task->m_notifyLevel = config.getNotifyLevel();
 
@@ -177,12 +192,12 @@ void AutoSyncManager::initConfig(const std::string &configName)
         task->m_permanentFailure = false;
 
         SE_LOG_DEBUG(NULL, NULL,
-                     "auto sync: %s: auto sync '%s', %s, %s, %d seconds repeat interval, %d seconds online delay",
+                     "auto sync: %s: auto sync '%s', %s, %s, %d seconds repeat interval, %d seconds online delay, %d seconds change delay",
                      configName.c_str(),
                      autoSync.c_str(),
                      bt ? "Bluetooth" : "no Bluetooth",
                      http ? "HTTP" : "no HTTP",
-                     task->m_interval, task->m_delay);
+                     task->m_interval, task->m_delay, task->m_changeDelay);
 
         task->m_urls.clear();
         BOOST_FOREACH(std::string url, urls) {
@@ -211,6 +226,8 @@ void AutoSyncManager::initConfig(const std::string &configName)
         task->m_urls.clear();
     }
 
+    watchChanges(task);
+
     bool lock = preventTerm();
     if (m_autoTermLocked && !lock) {
         SE_LOG_DEBUG(NULL, NULL, "auto sync: allow auto shutdown");
@@ -252,12 +269,37 @@ void AutoSyncManager::schedule(const std::string &reason)
         const std::string &configName = entry.first;
         const boost::shared_ptr<AutoSyncTask> &task = entry.second;
 
-        if (task->m_interval <= 0 || // not enabled
+        if ((task->m_interval <= 0 && !task->m_changeDelay) || // not enabled
             task->m_permanentFailure) { // don't try again
             continue;
         }
 
-        if (task->m_lastSyncTime + task->m_interval > now) {
+        // Pending local changes override the interval once the
+        // source has been quiet long enough.
+        bool changed = false;
+        if (task->m_changeTime) {
+            if (task->m_changeTime + task->m_changeDelay > now) {
+                int seconds = (task->m_changeTime + task->m_changeDelay - now).seconds() + 1;
+                SE_LOG_DEBUG(NULL, NULL, "auto sync: %s: local changes, quiet period expires in %ds",
+                             configName.c_str(),
+                             seconds);
+                task->m_changeTimeout.runOnce(seconds,
+                                              boost::bind(&AutoSyncManager::schedule,
+                                                          this,
+                                                          configName + " change timer"));
+            } else {
+                changed = true;
+            }
+        }
+
+        if (!changed &&
+            task->m_interval <= 0) {
+            // Only syncing when local changes are detected.
+            continue;
+        }
+
+        if (!changed &&
+            task->m_lastSyncTime + task->m_interval > now) {
             // Ran too recently, check again in the future. Always
             // reset timer, because both m_lastSyncTime and m_interval
             // may have changed.
@@ -330,6 +372,8 @@ void AutoSyncManager::schedule(const std::string &reason)
                                                task->m_remoteDeviceId,
                                                configName,
                                                m_server.getNextSession());
+            // Sessions requested by users are more important.
+            m_session->setPriority(Session::PRI_AUTOSYNC);
 
             // Temporarily set sync URL to the one which we picked above
             // once the session is active (setConfig() not allowed earlier).
@@ -360,6 +404,116 @@ void AutoSyncManager::schedule(const std::string &reason)
     SE_LOG_DEBUG(NULL, NULL, "auto sync: nothing to do");
 }
 
+void AutoSyncManager::watchChanges(const boost::shared_ptr<AutoSyncTask> &task)
+{
+    // Determine which sources need to be watched. The sources are
+    // only reopened if that differs from what is watched already.
+    // Changes recorded so far remain pending in both cases.
+    std::list<std::string> watched;
+    boost::shared_ptr<SyncConfig> config;
+    if (task->m_changeDelay &&
+        !task->m_urls.empty()) {
+        config.reset(new SyncConfig(task->m_configName));
+        BOOST_FOREACH (const std::string &sourceName, config->getSyncSources()) {
+            try {
+                boost::shared_ptr<PersistentSyncSourceConfig> sourceConfig = config->getSyncSourceConfig(sourceName);
+                if (!sourceConfig->isDisabled()) {
+                    watched.push_back(sourceName + "\n" +
+                                      sourceConfig->getBackend() + "\n" +
+                                      sourceConfig->getDatabaseID());
+                }
+            } catch (...) {
+                Exception::handle();
+            }
+        }
+    }
+    if (watched == task->m_watched) {
+        return;
+    }
+    task->stopWatching();
+    task->m_watched = watched;
+
+    BOOST_FOREACH (const std::string &entry, watched) {
+        std::string sourceName = entry.substr(0, entry.find('\n'));
+        try {
+            SyncSourceParams params(sourceName, config->getSyncSourceNodes(sourceName), config);
+            // Virtual sources do not support watching, their
+            // sub-sources get watched individually.
+            boost::shared_ptr<SyncSource> source(SyncSource::createSource(params, false, config.get()));
+            if (!source ||
+                !source->getOperations().m_watchChanges) {
+                SE_LOG_DEBUG(NULL, NULL, "auto sync: %s: cannot watch source %s for changes",
+                             task->m_configName.c_str(), sourceName.c_str());
+                continue;
+            }
+            source->open();
+            source->getOperations().m_watchChanges(boost::bind(&AutoSyncManager::localChange,
+                                                               this,
+                                                               task.get(),
+                                                               sourceName));
+            task->m_sources.push_back(source);
+            SE_LOG_DEBUG(NULL, NULL, "auto sync: %s: watching source %s for changes",
+                         task->m_configName.c_str(), sourceName.c_str());
+        } catch (...) {
+            // not fatal, interval-based syncing still works
+            Exception::handle();
+        }
+    }
+}
+
+void AutoSyncManager::localChange(AutoSyncTask *task, const std::string &sourceName)
+{
+    Timespec now = Timespec::monotonic();
+    if (task->m_syncRunning ||
+        (task->m_lastSyncEnd &&
+         task->m_lastSyncEnd + task->m_changeDelay > now)) {
+        // Most likely caused by the sync itself, but the user might
+        // also have made a change. Decided once the quiet period
+        // after the sync is over, see recheckChanges().
+        SE_LOG_DEBUG(NULL, NULL, "auto sync: %s: change in %s during or right after sync, checking later",
+                     task->m_configName.c_str(), sourceName.c_str());
+        task->m_syncChangeTime = now;
+        if (!task->m_syncRunning) {
+            int seconds = (task->m_lastSyncEnd + task->m_changeDelay - now).seconds() + 1;
+            task->m_syncChangeTimeout.runOnce(seconds,
+                                              boost::bind(&AutoSyncManager::recheckChanges,
+                                                          this,
+                                                          task));
+        }
+        return;
+    }
+
+    bool pending = task->m_changeTime;
+    task->m_changeTime = now;
+    if (!pending) {
+        // Further changes only move the time forward, schedule()
+        // picks that up when the timer fires.
+        SE_LOG_DEBUG(NULL, NULL, "auto sync: %s: local change in %s",
+                     task->m_configName.c_str(), sourceName.c_str());
+        schedule(task->m_configName + " local change");
+    }
+}
+
+void AutoSyncManager::recheckChanges(AutoSyncTask *task)
+{
+    if (task->m_syncRunning ||
+        !task->m_syncChangeTime) {
+        return;
+    }
+
+    // It is impossible to tell which of the changes came from the
+    // sync, so let another sync find out. That one finds nothing
+    // to do unless the user modified data, and then does not
+    // write anything itself, so this does not repeat endlessly.
+    SE_LOG_DEBUG(NULL, NULL, "auto sync: %s: changes during last sync, syncing again",
+                 task->m_configName.c_str());
+    if (!task->m_changeTime) {
+        task->m_changeTime = task->m_syncChangeTime;
+    }
+    task->m_syncChangeTime = Timespec();
+    schedule(task->m_configName + " change during sync");
+}
+
 void AutoSyncManager::connectIdle()
 {
     m_idleConnection =
@@ -388,6 +542,11 @@ void AutoSyncManager::sessionStarted(const boost::shared_ptr<Session> &session)
 
     const boost::shared_ptr<AutoSyncTask> &task = it->second;
     task->m_lastSyncTime = Timespec::monotonic();
+    // the sync includes all local changes made so far
+    task->m_changeTime = Timespec();
+    task->m_syncChangeTime = Timespec();
+    task->m_syncChangeTimeout.deactivate();
+    task->m_syncRunning = true;
 
     // track permanent failure
     session->m_doneSignal.connect(Session::DoneSignal_t::slot_type(&AutoSyncManager::anySyncDone, this, task.get(), _1).track(task).track(me));
@@ -410,7 +569,7 @@ bool AutoSyncManager::preventTerm()
 {
     BOOST_FOREACH (const PeerMap::value_type &entry, m_peerMap) {
         const boost::shared_ptr<AutoSyncTask> &task = entry.second;
-        if (task->m_interval > 0 &&
+        if ((task->m_interval > 0 || task->m_changeDelay) &&
             !task->m_permanentFailure &&
             !task->m_urls.empty()) {
             // that task might run
@@ -487,6 +646,14 @@ void AutoSyncManager::anySyncDone(AutoSyncTask *task, SyncMLStatus status)
 {
     // set "permanently failed" flag according to most recent result
     task->m_permanentFailure = !ErrorIsTemporary(status);
+    task->m_syncRunning = false;
+    task->m_lastSyncEnd = Timespec::monotonic();
+    if (task->m_syncChangeTime) {
+        task->m_syncChangeTimeout.runOnce(task->m_changeDelay + 1,
+                                          boost::bind(&AutoSyncManager::recheckChanges,
+                                                      this,
+                                                      task));
+    }
     SE_LOG_DEBUG(NULL, NULL, "auto sync: sync session %s done, result %d %s",
                  task->m_configName.c_str(),
                  status,
@@ -27,12 +27,15 @@
 
 #include <syncevo/SyncML.h>
 #include <syncevo/SyncContext.h>
+#include <syncevo/SyncSource.h>
 #include <syncevo/SmartPtr.h>
 #include <syncevo/util.h>
 
 #include "notification-manager-factory.h"
 #include "timeout.h"
 
+#include <list>
+
 SE_BEGIN_CXX
 
 class Server;
@@ -51,9 +54,20 @@ class Session;
  * parallel sessions are not currently supported by SyncEvolution,
  * scheduling the next session waits until the server is idle again.
  *
- * Currently only time-based automatic syncs are supported.
- * Syncs triggered by local or remote changes will be added
- * later.
+ * Syncs are time-based (autoSyncInterval). In addition, a sync can
+ * be triggered by changes in the local databases: when the
+ * autoSyncChangeDelay property of a config with auto sync enabled
+ * is set to a number of seconds, the manager keeps its sources
+ * open and watches them
+ * via SyncSource::Operations::m_watchChanges. A sync then starts
+ * once no further change was seen for that many seconds, without
+ * waiting for the interval to expire. Changes reported while a sync
+ * runs or shortly after it are probably caused by the sync itself,
+ * but might also come from the user; they cause another sync once
+ * that quiet period is over. Sources which cannot watch for changes
+ * only get synced at the normal interval. An interval of 0 means
+ * that syncs are only triggered by local changes. Syncs triggered by
+ * remote changes are not supported.
  */
 class AutoSyncManager
 {
@@ -114,6 +128,12 @@ class AutoSyncManager
         /** autoSyncDelay = the time that the peer must at least have been around (seconds) */
         unsigned int m_delay;
 
+        /**
+         * autoSyncChangeDelay = quiet period after a local change
+         * before syncing (seconds), 0 if local changes are not watched
+         */
+        unsigned int m_changeDelay;
+
         /**
          * autoSyncInterval = the minimum time in seconds between syncs.
          *
@@ -123,6 +143,8 @@ class AutoSyncManager
          * to the interval. In the extreme case (seen in testing), a sync takes longer
          * than the interval and thus the next sync is started immediately - probably
          * not what is expected. Keeping the behavior for now.
+         *
+         * 0 = only sync when local changes were detected (m_changeDelay).
          */
         unsigned int m_interval;
 
@@ -144,15 +166,47 @@ class AutoSyncManager
         typedef std::list< std::pair<Transport, std::string> > URLInfo_t;
         URLInfo_t m_urls;
 
+        /** opened sources whose changes are watched, empty if not enabled */
+        std::list< boost::shared_ptr<SyncSource> > m_sources;
+
+        /**
+         * name, backend and database of each source which is meant
+         * to be watched, whether that worked or not; the sources
+         * only get reopened when this changes
+         */
+        std::list<std::string> m_watched;
+
+        /** time of most recent local change not synced yet, zero if none */
+        Timespec m_changeTime;
+
+        /**
+         * time of most recent change reported while a sync ran or
+         * during the quiet period after it, zero if none
+         */
+        Timespec m_syncChangeTime;
+
+        /** true while a sync session for the config runs */
+        bool m_syncRunning;
+
+        /** end of the last sync, measured like m_lastSyncTime */
+        Timespec m_lastSyncEnd;
+
         AutoSyncTask(const std::string &configName) :
             m_configName(configName),
             m_syncSuccessStart(false),
             m_permanentFailure(false),
             m_delay(0),
-            m_interval(0)
+            m_changeDelay(0),
+            m_interval(0),
+            m_syncRunning(false)
         {
         }
 
+        ~AutoSyncTask() { stopWatching(); }
+
+        /** close and forget m_sources and m_watched */
+        void stopWatching();
+
         /* /\** compare whether two tasks are the same, based on unique config name *\/ */
         /* bool operator==(const AutoSyncTask &right) const */
         /* { */
@@ -162,6 +216,8 @@ class AutoSyncManager
         Timeout m_intervalTimeout;
         Timeout m_btTimeout;
         Timeout m_httpTimeout;
+        Timeout m_changeTimeout;
+        Timeout m_syncChangeTimeout;
     };
 
     /* /\** remove tasks from m_peerMap and m_workQueue created from the config *\/ */
@@ -208,6 +264,19 @@ class AutoSyncManager
     /** Record result. */
     void anySyncDone(AutoSyncTask *task, SyncMLStatus status);
 
+    /**
+     * Open the sources of the config and watch them for changes, if
+     * enabled. Sources which are watched already are kept open
+     * unless the set of sources changed.
+     */
+    void watchChanges(const boost::shared_ptr<AutoSyncTask> &task);
+
+    /** invoked by sources watched by watchChanges() */
+    void localChange(AutoSyncTask *task, const std::string &sourceName);
+
+    /** treat m_syncChangeTime as local change once the quiet period after the sync is over */
+    void recheckChanges(AutoSyncTask *task);
+
     AutoSyncManager(Server &server);
 
  public:
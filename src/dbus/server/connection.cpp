@@ -146,60 +146,16 @@ void Connection::process(const Caller_t &caller,
                     }
                 } else { //Server alerted notification case
                     // Extract server ID and match it against a server
-                    // configuration.  Multiple different peers might use the
-                    // same serverID ("PC Suite"), so check properties of the
-                    // of our configs first before going back to the name itself.
+                    // configuration, for Bluetooth transports also
+                    // against the mac address.
                     std::string serverID = san.fServerID;
-                    SyncConfig::ConfigList servers = SyncConfig::getConfigs();
-                    BOOST_FOREACH(const SyncConfig::ConfigList::value_type &server,
-                            servers) {
-                        SyncConfig conf(server.first);
-                        vector<string> urls = conf.getSyncURL();
-                        BOOST_FOREACH (const string &url, urls) {
-                            if (url == serverID) {
-                                config = server.first;
-                                break;
-                            }
-                        }
-                        if (!config.empty()) {
-                            break;
-                        }
-                    }
-
-                    // for Bluetooth transports match against mac address.
                     StringMap::const_iterator id = m_peer.find("id"),
                         trans = m_peer.find("transport");
-                    if (trans != m_peer.end() && id != m_peer.end()) {
-                        if (trans->second == "org.openobex.obexd") {
-                            m_peerBtAddr = id->second.substr(0, id->second.find("+"));
-                            BOOST_FOREACH(const SyncConfig::ConfigList::value_type &server,
-                                    servers) {
-                                SyncConfig conf(server.first);
-                                vector<string> urls = conf.getSyncURL();
-                                BOOST_FOREACH (string &url, urls){
-                                    url = url.substr (0, url.find("+"));
-                                    SE_LOG_DEBUG (NULL, NULL, "matching against %s",url.c_str());
-                                    if (url.find ("obex-bt://") ==0 && url.substr(strlen("obex-bt://"), url.npos) == m_peerBtAddr) {
-                                        config = server.first;
-                                        break;
-                                    }
-                                }
-                                if (!config.empty()){
-                                    break;
-                                }
-                            }
-                        }
-                    }
-
-                    if (config.empty()) {
-                        BOOST_FOREACH(const SyncConfig::ConfigList::value_type &server,
-                                      servers) {
-                            if (server.first == serverID) {
-                                config = serverID;
-                                break;
-                            }
-                        }
+                    if (trans != m_peer.end() && id != m_peer.end() &&
+                        trans->second == "org.openobex.obexd") {
+                        m_peerBtAddr = id->second.substr(0, id->second.find("+"));
                     }
+                    config = m_server.getPeerIndex().findSANConfig(serverID, m_peerBtAddr);
 
                     // create a default configuration name if none matched
                     if (config.empty()) {
@@ -267,22 +223,15 @@ void Connection::process(const Caller_t &caller,
                     // TODO: proper exception
                     throw runtime_error("could not extract LocURI=deviceID from initial message");
                 }
-                BOOST_FOREACH(const SyncConfig::ConfigList::value_type &entry,
-                              SyncConfig::getConfigs()) {
-                    SyncConfig peer(entry.first);
-                    if (info.m_deviceID == peer.getRemoteDevID()) {
-                        config = entry.first;
-                        SE_LOG_INFO(NULL, NULL, "matched %s against config %s (%s)",
-                                    info.toString().c_str(),
-                                    entry.first.c_str(),
-                                    entry.second.c_str());
-                        // Stop searching. Other peer configs might have the same remoteDevID.
-                        // We go with the first one found, which because of the sort order
-                        // of getConfigs() ensures that "foo" is found before "foo.old".
-                        break;
-                    }
-                }
-                if (config.empty()) {
+                // Other peer configs might have the same remoteDevID.
+                // We go with the first one found, which because of the sort order
+                // of getConfigs() ensures that "foo" is found before "foo.old".
+                config = m_server.getPeerIndex().findByRemoteDevID(info.m_deviceID);
+                if (!config.empty()) {
+                    SE_LOG_INFO(NULL, NULL, "matched %s against config %s",
+                                info.toString().c_str(),
+                                config.c_str());
+                } else {
                     // TODO: proper exception
                     throw runtime_error(string("no configuration found for ") +
                                         info.toString());
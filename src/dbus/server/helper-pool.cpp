@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2012 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ */
+
+#include "helper-pool.h"
+#include "server.h"
+
+#include <syncevo/Logging.h>
+#include <syncevo/SyncConfig.h>
+
+#include <boost/foreach.hpp>
+
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+
+SE_BEGIN_CXX
+
+HelperPool::HelperPool(Server &server) :
+    m_server(server),
+    m_size(0),
+    m_drained(false)
+{
+    try {
+        SyncConfig config("@default");
+        m_size = config.getDBusHelperPool();
+    } catch (...) {
+        Exception::handle(HANDLE_EXCEPTION_NO_ERROR);
+    }
+}
+
+HelperPool::~HelperPool()
+{
+    // Idle helpers would only notice that we are gone when trying to
+    // use the connection, so tell them explicitly.
+    BOOST_FOREACH (const boost::shared_ptr<Helper> &helper, m_helpers) {
+        BOOST_FOREACH (boost::signals2::connection &c, helper->m_connections) {
+            c.disconnect();
+        }
+        helper->m_forkexec->stop(SIGTERM);
+    }
+}
+
+void HelperPool::fill()
+{
+    if (m_drained) {
+        return;
+    }
+
+    while (m_helpers.size() < m_size) {
+        boost::shared_ptr<Helper> helper(new Helper);
+        helper->m_forkexec = ForkExecParent::create("syncevo-dbus-helper");
+        // The pool owns the ForkExecParent as long as these signals
+        // are connected, so "this" and the raw Helper pointer are
+        // valid. take() disconnects before handing over the helper.
+        helper->m_connections.push_back(helper->m_forkexec->m_onConnect.connect(boost::bind(&HelperPool::onConnect, this, helper.get(), _1)));
+        helper->m_connections.push_back(helper->m_forkexec->m_onQuit.connect(boost::bind(&HelperPool::onQuit, this, helper.get(), _1)));
+        helper->m_connections.push_back(helper->m_forkexec->m_onFailure.connect(boost::bind(&HelperPool::onFailure, this, helper.get(), _1, _2)));
+        if (!getenv("SYNCEVOLUTION_DEBUG")) {
+            helper->m_connections.push_back(helper->m_forkexec->m_onOutput.connect(&HelperPool::onOutput));
+        }
+        helper->m_forkexec->start();
+        m_helpers.push_back(helper);
+        SE_LOG_DEBUG(NULL, NULL, "helper pool: started helper, %ld of %ld",
+                     (long)m_helpers.size(), (long)m_size);
+    }
+}
+
+void HelperPool::drain()
+{
+    if (!m_drained) {
+        SE_LOG_DEBUG(NULL, NULL, "helper pool: stopping %ld idle helpers",
+                     (long)m_helpers.size());
+    }
+    m_drained = true;
+    // Entries get removed in onQuit(), once the helper is really gone.
+    BOOST_FOREACH (const boost::shared_ptr<Helper> &helper, m_helpers) {
+        helper->m_forkexec->stop(SIGTERM);
+    }
+}
+
+bool HelperPool::take(boost::shared_ptr<ForkExecParent> &forkexec,
+                      GDBusCXX::DBusConnectionPtr &conn)
+{
+    if (m_helpers.empty() || m_drained) {
+        return false;
+    }
+
+    // Prefer a helper which is already connected.
+    Helpers_t::iterator it = m_helpers.begin();
+    for (Helpers_t::iterator next = m_helpers.begin();
+         next != m_helpers.end();
+         ++next) {
+        if ((*next)->m_conn) {
+            it = next;
+            break;
+        }
+    }
+    boost::shared_ptr<Helper> helper = *it;
+    m_helpers.erase(it);
+    BOOST_FOREACH (boost::signals2::connection &c, helper->m_connections) {
+        c.disconnect();
+    }
+    forkexec = helper->m_forkexec;
+    conn = helper->m_conn;
+    SE_LOG_DEBUG(NULL, NULL, "helper pool: handing over %s helper, %ld left",
+                 conn ? "connected" : "starting",
+                 (long)m_helpers.size());
+    return true;
+}
+
+void HelperPool::onConnect(Helper *helper, const GDBusCXX::DBusConnectionPtr &conn) throw ()
+{
+    try {
+        SE_LOG_DEBUG(NULL, NULL, "helper pool: helper has connected");
+        helper->m_conn = conn;
+    } catch (...) {
+        Exception::handle();
+    }
+}
+
+void HelperPool::onQuit(Helper *helper, int status) throw ()
+{
+    try {
+        SE_LOG_DEBUG(NULL, NULL, "helper pool: idle helper quit with return code %d", status);
+        for (Helpers_t::iterator it = m_helpers.begin();
+             it != m_helpers.end();
+             ++it) {
+            if (it->get() == helper) {
+                // We are called by the ForkExecParent which is about
+                // to be removed, so it must survive until we
+                // return to the main loop.
+                m_server.delayDeletion(*it);
+                m_helpers.erase(it);
+                break;
+            }
+        }
+    } catch (...) {
+        Exception::handle();
+    }
+}
+
+void HelperPool::onFailure(Helper *helper, SyncMLStatus status, const std::string &explanation) throw ()
+{
+    try {
+        SE_LOG_DEBUG(NULL, NULL, "helper pool: helper failed, status code %d = %s, %s",
+                     status,
+                     Status2String(status).c_str(),
+                     explanation.c_str());
+    } catch (...) {
+        Exception::handle();
+    }
+}
+
+void HelperPool::onOutput(const char *buffer, size_t length)
+{
+    // same as Session::onOutput(): unexpected, treat null-bytes
+    // inside the buffer like line breaks
+    size_t off = 0;
+    do {
+        SE_LOG_ERROR(NULL, "session-helper", "%s", buffer + off);
+        off += strlen(buffer + off) + 1;
+    } while (off < length);
+}
+
+SE_END_CXX
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2012 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ */
+
+#ifndef HELPER_POOL_H
+#define HELPER_POOL_H
+
+#include <list>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/signals2.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <syncevo/ForkExec.h>
+#include <syncevo/SyncML.h>
+
+#include <syncevo/declarations.h>
+SE_BEGIN_CXX
+
+class Server;
+
+/**
+ * Keeps a number of syncevo-dbus-helper processes running which
+ * have not been assigned to a session yet. Starting a helper
+ * involves fork+exec, loading all backend modules and establishing
+ * the D-Bus connection back to the server; with the pool, a session
+ * gets a helper which is ready (or at least already on its way)
+ * and can send its first method call right away.
+ *
+ * The helper is generic until a session tells it what to do, so
+ * any helper can be handed to any session. The size of the pool is
+ * set with the global "dbusHelperPool" property. The default is 0,
+ * which means that each session starts its own helper, as before.
+ */
+class HelperPool : private boost::noncopyable
+{
+ public:
+    HelperPool(Server &server);
+    ~HelperPool();
+
+    /**
+     * Start helpers until the pool has the configured size. Does
+     * nothing after drain() was called.
+     */
+    void fill();
+
+    /**
+     * Stop all idle helpers and don't start new ones. Used when
+     * the server is going to shut down or restart, because helpers
+     * started before a package update might not match the files
+     * on disk anymore.
+     */
+    void drain();
+
+    /**
+     * Hand over one helper to the caller. The pool disconnects
+     * from all signals of the helper before returning it, so the
+     * caller must connect to m_onQuit/m_onFailure/m_onOutput
+     * itself.
+     *
+     * @retval forkexec     the helper, either STARTING or CONNECTED
+     * @retval conn         the connection to the helper if CONNECTED
+     * @return false if the pool is empty
+     */
+    bool take(boost::shared_ptr<ForkExecParent> &forkexec,
+              GDBusCXX::DBusConnectionPtr &conn);
+
+ private:
+    struct Helper
+    {
+        boost::shared_ptr<ForkExecParent> m_forkexec;
+        GDBusCXX::DBusConnectionPtr m_conn;
+        std::list<boost::signals2::connection> m_connections;
+    };
+    typedef std::list< boost::shared_ptr<Helper> > Helpers_t;
+
+    Server &m_server;
+    Helpers_t m_helpers;
+    size_t m_size;
+    bool m_drained;
+
+    void onConnect(Helper *helper, const GDBusCXX::DBusConnectionPtr &conn) throw ();
+    void onQuit(Helper *helper, int status) throw ();
+    void onFailure(Helper *helper, SyncMLStatus status, const std::string &explanation) throw ();
+    static void onOutput(const char *buffer, size_t length);
+};
+
+SE_END_CXX
+
+#endif // HELPER_POOL_H
@@ -0,0 +1,327 @@
+/*
+ * Copyright (C) 2012 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ */
+
+#include "peer-index.h"
+
+#include <syncevo/SyncConfig.h>
+#include <syncevo/Logging.h>
+#include <syncevo/util.h>
+#include <test.h>
+
+#include <boost/foreach.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <string.h>
+
+SE_BEGIN_CXX
+
+void PeerIndex::update(const SyncConfig::ConfigList &configs)
+{
+    m_syncURLs.clear();
+    m_btAddrs.clear();
+    m_remoteDevIDs.clear();
+    m_names.clear();
+
+    BOOST_FOREACH(const SyncConfig::ConfigList::value_type &server, configs) {
+        // insert() does not overwrite, so the first config wins
+        m_names.insert(std::make_pair(server.first, server.first));
+
+        SyncConfig conf(server.first);
+        std::vector<std::string> urls = conf.getSyncURL();
+        BOOST_FOREACH(const std::string &url, urls) {
+            m_syncURLs.insert(std::make_pair(url, server.first));
+            std::string addr = btAddrOf(url);
+            if (!addr.empty()) {
+                m_btAddrs.insert(std::make_pair(addr, server.first));
+            }
+        }
+        std::string deviceID = conf.getRemoteDevID();
+        if (!deviceID.empty()) {
+            m_remoteDevIDs.insert(std::make_pair(deviceID, server.first));
+        }
+    }
+    m_configs = configs;
+    m_valid = true;
+    SE_LOG_DEBUG(NULL, NULL, "peer index: %ld configs, %ld sync URLs",
+                 (long)m_names.size(), (long)m_syncURLs.size());
+}
+
+bool PeerIndex::refresh()
+{
+    // Only scans directories, much cheaper than reading all configs.
+    SyncConfig::ConfigList configs = SyncConfig::getConfigs();
+    if (m_valid && configs == m_configs) {
+        return false;
+    }
+    update(configs);
+    return true;
+}
+
+std::string PeerIndex::lookup(const Index_t &index, const std::string &key)
+{
+    Index_t::const_iterator it = index.find(key);
+    return it == index.end() ? "" : it->second;
+}
+
+std::string PeerIndex::btAddrOf(const std::string &url)
+{
+    std::string addr = url.substr(0, url.find("+"));
+    return boost::starts_with(addr, "obex-bt://") ?
+        addr.substr(strlen("obex-bt://")) :
+        "";
+}
+
+void PeerIndex::lookupSAN(const std::string &serverID,
+                          const std::string &btAddr,
+                          std::vector<std::string> &candidates) const
+{
+    // Multiple different peers might use the same serverID ("PC
+    // Suite"), so check properties of our configs first before
+    // going back to the name itself. The Bluetooth address
+    // identifies the peer best and therefore comes first.
+    candidates.assign(SAN_MAX, "");
+    if (!btAddr.empty()) {
+        candidates[SAN_BT_ADDR] = lookup(m_btAddrs, btAddr);
+    }
+    candidates[SAN_SYNC_URL] = lookup(m_syncURLs, serverID);
+    candidates[SAN_NAME] = lookup(m_names, serverID);
+}
+
+bool PeerIndex::matchesSAN(SANMatch match,
+                           const std::string &config,
+                           const std::string &serverID,
+                           const std::string &btAddr)
+{
+    SyncConfig conf(config);
+    if (!conf.exists()) {
+        return false;
+    }
+    if (match == SAN_NAME) {
+        // m_names maps each name to itself
+        return true;
+    }
+    std::vector<std::string> urls = conf.getSyncURL();
+    BOOST_FOREACH(const std::string &url, urls) {
+        if (match == SAN_SYNC_URL ?
+            url == serverID :
+            btAddrOf(url) == btAddr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PeerIndex::matchesRemoteDevID(const std::string &config,
+                                   const std::string &deviceID)
+{
+    SyncConfig conf(config);
+    return conf.exists() &&
+        conf.getRemoteDevID() == deviceID;
+}
+
+std::string PeerIndex::findSANConfig(const std::string &serverID,
+                                     const std::string &btAddr)
+{
+    bool updated = refresh();
+    std::vector<std::string> candidates;
+    lookupSAN(serverID, btAddr, candidates);
+    if (!updated) {
+        // Checking only the chosen candidate is not enough: a config
+        // which lost its syncURL would let a lower priority match
+        // win. Rebuild when any candidate is stale. Finding nothing
+        // is not a reason, refresh() already checked for new configs.
+        bool stale = false;
+        for (int match = 0; match < SAN_MAX; match++) {
+            const std::string &config = candidates[match];
+            if (!config.empty() &&
+                !matchesSAN(static_cast<SANMatch>(match), config, serverID, btAddr)) {
+                stale = true;
+                break;
+            }
+        }
+        if (stale) {
+            update(SyncConfig::getConfigs());
+            lookupSAN(serverID, btAddr, candidates);
+        }
+    }
+    BOOST_FOREACH(const std::string &config, candidates) {
+        if (!config.empty()) {
+            return config;
+        }
+    }
+    return "";
+}
+
+std::string PeerIndex::findByRemoteDevID(const std::string &deviceID)
+{
+    bool updated = refresh();
+    std::string config = lookup(m_remoteDevIDs, deviceID);
+    if (!updated &&
+        !config.empty() &&
+        !matchesRemoteDevID(config, deviceID)) {
+        update(SyncConfig::getConfigs());
+        config = lookup(m_remoteDevIDs, deviceID);
+    }
+    return config;
+}
+
+#ifdef ENABLE_UNIT_TESTS
+
+class PeerIndexTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(PeerIndexTest);
+    CPPUNIT_TEST(build);
+    CPPUNIT_TEST(invalidate);
+    CPPUNIT_TEST(staleHit);
+    CPPUNIT_TEST_SUITE_END();
+
+    std::string m_testDir;
+
+    static void createConfig(const std::string &name,
+                             const std::string &url,
+                             const std::string &deviceID = "")
+    {
+        SyncConfig config(name);
+        config.prepareConfigForWrite();
+        config.setSyncURL(url);
+        config.setRemoteDevID(deviceID);
+        config.flush();
+    }
+
+public:
+    PeerIndexTest() :
+        m_testDir("PeerIndexTest")
+    {}
+
+    void setUp()
+    {
+        rm_r(m_testDir);
+        mkdir_p(m_testDir);
+    }
+
+    void build()
+    {
+        ScopedEnvChange xdg("XDG_CONFIG_HOME", m_testDir);
+        ScopedEnvChange home("HOME", m_testDir);
+
+        createConfig("urlpeer.old", "http://server.example.com", "dev-a");
+        createConfig("urlpeer", "http://server.example.com", "dev-a");
+        createConfig("btpeer", "obex-bt://00:11:22:33:44:55+1");
+        createConfig("named", "http://named.example.com");
+
+        PeerIndex index;
+        // "foo" beats "foo.old"
+        CPPUNIT_ASSERT_EQUAL(std::string("urlpeer"),
+                             index.findSANConfig("http://server.example.com", ""));
+        // btAddr beats syncURL
+        CPPUNIT_ASSERT_EQUAL(std::string("btpeer"),
+                             index.findSANConfig("http://server.example.com", "00:11:22:33:44:55"));
+        CPPUNIT_ASSERT_EQUAL(std::string("urlpeer"),
+                             index.findSANConfig("http://server.example.com", "66:77:88:99:AA:BB"));
+        // btAddr beats name
+        CPPUNIT_ASSERT_EQUAL(std::string("btpeer"),
+                             index.findSANConfig("named", "00:11:22:33:44:55"));
+        CPPUNIT_ASSERT_EQUAL(std::string("named"),
+                             index.findSANConfig("named", ""));
+        CPPUNIT_ASSERT_EQUAL(std::string(""),
+                             index.findSANConfig("PC Suite", ""));
+        CPPUNIT_ASSERT_EQUAL(std::string("urlpeer"),
+                             index.findByRemoteDevID("dev-a"));
+        CPPUNIT_ASSERT_EQUAL(std::string(""),
+                             index.findByRemoteDevID("dev-b"));
+    }
+
+    void invalidate()
+    {
+        ScopedEnvChange xdg("XDG_CONFIG_HOME", m_testDir);
+        ScopedEnvChange home("HOME", m_testDir);
+
+        createConfig("urlpeer", "http://server.example.com", "dev-a");
+        PeerIndex index;
+        CPPUNIT_ASSERT_EQUAL(std::string("urlpeer"),
+                             index.findSANConfig("http://server.example.com", ""));
+        CPPUNIT_ASSERT_EQUAL(std::string(""),
+                             index.findSANConfig("http://new.example.com", ""));
+
+        // modified through the server; a negative result is kept
+        // until then
+        createConfig("urlpeer", "http://new.example.com", "dev-b");
+        CPPUNIT_ASSERT_EQUAL(std::string(""),
+                             index.findSANConfig("http://new.example.com", ""));
+        CPPUNIT_ASSERT_EQUAL(std::string(""),
+                             index.findByRemoteDevID("dev-b"));
+        index.invalidate();
+        CPPUNIT_ASSERT_EQUAL(std::string(""),
+                             index.findSANConfig("http://server.example.com", ""));
+        CPPUNIT_ASSERT_EQUAL(std::string("urlpeer"),
+                             index.findSANConfig("http://new.example.com", ""));
+        CPPUNIT_ASSERT_EQUAL(std::string("urlpeer"),
+                             index.findByRemoteDevID("dev-b"));
+        CPPUNIT_ASSERT_EQUAL(std::string(""),
+                             index.findByRemoteDevID("dev-a"));
+
+        // removed without invalidate()
+        {
+            SyncConfig config("urlpeer");
+            config.remove();
+        }
+        CPPUNIT_ASSERT_EQUAL(std::string(""),
+                             index.findSANConfig("http://new.example.com", ""));
+        CPPUNIT_ASSERT_EQUAL(std::string(""),
+                             index.findByRemoteDevID("dev-b"));
+    }
+
+    void staleHit()
+    {
+        ScopedEnvChange xdg("XDG_CONFIG_HOME", m_testDir);
+        ScopedEnvChange home("HOME", m_testDir);
+
+        createConfig("btpeer", "obex-bt://00:11:22:33:44:55", "dev-a");
+        createConfig("named", "http://named.example.com");
+        PeerIndex index;
+        CPPUNIT_ASSERT_EQUAL(std::string("btpeer"),
+                             index.findSANConfig("named", "00:11:22:33:44:55"));
+        CPPUNIT_ASSERT_EQUAL(std::string("named"),
+                             index.findSANConfig("named", "66:77:88:99:AA:BB"));
+
+        // A new config with a matching btAddr must win over the
+        // still valid name match, without invalidate().
+        createConfig("newpeer", "obex-bt://66:77:88:99:AA:BB");
+        CPPUNIT_ASSERT_EQUAL(std::string("newpeer"),
+                             index.findSANConfig("named", "66:77:88:99:AA:BB"));
+
+        // btpeer modified without invalidate(): the stale hit
+        // must not be used
+        createConfig("btpeer", "obex-bt://00:11:22:33:44:55", "dev-b");
+        CPPUNIT_ASSERT_EQUAL(std::string(""),
+                             index.findByRemoteDevID("dev-a"));
+        CPPUNIT_ASSERT_EQUAL(std::string("btpeer"),
+                             index.findByRemoteDevID("dev-b"));
+
+        // same for the btAddr, fall back to the name
+        createConfig("btpeer", "obex-bt://AA:BB:CC:DD:EE:FF", "dev-b");
+        CPPUNIT_ASSERT_EQUAL(std::string("named"),
+                             index.findSANConfig("named", "00:11:22:33:44:55"));
+    }
+};
+
+SYNCEVOLUTION_TEST_SUITE_REGISTRATION(PeerIndexTest);
+
+#endif // ENABLE_UNIT_TESTS
+
+SE_END_CXX
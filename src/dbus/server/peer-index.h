@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2012 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ */
+
+#ifndef PEER_INDEX_H
+#define PEER_INDEX_H
+
+#include <string>
+#include <map>
+#include <vector>
+
+#include <syncevo/SyncConfig.h>
+
+#include <syncevo/declarations.h>
+SE_BEGIN_CXX
+
+/**
+ * Maps properties of peer configs to the config names, for routing
+ * incoming connections without reading all configs each time.
+ *
+ * The index is built on demand from SyncConfig::getConfigs() and
+ * thrown away by invalidate(), which the server calls when configs
+ * are modified through it and when files on disk change. In addition,
+ * each lookup compares the list of configs with the one the index was
+ * built from and rebuilds it when configs were added or removed
+ * behind the server's back.
+ *
+ * Modifications of existing configs are only noticed via
+ * invalidate(). As a safeguard, all candidates found in an older
+ * index are checked against the current config before choosing one;
+ * if any of them no longer matches, the index is rebuilt and the
+ * lookup repeated. A lookup which finds nothing does not cause a
+ * rebuild, so negative results are as cheap as positive ones. If
+ * more than one config matches, the first one in the order of
+ * getConfigs() wins, which ensures that "foo" is found before
+ * "foo.old".
+ */
+class PeerIndex
+{
+ public:
+    PeerIndex() : m_valid(false) {}
+
+    /** forget everything, rebuild during next lookup */
+    void invalidate() { m_valid = false; }
+
+    /**
+     * Config for a Server Alerted Notification: the first config
+     * with a obex-bt://<btAddr> syncURL (if btAddr is not empty),
+     * otherwise the first one which has the server ID in its syncURL,
+     * otherwise the config called like the server ID.
+     *
+     * @return config name, empty if none matched
+     */
+    std::string findSANConfig(const std::string &serverID,
+                              const std::string &btAddr);
+
+    /** first config with this remoteDeviceID, empty if none */
+    std::string findByRemoteDevID(const std::string &deviceID);
+
+ private:
+    typedef std::map<std::string, std::string> Index_t;
+
+    /** the criteria of findSANConfig(), in order of decreasing priority */
+    enum SANMatch {
+        SAN_BT_ADDR,
+        SAN_SYNC_URL,
+        SAN_NAME,
+        SAN_MAX
+    };
+
+    bool m_valid;
+    /** result of SyncConfig::getConfigs() used by the last update() */
+    SyncConfig::ConfigList m_configs;
+    Index_t m_syncURLs;
+    Index_t m_btAddrs;
+    Index_t m_remoteDevIDs;
+    Index_t m_names;
+
+    /** rebuild all indices from these configs */
+    void update(const SyncConfig::ConfigList &configs);
+
+    /**
+     * update() if invalid or if configs were added or removed since
+     * the last update(), true if it was called
+     */
+    bool refresh();
+
+    /** one candidate per SANMatch, empty if none */
+    void lookupSAN(const std::string &serverID,
+                   const std::string &btAddr,
+                   std::vector<std::string> &candidates) const;
+    static std::string lookup(const Index_t &index, const std::string &key);
+
+    /** Bluetooth address in a obex-bt:// syncURL, empty for other URLs */
+    static std::string btAddrOf(const std::string &url);
+
+    /** true if the config exists and still matches the given criterion */
+    static bool matchesSAN(SANMatch match,
+                           const std::string &config,
+                           const std::string &serverID,
+                           const std::string &btAddr);
+
+    /** true if the config exists and has this remoteDeviceID */
+    static bool matchesRemoteDevID(const std::string &config,
+                                   const std::string &deviceID);
+};
+
+SE_END_CXX
+
+#endif // PEER_INDEX_H
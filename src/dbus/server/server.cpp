@@ -21,6 +21,7 @@
 #include <fstream>
 
 #include <boost/bind.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 
 #include <syncevo/GLibSupport.h>
 
@@ -33,6 +34,7 @@
 #include "restart.h"
 #include "client.h"
 #include "auto-sync-manager.h"
+#include "helper-pool.h"
 
 #include <boost/pointer_cast.hpp>
 
@@ -212,9 +214,9 @@ void Server::checkPresence(const std::string &server,
 
 void Server::getSessions(std::vector<DBusObject_t> &sessions)
 {
-    sessions.reserve(m_workQueue.size() + 1);
-    if (m_activeSession) {
-        sessions.push_back(m_activeSession->getPath());
+    sessions.reserve(m_workQueue.size() + m_activeSessions.size());
+    BOOST_FOREACH(const ActiveSession &active, m_activeSessions) {
+        sessions.push_back(active.m_session->getPath());
     }
     BOOST_FOREACH(boost::weak_ptr<Session> &session, m_workQueue) {
         boost::shared_ptr<Session> s = session.lock();
@@ -237,7 +239,7 @@ Server::Server(GMainLoop *loop,
     m_shutdownRequested(shutdownRequested),
     m_restart(restart),
     m_lastSession(time(NULL)),
-    m_activeSession(NULL),
+    m_maxActiveSessions(1),
     m_lastInfoReq(0),
     m_bluezManager(new BluezManager(*this)),
     sessionChanged(*this, "SessionChanged"),
@@ -255,6 +257,15 @@ Server::Server(GMainLoop *loop,
     struct timeval tv;
     gettimeofday(&tv, NULL);
     srand(tv.tv_usec);
+    try {
+        SyncConfig config("@default");
+        unsigned int maxSessions = config.getDBusMaxSessions();
+        if (maxSessions > 1) {
+            m_maxActiveSessions = maxSessions;
+        }
+    } catch (...) {
+        Exception::handle(HANDLE_EXCEPTION_NO_ERROR);
+    }
     add(this, &Server::getCapabilities, "GetCapabilities");
     add(this, &Server::getVersions, "GetVersions");
     add(this, &Server::attachClient, "Attach");
@@ -299,18 +310,22 @@ Server::Server(GMainLoop *loop,
 
     // connect ConfigChanged signal to source for that information
     m_configChangedSignal.connect(boost::bind(boost::ref(configChanged)));
+    m_configChangedSignal.connect(boost::bind(&PeerIndex::invalidate, &m_peerIndex));
 
     // create auto sync manager, now that server is ready
     m_autoSync = AutoSyncManager::createAutoSyncManager(*this);
+
+    m_helperPool.reset(new HelperPool(*this));
 }
 
 Server::~Server()
 {
     // make sure all other objects are gone before destructing ourselves
-    m_syncSession.reset();
+    m_syncSessions.clear();
     m_workQueue.clear();
     m_clients.clear();
     m_autoSync.reset();
+    m_helperPool.reset();
     m_infoReqMap.clear();
     m_timeouts.clear();
     m_delayDeletion.clear();
@@ -342,13 +357,15 @@ void Server::fileModified()
     SE_LOG_DEBUG(NULL, NULL, "file modified, %s shutdown: %s, %s",
                  m_shutdownRequested ? "continuing" : "initiating",
                  m_shutdownTimer ? "timer already active" : "timer not yet active",
-                 m_activeSession ? "waiting for active session to finish" : "setting timer");
+                 !m_activeSessions.empty() ? "waiting for active sessions to finish" : "setting timer");
     m_lastFileMod = Timespec::monotonic();
-    if (!m_activeSession) {
+    if (m_activeSessions.empty()) {
         m_shutdownTimer.activate(SHUTDOWN_QUIESENCE_SECONDS,
                                  boost::bind(&Server::shutdown, this));
     }
     m_shutdownRequested = true;
+    m_helperPool->drain();
+    m_peerIndex.invalidate();
 }
 
 void Server::run()
@@ -388,6 +405,7 @@ void Server::run()
 
     SE_LOG_INFO(NULL, NULL, "ready to run");
     if (!m_shutdownRequested) {
+        m_helperPool->fill();
         g_main_loop_run(m_loop);
     }
 
@@ -442,8 +460,8 @@ void Server::enqueue(const boost::shared_ptr<Session> &session)
     while (it != m_workQueue.begin()) {
         --it;
         // skip over dead sessions, they will get cleaned up elsewhere
-        boost::shared_ptr<Session> session = it->lock();
-        if (session && session->getPriority() <= session->getPriority()) {
+        boost::shared_ptr<Session> queued = it->lock();
+        if (queued && queued->getPriority() <= session->getPriority()) {
             ++it;
             break;
         }
@@ -477,29 +495,35 @@ void Server::killSessionsAsync(const std::string &peerDeviceID,
         }
     }
 
-    // Check active session. We need to wait for it to shut down cleanly.
-    boost::shared_ptr<Session> active = m_activeSessionRef.lock();
-    if (active &&
-        active->getPeerDeviceID() == peerDeviceID) {
-        SE_LOG_DEBUG(NULL, NULL, "aborting active session %s because it matches deviceID %s",
-                     active->getSessionID().c_str(),
-                     peerDeviceID.c_str());
-        // hand over work to session
-        active->abortAsync(onResult);
-    } else {
-        onResult.done();
+    // Check active sessions. We need to wait for it to shut down
+    // cleanly. Sessions for the same device use the same config and
+    // thus never run concurrently, so there is at most one.
+    BOOST_FOREACH(const ActiveSession &entry, m_activeSessions) {
+        boost::shared_ptr<Session> active = entry.m_ref.lock();
+        if (active &&
+            active->getPeerDeviceID() == peerDeviceID) {
+            SE_LOG_DEBUG(NULL, NULL, "aborting active session %s because it matches deviceID %s",
+                         active->getSessionID().c_str(),
+                         peerDeviceID.c_str());
+            // hand over work to session
+            active->abortAsync(onResult);
+            return;
+        }
     }
+    onResult.done();
 }
 
 void Server::dequeue(Session *session)
 {
     bool idle = isIdle();
 
-    if (m_syncSession.get() == session) {
-        // This is the running sync session.
-        // It's not in the work queue and we have to
-        // keep it active, so nothing to do.
-        return;
+    BOOST_FOREACH(const boost::shared_ptr<Session> &sync, m_syncSessions) {
+        if (sync.get() == session) {
+            // This is a running sync session.
+            // It's not in the work queue and we have to
+            // keep it active, so nothing to do.
+            return;
+        }
     }
 
     for (WorkQueue_t::iterator it = m_workQueue.begin();
@@ -512,12 +536,12 @@ void Server::dequeue(Session *session)
         }
     }
 
-    if (m_activeSession == session) {
-        // The session is releasing the lock, so someone else might
+    ActiveSessions_t::iterator active = findActiveSession(session);
+    if (active != m_activeSessions.end()) {
+        // The session is releasing its locks, so someone else might
         // run now.
         sessionChanged(session->getPath(), false);
-        m_activeSession = NULL;
-        m_activeSessionRef.reset();
+        m_activeSessions.erase(active);
         checkQueue();
     }
 
@@ -528,38 +552,130 @@ void Server::dequeue(Session *session)
 
 void Server::addSyncSession(Session *session)
 {
-    // Only one session can run a sync, and only the active session
-    // can make itself the sync session.
-    if (m_syncSession) {
-        if (m_syncSession.get() != session) {
-            SE_THROW("already have a sync session");
-        } else {
+    // Only an active session can make itself a sync session.
+    BOOST_FOREACH(const boost::shared_ptr<Session> &sync, m_syncSessions) {
+        if (sync.get() == session) {
             return;
         }
     }
-    m_syncSession = m_activeSessionRef.lock();
-    m_newSyncSessionSignal(m_syncSession);
-    if (!m_syncSession) {
-        SE_THROW("session should not start a sync, all clients already detached");
-    }
-    if (m_syncSession.get() != session) {
-        m_syncSession.reset();
+    ActiveSessions_t::iterator active = findActiveSession(session);
+    if (active == m_activeSessions.end()) {
         SE_THROW("inactive session asked to become sync session");
     }
+    boost::shared_ptr<Session> syncSession = active->m_ref.lock();
+    if (!syncSession) {
+        SE_THROW("session should not start a sync, all clients already detached");
+    }
+    m_syncSessions.push_back(syncSession);
+    m_newSyncSessionSignal(syncSession);
 }
 
 void Server::removeSyncSession(Session *session)
 {
-    if (session == m_syncSession.get()) {
-        // Normally the owner calls this, but if it is already gone,
-        // then do it again and thus effectively start counting from
-        // now.
-        delaySessionDestruction(m_syncSession);
-        m_syncSession.reset();
-    } else {
-        SE_LOG_DEBUG(NULL, NULL, "ignoring removeSyncSession() for session %s, it is not the sync session",
-                     session->getSessionID().c_str());
+    for (std::list< boost::shared_ptr<Session> >::iterator it = m_syncSessions.begin();
+         it != m_syncSessions.end();
+         ++it) {
+        if (it->get() == session) {
+            // Normally the owner calls this, but if it is already gone,
+            // then do it again and thus effectively start counting from
+            // now.
+            delaySessionDestruction(*it);
+            m_syncSessions.erase(it);
+            return;
+        }
+    }
+    SE_LOG_DEBUG(NULL, NULL, "ignoring removeSyncSession() for session %s, it is not a sync session",
+                 session->getSessionID().c_str());
+}
+
+Server::ActiveSessions_t::iterator Server::findActiveSession(Session *session)
+{
+    ActiveSessions_t::iterator it = m_activeSessions.begin();
+    while (it != m_activeSessions.end() &&
+           it->m_session != session) {
+        ++it;
+    }
+    return it;
+}
+
+/** adds the locks for one config, see Server::Locks_t */
+static void addConfigLocks(const std::string &configName,
+                           std::set<std::string> &locks,
+                           bool followLocal)
+{
+    std::string peer, context;
+    SyncConfig::splitConfigString(SyncConfig::normalizeConfigString(configName),
+                                  peer, context);
+    locks.insert("@" + context);
+
+    SyncConfig config(configName);
+    if (!config.exists()) {
+        // Session might create the config. Cannot tell which
+        // databases it will use, so lock everything.
+        locks.insert("*");
+        return;
+    }
+    BOOST_FOREACH(const std::string &source, config.getSyncSources()) {
+        boost::shared_ptr<PersistentSyncSourceConfig> sourceConfig = config.getSyncSourceConfig(source);
+        locks.insert(sourceConfig->getSourceType().m_backend + ":" +
+                     sourceConfig->getDatabaseID());
+    }
+
+    if (followLocal) {
+        std::vector<std::string> urls = config.getSyncURL();
+        BOOST_FOREACH(const std::string &url, urls) {
+            if (boost::starts_with(url, "local://")) {
+                addConfigLocks(url.substr(strlen("local://")), locks, false);
+            }
+        }
+    }
+}
+
+Server::Locks_t Server::getSessionLocks(Session &session)
+{
+    Locks_t locks;
+    std::string configName = session.getConfigName();
+    bool all = configName.empty();
+    BOOST_FOREACH(const std::string &flag, session.getFlags()) {
+        if (boost::iequals(flag, "all-configs")) {
+            all = true;
+        }
+    }
+    if (!all) {
+        try {
+            addConfigLocks(configName, locks, true);
+        } catch (...) {
+            // Let the session deal with the problem when it runs,
+            // but without running anything else in parallel.
+            SE_LOG_DEBUG(NULL, NULL, "session %s: cannot determine locks for config %s",
+                         session.getSessionID().c_str(),
+                         configName.c_str());
+            all = true;
+        }
+    }
+    if (all) {
+        locks.clear();
+        locks.insert("*");
+    }
+    return locks;
+}
+
+/** true if one of the locks in a is also in b */
+static bool locksConflict(const std::set<std::string> &a,
+                          const std::set<std::string> &b)
+{
+    if (a.empty() || b.empty()) {
+        return false;
+    }
+    if (a.count("*") || b.count("*")) {
+        return true;
+    }
+    BOOST_FOREACH(const std::string &lock, a) {
+        if (b.count(lock)) {
+            return true;
+        }
     }
+    return false;
 }
 
 static bool quitLoop(GMainLoop *loop)
@@ -572,12 +688,12 @@ static bool quitLoop(GMainLoop *loop)
 
 void Server::checkQueue()
 {
-    if (m_activeSession) {
-        // still busy
-        return;
-    }
-
     if (m_shutdownRequested) {
+        if (!m_activeSessions.empty()) {
+            // still busy
+            return;
+        }
+
         // Don't schedule new sessions. Instead return to Server::run().
         // But don't do it immediately: when done inside the Session.Detach()
         // call, the D-Bus response was not delivered reliably to the client
@@ -587,18 +703,55 @@ void Server::checkQueue()
         return;
     }
 
-    while (!m_workQueue.empty()) {
-        boost::shared_ptr<Session> session = m_workQueue.front().lock();
-        m_workQueue.pop_front();
-        if (session) {
+    // Activate one session at a time and then start again from the
+    // beginning, because activating a session may also modify the
+    // queue.
+    bool activated = true;
+    while (activated &&
+           m_activeSessions.size() < m_maxActiveSessions) {
+        activated = false;
+        Locks_t reserved;
+        BOOST_FOREACH(const ActiveSession &active, m_activeSessions) {
+            reserved.insert(active.m_locks.begin(), active.m_locks.end());
+        }
+
+        WorkQueue_t::iterator it = m_workQueue.begin();
+        while (it != m_workQueue.end()) {
+            boost::shared_ptr<Session> session = it->lock();
+            if (!session) {
+                it = m_workQueue.erase(it);
+                continue;
+            }
+            Locks_t locks = getSessionLocks(*session);
+            if (locksConflict(reserved, locks)) {
+                // Has to wait, and sessions after it must not
+                // take what it needs.
+                SE_LOG_DEBUG(NULL, NULL, "session %s must wait for other sessions",
+                             session->getSessionID().c_str());
+                reserved.insert(locks.begin(), locks.end());
+                ++it;
+                continue;
+            }
+
             // activate the session
-            m_activeSession = session.get();
-            m_activeSessionRef = session;
+            m_workQueue.erase(it);
+            ActiveSession active;
+            active.m_session = session.get();
+            active.m_ref = session;
+            active.m_locks = locks;
+            m_activeSessions.push_back(active);
             session->activateSession();
             sessionChanged(session->getPath(), true);
-            return;
+            activated = true;
+            break;
         }
     }
+
+    if (m_activeSessions.empty()) {
+        // Idle: replace helpers handed out to the sessions which ran
+        // before.
+        m_helperPool->fill();
+    }
 }
 
 bool Server::sessionExpired(const boost::shared_ptr<Session> &session)
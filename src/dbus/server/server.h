@@ -33,6 +33,7 @@
 #include "presence-status.h"
 #include "timeout.h"
 #include "dbus-callbacks.h"
+#include "peer-index.h"
 
 #include <syncevo/declarations.h>
 SE_BEGIN_CXX
@@ -46,6 +47,7 @@ class Restart;
 class Client;
 class GLibNotify;
 class AutoSyncManager;
+class HelperPool;
 
 /**
  * Implements the main org.syncevolution.Server interface.
@@ -96,35 +98,69 @@ class Server : public GDBusCXX::DBusObjectHelper,
 
 
     /**
-     * The session which currently holds the main lock on the server.
-     * To avoid issues with concurrent modification of data or configs,
-     * only one session may make such modifications at a time. A
-     * plain pointer which is reset by the session's deconstructor.
-     *
-     * The server doesn't hold a shared pointer to the session so
-     * that it can be deleted when the last client detaches from it.
-     *
-     * A weak pointer alone did not work because it does not provide access
-     * to the underlying pointer after the last corresponding shared
-     * pointer is gone (which triggers the deconstructing of the session).
+     * Names of the resources used by a session: the context
+     * ("@<context>") and the databases ("<backend>:<database>") of
+     * the config that the session operates on, including the target
+     * context of a local sync. "*" stands for "everything" and is
+     * used for sessions without config or with the "all-configs"
+     * flag. Sessions whose locks overlap never run concurrently.
      */
-    Session *m_activeSession;
+    typedef std::set<std::string> Locks_t;
+
+    struct ActiveSession
+    {
+        /**
+         * A plain pointer which is removed by dequeue(), called by
+         * the session's deconstructor.
+         *
+         * The server doesn't hold a shared pointer to the session so
+         * that it can be deleted when the last client detaches from it.
+         *
+         * A weak pointer alone did not work because it does not provide access
+         * to the underlying pointer after the last corresponding shared
+         * pointer is gone (which triggers the deconstructing of the session).
+         */
+        Session *m_session;
+
+        /** the weak pointer that corresponds to m_session */
+        boost::weak_ptr<Session> m_ref;
+
+        /** locks held by the session while it is active */
+        Locks_t m_locks;
+    };
+    typedef std::list<ActiveSession> ActiveSessions_t;
 
     /**
-     * The weak pointer that corresponds to m_activeSession.
+     * The sessions which currently hold locks on the server. To avoid
+     * issues with concurrent modification of data or configs, only
+     * sessions with disjoint locks may be active at the same time.
+     * See checkQueue().
      */
-    boost::weak_ptr<Session> m_activeSessionRef;
+    ActiveSessions_t m_activeSessions;
 
     /**
-     * The running sync session. Having a separate reference to it
-     * ensures that the object won't go away prematurely, even if all
+     * Upper limit for the size of m_activeSessions, set via
+     * the global "dbusMaxSessions" property. Defaults to 1 = one
+     * session at a time.
+     */
+    size_t m_maxActiveSessions;
+
+    /** find session in m_activeSessions, end() if not found */
+    ActiveSessions_t::iterator findActiveSession(Session *session);
+
+    /** determines the locks needed by a session */
+    static Locks_t getSessionLocks(Session &session);
+
+    /**
+     * The running sync sessions. Having a separate reference to them
+     * ensures that the objects won't go away prematurely, even if all
      * clients disconnect.
      *
      * The session itself needs to request this special treatment with
      * addSyncSession() and remove itself with removeSyncSession() when
      * done.
      */
-    boost::shared_ptr<Session> m_syncSession;
+    std::list< boost::shared_ptr<Session> > m_syncSessions;
 
     typedef std::list< boost::weak_ptr<Session> > WorkQueue_t;
     /**
@@ -135,7 +171,7 @@ class Server : public GDBusCXX::DBusObjectHelper,
      *
      * Active sessions are removed from this list and then continue
      * to exist as long as a client in m_clients references it or
-     * it is the currently running sync session (m_syncSession).
+     * it is a running sync session (m_syncSessions).
      */
     WorkQueue_t m_workQueue;
 
@@ -351,6 +387,12 @@ class Server : public GDBusCXX::DBusObjectHelper,
     /** Manager to automatic sync */
     boost::shared_ptr<AutoSyncManager> m_autoSync;
 
+    /** config lookup for incoming connections */
+    PeerIndex m_peerIndex;
+
+    /** idle syncevo-dbus-helper processes, handed to sessions on demand */
+    boost::shared_ptr<HelperPool> m_helperPool;
+
     //automatic termination
     AutoTerm m_autoTerm;
 
@@ -389,7 +431,7 @@ public:
     void run();
 
     /** true iff no work is pending */
-    bool isIdle() const { return !m_activeSession && m_workQueue.empty(); }
+    bool isIdle() const { return m_activeSessions.empty() && m_workQueue.empty(); }
 
     /** isIdle() might have changed its value, current value included */
     typedef boost::signals2::signal<void (bool isIdle)> IdleSignal_t;
@@ -454,7 +496,7 @@ public:
     /**
      * Remember that the session is running a sync (or some other
      * important operation) and keeps a pointer to it, to prevent
-     * deleting it. Currently can only called by the active sync
+     * deleting it. Can only be called by an active
      * session. Will fail if all clients have detached already.
      *
      * If successful, it triggers m_newSyncSessionSignal.
@@ -467,8 +509,12 @@ public:
     void removeSyncSession(Session *session);
 
     /**
-     * Checks whether the server is ready to run another session
-     * and if so, activates the first one in the queue.
+     * Checks whether the server is ready to run more sessions and if
+     * so, activates them in the order of the queue. A session is
+     * skipped while its locks conflict with those of an active
+     * session or a session before it in the queue; the latter
+     * ensures that a waiting session cannot be overtaken
+     * indefinitely by later ones.
      */
     void checkQueue();
 
@@ -559,6 +605,10 @@ public:
 
     PresenceStatus& getPresenceStatus() {return m_presence;}
 
+    HelperPool &getHelperPool() { return *m_helperPool; }
+
+    PeerIndex &getPeerIndex() { return m_peerIndex; }
+
     void clearPeerTempls() { m_matchedTempls.clear(); }
     void addPeerTempl(const string &templName, const boost::shared_ptr<SyncConfig::TemplateDescription> peerTempl);
 
@@ -25,6 +25,7 @@
 #include "info-req.h"
 #include "session-common.h"
 #include "dbus-callbacks.h"
+#include "helper-pool.h"
 
 #include <syncevo/ForkExec.h>
 #include <syncevo/SyncContext.h>
@@ -735,9 +736,17 @@ void Session::useHelperAsync(const SimpleResult &result)
         // might happen is when the helper is still starting when
         // a new request comes in. In that case we reuse the same
         // helper process for both operations.
+        //
+        // A new helper is taken from the server's pool of idle
+        // helpers if possible. Such a helper might have connected
+        // already, in which case we set up m_helper directly instead
+        // of waiting for m_onConnect.
+        GDBusCXX::DBusConnectionPtr conn;
         if (!m_forkExecParent ||
             m_forkExecParent->getState() != ForkExecParent::STARTING) {
-            m_forkExecParent = SyncEvo::ForkExecParent::create("syncevo-dbus-helper");
+            if (!m_server.getHelperPool().take(m_forkExecParent, conn)) {
+                m_forkExecParent = SyncEvo::ForkExecParent::create("syncevo-dbus-helper");
+            }
             // We own m_forkExecParent, so the "this" pointer for
             // onConnect will live longer than the signal in
             // m_forkExecParent -> no need for resource
@@ -755,6 +764,12 @@ void Session::useHelperAsync(const SimpleResult &result)
                 // startup or final shutdown.
                 m_forkExecParent->m_onOutput.connect(bind(&Session::onOutput, this, _1, _2));
             }
+
+            if (conn) {
+                onConnect(conn);
+                useHelper2(result, boost::signals2::connection());
+                return;
+            }
         }
 
         // Now also connect result with the right events. Will be
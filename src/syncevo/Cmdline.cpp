@@ -1467,43 +1467,55 @@ bool Cmdline::run() {
                 }
                 bool haveItem = false;     // have written one item
                 bool haveNewline = false;  // that item had a newline at the end
-                BOOST_FOREACH(const string &luid, m_luids) {
-                    string item;
-                    raw->readItemRaw(luid, item);
-                    if (!out) {
-                        // write into directory
-                        string fullPath = m_itemPath + "/" + luid;
-                        ofstream file((m_itemPath + "/" + luid).c_str());
-                        file << item;
-                        file.close();
-                        if (file.bad()) {
-                            SyncContext::throwError(fullPath, errno);
-                        }
-                    } else {
-                        std::string delimiter;
-                        if (haveItem) {
-                            if (m_delimiter.size() > 1 &&
-                                haveNewline &&
-                                m_delimiter[0] == '\n') {
-                                // already wrote initial newline, skip it
-                                delimiter = m_delimiter.substr(1);
-                            } else {
-                                delimiter = m_delimiter;
+                // read in batches, for sources which can fetch several items at once
+                static const size_t batchSize = 100;
+                vector<string> luids, items;
+                list<string>::const_iterator luidit = m_luids.begin();
+                while (luidit != m_luids.end()) {
+                    luids.clear();
+                    while (luidit != m_luids.end() && luids.size() < batchSize) {
+                        luids.push_back(*luidit);
+                        ++luidit;
+                    }
+                    raw->readItemsRaw(luids, items);
+                    for (size_t i = 0; i < luids.size(); i++) {
+                        const string &luid = luids[i];
+                        const string &item = items[i];
+                        if (!out) {
+                            // write into directory
+                            string fullPath = m_itemPath + "/" + luid;
+                            ofstream file((m_itemPath + "/" + luid).c_str());
+                            file << item;
+                            file.close();
+                            if (file.bad()) {
+                                SyncContext::throwError(fullPath, errno);
                             }
-                        }
-                        if (out == &std::cout) {
-                            // special case, use logging infrastructure
-                            SE_LOG_SHOW(NULL, NULL, "%s%s",
-                                        delimiter.c_str(),
-                                        item.c_str());
-                            // always prints newline
-                            haveNewline = true;
                         } else {
-                            // write to file
-                            *out << item;
-                            haveNewline = boost::ends_with(item, "\n");
+                            std::string delimiter;
+                            if (haveItem) {
+                                if (m_delimiter.size() > 1 &&
+                                    haveNewline &&
+                                    m_delimiter[0] == '\n') {
+                                    // already wrote initial newline, skip it
+                                    delimiter = m_delimiter.substr(1);
+                                } else {
+                                    delimiter = m_delimiter;
+                                }
+                            }
+                            if (out == &std::cout) {
+                                // special case, use logging infrastructure
+                                SE_LOG_SHOW(NULL, NULL, "%s%s",
+                                            delimiter.c_str(),
+                                            item.c_str());
+                                // always prints newline
+                                haveNewline = true;
+                            } else {
+                                // write to file
+                                *out << item;
+                                haveNewline = boost::ends_with(item, "\n");
+                            }
+                            haveItem = true;
                         }
-                        haveItem = true;
                     }
                 }
                 if (outFile) {
@@ -2218,7 +2230,7 @@ static bool isPropAssignment(const string &buffer) {
 
 // remove pure comment lines from buffer,
 // also empty lines,
-// also defaultPeer and keyring (because reference properties do not include global props)
+// also global properties like defaultPeer and keyring (because reference properties do not include global props)
 static string filterConfig(const string &buffer)
 {
     ostringstream res;
@@ -2232,6 +2244,8 @@ static string filterConfig(const string &buffer)
         if (!line.empty() &&
             line.find("defaultPeer =") == line.npos &&
             line.find("keyring =") == line.npos &&
+            line.find("dbusHelperPool =") == line.npos &&
+            line.find("dbusMaxSessions =") == line.npos &&
             (!boost::starts_with(line, "# ") ||
              isPropAssignment(line.substr(2)))) {
             res << line << endl;
@@ -3513,6 +3527,8 @@ protected:
                               "\n"
                               "autoSyncDelay (5M, unshared)\n"
                               "\n"
+                              "autoSyncChangeDelay (0, unshared)\n"
+                              "\n"
                               "preventSlowSync (TRUE, unshared)\n"
                               "\n"
                               "useProxy (FALSE, unshared)\n"
@@ -3563,7 +3579,11 @@ protected:
                               "\n"
                               "defaultPeer (no default, global)\n"
                               "\n"
-                              "keyring (yes, global)\n");
+                              "keyring (yes, global)\n"
+                              "\n"
+                              "dbusHelperPool (0, global)\n"
+                              "\n"
+                              "dbusMaxSessions (1, global)\n");
 
         string sourceProperties("sync (disabled, unshared, required)\n"
                                 "\n"
@@ -4442,6 +4462,7 @@ private:
                          "peers/scheduleworld/config.ini:# autoSync = 0\n"
                          "peers/scheduleworld/config.ini:# autoSyncInterval = 30M\n"
                          "peers/scheduleworld/config.ini:# autoSyncDelay = 5M\n"
+                         "peers/scheduleworld/config.ini:# autoSyncChangeDelay = 0\n"
                          "peers/scheduleworld/config.ini:# preventSlowSync = 1\n"
                          "peers/scheduleworld/config.ini:# useProxy = 0\n"
                          "peers/scheduleworld/config.ini:# proxyHost = \n"
@@ -4558,6 +4579,7 @@ private:
             "spds/syncml/config.txt:# autoSync = 0\n"
             "spds/syncml/config.txt:# autoSyncInterval = 30M\n"
             "spds/syncml/config.txt:# autoSyncDelay = 5M\n"
+            "spds/syncml/config.txt:# autoSyncChangeDelay = 0\n"
             "spds/syncml/config.txt:# preventSlowSync = 1\n"
             "spds/syncml/config.txt:# useProxy = 0\n"
             "spds/syncml/config.txt:# proxyHost = \n"
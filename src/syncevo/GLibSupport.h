@@ -117,7 +117,8 @@ SE_END_CXX
 SE_BEGIN_CXX
 
 /**
- * Wrapper around g_file_monitor_file().
+ * Wrapper around g_file_monitor(). Monitors a file or, if the
+ * path refers to a directory, the entries in it.
  * Not copyable because monitor is tied to specific callback
  * via memory address.
  */
@@ -26,6 +26,11 @@
 #include <boost/scoped_array.hpp>
 #include <boost/foreach.hpp>
 
+#ifdef ENABLE_UNIT_TESTS
+#include "test.h"
+#include <syncevo/StringDataBlob.h>
+#endif
+
 #include <syncevo/declarations.h>
 using namespace std;
 SE_BEGIN_CXX
@@ -71,16 +76,6 @@ void IniFileConfigNode::toFile(std::ostream &file) {
     }
 }
 
-void IniFileConfigNode::read()
-{
-    boost::shared_ptr<std::istream> file(m_data->read());
-    std::string line;
-    while (getline(*file, line)) {
-        m_lines.push_back(line);
-    }
-    m_modified = false;
-}
-
 
 /**
  * get property and value from line, if any present
@@ -177,14 +172,74 @@ static bool getValue(const string &line,
         !strcasecmp(curProp.c_str(), property.c_str());
 }
 
-InitStateString IniFileConfigNode::readProperty(const string &property) const
+void IniFileConfigNode::read()
+{
+    boost::shared_ptr<std::istream> file(m_data->read());
+    std::string line;
+    while (getline(*file, line)) {
+        m_lines.push_back(line);
+        addToIndex(--m_lines.end());
+    }
+    m_modified = false;
+}
+
+void IniFileConfigNode::addToIndex(const Lines_t::iterator &line)
 {
-    string value;
+    string property, value;
+    bool isComment;
 
-    BOOST_FOREACH(const string &line, m_lines) {
+    if (getContent(*line, property, value, isComment, true)) {
+        (isComment ? m_defaults : m_assignments)[property].push_back(line);
+    }
+}
+
+void IniFileConfigNode::insertIntoIndex(const Lines_t::iterator &line)
+{
+    string property, value;
+    bool isComment;
+
+    if (getContent(*line, property, value, isComment, true)) {
+        std::list<Lines_t::iterator> &lines = (isComment ? m_defaults : m_assignments)[property];
+        // Entries are sorted by their position in m_lines. Find the
+        // first one which comes after the new line.
+        std::list<Lines_t::iterator>::iterator pos = lines.begin();
+        for (Lines_t::iterator it = m_lines.begin();
+             it != line && pos != lines.end();
+             ++it) {
+            if (*pos == it) {
+                ++pos;
+            }
+        }
+        lines.insert(pos, line);
+    }
+}
+
+void IniFileConfigNode::removeFromIndex(const Lines_t::iterator &line)
+{
+    string property, value;
+    bool isComment;
+
+    if (getContent(*line, property, value, isComment, true)) {
+        Index_t &index = isComment ? m_defaults : m_assignments;
+        Index_t::iterator it = index.find(property);
+        if (it != index.end()) {
+            it->second.remove(line);
+            if (it->second.empty()) {
+                index.erase(it);
+            }
+        }
+    }
+}
+
+InitStateString IniFileConfigNode::readProperty(const string &property) const
+{
+    Index_t::const_iterator it = m_assignments.find(property);
+    if (it != m_assignments.end()) {
+        string value;
         bool isComment;
 
-        if (getValue(line, property, value, isComment, false)) {
+        // only the first instance of the property counts
+        if (getValue(*it->second.front(), property, value, isComment, false)) {
             return InitStateString(value, true);
         }
     }
@@ -208,18 +263,13 @@ void IniFileConfigNode::readProperties(ConfigProps &props) const {
 
 void IniFileConfigNode::removeProperty(const string &property)
 {
-    string value;
-
-    list<string>::iterator it = m_lines.begin();
-    while (it != m_lines.end()) {
-        const string &line = *it;
-        bool isComment;
-        if (getValue(line, property, value, isComment, false)) {
-            it = m_lines.erase(it);
-            m_modified = true;
-        } else {
-            it++;
+    Index_t::iterator it = m_assignments.find(property);
+    if (it != m_assignments.end()) {
+        BOOST_FOREACH(const Lines_t::iterator &line, it->second) {
+            m_lines.erase(line);
         }
+        m_assignments.erase(it);
+        m_modified = true;
     }
 }
 
@@ -236,20 +286,39 @@ void IniFileConfigNode::writeProperty(const string &property,
     }
     newstr += property + " = " + newvalue;
 
-    BOOST_FOREACH(string &line, m_lines) {
+    // Update an existing assignment, or if there is none, the
+    // commented out default value.
+    Index_t::iterator it = m_assignments.find(property);
+    bool found = it != m_assignments.end();
+    if (!found) {
+        it = m_defaults.find(property);
+        found = it != m_defaults.end();
+    }
+    if (found) {
+        Lines_t::iterator line = it->second.front();
         bool isComment;
 
-        if (getValue(line, property, oldvalue, isComment, true)) {
-            if (newvalue != oldvalue ||
-                (isComment && !isDefault)) {
-                line = newstr;
-                m_modified = true;
+        if (getValue(*line, property, oldvalue, isComment, true) &&
+            (newvalue != oldvalue ||
+             (isComment && !isDefault))) {
+            if (isComment == isDefault) {
+                // Same kind of line and same property, the line
+                // keeps its position in the index.
+                *line = newstr;
+            } else {
+                // invalidates "it"
+                removeFromIndex(line);
+                *line = newstr;
+                insertIntoIndex(line);
             }
-            return;
+            m_modified = true;
         }
+        return;
     }
 
-    // add each line of the comment as separate line in .ini file
+    // add each line of the comment as separate line in .ini file;
+    // index them like read() would, because a comment line might
+    // look like a commented out assignment
     if (comment.size()) {
         list<string> commentLines;
         ConfigProperty::splitComment(comment, commentLines);
@@ -258,16 +327,20 @@ void IniFileConfigNode::writeProperty(const string &property,
         }
         BOOST_FOREACH(const string &comment, commentLines) {
             m_lines.push_back(string("# ") + comment);
+            addToIndex(--m_lines.end());
         }
     }
 
     m_lines.push_back(newstr);
+    addToIndex(--m_lines.end());
     m_modified = true;
 }
 
 void IniFileConfigNode::clear()
 {
     m_lines.clear();
+    m_assignments.clear();
+    m_defaults.clear();
     m_modified = true;
 }
 
@@ -368,4 +441,117 @@ void IniHashConfigNode::writeProperty(const string &property,
 }
 
 
+#ifdef ENABLE_UNIT_TESTS
+
+class IniFileConfigNodeTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(IniFileConfigNodeTest);
+    CPPUNIT_TEST(index);
+    CPPUNIT_TEST(duplicates);
+    CPPUNIT_TEST(comments);
+    CPPUNIT_TEST_SUITE_END();
+
+    void index() {
+        boost::shared_ptr<string> data(new string);
+        data->assign("# comment\n"
+                     "foo = bar\n"
+                     "Foo = ignored\n"
+                     "\n"
+                     "# default = 1\n"
+                     "x = y\n");
+        boost::shared_ptr<DataBlob> blob(new StringDataBlob("test", data, false));
+        IniFileConfigNode node(blob);
+
+        // first instance wins, case-insensitive
+        CPPUNIT_ASSERT_EQUAL(string("bar"), node.readProperty("FOO").get());
+        CPPUNIT_ASSERT(!node.readProperty("default").wasSet());
+        CPPUNIT_ASSERT(!node.readProperty("comment").wasSet());
+
+        // update in place, including commented out default
+        node.setProperty("x", "z");
+        node.setProperty("default", "2");
+        CPPUNIT_ASSERT_EQUAL(string("z"), node.readProperty("x").get());
+        CPPUNIT_ASSERT_EQUAL(string("2"), node.readProperty("default").get());
+
+        // removes all instances
+        node.removeProperty("foo");
+        CPPUNIT_ASSERT(!node.readProperty("foo").wasSet());
+
+        // append new property, turn existing one into comment
+        node.setProperty("new", "value");
+        node.setProperty("x", InitStateString("unset", false));
+        CPPUNIT_ASSERT(!node.readProperty("x").wasSet());
+        node.setProperty("x", "set");
+        CPPUNIT_ASSERT_EQUAL(string("set"), node.readProperty("x").get());
+
+        node.flush();
+        CPPUNIT_ASSERT_EQUAL(string("# comment\n"
+                                    "\n"
+                                    "default = 2\n"
+                                    "x = set\n"
+                                    "new = value\n"),
+                             *data);
+
+        // index must be rebuilt
+        node.reload();
+        CPPUNIT_ASSERT_EQUAL(string("2"), node.readProperty("default").get());
+        node.clear();
+        CPPUNIT_ASSERT(!node.readProperty("default").wasSet());
+    }
+
+    void duplicates() {
+        boost::shared_ptr<string> data(new string);
+        data->assign("foo = 1\n"
+                     "foo = 2\n"
+                     "# foo = 3\n");
+        boost::shared_ptr<DataBlob> blob(new StringDataBlob("test", data, false));
+        IniFileConfigNode node(blob);
+
+        // updating the first instance must not reorder the duplicates
+        node.setProperty("foo", "a");
+        CPPUNIT_ASSERT_EQUAL(string("a"), node.readProperty("foo").get());
+        node.setProperty("foo", "b");
+        CPPUNIT_ASSERT_EQUAL(string("b"), node.readProperty("foo").get());
+
+        // turning it into a comment keeps its position among the defaults
+        node.setProperty("foo", InitStateString("unset", false));
+        CPPUNIT_ASSERT_EQUAL(string("2"), node.readProperty("foo").get());
+        node.removeProperty("foo");
+        node.setProperty("foo", "c");
+        CPPUNIT_ASSERT_EQUAL(string("c"), node.readProperty("foo").get());
+
+        node.flush();
+        CPPUNIT_ASSERT_EQUAL(string("foo = c\n"
+                                    "# foo = 3\n"),
+                             *data);
+    }
+
+    void comments() {
+        boost::shared_ptr<string> data(new string);
+        boost::shared_ptr<DataBlob> blob(new StringDataBlob("test", data, false));
+        IniFileConfigNode node(blob);
+
+        // a comment line which looks like a commented out default
+        // must be found with and without reloading
+        node.setProperty("foo", InitStateString("1", true), "example:\nbar = 2");
+        node.setProperty("bar", "3");
+        node.flush();
+        string expected("# example:\n"
+                        "bar = 3\n"
+                        "foo = 1\n");
+        CPPUNIT_ASSERT_EQUAL(expected, *data);
+
+        node.reload();
+        node.setProperty("bar", "4");
+        node.flush();
+        CPPUNIT_ASSERT_EQUAL(string("# example:\n"
+                                    "bar = 4\n"
+                                    "foo = 1\n"),
+                             *data);
+    }
+};
+
+SYNCEVOLUTION_TEST_SUITE_REGISTRATION(IniFileConfigNodeTest);
+
+#endif // ENABLE_UNIT_TESTS
+
 SE_END_CXX
@@ -25,6 +25,7 @@
 
 #include <string>
 #include <list>
+#include <map>
 
 #include <syncevo/declarations.h>
 SE_BEGIN_CXX
@@ -72,10 +73,36 @@ class IniBaseConfigNode: public ConfigNode {
  *
  */
 class IniFileConfigNode : public IniBaseConfigNode {
-    std::list<std::string> m_lines;
+    typedef std::list<std::string> Lines_t;
+    Lines_t m_lines;
+
+    /**
+     * Positions of lines with a "property = value" assignment
+     * (m_assignments) or a commented out "# property = value"
+     * assignment (m_defaults), indexed by property name
+     * (case-insensitive). Built by read() and kept up-to-date by all
+     * methods which modify m_lines, so that looking up a property
+     * does not have to parse all lines.
+     */
+    typedef std::map<std::string, std::list<Lines_t::iterator>, Nocase<std::string> > Index_t;
+    Index_t m_assignments;
+    Index_t m_defaults;
 
     void read();
 
+    /**
+     * add line to m_assignments or m_defaults, if it is an
+     * assignment; the line must come after all lines already in the
+     * index
+     */
+    void addToIndex(const Lines_t::iterator &line);
+
+    /** like addToIndex(), for a line anywhere in m_lines */
+    void insertIntoIndex(const Lines_t::iterator &line);
+
+    /** undo addToIndex(), must be called before modifying or removing the line */
+    void removeFromIndex(const Lines_t::iterator &line);
+
  protected:
     virtual void toFile(std::ostream &file);
 
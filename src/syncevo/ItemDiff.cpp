@@ -0,0 +1,544 @@
+/*
+ * Copyright (C) 2012 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ */
+
+#include <syncevo/ItemDiff.h>
+#include <syncevo/lcs.h>
+#include <syncevo/util.h>
+#include <test.h>
+
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+#include <list>
+#include <map>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <boost/foreach.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include <syncevo/declarations.h>
+SE_BEGIN_CXX
+
+/**
+ * Properties which change with every modification or are added
+ * by the storage, without being relevant for the user.
+ */
+static bool isVolatileProperty(const std::string &name)
+{
+    return name == "PRODID" ||
+        name == "CREATED" ||
+        name == "DTSTAMP" ||
+        name == "LAST-MODIFIED" ||
+        name == "REV";
+}
+
+/**
+ * Undo line continuation and remove carriage returns.
+ */
+static std::string unfold(const std::string &item)
+{
+    std::string res;
+    res.reserve(item.size());
+    for (size_t i = 0; i < item.size(); i++) {
+        char c = item[i];
+        if (c == '\r') {
+            continue;
+        }
+        if (c == '\n' &&
+            i + 1 < item.size() &&
+            (item[i + 1] == ' ' || item[i + 1] == '\t')) {
+            i++;
+            continue;
+        }
+        res += c;
+    }
+    return res;
+}
+
+/**
+ * Offset of the colon which separates name and parameters from the value,
+ * std::string::npos if none. Colons inside quoted parameter values
+ * are skipped.
+ */
+static size_t findValue(const std::string &line)
+{
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); i++) {
+        if (line[i] == '"') {
+            quoted = !quoted;
+        } else if (line[i] == ':' && !quoted) {
+            return i;
+        }
+    }
+    return std::string::npos;
+}
+
+/**
+ * @retval uid     value of the first UID property, empty if none
+ * @return normalized item, see NormalizeItem()
+ */
+static std::string normalize(const std::string &item, std::string &uid)
+{
+    std::string unfolded = unfold(item);
+    std::istringstream in(unfolded);
+    std::string line;
+    std::string res;
+    bool uidIrrelevant = false;
+
+    uid = "";
+    while (std::getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        size_t colon = findValue(line);
+        if (colon == std::string::npos) {
+            // not a property, keep it as it is
+            res += line;
+            res += '\n';
+            continue;
+        }
+        std::string value = line.substr(colon + 1);
+        std::string nameAndParams = line.substr(0, colon);
+        std::vector<std::string> params;
+        boost::split(params, nameAndParams, boost::is_any_of(";"));
+        std::string name = boost::to_upper_copy(params.front());
+        params.erase(params.begin());
+
+        if (name == "BEGIN" &&
+            (value == "VCARD" || value == "VJOURNAL")) {
+            // UID may differ, but only in vCards and journal entries:
+            // in calendar events the UID needs to be preserved to handle
+            // meeting invitations/replies correctly
+            uidIrrelevant = true;
+        }
+        if (name == "UID") {
+            if (uid.empty()) {
+                uid = value;
+            }
+            if (uidIrrelevant) {
+                continue;
+            }
+        }
+        if (isVolatileProperty(name)) {
+            continue;
+        }
+        // the distinction between an empty and a missing property
+        // is vague, so ignore empty properties
+        if (value.find_first_not_of(';') == std::string::npos) {
+            continue;
+        }
+
+        // ignore charset specifications, assume UTF-8, and
+        // replace parameters with a sorted parameter list
+        bool base64 = false;
+        std::vector<std::string> relevant;
+        BOOST_FOREACH (const std::string &param, params) {
+            if (boost::iequals(param, "CHARSET=UTF-8") ||
+                boost::iequals(param, "CHARSET=\"UTF-8\"")) {
+                continue;
+            }
+            if (boost::iequals(param, "ENCODING=B") ||
+                boost::iequals(param, "ENCODING=BASE64")) {
+                base64 = true;
+            }
+            relevant.push_back(param);
+        }
+        std::sort(relevant.begin(), relevant.end());
+
+        if (base64 && name == "PHOTO") {
+            // Don't show base64 encoded data (makes diff very long),
+            // only its size and a hash. White space inside the data
+            // is irrelevant.
+            std::string data;
+            BOOST_FOREACH (char c, value) {
+                if (!isspace(c)) {
+                    data += c;
+                }
+            }
+            res += StringPrintf("PHOTO: %lu base64 characters, hash %lx\n",
+                                (unsigned long)data.size(),
+                                Hash(data));
+            continue;
+        }
+
+        res += name;
+        BOOST_FOREACH (const std::string &param, relevant) {
+            res += ';';
+            res += param;
+        }
+        res += ':';
+        res += value;
+        res += '\n';
+    }
+    return res;
+}
+
+std::string NormalizeItem(const std::string &item)
+{
+    std::string uid;
+    return normalize(item, uid);
+}
+
+namespace {
+    /** marks each line of a record like synccompare does internally */
+    enum LineType {
+        LINE_UNCHANGED,
+        LINE_OLD,
+        LINE_NEW
+    };
+    typedef std::vector< std::pair<LineType, std::string> > Record_t;
+
+    /** a normalized item, its UID and whether it was paired */
+    struct Item {
+        Item(const std::string &item) : m_paired(false) { m_normalized = normalize(item, m_uid); }
+        bool operator < (const Item &other) const { return m_normalized < other.m_normalized; }
+
+        std::string m_normalized;
+        std::string m_uid;
+        bool m_paired;
+    };
+}
+
+static void splitLines(const std::string &normalized, std::vector<std::string> &lines)
+{
+    std::istringstream in(normalized);
+    std::string line;
+    while (std::getline(in, line)) {
+        lines.push_back(line);
+    }
+}
+
+/** add all lines of one item with the same type */
+static void markLines(const std::string &normalized, LineType type, Record_t &record)
+{
+    std::vector<std::string> lines;
+    splitLines(normalized, lines);
+    BOOST_FOREACH (const std::string &line, lines) {
+        record.push_back(std::make_pair(type, line));
+    }
+}
+
+/** line-by-line comparison of two items, based on their longest common subsequence */
+static void diffLines(const std::string &oldNormalized, const std::string &newNormalized, Record_t &record)
+{
+    typedef std::vector<std::string> Lines_t;
+    Lines_t a, b;
+    splitLines(oldNormalized, a);
+    splitLines(newNormalized, b);
+
+    std::vector< LCS::Entry<std::string> > common;
+    LCS::lcs(a, b, std::back_inserter(common), LCS::accessor_sequence<Lines_t>());
+
+    size_t i = 0, j = 0;
+    BOOST_FOREACH (const LCS::Entry<std::string> &entry, common) {
+        // indices in the result start at 1
+        while (i + 1 < entry.index_a) {
+            record.push_back(std::make_pair(LINE_OLD, a[i++]));
+        }
+        while (j + 1 < entry.index_b) {
+            record.push_back(std::make_pair(LINE_NEW, b[j++]));
+        }
+        record.push_back(std::make_pair(LINE_UNCHANGED, a[i]));
+        i++;
+        j++;
+    }
+    while (i < a.size()) {
+        record.push_back(std::make_pair(LINE_OLD, a[i++]));
+    }
+    while (j < b.size()) {
+        record.push_back(std::make_pair(LINE_NEW, b[j++]));
+    }
+}
+
+/** number of characters in UTF-8 string */
+static size_t printableLength(const std::string &str)
+{
+    size_t len = 0;
+    BOOST_FOREACH (char c, str) {
+        if ((c & 0xC0) != 0x80) {
+            len++;
+        }
+    }
+    return len;
+}
+
+static std::string pad(const std::string &str, size_t width)
+{
+    size_t len = printableLength(str);
+    return len < width ? str + std::string(width - len, ' ') : str;
+}
+
+/** prints one record side-by-side, in the same format as synccompare */
+static void printRecord(const Record_t &record, size_t width, std::ostream &out)
+{
+    // old lines are preserved for merging them with new ones
+    std::list<std::string> buffer;
+    BOOST_FOREACH (const Record_t::value_type &line, record) {
+        switch (line.first) {
+        case LINE_UNCHANGED:
+            BOOST_FOREACH (const std::string &old, buffer) {
+                out << pad(old, width) << " <\n";
+            }
+            buffer.clear();
+            out << pad(line.second, width) << "   " << line.second << "\n";
+            break;
+        case LINE_OLD:
+            buffer.push_back(line.second);
+            break;
+        case LINE_NEW:
+            if (!buffer.empty()) {
+                out << pad(buffer.front(), width) << " | " << line.second << "\n";
+                buffer.pop_front();
+            } else {
+                out << std::string(width, ' ') << " > " << line.second << "\n";
+            }
+            break;
+        }
+    }
+    BOOST_FOREACH (const std::string &old, buffer) {
+        out << pad(old, width) << " <\n";
+    }
+}
+
+bool CompareItems(const std::vector<std::string> &oldItems,
+                  const std::vector<std::string> &newItems,
+                  const ItemDiffLabels &labels,
+                  std::ostream &out,
+                  int columns)
+{
+    std::vector<Item> oldNormalized(oldItems.begin(), oldItems.end());
+    std::vector<Item> newNormalized(newItems.begin(), newItems.end());
+    std::sort(oldNormalized.begin(), oldNormalized.end());
+    std::sort(newNormalized.begin(), newNormalized.end());
+
+    // Remove items which are identical on both sides, in a single
+    // pass over both sorted lists. Only the remaining ones need to
+    // be compared line by line.
+    std::vector<Item> removed, added;
+    std::vector<Item>::const_iterator oldIt = oldNormalized.begin(),
+        newIt = newNormalized.begin();
+    while (oldIt != oldNormalized.end() ||
+           newIt != newNormalized.end()) {
+        if (newIt == newNormalized.end() ||
+            (oldIt != oldNormalized.end() && *oldIt < *newIt)) {
+            removed.push_back(*oldIt++);
+        } else if (oldIt == oldNormalized.end() ||
+                   *newIt < *oldIt) {
+            added.push_back(*newIt++);
+        } else {
+            ++oldIt;
+            ++newIt;
+        }
+    }
+    if (removed.empty() && added.empty()) {
+        return false;
+    }
+
+    // Pair modified items via their UID. Records are sorted by the
+    // normalized content of the item on the left side, like
+    // synccompare sorts all items.
+    typedef std::map<std::string, size_t> UIDs_t;
+    UIDs_t uids;
+    for (size_t i = 0; i < removed.size(); i++) {
+        if (!removed[i].m_uid.empty()) {
+            uids.insert(std::make_pair(removed[i].m_uid, i));
+        }
+    }
+    typedef std::multimap<std::string, Record_t> Records_t;
+    Records_t records;
+    BOOST_FOREACH (const Item &item, added) {
+        UIDs_t::iterator it = item.m_uid.empty() ?
+            uids.end() :
+            uids.find(item.m_uid);
+        Record_t record;
+        if (it != uids.end()) {
+            Item &old = removed[it->second];
+            old.m_paired = true;
+            uids.erase(it);
+            diffLines(old.m_normalized, item.m_normalized, record);
+            records.insert(std::make_pair(old.m_normalized, record));
+        } else {
+            markLines(item.m_normalized, LINE_NEW, record);
+            records.insert(std::make_pair(item.m_normalized, record));
+        }
+    }
+    BOOST_FOREACH (const Item &item, removed) {
+        if (!item.m_paired) {
+            Record_t record;
+            markLines(item.m_normalized, LINE_OLD, record);
+            records.insert(std::make_pair(item.m_normalized, record));
+        }
+    }
+
+    size_t width = columns > 3 ? (columns - 3) / 2 : 1;
+    std::string separator(width * 2 + 3, '-');
+    out << std::string(width > labels.m_left.size() ? width - labels.m_left.size() : 0, ' ')
+        << labels.m_left << " | " << labels.m_right << "\n"
+        << std::string(width > labels.m_removed.size() ? width - labels.m_removed.size() : 0, ' ')
+        << labels.m_removed << " <\n"
+        << std::string(width, ' ') << " > " << labels.m_added << "\n"
+        << separator << "\n";
+    BOOST_FOREACH (const Records_t::value_type &record, records) {
+        printRecord(record.second, width, out);
+        out << separator << "\n";
+    }
+    return true;
+}
+
+static void readItem(const std::string &path, std::vector<std::string> &items)
+{
+    std::string item;
+    if (!ReadFile(path, item)) {
+        SE_THROW(path + ": reading item failed");
+    }
+    items.push_back(item);
+}
+
+bool CompareItemDirs(const std::string &oldDir,
+                     const std::string &newDir,
+                     const ItemDiffLabels &labels,
+                     std::ostream &out,
+                     int columns)
+{
+    // Build map from inode to file name(s); each inode
+    // might be used more than once.
+    typedef std::pair<dev_t, ino_t> Inode_t;
+    typedef std::map< Inode_t, std::list<std::string> > Inodes_t;
+    Inodes_t oldInodes;
+    ReadDir oldEntries(oldDir);
+    BOOST_FOREACH (const std::string &entry, oldEntries) {
+        std::string path = oldDir + "/" + entry;
+        struct stat buf;
+        if (!stat(path.c_str(), &buf) && S_ISREG(buf.st_mode)) {
+            oldInodes[Inode_t(buf.st_dev, buf.st_ino)].push_back(path);
+        }
+    }
+
+    // Skip common files, read the others.
+    std::vector<std::string> oldItems, newItems;
+    ReadDir newEntries(newDir);
+    BOOST_FOREACH (const std::string &entry, newEntries) {
+        std::string path = newDir + "/" + entry;
+        struct stat buf;
+        if (stat(path.c_str(), &buf) || !S_ISREG(buf.st_mode)) {
+            continue;
+        }
+        Inodes_t::iterator it = oldInodes.find(Inode_t(buf.st_dev, buf.st_ino));
+        if (it != oldInodes.end() && !it->second.empty()) {
+            it->second.pop_back();
+        } else {
+            readItem(path, newItems);
+        }
+    }
+    BOOST_FOREACH (const Inodes_t::value_type &inode, oldInodes) {
+        BOOST_FOREACH (const std::string &path, inode.second) {
+            readItem(path, oldItems);
+        }
+    }
+
+    return CompareItems(oldItems, newItems, labels, out, columns);
+}
+
+#ifdef ENABLE_UNIT_TESTS
+
+class ItemDiffTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(ItemDiffTest);
+    CPPUNIT_TEST(normalize);
+    CPPUNIT_TEST(compare);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void normalize()
+    {
+        CPPUNIT_ASSERT_EQUAL(std::string("BEGIN:VCARD\n"
+                                         "VERSION:3.0\n"
+                                         "FN:John Doe\n"
+                                         "TEL;TYPE=CELL;TYPE=WORK:1234\n"
+                                         "NOTE:long note\n"
+                                         "END:VCARD\n"),
+                             NormalizeItem("BEGIN:VCARD\r\n"
+                                           "VERSION:3.0\r\n"
+                                           "UID:foo\r\n"
+                                           "REV:20120101T000000Z\r\n"
+                                           "FN;CHARSET=UTF-8:John Doe\r\n"
+                                           "N:;;;;\r\n"
+                                           "TEL;TYPE=WORK;TYPE=CELL:1234\r\n"
+                                           "NOTE:long\r\n"
+                                           "  note\r\n"
+                                           "END:VCARD\r\n"));
+
+        // UID is relevant in calendar items
+        CPPUNIT_ASSERT_EQUAL(std::string("BEGIN:VCALENDAR\n"
+                                         "BEGIN:VEVENT\n"
+                                         "UID:foo\n"
+                                         "SUMMARY:meeting\n"
+                                         "END:VEVENT\n"
+                                         "END:VCALENDAR\n"),
+                             NormalizeItem("BEGIN:VCALENDAR\n"
+                                           "PRODID:-//test\n"
+                                           "BEGIN:VEVENT\n"
+                                           "UID:foo\n"
+                                           "DTSTAMP:20120101T000000Z\n"
+                                           "LAST-MODIFIED:20120101T000000Z\n"
+                                           "SUMMARY:meeting\n"
+                                           "END:VEVENT\n"
+                                           "END:VCALENDAR\n"));
+    }
+
+    void compare()
+    {
+        std::vector<std::string> oldItems, newItems;
+        oldItems.push_back("BEGIN:VCARD\nUID:1\nREV:1\nFN:unchanged\nEND:VCARD\n");
+        oldItems.push_back("BEGIN:VCARD\nUID:2\nFN:modified\nTEL:1\nEND:VCARD\n");
+        oldItems.push_back("BEGIN:VCARD\nUID:3\nFN:removed\nEND:VCARD\n");
+        newItems.push_back("BEGIN:VCARD\nUID:2\nFN:modified\nTEL:2\nEND:VCARD\n");
+        newItems.push_back("BEGIN:VCARD\nUID:1\nREV:2\nFN:unchanged\nEND:VCARD\n");
+
+        std::ostringstream out;
+        CPPUNIT_ASSERT(!CompareItems(oldItems, oldItems, ItemDiffLabels(), out, 43));
+        CPPUNIT_ASSERT_EQUAL(std::string(""), out.str());
+
+        CPPUNIT_ASSERT(CompareItems(oldItems, newItems, ItemDiffLabels(), out, 43));
+        CPPUNIT_ASSERT_EQUAL(std::string("         before sync | after sync\n"
+                                         " removed during sync <\n"
+                                         "                     > added during sync\n"
+                                         "-------------------------------------------\n"
+                                         "BEGIN:VCARD            BEGIN:VCARD\n"
+                                         "FN:modified            FN:modified\n"
+                                         "TEL:1                | TEL:2\n"
+                                         "END:VCARD              END:VCARD\n"
+                                         "-------------------------------------------\n"
+                                         "BEGIN:VCARD          <\n"
+                                         "FN:removed           <\n"
+                                         "END:VCARD            <\n"
+                                         "-------------------------------------------\n"),
+                             out.str());
+    }
+};
+
+SYNCEVOLUTION_TEST_SUITE_REGISTRATION(ItemDiffTest);
+
+#endif // ENABLE_UNIT_TESTS
+
+SE_END_CXX
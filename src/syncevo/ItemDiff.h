@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2012 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ */
+
+#ifndef INCL_SYNCEVOLUTION_ITEMDIFF
+# define INCL_SYNCEVOLUTION_ITEMDIFF
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include <syncevo/declarations.h>
+SE_BEGIN_CXX
+
+/**
+ * Headings used when printing differences between two sets of items,
+ * same meaning as CLIENT_TEST_LEFT_NAME/RIGHT_NAME/REMOVED/ADDED
+ * in synccompare.
+ */
+struct ItemDiffLabels
+{
+    ItemDiffLabels(const std::string &left = "before sync",
+                   const std::string &right = "after sync",
+                   const std::string &removed = "removed during sync",
+                   const std::string &added = "added during sync") :
+        m_left(left),
+        m_right(right),
+        m_removed(removed),
+        m_added(added)
+    {}
+
+    std::string m_left, m_right, m_removed, m_added;
+};
+
+/**
+ * Turns a single vCard or iCalendar item into a form where
+ * irrelevant differences are removed: line continuations, carriage
+ * returns, properties which change with every modification (REV,
+ * LAST-MODIFIED, DTSTAMP, ...), empty properties, order of
+ * parameters, UTF-8 charset. Inline base64 PHOTO data is replaced
+ * by its size and a hash.
+ *
+ * This covers the parts of synccompare's normalization which matter
+ * when comparing dumps of the same local database; the peer-specific
+ * workarounds of that script are not needed for that.
+ */
+std::string NormalizeItem(const std::string &item);
+
+/**
+ * Compares two sets of items and prints the differences side-by-side
+ * in the same format as synccompare. Identical items are skipped.
+ * The remaining ones are paired by UID and compared line by line
+ * with LCS::lcs(), so the cost of the comparison depends on the
+ * number and size of modified items, not on the size of the
+ * database.
+ *
+ * @param oldItems     items on the left side, in their original format
+ * @param newItems     items on the right side
+ * @param labels       headings for the output
+ * @param out          receives the output, nothing if no differences
+ * @param columns      total width of the output
+ * @return true if there were differences
+ */
+bool CompareItems(const std::vector<std::string> &oldItems,
+                  const std::vector<std::string> &newItems,
+                  const ItemDiffLabels &labels,
+                  std::ostream &out,
+                  int columns = 80);
+
+/**
+ * Same as CompareItems() for two directories with one item per
+ * file, as created for database dumps. Files which are hard links
+ * to the same inode are known to be identical and therefore not
+ * even read.
+ *
+ * @throw Exception if one of the directories or files cannot be read
+ */
+bool CompareItemDirs(const std::string &oldDir,
+                     const std::string &newDir,
+                     const ItemDiffLabels &labels,
+                     std::ostream &out,
+                     int columns = 80);
+
+SE_END_CXX
+
+#endif // INCL_SYNCEVOLUTION_ITEMDIFF
@@ -1475,6 +1475,21 @@ static ConfigProperty globalPropKeyring("keyring",
                                         "of retrieving the password from the keyring.\n",
                                         "yes");
 
+static UIntConfigProperty globalPropDBusHelperPool("dbusHelperPool",
+                                                   "Number of syncevo-dbus-helper processes which the D-Bus server\n"
+                                                   "keeps running in advance, so that a new session does not have\n"
+                                                   "to wait for starting one. 0 starts a helper for each session\n"
+                                                   "when it needs one. Read when the D-Bus server starts.\n",
+                                                   "0");
+
+static UIntConfigProperty globalPropDBusMaxSessions("dbusMaxSessions",
+                                                    "Maximum number of sessions which the D-Bus server runs at\n"
+                                                    "the same time. Only sessions which use different configuration\n"
+                                                    "contexts and databases run concurrently, others are queued.\n"
+                                                    "0 and 1 run one session at a time. Read when the D-Bus server\n"
+                                                    "starts.\n",
+                                                    "1");
+
 static StringConfigProperty syncPropAutoSync("autoSync",
                                              "Controls automatic synchronization. Currently,\n"
                                              "automatic synchronization is done by running\n"
@@ -1504,9 +1519,9 @@ static SecondsConfigProperty syncPropAutoSyncInterval("autoSyncInterval",
                                                       "side. Some SyncML server operators only allow a\n"
                                                       "certain number of sessions per day.\n"
                                                       "The value 0 has the effect of only running automatic\n"
-                                                      "synchronization when changes are detected (not\n"
-                                                      "implemented yet, therefore it basically disables\n"
-                                                      "automatic synchronization).\n",
+                                                      "synchronization when changes are detected (see\n"
+                                                      "autoSyncChangeDelay). Without change detection it\n"
+                                                      "basically disables automatic synchronization.\n",
                                                       "30M");
 
 static SecondsConfigProperty syncPropAutoSyncDelay("autoSyncDelay",
@@ -1522,6 +1537,17 @@ static SecondsConfigProperty syncPropAutoSyncDelay("autoSyncDelay",
                                                    "enough to complete the synchronization.\n",
                                                    "5M");
 
+static SecondsConfigProperty syncPropAutoSyncChangeDelay("autoSyncChangeDelay",
+                                                         "If not zero, the D-Bus server watches the local databases\n"
+                                                         "of a peer with automatic synchronization enabled for changes\n"
+                                                         "and starts a sync once no further change was seen for this\n"
+                                                         "duration, specified in seconds or 1h30m5s format, without\n"
+                                                         "waiting for the autoSyncInterval to expire. Not all backends\n"
+                                                         "support watching; their databases are only synchronized at\n"
+                                                         "the regular interval, or not at all if autoSyncInterval\n"
+                                                         "is 0.\n",
+                                                         "0");
+
 /* config and on-disk file versionsing */
 static IntConfigProperty propRootMinVersion("rootMinVersion", "");
 static IntConfigProperty propRootCurVersion("rootCurVersion", "");
@@ -1599,6 +1625,7 @@ public:
         registry.push_back(&syncPropAutoSync);
         registry.push_back(&syncPropAutoSyncInterval);
         registry.push_back(&syncPropAutoSyncDelay);
+        registry.push_back(&syncPropAutoSyncChangeDelay);
         registry.push_back(&syncPropPreventSlowSync);
         registry.push_back(&syncPropUseProxy);
         registry.push_back(&syncPropProxyHost);
@@ -1630,6 +1657,8 @@ public:
         registry.push_back(&syncPropDeviceData);
         registry.push_back(&globalPropDefaultPeer);
         registry.push_back(&globalPropKeyring);
+        registry.push_back(&globalPropDBusHelperPool);
+        registry.push_back(&globalPropDBusMaxSessions);
 
 #if 0
         // Must not be registered! Not valid for --sync-property and
@@ -1673,6 +1702,8 @@ public:
         // global sync properties
         globalPropDefaultPeer.setSharing(ConfigProperty::GLOBAL_SHARING);
         globalPropKeyring.setSharing(ConfigProperty::GLOBAL_SHARING);
+        globalPropDBusHelperPool.setSharing(ConfigProperty::GLOBAL_SHARING);
+        globalPropDBusMaxSessions.setSharing(ConfigProperty::GLOBAL_SHARING);
         propRootMinVersion.setSharing(ConfigProperty::GLOBAL_SHARING);
         propRootCurVersion.setSharing(ConfigProperty::GLOBAL_SHARING);
 
@@ -1976,6 +2007,10 @@ InitStateString SyncConfig::getDefaultPeer() const { return globalPropDefaultPee
 void SyncConfig::setDefaultPeer(const string &value) { globalPropDefaultPeer.setProperty(*getNode(globalPropDefaultPeer), value); }
 InitStateTri SyncConfig::getKeyring() const { return globalPropKeyring.getProperty(*getNode(globalPropKeyring)); }
 void SyncConfig::setKeyring(const string &value) { globalPropKeyring.setProperty(*getNode(globalPropKeyring), value); }
+InitState<unsigned int> SyncConfig::getDBusHelperPool() const { return globalPropDBusHelperPool.getPropertyValue(*getNode(globalPropDBusHelperPool)); }
+void SyncConfig::setDBusHelperPool(unsigned int value) { globalPropDBusHelperPool.setProperty(*getNode(globalPropDBusHelperPool), value); }
+InitState<unsigned int> SyncConfig::getDBusMaxSessions() const { return globalPropDBusMaxSessions.getPropertyValue(*getNode(globalPropDBusMaxSessions)); }
+void SyncConfig::setDBusMaxSessions(unsigned int value) { globalPropDBusMaxSessions.setProperty(*getNode(globalPropDBusMaxSessions), value); }
 
 InitStateString SyncConfig::getAutoSync() const { return syncPropAutoSync.getProperty(*getNode(syncPropAutoSync)); }
 void SyncConfig::setAutoSync(const string &value, bool temporarily) { syncPropAutoSync.setProperty(*getNode(syncPropAutoSync), value, temporarily); }
@@ -1983,6 +2018,8 @@ InitState<unsigned int> SyncConfig::getAutoSyncInterval() const { return syncPro
 void SyncConfig::setAutoSyncInterval(unsigned int value, bool temporarily) { syncPropAutoSyncInterval.setProperty(*getNode(syncPropAutoSyncInterval), value, temporarily); }
 InitState<unsigned int> SyncConfig::getAutoSyncDelay() const { return syncPropAutoSyncDelay.getPropertyValue(*getNode(syncPropAutoSyncDelay)); }
 void SyncConfig::setAutoSyncDelay(unsigned int value, bool temporarily) { syncPropAutoSyncDelay.setProperty(*getNode(syncPropAutoSyncDelay), value, temporarily); }
+InitState<unsigned int> SyncConfig::getAutoSyncChangeDelay() const { return syncPropAutoSyncChangeDelay.getPropertyValue(*getNode(syncPropAutoSyncChangeDelay)); }
+void SyncConfig::setAutoSyncChangeDelay(unsigned int value, bool temporarily) { syncPropAutoSyncChangeDelay.setProperty(*getNode(syncPropAutoSyncChangeDelay), value, temporarily); }
 
 std::string SyncConfig::findSSLServerCertificate()
 {
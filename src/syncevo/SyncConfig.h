@@ -1386,6 +1386,12 @@ class SyncConfig {
     virtual InitStateTri getKeyring() const;
     virtual void setKeyring(const std::string &value);
 
+    virtual InitState<unsigned int> getDBusHelperPool() const;
+    virtual void setDBusHelperPool(unsigned int value);
+
+    virtual InitState<unsigned int> getDBusMaxSessions() const;
+    virtual void setDBusMaxSessions(unsigned int value);
+
     virtual InitStateString getLogDir() const;
     virtual void setLogDir(const std::string &value, bool temporarily = false);
 
@@ -1534,6 +1540,8 @@ class SyncConfig {
     virtual void setAutoSyncInterval(unsigned int value, bool temporarily = false);
     virtual InitState<unsigned int> getAutoSyncDelay() const;
     virtual void setAutoSyncDelay(unsigned int value, bool temporarily = false);
+    virtual InitState<unsigned int> getAutoSyncChangeDelay() const;
+    virtual void setAutoSyncChangeDelay(unsigned int value, bool temporarily = false);
 
     /**
      * Specifies whether WBXML is to be used (default).
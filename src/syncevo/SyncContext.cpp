@@ -26,6 +26,8 @@
 #include <syncevo/SyncContext.h>
 #include <syncevo/SyncSource.h>
 #include <syncevo/util.h>
+#include <syncevo/ItemDiff.h>
+#include <syncevo/SyncMLHeader.h>
 #include <syncevo/SuspendFlags.h>
 
 #include <syncevo/SafeConfigNode.h>
@@ -147,6 +149,12 @@ public:
     // internal prefix for backup directory name: "SyncEvolution-"
     static const char* const DIR_PREFIX;
 
+    // name of the directory with items shared by all database dumps
+    static const char* const ITEM_STORE;
+
+    // name of the file with a summary of all sessions in the directory
+    static const char* const SESSION_INDEX;
+
     /**
      * Compare two directory by its creation time encoded
      * in the directory name sort them in ascending order
@@ -289,6 +297,36 @@ class LogDir : public LoggerBase, private boost::noncopyable, private LogDirName
     bool m_readonly;         /**< m_info is not to be written to */
     SyncReport *m_report;    /**< record start/end times here */
 
+public:
+    /**
+     * The parts of a session report that are needed by expire() and
+     * for finding the latest session of a source.
+     */
+    struct SessionInfo {
+        SessionInfo() : m_status(STATUS_DIED_PREMATURELY) {}
+
+        struct Source {
+            Source() : m_itemsBefore(-1), m_itemsAfter(-1), m_changed(false) {}
+
+            /** number of items in the dumps, -1 if no dump was made */
+            int m_itemsBefore, m_itemsAfter;
+            /** local or remote changes were made during the session */
+            bool m_changed;
+            /** result of contentDigest() for the dumps, empty if no dump */
+            string m_digestBefore, m_digestAfter;
+        };
+        typedef map<string, Source> Sources_t;
+
+        SyncMLStatus m_status;
+        Sources_t m_sources;
+    };
+
+private:
+    /** session summaries, loaded from SESSION_INDEX on demand */
+    boost::shared_ptr<ConfigNode> m_index;
+    typedef map<string, SessionInfo> Sessions_t;
+    Sessions_t m_sessions;
+
 public:
     LogDir(SyncContext &client) : m_client(client), m_parentLogger(LoggerBase::instance()), m_info(NULL), m_readonly(false), m_report(NULL)
     {
@@ -565,6 +603,20 @@ public:
         return m_path;
     }
 
+    /**
+     * return directory for the items shared by all database dumps
+     * in the log directory, empty if the current path is not
+     * a session directory inside it
+     */
+    string getItemStore() const {
+        if (m_logdir.empty() ||
+            m_logdir == "none" ||
+            !boost::starts_with(m_path, m_logdir + "/")) {
+            return "";
+        }
+        return m_logdir + "/" + ITEM_STORE;
+    }
+
     // return log file, empty if not enabled
     const string &getLogfile() {
         return m_logfile;
@@ -610,26 +662,25 @@ public:
                 bool havedumps = false;
                 bool errors = false;
 
-                LogDir logdir(m_client);
-                logdir.openLogdir(dirs[i]);
-                SyncReport report;
-                logdir.readReport(report);
-                SyncMLStatus status = report.getStatus();
+                SessionInfo session;
+                getSessionInfo(dirs[i], session);
+                SyncMLStatus status = session.m_status;
                 if (status != STATUS_OK && status != STATUS_HTTP_OK) {
                     errors = true;
                 }
-                BOOST_FOREACH(SyncReport::SourceReport_t source, report) {
-                    string &sourcename = source.first;
-                    SyncSourceReport &sourcereport = source.second;
+                BOOST_FOREACH(const SessionInfo::Sources_t::value_type &source, session.m_sources) {
+                    const string &sourcename = source.first;
+                    const SessionInfo::Source &sourceinfo = source.second;
                     list<DumpInfo> &dumplist = dumps[sourcename];
-                    if (sourcereport.m_backupBefore.isAvailable() ||
-                        sourcereport.m_backupAfter.isAvailable()) {
+                    if (sourceinfo.m_itemsBefore >= 0 ||
+                        sourceinfo.m_itemsAfter >= 0) {
                         // yes, we have backup dumps
                         havedumps = true;
 
                         DumpInfo info(i,
-                                      sourcereport.m_backupBefore.getNumItems(),
-                                      sourcereport.m_backupAfter.getNumItems());
+                                      sourceinfo.m_itemsBefore,
+                                      sourceinfo.m_itemsAfter,
+                                      sourceinfo.m_digestAfter);
 
                         // now check for changes, if none found yet
                         if (!changes) {
@@ -641,11 +692,9 @@ public:
                                 changes =
                                     // item count changed -> items changed
                                     previous.m_itemsDumpedAfter != info.m_itemsDumpedBefore ||
-                                    sourcereport.wasChanged(SyncSourceReport::ITEM_LOCAL) ||
-                                    sourcereport.wasChanged(SyncSourceReport::ITEM_REMOTE) ||
-                                    haveDifferentContent(sourcename,
-                                                         dirs[previous.m_dirIndex], "after",
-                                                         dirs[i], "before");
+                                    sourceinfo.m_changed ||
+                                    // same inodes <=> same content
+                                    previous.m_digestAfter != sourceinfo.m_digestBefore;
                             }
                         }
 
@@ -688,11 +737,41 @@ public:
                     if (!mustkeep) {
                         SE_LOG_DEBUG(NULL, NULL, "removing %s", path.c_str());
                         rm_r(path);
+                        removeSessionInfo(path);
                         ++deleted;
                     }
                 }
             }
+            // also stores sessions added by getSessionInfo()
+            flushIndex();
+            if (deleted) {
+                pruneItemStore();
+            }
+        }
+    }
+
+    /**
+     * Remove all items from the shared store which are not
+     * referenced by any database dump anymore. Such files
+     * have no other hard link than the one in the store.
+     */
+    void pruneItemStore() {
+        string store = m_logdir + "/" + ITEM_STORE;
+        if (!isDir(store)) {
+            return;
+        }
+        ReadDir dir(store);
+        int removed = 0;
+        BOOST_FOREACH(const string &entry, dir) {
+            string fullpath = store + "/" + entry;
+            struct stat buf;
+            if (!stat(fullpath.c_str(), &buf) &&
+                buf.st_nlink <= 1 &&
+                !unlink(fullpath.c_str())) {
+                ++removed;
+            }
         }
+        SE_LOG_DEBUG(NULL, NULL, "removed %d unused items from %s", removed, store.c_str());
     }
 
     // finalize session
@@ -709,6 +788,24 @@ public:
                     writeReport(*m_report);
                 }
                 m_info->flush();
+
+                // Add to index right away, while the dumps of
+                // this session are known to be complete.
+                if (m_report &&
+                    m_logdir != "none" &&
+                    boost::starts_with(m_path, m_logdir + "/")) {
+                    try {
+                        string root, name;
+                        parseLogDir(m_path, root, name);
+                        SessionInfo info;
+                        summarizeSession(m_path, *m_report, info);
+                        storeSessionInfo(name, info);
+                        flushIndex();
+                    } catch (...) {
+                        // not fatal, expire() reads the session directly
+                        Exception::handle(HANDLE_EXCEPTION_NO_ERROR);
+                    }
+                }
             }
             m_info.reset();
         }
@@ -810,39 +907,194 @@ public:
                                      const string &secondDir,
                                      const string &secondSuffix)
     {
-        string first = firstDir + "/" + sourceName + "." + firstSuffix;
-        string second = secondDir + "/" + sourceName + "." + secondSuffix;
-        ReadDir firstContent(first);
-        ReadDir secondContent(second);
-        set<ino_t> firstInodes;
-        BOOST_FOREACH(const string &name, firstContent) {
+        return
+            contentDigest(firstDir + "/" + sourceName + "." + firstSuffix) !=
+            contentDigest(secondDir + "/" + sourceName + "." + secondSuffix);
+    }
+
+    /**
+     * Identifies the content of a database dump via the inodes of its
+     * files. Because unmodified items are hard links to the same file,
+     * two dumps have the same digest if (and, except for hash
+     * collisions, only if) they contain the same items.
+     */
+    static string contentDigest(const string &dir)
+    {
+        ReadDir content(dir);
+        vector<ino_t> inodes;
+        inodes.reserve(content.end() - content.begin());
+        BOOST_FOREACH(const string &name, content) {
             struct stat buf;
-            string fullpath = first + "/" + name;
+            string fullpath = dir + "/" + name;
             if (stat(fullpath.c_str(), &buf)) {
                 SyncContext::throwError(fullpath, errno);
             }
-            firstInodes.insert(buf.st_ino);
+            inodes.push_back(buf.st_ino);
         }
-        BOOST_FOREACH(const string &name, secondContent) {
-            struct stat buf;
-            string fullpath = second + "/" + name;
-            if (stat(fullpath.c_str(), &buf)) {
-                SyncContext::throwError(fullpath, errno);
+        sort(inodes.begin(), inodes.end());
+        ostringstream list;
+        BOOST_FOREACH(ino_t inode, inodes) {
+            list << inode << ' ';
+        }
+        return StringPrintf("%lu-%lx", (unsigned long)inodes.size(), Hash(list.str()));
+    }
+
+    /**
+     * Summary of the session in the given directory. Normally comes
+     * from the session index in the logdir root, which avoids
+     * reading the status.ini of each session and stat()ing the files
+     * of its database dumps. Sessions which are not in the index yet
+     * (created by an older release, or lost due to a concurrent
+     * update of the index by another process) are read from their
+     * directory and then added to the index, see flushIndex().
+     */
+    void getSessionInfo(const string &dir, SessionInfo &info) {
+        string root, name;
+        parseLogDir(dir, root, name);
+        bool indexed = !m_logdir.empty() && root == m_logdir;
+        if (indexed) {
+            loadIndex();
+            Sessions_t::const_iterator it = m_sessions.find(name);
+            if (it != m_sessions.end() &&
+                it->second.m_status != STATUS_DIED_PREMATURELY) {
+                info = it->second;
+                return;
             }
-            set<ino_t>::iterator it = firstInodes.find(buf.st_ino);
-            if (it == firstInodes.end()) {
-                // second dir has different file
-                return true;
+        }
+
+        LogDir logdir(m_client);
+        logdir.openLogdir(dir);
+        SyncReport report;
+        logdir.readReport(report);
+        summarizeSession(dir, report, info);
+        // A session which is still running looks like one which
+        // died prematurely. Its information may still change,
+        // so don't remember it.
+        if (indexed && info.m_status != STATUS_DIED_PREMATURELY) {
+            storeSessionInfo(name, info);
+        }
+    }
+
+    /**
+     * Write changes made by getSessionInfo(), storeSessionInfo()
+     * and removeSessionInfo(). Callers looking up many sessions do
+     * that once at the end.
+     */
+    void flushIndex() {
+        if (m_index) {
+            m_index->flush();
+        }
+    }
+
+    /** extract the information for SessionInfo from a session report */
+    static void summarizeSession(const string &dir, const SyncReport &report, SessionInfo &info) {
+        info = SessionInfo();
+        info.m_status = report.getStatus();
+        BOOST_FOREACH(SyncReport::SourceReport_t source, report) {
+            string &sourcename = source.first;
+            SyncSourceReport &sourcereport = source.second;
+            SessionInfo::Source &sourceinfo = info.m_sources[sourcename];
+            sourceinfo.m_changed =
+                sourcereport.wasChanged(SyncSourceReport::ITEM_LOCAL) ||
+                sourcereport.wasChanged(SyncSourceReport::ITEM_REMOTE);
+            if (sourcereport.m_backupBefore.isAvailable()) {
+                sourceinfo.m_itemsBefore = sourcereport.m_backupBefore.getNumItems();
+                sourceinfo.m_digestBefore = contentDigest(dir + "/" + sourcename + ".before");
+            }
+            if (sourcereport.m_backupAfter.isAvailable()) {
+                sourceinfo.m_itemsAfter = sourcereport.m_backupAfter.getNumItems();
+                sourceinfo.m_digestAfter = contentDigest(dir + "/" + sourcename + ".after");
+            }
+        }
+    }
+
+    /**
+     * Read SESSION_INDEX once. Each session is stored as
+     * <session> = <status> plus one
+     * <session>/<source> = <items before> <items after> <changed> <digest before> <digest after>
+     * entry per source. Entries of sessions whose directory
+     * was removed by someone else are dropped.
+     */
+    void loadIndex() {
+        if (m_index) {
+            return;
+        }
+        boost::shared_ptr<ConfigNode> filenode(new IniFileConfigNode(m_logdir, SESSION_INDEX, false));
+        m_index.reset(new SafeConfigNode(filenode));
+        m_sessions.clear();
+        ConfigProps props;
+        m_index->readProperties(props);
+        BOOST_FOREACH(const ConfigProps::value_type &entry, props) {
+            size_t slash = entry.first.find('/');
+            if (slash == entry.first.npos) {
+                m_sessions[entry.first].m_status = (SyncMLStatus)atoi(entry.second.c_str());
             } else {
-                firstInodes.erase(it);
+                SessionInfo::Source &sourceinfo =
+                    m_sessions[entry.first.substr(0, slash)].m_sources[entry.first.substr(slash + 1)];
+                istringstream in(entry.second);
+                int changed = 1;
+                in >> sourceinfo.m_itemsBefore >> sourceinfo.m_itemsAfter >> changed
+                   >> sourceinfo.m_digestBefore >> sourceinfo.m_digestAfter;
+                sourceinfo.m_changed = changed != 0;
+                if (sourceinfo.m_digestBefore == "-") {
+                    sourceinfo.m_digestBefore = "";
+                }
+                if (sourceinfo.m_digestAfter == "-") {
+                    sourceinfo.m_digestAfter = "";
+                }
             }
         }
-        if (!firstInodes.empty()) {
-            // first dir has different file
-            return true;
+
+        // Directories are created before adding them to the index,
+        // so reading the directory after the index finds all of them.
+        if (isDir(m_logdir)) {
+            ReadDir dir(m_logdir);
+            set<string> existing(dir.begin(), dir.end());
+            vector<string> stale;
+            BOOST_FOREACH(const Sessions_t::value_type &session, m_sessions) {
+                if (existing.find(session.first) == existing.end()) {
+                    stale.push_back(session.first);
+                }
+            }
+            BOOST_FOREACH(const string &name, stale) {
+                SE_LOG_DEBUG(NULL, NULL, "removing %s from session index, directory is gone", name.c_str());
+                removeSessionInfo(m_logdir + "/" + name);
+            }
+        }
+    }
+
+    /** add or replace session in index, without flushing */
+    void storeSessionInfo(const string &name, const SessionInfo &info) {
+        loadIndex();
+        m_sessions[name] = info;
+        m_index->setProperty(name, StringPrintf("%d", (int)info.m_status));
+        BOOST_FOREACH(const SessionInfo::Sources_t::value_type &source, info.m_sources) {
+            const SessionInfo::Source &sourceinfo = source.second;
+            m_index->setProperty(name + "/" + source.first,
+                                 StringPrintf("%d %d %d %s %s",
+                                              sourceinfo.m_itemsBefore,
+                                              sourceinfo.m_itemsAfter,
+                                              sourceinfo.m_changed ? 1 : 0,
+                                              sourceinfo.m_digestBefore.empty() ? "-" : sourceinfo.m_digestBefore.c_str(),
+                                              sourceinfo.m_digestAfter.empty() ? "-" : sourceinfo.m_digestAfter.c_str()));
         }
-        // exact match of inodes
-        return false;
+    }
+
+    /** remove session from index, without flushing */
+    void removeSessionInfo(const string &dir) {
+        string root, name;
+        parseLogDir(dir, root, name);
+        if (!m_index || root != m_logdir) {
+            return;
+        }
+        Sessions_t::iterator it = m_sessions.find(name);
+        if (it != m_sessions.end()) {
+            BOOST_FOREACH(const SessionInfo::Sources_t::value_type &source, it->second.m_sources) {
+                m_index->removeProperty(name + "/" + source.first);
+            }
+            m_sessions.erase(it);
+        }
+        m_index->removeProperty(name);
     }
 
 private:
@@ -859,12 +1111,15 @@ private:
         size_t m_dirIndex;
         int m_itemsDumpedBefore;
         int m_itemsDumpedAfter;
+        string m_digestAfter;
         DumpInfo(size_t dirIndex,
                  int itemsDumpedBefore,
-                 int itemsDumpedAfter) :
+                 int itemsDumpedAfter,
+                 const string &digestAfter) :
             m_dirIndex(dirIndex),
             m_itemsDumpedBefore(itemsDumpedBefore),
-            m_itemsDumpedAfter(itemsDumpedAfter)
+            m_itemsDumpedAfter(itemsDumpedAfter),
+            m_digestAfter(digestAfter)
         {}
     };
 
@@ -924,6 +1179,8 @@ private:
 };
 
 const char* const LogDirNames::DIR_PREFIX = "SyncEvolution-";
+const char* const LogDirNames::ITEM_STORE = ".syncevolution-items";
+const char* const LogDirNames::SESSION_INDEX = ".syncevolution-sessions.ini";
 
 /**
  * This class owns the sync sources. For historic reasons (required
@@ -1113,7 +1370,8 @@ public:
                                                              suffix == "after" ?
                                                              SyncSource::Operations::BackupInfo::BACKUP_AFTER :
                                                              SyncSource::Operations::BackupInfo::BACKUP_OTHER,
-                                                             dir, node);
+                                                             dir, node,
+                                                             m_logdir.getItemStore());
                 source->getOperations().m_backupData(oldBackup, newBackup,
                                                      report ? source->*report : dummy);
                 SE_LOG_DEBUG(NULL, NULL, "%s created", dir.c_str());
@@ -1192,12 +1450,13 @@ public:
      * @param currentSuffix  the current database dump suffix: "current"
      *                       when not doing a sync, otherwise "before"
      * @param excludeSource  when not empty, only dump that source
+     * @param labels         headings for the side-by-side comparison
      */
     bool dumpLocalChanges(const string &oldSession,
                           const string &oldSuffix, const string &newSuffix,
                           const string &excludeSource,
                           const string &intro = "Local data changes to be applied remotely during synchronization:\n",
-                          const string &config = "CLIENT_TEST_LEFT_NAME='after last sync' CLIENT_TEST_RIGHT_NAME='current data' CLIENT_TEST_REMOVED='removed since last sync' CLIENT_TEST_ADDED='added since last sync'") {
+                          const ItemDiffLabels &labels = ItemDiffLabels("after last sync", "current data", "removed since last sync", "added since last sync")) {
         if (m_logLevel <= LOGGING_SUMMARY) {
             return false;
         }
@@ -1227,36 +1486,32 @@ public:
                      it != dirs.rend();
                      ++it) {
                     const string &sessiondir = *it;
-                    LogDir oldsession(m_client);
-                    oldsession.openLogdir(sessiondir);
-                    SyncReport report;
-                    oldsession.readReport(report);
-                    if (report.find(source->getName()) != report.end())  {
+                    LogDir::SessionInfo session;
+                    m_logdir.getSessionInfo(sessiondir, session);
+                    if (session.m_sources.find(source->getName()) != session.m_sources.end())  {
                         // source was active in that session, use dump
                         // made there
                         oldDir = databaseName(*source, oldSuffix, sessiondir);
                         break;
                     }
                 }
+                m_logdir.flushIndex();
             } else {
                 oldDir = databaseName(*source, oldSuffix, oldSession);
             }
             string newDir = databaseName(*source, newSuffix);
             SE_LOG_SHOW(NULL, NULL, "*** %s ***", source->getDisplayName().c_str());
-            string cmd = string("env CLIENT_TEST_COMPARISON_FAILED=10 " + config + " synccompare '" ) +
-                oldDir + "' '" + newDir + "'";
-            int ret = Execute(cmd, EXECUTE_NO_STDERR);
-            switch (ret == -1 ? ret :
-                    WIFEXITED(ret) ? WEXITSTATUS(ret) :
-                    -1) {
-            case 0:
-                SE_LOG_SHOW(NULL, NULL, "no changes");
-                break;
-            case 10:
-                break;
-            default:
-                SE_LOG_SHOW(NULL, NULL, "Comparison was impossible.");
-                break;
+            try {
+                std::ostringstream out;
+                if (CompareItemDirs(oldDir, newDir, labels, out)) {
+                    SE_LOG_SHOW(NULL, NULL, "%s", out.str().c_str());
+                } else {
+                    SE_LOG_SHOW(NULL, NULL, "no changes");
+                }
+            } catch (...) {
+                string explanation;
+                Exception::handle(explanation, HANDLE_EXCEPTION_NO_ERROR);
+                SE_LOG_SHOW(NULL, NULL, "Comparison was impossible: %s", explanation.c_str());
             }
         }
         SE_LOG_SHOW(NULL, NULL, "\n");
@@ -1370,7 +1625,7 @@ public:
                                      "before", "after", "",
                                      StringPrintf("\nData modified %s during synchronization:\n",
                                                   m_client.isLocalSync() ? m_client.getContextName().c_str() : "locally"),
-                                     "CLIENT_TEST_LEFT_NAME='before sync' CLIENT_TEST_RIGHT_NAME='after sync' CLIENT_TEST_REMOVED='removed during sync' CLIENT_TEST_ADDED='added during sync'");
+                                     ItemDiffLabels("before sync", "after sync", "removed during sync", "added during sync"));
                 }
 
                 // now remove some old logdirs
@@ -2745,6 +3000,19 @@ struct SyncContext::SyncMLMessageInfo
 SyncContext::analyzeSyncMLMessage(const char *data, size_t len,
                                   const std::string &messageType)
 {
+    SyncMLMessageInfo info;
+    SyncMLHeader header;
+    if (ParseSyncMLHeader(data, len, messageType, header) &&
+        !header.m_sourceURI.empty()) {
+        info.m_deviceID = header.m_sourceURI;
+        info.m_sessionID = header.m_sessionID;
+        info.m_targetURI = header.m_targetURI;
+        info.m_maxMsgSize = header.m_maxMsgSize;
+        return info;
+    }
+    SE_LOG_DEBUG(NULL, NULL, "SyncHdr not found in %s message, analyzing it with the engine",
+                 messageType.c_str());
+
     SyncContext sync;
     SourceList sourceList(sync, false);
     sourceList.setLogLevel(SourceList::LOGGING_SUMMARY);
@@ -2782,7 +3050,6 @@ SyncContext::analyzeSyncMLMessage(const char *data, size_t len,
         }
     } while (stepCmd == sysync::STEPCMD_STEP);
 
-    SyncMLMessageInfo info;
     info.m_deviceID = sync.getSyncDeviceID();
     return info;
 }
@@ -4074,10 +4341,7 @@ void SyncContext::restore(const string &dirname, RestoreDatabase database)
         sourceList.dumpDatabases("current", NULL);
         sourceList.dumpLocalChanges(dirname, "current", datadump, "",
                                     "Data changes to be applied locally during restore:\n",
-                                    "CLIENT_TEST_LEFT_NAME='current data' "
-                                    "CLIENT_TEST_REMOVED='after restore' " 
-                                    "CLIENT_TEST_REMOVED='to be removed' "
-                                    "CLIENT_TEST_ADDED='to be added'");
+                                    ItemDiffLabels("current data", "after restore", "to be removed", "to be added"));
     }
 
     SyncReport report;
@@ -4266,6 +4530,7 @@ private:
     CPPUNIT_TEST(testQuickCompare);
     CPPUNIT_TEST(testSessionNoChanges);
     CPPUNIT_TEST(testSessionChanges);
+    CPPUNIT_TEST(testSessionIndex);
     CPPUNIT_TEST(testMultipleSessions);
     CPPUNIT_TEST(testExpire);
     CPPUNIT_TEST_SUITE_END();
@@ -4342,7 +4607,10 @@ private:
         string logdir = getLogDir();
         ReadDir dirs(logdir);
         BOOST_FOREACH(const string &dir, dirs) {
-            sessions.push_back(logdir + "/" + dir);
+            // skip item store
+            if (!boost::starts_with(dir, ".")) {
+                sessions.push_back(logdir + "/" + dir);
+            }
         }
         sort(sessions.begin(), sessions.end());
         return sessions;
@@ -4386,6 +4654,43 @@ private:
         CPPUNIT_ASSERT(!LogDir::haveDifferentContent("file_event",
                                                      dir, "before",
                                                      dir, "after"));
+
+        // item shared by both dumps and the item store
+        struct stat buf;
+        CPPUNIT_ASSERT(!stat((dir + "/file_event.before/1").c_str(), &buf));
+        CPPUNIT_ASSERT_EQUAL((nlink_t)3, buf.st_nlink);
+    }
+
+    void testSessionIndex() {
+        ScopedEnvChange config("XDG_CONFIG_HOME", "LogDirTest/config");
+        ScopedEnvChange cache("XDG_CACHE_HOME", "LogDirTest/cache");
+
+        string dir = session(false, STATUS_OK, "file_event", ".one", ".two", (char *)0);
+        IniFileConfigNode index(getLogDir(), ".syncevolution-sessions.ini", true);
+        CPPUNIT_ASSERT(index.exists());
+
+        // summary must come from the index, not the session itself
+        CPPUNIT_ASSERT(!unlink((dir + "/status.ini").c_str()));
+        LogDir logdir(*this);
+        LogDir::SessionInfo info;
+        logdir.getSessionInfo(dir, info);
+        CPPUNIT_ASSERT_EQUAL(STATUS_HTTP_OK, info.m_status);
+        CPPUNIT_ASSERT_EQUAL((size_t)1, info.m_sources.size());
+        const LogDir::SessionInfo::Source &source = info.m_sources["file_event"];
+        CPPUNIT_ASSERT_EQUAL(1, source.m_itemsBefore);
+        CPPUNIT_ASSERT_EQUAL(2, source.m_itemsAfter);
+        CPPUNIT_ASSERT(!source.m_digestBefore.empty());
+        CPPUNIT_ASSERT(source.m_digestBefore != source.m_digestAfter);
+
+        // entry of a session removed by someone else is dropped
+        rm_r(dir);
+        LogDir pruned(*this);
+        pruned.loadIndex();
+        pruned.flushIndex();
+        IniFileConfigNode after(getLogDir(), ".syncevolution-sessions.ini", true);
+        ConfigProps props;
+        after.readProperties(props);
+        CPPUNIT_ASSERT_EQUAL((size_t)0, props.size());
     }
 
     void testSessionChanges() {
@@ -288,7 +288,12 @@ class SyncContext : public SyncConfig {
 
     /** result of analyzeSyncMLMessage() */
     struct SyncMLMessageInfo {
+        SyncMLMessageInfo() : m_maxMsgSize(0) {}
+
         std::string m_deviceID;
+        std::string m_sessionID;   /**< empty if unknown */
+        std::string m_targetURI;   /**< empty if unknown */
+        unsigned long m_maxMsgSize; /**< 0 if unknown */
 
         /** a string representation of the whole structure for debugging */
         std::string toString() { return std::string("deviceID ") + m_deviceID; }
@@ -299,6 +304,11 @@ class SyncContext : public SyncConfig {
      * without changing any local data. Returns once the LocURI =
      * device ID of the client is known.
      *
+     * Normally only the SyncHdr gets parsed, with
+     * ParseSyncMLHeader(). The Synthesis engine is used only as
+     * fallback when that fails, because it is much more expensive:
+     * it needs a complete config and session.
+     *
      * @return device ID, empty if not in data
      */
     static SyncMLMessageInfo
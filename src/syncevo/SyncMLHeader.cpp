@@ -0,0 +1,568 @@
+/*
+ * Copyright (C) 2012 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ */
+
+#include <syncevo/SyncMLHeader.h>
+#include <syncevo/TransportAgent.h>
+#include <syncevo/util.h>
+#include <test.h>
+
+#include <vector>
+#include <algorithm>
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <syncevo/declarations.h>
+SE_BEGIN_CXX
+
+namespace {
+
+/**
+ * Receives the elements of the message, for both representations.
+ * Element names are without namespace prefix.
+ */
+class HeaderCollector
+{
+    SyncMLHeader &m_header;
+    std::vector<std::string> m_path;
+    std::string m_text;
+    bool m_complete;
+    bool m_stop;
+
+    /** true if the current element is SyncML/SyncHdr/<a>[/<b>] */
+    bool at(const char *a, const char *b = NULL) const
+    {
+        return m_path.size() == (b ? 4 : 3) &&
+            m_path[0] == "SyncML" &&
+            m_path[1] == "SyncHdr" &&
+            m_path[2] == a &&
+            (!b || m_path[3] == b);
+    }
+
+public:
+    HeaderCollector(SyncMLHeader &header) :
+        m_header(header),
+        m_complete(false),
+        m_stop(false)
+    {}
+
+    /** SyncHdr was seen completely */
+    bool complete() const { return m_complete; }
+
+    /** no need to continue parsing */
+    bool done() const { return m_complete || m_stop; }
+
+    void start(const std::string &name)
+    {
+        m_path.push_back(name);
+        m_text.clear();
+        if (name == "SyncBody") {
+            // SyncHdr must come first, so it is missing
+            m_stop = true;
+        }
+    }
+
+    void text(const std::string &text) { m_text += text; }
+
+    void end()
+    {
+        if (m_path.empty()) {
+            // unbalanced
+            m_stop = true;
+            return;
+        }
+        if (at("VerProto")) {
+            m_header.m_verProto = m_text;
+        } else if (at("SessionID")) {
+            m_header.m_sessionID = m_text;
+        } else if (at("MsgID")) {
+            m_header.m_msgID = m_text;
+        } else if (at("RespURI")) {
+            m_header.m_respURI = m_text;
+        } else if (at("Target", "LocURI")) {
+            m_header.m_targetURI = m_text;
+        } else if (at("Source", "LocURI")) {
+            m_header.m_sourceURI = m_text;
+        } else if (at("Meta", "MaxMsgSize")) {
+            m_header.m_maxMsgSize = strtoul(m_text.c_str(), NULL, 10);
+        } else if (at("Meta", "MaxObjSize")) {
+            m_header.m_maxObjSize = strtoul(m_text.c_str(), NULL, 10);
+        } else if (m_path.size() == 2 && m_path[1] == "SyncHdr") {
+            m_complete = true;
+        }
+        m_text.clear();
+        m_path.pop_back();
+    }
+};
+
+/** encode a Unicode character as UTF-8 */
+std::string utf8(unsigned long c)
+{
+    std::string res;
+    if (c < 0x80) {
+        res += (char)c;
+    } else if (c < 0x800) {
+        res += (char)(0xC0 | (c >> 6));
+        res += (char)(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+        res += (char)(0xE0 | (c >> 12));
+        res += (char)(0x80 | ((c >> 6) & 0x3F));
+        res += (char)(0x80 | (c & 0x3F));
+    } else {
+        res += (char)(0xF0 | (c >> 18));
+        res += (char)(0x80 | ((c >> 12) & 0x3F));
+        res += (char)(0x80 | ((c >> 6) & 0x3F));
+        res += (char)(0x80 | (c & 0x3F));
+    }
+    return res;
+}
+
+/** replaces predefined and numeric character references */
+std::string decodeEntities(const char *start, const char *end)
+{
+    std::string res;
+    while (start < end) {
+        const char *amp = std::find(start, end, '&');
+        res.append(start, amp);
+        if (amp == end) {
+            break;
+        }
+        const char *semicolon = std::find(amp, end, ';');
+        if (semicolon == end) {
+            res.append(amp, end);
+            break;
+        }
+        std::string entity(amp + 1, semicolon);
+        if (entity == "amp") {
+            res += '&';
+        } else if (entity == "lt") {
+            res += '<';
+        } else if (entity == "gt") {
+            res += '>';
+        } else if (entity == "quot") {
+            res += '"';
+        } else if (entity == "apos") {
+            res += '\'';
+        } else if (entity.size() > 2 && entity[0] == '#' && entity[1] == 'x') {
+            res += utf8(strtoul(entity.c_str() + 2, NULL, 16));
+        } else if (entity.size() > 1 && entity[0] == '#') {
+            res += utf8(strtoul(entity.c_str() + 1, NULL, 10));
+        } else {
+            res.append(amp, semicolon + 1);
+        }
+        start = semicolon + 1;
+    }
+    return res;
+}
+
+/** skip to the end of the given string, NULL if not found */
+const char *skipPast(const char *pos, const char *end, const char *str)
+{
+    size_t len = strlen(str);
+    const char *found = std::search(pos, end, str, str + len);
+    return found == end ? NULL : found + len;
+}
+
+bool parseXML(const char *pos, const char *end, HeaderCollector &collector)
+{
+    while (pos < end && !collector.done()) {
+        const char *lt = std::find(pos, end, '<');
+        if (lt != pos) {
+            collector.text(decodeEntities(pos, lt));
+        }
+        if (lt == end) {
+            break;
+        }
+        pos = lt + 1;
+        if (pos < end && *pos == '?') {
+            pos = skipPast(pos, end, "?>");
+        } else if (end - pos >= 3 && !memcmp(pos, "!--", 3)) {
+            pos = skipPast(pos, end, "-->");
+        } else if (end - pos >= 8 && !memcmp(pos, "![CDATA[", 8)) {
+            const char *start = pos + 8;
+            pos = skipPast(start, end, "]]>");
+            if (pos) {
+                collector.text(std::string(start, pos - 3));
+            }
+        } else if (pos < end && *pos == '!') {
+            pos = skipPast(pos, end, ">");
+        } else {
+            const char *gt = std::find(pos, end, '>');
+            if (gt == end) {
+                return false;
+            }
+            bool closing = *pos == '/';
+            bool empty = gt[-1] == '/';
+            const char *name = closing ? pos + 1 : pos;
+            const char *nameEnd = name;
+            while (nameEnd < gt &&
+                   !isspace(*nameEnd) &&
+                   *nameEnd != '/') {
+                nameEnd++;
+            }
+            // ignore namespace prefix
+            const char *colon = std::find(name, nameEnd, ':');
+            if (colon != nameEnd) {
+                name = colon + 1;
+            }
+            if (closing) {
+                collector.end();
+            } else {
+                collector.start(std::string(name, nameEnd));
+                if (empty) {
+                    collector.end();
+                }
+            }
+            pos = gt + 1;
+        }
+        if (!pos) {
+            return false;
+        }
+    }
+    return collector.complete();
+}
+
+/**
+ * WBXML global tokens, see "WAP Binary XML Content Format".
+ */
+enum {
+    WBXML_SWITCH_PAGE = 0x00,
+    WBXML_END = 0x01,
+    WBXML_ENTITY = 0x02,
+    WBXML_STR_I = 0x03,
+    WBXML_LITERAL = 0x04,
+    WBXML_EXT_I_0 = 0x40,
+    WBXML_EXT_I_2 = 0x42,
+    WBXML_PI = 0x43,
+    WBXML_LITERAL_C = 0x44,
+    WBXML_EXT_T_0 = 0x80,
+    WBXML_EXT_T_2 = 0x82,
+    WBXML_STR_T = 0x83,
+    WBXML_LITERAL_A = 0x84,
+    WBXML_EXT_0 = 0xC0,
+    WBXML_EXT_2 = 0xC2,
+    WBXML_OPAQUE = 0xC3,
+    WBXML_LITERAL_AC = 0xC4
+};
+
+/**
+ * Tag tokens of the SyncML code page 0 (SyncML 1.1 and 1.2),
+ * starting at 0x05.
+ */
+const char * const syncMLTags[] = {
+    "Add", "Alert", "Archive", "Atomic", "Chal", "Cmd", "CmdID",
+    "CmdRef", "Copy", "Cred", "Data", "Delete", "Exec", "Final",
+    "Get", "Item", "Lang", "LocName", "LocURI", "Map", "MapItem",
+    "Meta", "MsgID", "MsgRef", "NoResp", "NoResults", "Put",
+    "Replace", "RespURI", "Results", "Search", "Sequence",
+    "SessionID", "SftDel", "Source", "SourceRef", "Status", "Sync",
+    "SyncBody", "SyncHdr", "SyncML", "Target", "TargetRef",
+    "Reserved", "VerDTD", "VerProto"
+};
+
+/**
+ * Tag tokens of the MetInf code page 1, starting at 0x05.
+ */
+const char * const metInfTags[] = {
+    "Anchor", "EMI", "Format", "FreeID", "FreeMem", "Last", "Mark",
+    "MaxMsgSize", "Mem", "MetInf", "Next", "NextNonce", "SharedMem",
+    "Size", "Type", "Version", "MaxObjSize"
+};
+
+class WBXMLReader
+{
+    const unsigned char *m_pos, *m_end;
+
+public:
+    WBXMLReader(const char *data, size_t len) :
+        m_pos(reinterpret_cast<const unsigned char *>(data)),
+        m_end(m_pos + len)
+    {}
+
+    bool eof() const { return m_pos >= m_end; }
+
+    /** @throw Exception at end of data */
+    unsigned char byte()
+    {
+        if (eof()) {
+            SE_THROW("WBXML: unexpected end of data");
+        }
+        return *m_pos++;
+    }
+
+    /** multi-byte unsigned integer */
+    unsigned long mbUInt32()
+    {
+        unsigned long res = 0;
+        unsigned char b;
+        int count = 0;
+        do {
+            if (++count > 5) {
+                SE_THROW("WBXML: invalid integer");
+            }
+            b = byte();
+            res = (res << 7) | (b & 0x7F);
+        } while (b & 0x80);
+        return res;
+    }
+
+    /** null-terminated string */
+    std::string string()
+    {
+        const unsigned char *start = m_pos;
+        while (byte()) {
+        }
+        return std::string(reinterpret_cast<const char *>(start), m_pos - start - 1);
+    }
+
+    /** opaque data or string table */
+    std::string data(unsigned long len)
+    {
+        if (len > (unsigned long)(m_end - m_pos)) {
+            SE_THROW("WBXML: data too long");
+        }
+        std::string res(reinterpret_cast<const char *>(m_pos), len);
+        m_pos += len;
+        return res;
+    }
+};
+
+/** null-terminated string at offset in the string table */
+std::string stringTableEntry(const std::string &table, unsigned long offset)
+{
+    if (offset >= table.size()) {
+        SE_THROW("WBXML: invalid string table reference");
+    }
+    return std::string(table.c_str() + offset);
+}
+
+/**
+ * Handles a token which is valid both in content and in attribute
+ * lists.
+ *
+ * @return true if the token was handled
+ */
+bool parseWBXMLValue(unsigned char token,
+                     WBXMLReader &reader,
+                     const std::string &table,
+                     std::string &value)
+{
+    if (token == WBXML_STR_I) {
+        value = reader.string();
+    } else if (token == WBXML_STR_T) {
+        value = stringTableEntry(table, reader.mbUInt32());
+    } else if (token == WBXML_ENTITY) {
+        value = utf8(reader.mbUInt32());
+    } else if (token == WBXML_OPAQUE) {
+        value = reader.data(reader.mbUInt32());
+    } else if (token >= WBXML_EXT_I_0 && token <= WBXML_EXT_I_2) {
+        reader.string();
+        value = "";
+    } else if (token >= WBXML_EXT_T_0 && token <= WBXML_EXT_T_2) {
+        reader.mbUInt32();
+        value = "";
+    } else if (token >= WBXML_EXT_0 && token <= WBXML_EXT_2) {
+        value = "";
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/** skips an attribute list, including the terminating END */
+void skipWBXMLAttributes(WBXMLReader &reader, const std::string &table)
+{
+    std::string value;
+    unsigned char token;
+    while ((token = reader.byte()) != WBXML_END) {
+        if (token == WBXML_SWITCH_PAGE) {
+            reader.byte();
+        } else if (token == WBXML_LITERAL) {
+            reader.mbUInt32();
+        } else {
+            // attribute start or value token
+            parseWBXMLValue(token, reader, table, value);
+        }
+    }
+}
+
+bool parseWBXML(const char *data, size_t len, HeaderCollector &collector)
+{
+    WBXMLReader reader(data, len);
+    unsigned char version = reader.byte();
+    if (!reader.mbUInt32()) {
+        // public ID as string table reference
+        reader.mbUInt32();
+    }
+    if (version > 0) {
+        // charset, must be UTF-8 for SyncML
+        reader.mbUInt32();
+    }
+    std::string table = reader.data(reader.mbUInt32());
+
+    unsigned char page = 0;
+    std::string value;
+    while (!reader.eof() && !collector.done()) {
+        unsigned char token = reader.byte();
+        if (token == WBXML_SWITCH_PAGE) {
+            page = reader.byte();
+        } else if (token == WBXML_END) {
+            collector.end();
+        } else if (token == WBXML_PI) {
+            skipWBXMLAttributes(reader, table);
+        } else if (parseWBXMLValue(token, reader, table, value)) {
+            collector.text(value);
+        } else {
+            // Element, bit 7 = has attributes, bit 6 = has content.
+            size_t id = token & 0x3F;
+            std::string name;
+            if (id == WBXML_LITERAL) {
+                name = stringTableEntry(table, reader.mbUInt32());
+            } else if (page == 0 && id - 5 < sizeof(syncMLTags) / sizeof(syncMLTags[0])) {
+                name = syncMLTags[id - 5];
+            } else if (page == 1 && id - 5 < sizeof(metInfTags) / sizeof(metInfTags[0])) {
+                name = metInfTags[id - 5];
+            }
+            collector.start(name);
+            if (token & 0x80) {
+                skipWBXMLAttributes(reader, table);
+            }
+            if (!(token & 0x40)) {
+                collector.end();
+            }
+        }
+    }
+    return collector.complete();
+}
+
+} // anonymous namespace
+
+bool ParseSyncMLHeader(const char *data, size_t len,
+                       const std::string &type,
+                       SyncMLHeader &header)
+{
+    // relaxed checking: ignore stuff like "; CHARSET=UTF-8"
+    std::string baseType = type.substr(0, type.find(';'));
+    bool wbxml;
+    if (baseType == TransportAgent::m_contentTypeSyncWBXML) {
+        wbxml = true;
+    } else if (baseType == TransportAgent::m_contentTypeSyncML) {
+        wbxml = false;
+    } else {
+        // XML starts with "<", perhaps after white space or a BOM;
+        // WBXML with a small version number.
+        wbxml = len > 0 && (unsigned char)data[0] < 0x10;
+    }
+
+    HeaderCollector collector(header);
+    try {
+        return wbxml ?
+            parseWBXML(data, len, collector) :
+            parseXML(data, data + len, collector);
+    } catch (...) {
+        // invalid WBXML, treated like an incomplete header
+        return false;
+    }
+}
+
+#ifdef ENABLE_UNIT_TESTS
+
+class SyncMLHeaderTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(SyncMLHeaderTest);
+    CPPUNIT_TEST(xml);
+    CPPUNIT_TEST(wbxml);
+    CPPUNIT_TEST(incomplete);
+    CPPUNIT_TEST_SUITE_END();
+
+    void check(const SyncMLHeader &header)
+    {
+        CPPUNIT_ASSERT_EQUAL(std::string("SyncML/1.2"), header.m_verProto);
+        CPPUNIT_ASSERT_EQUAL(std::string("sc-api-nat"), header.m_sourceURI);
+        CPPUNIT_ASSERT_EQUAL(std::string("1"), header.m_msgID);
+    }
+
+public:
+    void xml()
+    {
+        static const char message[] =
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+            "<SyncML xmlns='SYNCML:SYNCML1.2'><SyncHdr><VerDTD>1.2</VerDTD><VerProto>SyncML/1.2</VerProto>"
+            "<SessionID>255</SessionID><MsgID>1</MsgID>"
+            "<Target><LocURI>http://127.0.0.1:9000/syncevolution?a=1&amp;b=2</LocURI></Target>"
+            "<Source><LocURI>sc-api-nat</LocURI><LocName>test</LocName></Source>"
+            "<Cred><Meta><Format xmlns='syncml:metinf'>b64</Format><Type xmlns='syncml:metinf'>syncml:auth-md5</Type></Meta>"
+            "<Data>kHzMn3RWFGWSKeBpXicppQ==</Data></Cred>"
+            "<Meta><MaxMsgSize xmlns='syncml:metinf'>20000</MaxMsgSize><MaxObjSize xmlns='syncml:metinf'>4000000</MaxObjSize></Meta>"
+            "</SyncHdr><SyncBody><Final/></SyncBody></SyncML>";
+        SyncMLHeader header;
+        CPPUNIT_ASSERT(ParseSyncMLHeader(message, sizeof(message) - 1, "application/vnd.syncml+xml; charset=UTF-8", header));
+        check(header);
+        CPPUNIT_ASSERT_EQUAL(std::string("255"), header.m_sessionID);
+        CPPUNIT_ASSERT_EQUAL(std::string("http://127.0.0.1:9000/syncevolution?a=1&b=2"), header.m_targetURI);
+        CPPUNIT_ASSERT_EQUAL(20000ul, header.m_maxMsgSize);
+        CPPUNIT_ASSERT_EQUAL(4000000ul, header.m_maxObjSize);
+    }
+
+    void wbxml()
+    {
+        // beginning of TestConnection.message1WBXML from test-dbus.py, without Cred
+        static const unsigned char message[] = {
+            0x02, 0xa4, 0x01, 0x6a, 0x00, 0x6d, 0x6c, 0x71, 0x03, '1', '.', '2', 0x00, 0x01,
+            0x72, 0x03, 'S', 'y', 'n', 'c', 'M', 'L', '/', '1', '.', '2', 0x00, 0x01,
+            0x65, 0x03, '2', '1', '1', 0x00, 0x01,
+            0x5b, 0x03, '1', 0x00, 0x01,
+            0x6e, 0x57, 0x03, 'h', 't', 't', 'p', ':', '/', '/', 'm', 'y', '.', 'f', 'u', 'n', 'a', 'm', 'b', 'o', 'l', '.', 'c', 'o', 'm', '/', 's', 'y', 'n', 'c', 0x00, 0x01, 0x01,
+            0x67, 0x57, 0x03, 's', 'c', '-', 'a', 'p', 'i', '-', 'n', 'a', 't', 0x00, 0x01,
+            0x56, 0x03, 'p', 'a', 't', 'r', 'i', 'c', 'k', '.', 'o', 'h', 'l', 'y', 0x00, 0x01, 0x01,
+            0x5a, 0x00, 0x01, 0x4c, 0x03, '1', '5', '0', '0', '0', '0', 0x00, 0x01,
+            0x55, 0x03, '4', '0', '0', '0', '0', '0', '0', 0x00, 0x01, 0x01,
+            0x01,
+            // SyncBody would follow here
+            0x00, 0x00, 0x6b
+        };
+        SyncMLHeader header;
+        CPPUNIT_ASSERT(ParseSyncMLHeader(reinterpret_cast<const char *>(message), sizeof(message), "application/vnd.syncml+wbxml", header));
+        check(header);
+        CPPUNIT_ASSERT_EQUAL(std::string("211"), header.m_sessionID);
+        CPPUNIT_ASSERT_EQUAL(std::string("http://my.funambol.com/sync"), header.m_targetURI);
+        CPPUNIT_ASSERT_EQUAL(150000ul, header.m_maxMsgSize);
+        CPPUNIT_ASSERT_EQUAL(4000000ul, header.m_maxObjSize);
+
+        // same without content type
+        SyncMLHeader header2;
+        CPPUNIT_ASSERT(ParseSyncMLHeader(reinterpret_cast<const char *>(message), sizeof(message), "", header2));
+        check(header2);
+    }
+
+    void incomplete()
+    {
+        static const char message[] =
+            "<SyncML><SyncHdr><VerProto>SyncML/1.2</VerProto><Source><LocURI>foo";
+        SyncMLHeader header;
+        CPPUNIT_ASSERT(!ParseSyncMLHeader(message, sizeof(message) - 1, "application/vnd.syncml+xml", header));
+        CPPUNIT_ASSERT(!ParseSyncMLHeader(message, 3, "application/vnd.syncml+wbxml", header));
+    }
+};
+
+SYNCEVOLUTION_TEST_SUITE_REGISTRATION(SyncMLHeaderTest);
+
+#endif // ENABLE_UNIT_TESTS
+
+SE_END_CXX
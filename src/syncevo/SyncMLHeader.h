@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2012 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ */
+
+#ifndef INCL_SYNCEVOLUTION_SYNCMLHEADER
+# define INCL_SYNCEVOLUTION_SYNCMLHEADER
+
+#include <string>
+
+#include <syncevo/declarations.h>
+SE_BEGIN_CXX
+
+/**
+ * Fields from the <SyncHdr> of a SyncML message. Strings are empty
+ * and numbers zero if the message did not contain them.
+ */
+struct SyncMLHeader
+{
+    SyncMLHeader() :
+        m_maxMsgSize(0),
+        m_maxObjSize(0)
+    {}
+
+    std::string m_verProto;     /**< VerProto, like "SyncML/1.2" */
+    std::string m_sessionID;    /**< SessionID */
+    std::string m_msgID;        /**< MsgID */
+    std::string m_targetURI;    /**< Target/LocURI = the recipient */
+    std::string m_sourceURI;    /**< Source/LocURI = device ID of the sender */
+    std::string m_respURI;      /**< RespURI */
+    unsigned long m_maxMsgSize; /**< Meta/MaxMsgSize */
+    unsigned long m_maxObjSize; /**< Meta/MaxObjSize */
+};
+
+/**
+ * Extracts the SyncHdr fields from the XML or WBXML representation
+ * of a SyncML message. Only the header is parsed and nothing is
+ * validated, so this is much cheaper than letting the Synthesis
+ * engine process the message.
+ *
+ * @param data     the message
+ * @param len      size of the message in bytes
+ * @param type     content type; if neither XML nor WBXML, the
+ *                 representation is guessed from the data
+ * @retval header  receives the fields
+ * @return false if no complete SyncHdr was found
+ */
+bool ParseSyncMLHeader(const char *data, size_t len,
+                       const std::string &type,
+                       SyncMLHeader &header);
+
+SE_END_CXX
+
+#endif // INCL_SYNCEVOLUTION_SYNCMLHEADER
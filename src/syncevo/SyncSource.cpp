@@ -41,12 +41,15 @@
 #include <ctype.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include <fstream>
 #include <iostream>
 
 #ifdef ENABLE_UNIT_TESTS
 #include "test.h"
+#include <syncevo/VolatileConfigNode.h>
 #endif
 
 #include <syncevo/declarations.h>
@@ -784,6 +787,26 @@ void SyncSourceSerialize::init(SyncSource::Operations &ops)
 }
 
 
+void SyncSourceRaw::readItemsRaw(const std::vector<std::string> &luids,
+                                 std::vector<std::string> &items)
+{
+    items.resize(luids.size());
+    for (size_t i = 0; i < luids.size(); i++) {
+        readItemRaw(luids[i], items[i]);
+    }
+}
+
+void SyncSourceRaw::insertItemsRaw(const std::vector<std::string> &luids,
+                                   const std::vector<std::string> &items,
+                                   std::vector<InsertItemResult> &results)
+{
+    results.clear();
+    results.reserve(luids.size());
+    for (size_t i = 0; i < luids.size(); i++) {
+        results.push_back(insertItemRaw(luids[i], items[i]));
+    }
+}
+
 void ItemCache::init(const SyncSource::Operations::ConstBackupInfo &oldBackup,
                      const SyncSource::Operations::BackupInfo &newBackup,
                      bool legacy)
@@ -792,6 +815,11 @@ void ItemCache::init(const SyncSource::Operations::ConstBackupInfo &oldBackup,
     m_legacy = legacy;
     m_backup = newBackup;
     m_hash2counter.clear();
+    m_counter2rev.clear();
+    m_storeFiles.clear();
+    if (!m_backup.m_storeDir.empty()) {
+        mkdir_p(m_backup.m_storeDir);
+    }
     m_dirname = oldBackup.m_dirname;
     if (m_dirname.empty() || !oldBackup.m_node) {
         return;
@@ -807,6 +835,20 @@ void ItemCache::init(const SyncSource::Operations::ConstBackupInfo &oldBackup,
         Hash_t hash;
         if (oldBackup.m_node->getProperty(key.str(), hash)) {
             m_hash2counter[hash] = counter;
+
+            // same keys as in backupItem()
+            stringstream uidkey, revkey;
+            uidkey << counter << "-uid";
+            if (legacy) {
+                revkey << counter << "-uid";
+            }
+            revkey << counter << "-rev";
+            string uid, rev;
+            if (oldBackup.m_node->getProperty(uidkey.str(), uid) &&
+                oldBackup.m_node->getProperty(revkey.str(), rev) &&
+                !rev.empty()) {
+                m_counter2rev[counter] = make_pair(uid, rev);
+            }
         }
     }
 }
@@ -832,6 +874,47 @@ string ItemCache::getFilename(Hash_t hash)
     }
 }
 
+string ItemCache::getStoreFilename(Hash_t hash, size_t size)
+{
+    if (m_backup.m_storeDir.empty()) {
+        return "";
+    }
+    // The size is part of the name because the default hash
+    // is not collision resistant.
+    stringstream filename;
+    filename << m_backup.m_storeDir << "/" << hash << "-" << size;
+    return filename.str();
+}
+
+bool ItemCache::sameContent(const string &filename, const std::string &item)
+{
+#ifdef USE_SHA256
+    return true;
+#else
+    string content;
+    if (!ReadFile(filename, content)) {
+        return false;
+    }
+    if (content != item) {
+        SE_LOG_DEBUG(NULL, NULL, "%s: same hash, different content", filename.c_str());
+        return false;
+    }
+    return true;
+#endif
+}
+
+bool ItemCache::sameRevision(Hash_t hash, const std::string &uid, const std::string &rev)
+{
+    Map_t::const_iterator it = m_hash2counter.find(hash);
+    if (it == m_hash2counter.end()) {
+        return false;
+    }
+    Revisions_t::const_iterator it2 = m_counter2rev.find(it->second);
+    return it2 != m_counter2rev.end() &&
+        it2->second.first == uid &&
+        it2->second.second == rev;
+}
+
 const char *ItemCache::m_hashSuffix =
 #ifdef USE_SHA256
     "-sha256"
@@ -848,7 +931,35 @@ void ItemCache::backupItem(const std::string &item,
     filename << m_backup.m_dirname << "/" << m_counter;
 
     ItemCache::Hash_t hash = hashFunc(item);
-    string oldfilename = getFilename(hash);
+    string storefilename = getStoreFilename(hash, item.size());
+    if (!storefilename.empty()) {
+        m_storeFiles.insert(storefilename);
+    }
+
+    // An unchanged item can be linked to its old file directly,
+    // comparing the content is only necessary for other items.
+    bool unchanged = sameRevision(hash, uid, rev);
+    bool stored = false;
+    if (!unchanged &&
+        !storefilename.empty() &&
+        sameContent(storefilename, item)) {
+        // found file with same content in store, reuse it via hardlink
+        if (!link(storefilename.c_str(), filename.str().c_str())) {
+            stored = true;
+        } else if (errno != ENOENT) {
+            SE_LOG_DEBUG(NULL, NULL, "hard linking stored %s new %s: %s",
+                         storefilename.c_str(),
+                         filename.str().c_str(),
+                         strerror(errno));
+        }
+    }
+
+    string oldfilename = stored ? "" : getFilename(hash);
+    if (!oldfilename.empty() &&
+        !unchanged &&
+        !sameContent(oldfilename, item)) {
+        oldfilename.clear();
+    }
     if (!oldfilename.empty()) {
         // found old file with same content, reuse it via hardlink
         if (link(oldfilename.c_str(), filename.str().c_str())) {
@@ -862,7 +973,7 @@ void ItemCache::backupItem(const std::string &item,
         }
     }
 
-    if (oldfilename.empty()) {
+    if (!stored && oldfilename.empty()) {
         // write new file instead of reusing old one
         ofstream out(filename.str().c_str());
         out.write(item.c_str(), item.size());
@@ -872,6 +983,21 @@ void ItemCache::backupItem(const std::string &item,
         }
     }
 
+    if (!stored && !storefilename.empty()) {
+        // Make content available to future backups. Failures are
+        // not fatal, the backup itself is complete. EEXIST happens
+        // when the stored file could not be linked to above (too
+        // many links or different content with the same hash, for
+        // example).
+        if (link(filename.str().c_str(), storefilename.c_str()) &&
+            errno != EEXIST) {
+            SE_LOG_DEBUG(NULL, NULL, "hard linking new %s stored %s: %s",
+                         filename.str().c_str(),
+                         storefilename.c_str(),
+                         strerror(errno));
+        }
+    }
+
     stringstream key;
     key << m_counter << "-uid";
     m_backup.m_node->setProperty(key.str(), uid);
@@ -902,6 +1028,22 @@ void ItemCache::finalize(BackupReport &report)
     m_backup.m_node->setProperty("numitems", value.str());
     m_backup.m_node->flush();
 
+    // Files removed by reset() may have left entries in the store
+    // which no backup links to anymore.
+    int removed = 0;
+    BOOST_FOREACH(const string &storefilename, m_storeFiles) {
+        struct stat buf;
+        if (!stat(storefilename.c_str(), &buf) &&
+            buf.st_nlink <= 1 &&
+            !unlink(storefilename.c_str())) {
+            ++removed;
+        }
+    }
+    if (removed) {
+        SE_LOG_DEBUG(NULL, NULL, "removed %d unused items from %s", removed, m_backup.m_storeDir.c_str());
+    }
+    m_storeFiles.clear();
+
     report.setNumItems(m_counter - 1);
 }
 
@@ -934,18 +1076,86 @@ void SyncSourceRevisions::backupData(const SyncSource::Operations::ConstBackupIn
         revisions = &buffer;
     }
 
-    string item;
+    // Items are requested in batches of limited size, so that
+    // backends which implement readItemsRaw() can fetch several of
+    // them at once without keeping the whole database in memory.
+    static const size_t batchSize = 100;
+    std::vector<std::string> uids, revs, items;
+    uids.reserve(batchSize);
+    revs.reserve(batchSize);
+    size_t done = 0;
     errno = 0;
-    BOOST_FOREACH(const StringPair &mapping, *revisions) {
-        const string &uid = mapping.first;
-        const string &rev = mapping.second;
-        m_raw->readItemRaw(uid, item);
-        cache.backupItem(item, uid, rev);
+    RevisionMap_t::const_iterator it = revisions->begin();
+    while (it != revisions->end()) {
+        uids.clear();
+        revs.clear();
+        while (it != revisions->end() && uids.size() < batchSize) {
+            uids.push_back(it->first);
+            revs.push_back(it->second);
+            ++it;
+        }
+        m_raw->readItemsRaw(uids, items);
+        if (items.size() != uids.size()) {
+            throwError(StringPrintf("reading items for backup: got %lu instead of %lu items",
+                                    (unsigned long)items.size(), (unsigned long)uids.size()));
+        }
+        for (size_t i = 0; i < uids.size(); i++) {
+            cache.backupItem(items[i], uids[i], revs[i]);
+        }
+        done += uids.size();
+        SE_LOG_DEBUG(this, NULL, "backup: %lu of %lu items done",
+                     (unsigned long)done, (unsigned long)revisions->size());
     }
 
     cache.finalize(report);
 }
 
+/** counts an item which was (or would have been) restored */
+static void countRestoredItem(SyncSourceReport::ItemState state,
+                              SyncSourceReport &report)
+{
+    report.incrementItemStat(report.ITEM_LOCAL,
+                             report.ITEM_ANY,
+                             report.ITEM_TOTAL);
+    report.incrementItemStat(report.ITEM_LOCAL,
+                             state,
+                             report.ITEM_TOTAL);
+}
+
+/**
+ * Stores the items collected by SyncSourceRevisions::restoreData()
+ * and clears the lists afterwards. Items are only counted once
+ * storing them was attempted, so items after a failed one are not
+ * part of the report, as if restoring had stopped right there.
+ */
+static void restoreItems(SyncSourceRaw &raw,
+                         std::vector<std::string> &luids,
+                         std::vector<std::string> &items,
+                         std::vector<SyncSourceReport::ItemState> &states,
+                         SyncSourceReport &report)
+{
+    std::vector<SyncSourceRaw::InsertItemResult> results;
+    try {
+        raw.insertItemsRaw(luids, items, results);
+    } catch (...) {
+        // results tells us which item failed
+        size_t failed = std::min(results.size(), states.size() - 1);
+        for (size_t i = 0; i <= failed; i++) {
+            countRestoredItem(states[i], report);
+        }
+        report.incrementItemStat(report.ITEM_LOCAL,
+                                 states[failed],
+                                 report.ITEM_REJECT);
+        throw;
+    }
+    BOOST_FOREACH(SyncSourceReport::ItemState state, states) {
+        countRestoredItem(state, report);
+    }
+    luids.clear();
+    items.clear();
+    states.clear();
+}
+
 void SyncSourceRevisions::restoreData(const SyncSource::Operations::ConstBackupInfo &oldBackup,
                                       bool dryrun,
                                       SyncSourceReport &report)
@@ -953,6 +1163,12 @@ void SyncSourceRevisions::restoreData(const SyncSource::Operations::ConstBackupI
     RevisionMap_t revisions;
     listAllItems(revisions);
 
+    // Items which need to be added or updated are stored in
+    // batches, see SyncSourceRaw::insertItemsRaw().
+    static const size_t batchSize = 100;
+    std::vector<std::string> luids, items;
+    std::vector<SyncSourceReport::ItemState> states;
+
     long numitems;
     string strval;
     strval = oldBackup.m_node->readProperty("numitems");
@@ -967,19 +1183,22 @@ void SyncSourceRevisions::restoreData(const SyncSource::Operations::ConstBackupI
         key << counter << "-rev";
         string rev = oldBackup.m_node->readProperty(key.str());
         RevisionMap_t::iterator it = revisions.find(uid);
-        report.incrementItemStat(report.ITEM_LOCAL,
-                                 report.ITEM_ANY,
-                                 report.ITEM_TOTAL);
         if (it != revisions.end() &&
             it->second == rev) {
             // item exists in backup and database with same revision:
             // nothing to do
+            report.incrementItemStat(report.ITEM_LOCAL,
+                                     report.ITEM_ANY,
+                                     report.ITEM_TOTAL);
         } else {
             // add or update, so need item
             stringstream filename;
             filename << oldBackup.m_dirname << "/" << counter;
             string data;
             if (!ReadFile(filename.str(), data)) {
+                report.incrementItemStat(report.ITEM_LOCAL,
+                                         report.ITEM_ANY,
+                                         report.ITEM_TOTAL);
                 throwError(StringPrintf("restoring %s from %s failed: could not read file",
                                         uid.c_str(),
                                         filename.str().c_str()));
@@ -998,19 +1217,17 @@ void SyncSourceRevisions::restoreData(const SyncSource::Operations::ConstBackupI
                 it == revisions.end() ?
                 SyncSourceReport::ITEM_ADDED :   // not found in database, create anew
                 SyncSourceReport::ITEM_UPDATED;  // found, update existing item
-            try {
-                report.incrementItemStat(report.ITEM_LOCAL,
-                                         state,
-                                         report.ITEM_TOTAL);
-                if (!dryrun) {
-                    m_raw->insertItemRaw(it == revisions.end() ? "" : uid,
-                                         data);
+            if (dryrun) {
+                countRestoredItem(state, report);
+            } else {
+                // counted by restoreItems()
+                luids.push_back(it == revisions.end() ? "" : uid);
+                items.push_back(std::string());
+                items.back().swap(data);
+                states.push_back(state);
+                if (luids.size() >= batchSize) {
+                    restoreItems(*m_raw, luids, items, states, report);
                 }
-            } catch (...) {
-                report.incrementItemStat(report.ITEM_LOCAL,
-                                         state,
-                                         report.ITEM_REJECT);
-                throw;
             }
         }
 
@@ -1023,6 +1240,10 @@ void SyncSourceRevisions::restoreData(const SyncSource::Operations::ConstBackupI
         }
     }
 
+    if (!luids.empty()) {
+        restoreItems(*m_raw, luids, items, states, report);
+    }
+
     // now remove items that were not in the backup
     BOOST_FOREACH(const StringPair &mapping, revisions) {
         try {
@@ -1054,46 +1275,46 @@ void SyncSourceRevisions::detectChanges(ConfigNode &trackingNode, ChangeMode mod
         m_firstCycle = false;
     }
 
-    if (mode == CHANGES_NONE) {
-        // shortcut because nothing changed: just copy our known item list
+    // Read the tracking node exactly once. Looking up each item with
+    // readProperty() would escape the key and search the node once
+    // per item; instead the sorted copy is compared against the
+    // sorted current revisions in a single pass below.
+    RevisionMap_t tracked;
+    {
         ConfigProps props;
         trackingNode.readProperties(props);
+        tracked.insert(props.begin(), props.end());
+    }
 
-        RevisionMap_t revisions;
-        BOOST_FOREACH(const StringPair &mapping, props) {
-            const string &uid = mapping.first;
-            const string &revision = mapping.second;
-            addItem(uid);
-            revisions[uid] = revision;
+    if (mode == CHANGES_NONE) {
+        // shortcut because nothing changed: just copy our known item list
+        BOOST_FOREACH(const StringPair &mapping, tracked) {
+            addItem(mapping.first);
         }
-        setAllItems(revisions);
+        setAllItems(tracked);
         return;
     }
 
     if (!m_revisionsSet &&
-        mode == CHANGES_FULL) {
-        ConfigProps props;
-        trackingNode.readProperties(props);
-        if (!props.empty()) {
-            // We were not asked to throw away all old information and
-            // there is some that may be worth salvaging, so let's give
-            // our derived class a chance to update it instead of having
-            // to reread everything.
-            //
-            // The exact number of items at which the update method is
-            // more efficient depends on the derived class; here we assume
-            // that even a single item makes it worthwhile. The derived
-            // class can always ignore the information if it has different
-            // tradeoffs.
-            //
-            // TODO (?): an API which only provides the information
-            // on demand...
-            m_revisions.clear();
-            m_revisions.insert(props.begin(), props.end());
-            updateAllItems(m_revisions);
-            // continue with m_revisions initialized below
-            m_revisionsSet = true;
-        }
+        mode == CHANGES_FULL &&
+        !tracked.empty()) {
+        // We were not asked to throw away all old information and
+        // there is some that may be worth salvaging, so let's give
+        // our derived class a chance to update it instead of having
+        // to reread everything.
+        //
+        // The exact number of items at which the update method is
+        // more efficient depends on the derived class; here we assume
+        // that even a single item makes it worthwhile. The derived
+        // class can always ignore the information if it has different
+        // tradeoffs.
+        //
+        // TODO (?): an API which only provides the information
+        // on demand...
+        m_revisions = tracked;
+        updateAllItems(m_revisions);
+        // continue with m_revisions initialized below
+        m_revisionsSet = true;
     }
 
     // traditional, slow fallback follows...
@@ -1101,48 +1322,94 @@ void SyncSourceRevisions::detectChanges(ConfigNode &trackingNode, ChangeMode mod
 
     // Delay setProperty calls until after checking all uids.
     // Necessary for MapSyncSource, which shares the revision among
-    // several uids. Another advantage is that we can do the "find
-    // deleted items" check with less entries (new items not added
-    // yet).
+    // several uids. Items which were deleted are also removed from
+    // the tracking node first, before recording new revisions.
     StringMap revUpdates;
-
-    BOOST_FOREACH(const StringPair &mapping, m_revisions) {
-        const string &uid = mapping.first;
-        const string &revision = mapping.second;
-
-        // always remember the item, need full list
-        addItem(uid);
-
-        // TODO: avoid unnecessary work in CHANGES_SLOW mode
-        // Not done yet to avoid introducing bugs.
-        string serverRevision(trackingNode.readProperty(uid));
-        if (!serverRevision.size()) {
+    std::list<std::string> deleted;
+
+    // merge join of current and previous revisions, both sorted by uid
+    RevisionMap_t::const_iterator current = m_revisions.begin();
+    RevisionMap_t::const_iterator previous = tracked.begin();
+    while (current != m_revisions.end() ||
+           previous != tracked.end()) {
+        if (previous == tracked.end() ||
+            (current != m_revisions.end() && current->first < previous->first)) {
+            // not tracked yet
+            const string &uid = current->first;
+            addItem(uid);
             addItem(uid, NEW);
-            revUpdates[uid] = revision;
+            revUpdates[uid] = current->second;
+            ++current;
+        } else if (current == m_revisions.end() ||
+                   previous->first < current->first) {
+            // tracked, but gone now
+            deleted.push_back(previous->first);
+            ++previous;
         } else {
-            if (revision != serverRevision) {
-                addItem(uid, UPDATED);
+            // TODO: avoid unnecessary work in CHANGES_SLOW mode
+            // Not done yet to avoid introducing bugs.
+            const string &uid = current->first;
+            const string &revision = current->second;
+            const string &serverRevision = previous->second;
+            addItem(uid);
+            if (serverRevision.empty()) {
+                addItem(uid, NEW);
+                revUpdates[uid] = revision;
+            } else if (revision != serverRevision) {
+                if (!sameRevision(serverRevision, revision)) {
+                    addItem(uid, UPDATED);
+                }
                 revUpdates[uid] = revision;
             }
+            ++current;
+            ++previous;
         }
     }
 
     // clear information about all items that we recognized as deleted
-    ConfigProps props;
-    trackingNode.readProperties(props);
-
-    BOOST_FOREACH(const StringPair &mapping, props) {
-        const string &uid(mapping.first);
-        if (getAllItems().find(uid) == getAllItems().end()) {
-            addItem(uid, DELETED);
-            trackingNode.removeProperty(uid);
-        }
+    BOOST_FOREACH(const string &uid, deleted) {
+        addItem(uid, DELETED);
+        trackingNode.removeProperty(uid);
     }
 
     // now update tracking node
     BOOST_FOREACH(const StringPair &update, revUpdates) {
         trackingNode.setProperty(update.first, update.second);
     }
+
+    SE_LOG_DEBUG(this, NULL, "%lu items, %lu new, %lu updated, %lu deleted",
+                 (unsigned long)m_revisions.size(),
+                 (unsigned long)getNewItems().size(),
+                 (unsigned long)getUpdatedItems().size(),
+                 (unsigned long)deleted.size());
+}
+
+SyncSourceRevisions::ChangeMode SyncSourceRevisions::checkDatabaseRevision(ConfigNode &metaNode, bool reset)
+{
+    ChangeMode mode = CHANGES_FULL;
+    string oldRevision = metaNode.readProperty("databaseRevision");
+    if (!oldRevision.empty()) {
+        string newRevision = databaseRevision();
+        SE_LOG_DEBUG(this, NULL, "old database revision '%s', new revision '%s'",
+                     oldRevision.c_str(),
+                     newRevision.c_str());
+        if (newRevision == oldRevision) {
+            SE_LOG_DEBUG(this, NULL, "revisions match, no item changes");
+            mode = CHANGES_NONE;
+        }
+
+        if (reset) {
+            metaNode.setProperty("databaseRevision", "");
+            metaNode.flush();
+        }
+    }
+    return mode;
+}
+
+void SyncSourceRevisions::storeDatabaseRevision(ConfigNode &metaNode)
+{
+    string updatedRevision = databaseRevision();
+    metaNode.setProperty("databaseRevision", updatedRevision);
 }
 
 void SyncSourceRevisions::updateRevision(ConfigNode &trackingNode,
@@ -1169,6 +1436,9 @@ void SyncSourceRevisions::deleteRevision(ConfigNode &trackingNode,
 
 void SyncSourceRevisions::sleepSinceModification()
 {
+    if (m_revisionAccuracySeconds <= 0) {
+        return;
+    }
     Timespec current = Timespec::monotonic();
     // Don't let this get interrupted by user abort.
     // It is needed for correct change tracking.
@@ -1293,7 +1563,9 @@ sysync::TSyError SyncSourceAdmin::saveAdminData(const char *adminData)
                               StringEscape::escape(adminData, '!', StringEscape::INI_VALUE));
 
     // Flush here, because some calls to saveAdminData() happend
-    // after SyncSourceAdmin::flush() (= session end).
+    // after SyncSourceAdmin::flush() (= session end). The map
+    // changes belonging to the admin data must be on disk, too.
+    syncMapJournal();
     m_configNode->flush();
     return sysync::LOCERR_OK;
 }
@@ -1328,9 +1600,7 @@ sysync::TSyError SyncSourceAdmin::insertMapItem(sysync::cMapID mID)
     }
 #else
     m_mapping[key] = value;
-    m_mappingNode->clear();
-    m_mappingNode->writeProperties(m_mapping);
-    m_mappingNode->flush();
+    storeMapChange(key, &value);
     return sysync::LOCERR_OK;
 #endif
 }
@@ -1346,9 +1616,7 @@ sysync::TSyError SyncSourceAdmin::updateMapItem(sysync::cMapID mID)
         return sysync::DB_Forbidden;
     } else {
         m_mapping[key] = value;
-        m_mappingNode->clear();
-        m_mappingNode->writeProperties(m_mapping);
-        m_mappingNode->flush();
+        storeMapChange(key, &value);
         return sysync::LOCERR_OK;
     }
 }
@@ -1364,9 +1632,7 @@ sysync::TSyError SyncSourceAdmin::deleteMapItem(sysync::cMapID mID)
         return sysync::DB_Forbidden;
     } else {
         m_mapping.erase(it);
-        m_mappingNode->clear();
-        m_mappingNode->writeProperties(m_mapping);
-        m_mappingNode->flush();
+        storeMapChange(key, NULL);
         return sysync::LOCERR_OK;
     }
 }
@@ -1375,9 +1641,14 @@ void SyncSourceAdmin::flush()
 {
     m_configNode->flush();
     if (m_mappingLoaded) {
+        // journal must be complete in case that rewriting the
+        // mapping node gets interrupted
+        syncMapJournal();
         m_mappingNode->clear();
         m_mappingNode->writeProperties(m_mapping);
         m_mappingNode->flush();
+        // compaction done, journal no longer needed
+        removeMapJournal();
     }
 }
 
@@ -1385,10 +1656,138 @@ void SyncSourceAdmin::resetMap()
 {
     m_mapping.clear();
     m_mappingNode->readProperties(m_mapping);
+    replayMapJournal();
     m_mappingIterator = m_mapping.begin();
     m_mappingLoaded = true;
 }
 
+void SyncSourceAdmin::storeMapChange(const string &key, const string *value)
+{
+    if (m_mappingJournal.empty()) {
+        // traditional, slow method: rewrite everything
+        m_mappingNode->clear();
+        m_mappingNode->writeProperties(m_mapping);
+        m_mappingNode->flush();
+        return;
+    }
+
+    if (m_mappingJournalFD < 0) {
+        openMapJournal();
+    }
+
+    // Keys and values are escaped by mapid2entry() and thus
+    // never contain line breaks. Keys also contain no spaces.
+    string line;
+    if (value) {
+        line.reserve(key.size() + value->size() + 3);
+        line += '+';
+        line += key;
+        line += ' ';
+        line += *value;
+    } else {
+        line += '-';
+        line += key;
+    }
+    line += '\n';
+
+    // Lines are appended, so an incomplete line (after a crash) can
+    // only be at the end of the journal. It is ignored by
+    // replayMapJournal() and cut off by openMapJournal() before
+    // appending anything.
+    const char *data = line.c_str();
+    size_t len = line.size();
+    while (len) {
+        ssize_t written = ::write(m_mappingJournalFD, data, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throwError(m_mappingJournal, errno);
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+void SyncSourceAdmin::openMapJournal()
+{
+    mkdir_p(getDirname(m_mappingJournal));
+    m_mappingJournalFD = ::open(m_mappingJournal.c_str(),
+                                O_WRONLY|O_CREAT|O_APPEND,
+                                S_IRUSR|S_IWUSR);
+    if (m_mappingJournalFD < 0) {
+        throwError(m_mappingJournal, errno);
+    }
+
+    // Remove an incomplete last line, otherwise the next record
+    // would be merged with it.
+    string journal;
+    if (ReadFile(m_mappingJournal, journal)) {
+        size_t end = journal.rfind('\n');
+        off_t valid = end == journal.npos ? 0 : end + 1;
+        if ((size_t)valid != journal.size()) {
+            SE_LOG_DEBUG(this, NULL, "removing %lu bytes of incomplete map change from %s",
+                         (unsigned long)(journal.size() - valid), m_mappingJournal.c_str());
+            if (ftruncate(m_mappingJournalFD, valid)) {
+                throwError(m_mappingJournal, errno);
+            }
+        }
+    }
+}
+
+void SyncSourceAdmin::syncMapJournal()
+{
+    if (m_mappingJournalFD >= 0 &&
+        fsync(m_mappingJournalFD)) {
+        throwError(m_mappingJournal, errno);
+    }
+}
+
+void SyncSourceAdmin::replayMapJournal()
+{
+    string journal;
+    if (m_mappingJournal.empty() ||
+        !ReadFile(m_mappingJournal, journal)) {
+        return;
+    }
+
+    size_t numChanges = 0;
+    size_t start = 0;
+    size_t end;
+    while ((end = journal.find('\n', start)) != journal.npos) {
+        if (end > start + 1) {
+            switch (journal[start]) {
+            case '+': {
+                size_t sep = journal.find(' ', start + 1);
+                if (sep != journal.npos && sep < end) {
+                    m_mapping[journal.substr(start + 1, sep - start - 1)] =
+                        journal.substr(sep + 1, end - sep - 1);
+                    numChanges++;
+                }
+                break;
+            }
+            case '-':
+                m_mapping.erase(journal.substr(start + 1, end - start - 1));
+                numChanges++;
+                break;
+            }
+        }
+        start = end + 1;
+    }
+    SE_LOG_DEBUG(this, NULL, "replayed %lu map changes from %s",
+                 (unsigned long)numChanges, m_mappingJournal.c_str());
+}
+
+void SyncSourceAdmin::removeMapJournal()
+{
+    if (m_mappingJournalFD >= 0) {
+        ::close(m_mappingJournalFD);
+        m_mappingJournalFD = -1;
+    }
+    if (!m_mappingJournal.empty()) {
+        ::unlink(m_mappingJournal.c_str());
+    }
+}
 
 void SyncSourceAdmin::mapid2entry(sysync::cMapID mID, string &key, string &value)
 {
@@ -1426,15 +1825,30 @@ void SyncSourceAdmin::entry2mapid(const string &key, const string &value, sysync
     }
 }
 
+SyncSourceAdmin::SyncSourceAdmin() :
+    m_mappingLoaded(false),
+    m_mappingJournalFD(-1)
+{
+}
+
+SyncSourceAdmin::~SyncSourceAdmin()
+{
+    if (m_mappingJournalFD >= 0) {
+        ::close(m_mappingJournalFD);
+    }
+}
+
 void SyncSourceAdmin::init(SyncSource::Operations &ops,
                            const boost::shared_ptr<ConfigNode> &config,
                            const std::string adminPropertyName,
-                           const boost::shared_ptr<ConfigNode> &mapping)
+                           const boost::shared_ptr<ConfigNode> &mapping,
+                           const std::string &journal)
 {
     m_configNode = config;
     m_adminPropertyName = adminPropertyName;
     m_mappingNode = mapping;
     m_mappingLoaded = false;
+    m_mappingJournal = journal;
 
     ops.m_loadAdminData = boost::bind(&SyncSourceAdmin::loadAdminData,
                                       this, _1, _2, _3);
@@ -1454,10 +1868,12 @@ void SyncSourceAdmin::init(SyncSource::Operations &ops,
 void SyncSourceAdmin::init(SyncSource::Operations &ops,
                            SyncSource *source)
 {
+    std::string cacheDir = source->getCacheDir();
     init(ops,
          source->getProperties(true),
          SourceAdminDataName,
-         source->getServerNode());
+         source->getServerNode(),
+         cacheDir.empty() ? "" : cacheDir + "/mapping.journal");
 }
 
 void SyncSourceBlob::init(SyncSource::Operations &ops,
@@ -1495,6 +1911,7 @@ void TestingSyncSource::removeAllItems()
 class SyncSourceTest : public CppUnit::TestFixture {
     CPPUNIT_TEST_SUITE(SyncSourceTest);
     CPPUNIT_TEST(backendsAvailable);
+    CPPUNIT_TEST(itemCacheStore);
     CPPUNIT_TEST_SUITE_END();
 
     void backendsAvailable()
@@ -1505,6 +1922,48 @@ class SyncSourceTest : public CppUnit::TestFixture {
         CPPUNIT_ASSERT( !SyncSource::backendsInfo().empty() );
 #endif
     }
+
+    static nlink_t numLinks(const string &filename)
+    {
+        struct stat buf;
+        return stat(filename.c_str(), &buf) ? 0 : buf.st_nlink;
+    }
+
+    void itemCacheStore()
+    {
+        rm_r("SyncSourceTest");
+        string store = "SyncSourceTest/store";
+        boost::shared_ptr<ConfigNode> node1(new VolatileConfigNode);
+        SyncSource::Operations::BackupInfo backup1(SyncSource::Operations::BackupInfo::BACKUP_OTHER,
+                                                   "SyncSourceTest/one", node1, store);
+        mkdir_p(backup1.m_dirname);
+        BackupReport report;
+        ItemCache cache;
+        cache.init(SyncSource::Operations::ConstBackupInfo(), backup1, true);
+        string stored1 = cache.getStoreFilename(cache.hashFunc("first"), 5);
+        string stored2 = cache.getStoreFilename(cache.hashFunc("second"), 6);
+
+        // discarded backup must not leave its item in the store
+        cache.backupItem("first", "uid1", "rev1");
+        CPPUNIT_ASSERT_EQUAL((nlink_t)2, numLinks(stored1));
+        cache.reset();
+        cache.backupItem("second", "uid2", "rev2");
+        cache.finalize(report);
+        CPPUNIT_ASSERT_EQUAL((nlink_t)0, numLinks(stored1));
+        CPPUNIT_ASSERT_EQUAL((nlink_t)2, numLinks(stored2));
+
+        // unchanged item shares the file with old backup and store
+        boost::shared_ptr<ConfigNode> node2(new VolatileConfigNode);
+        SyncSource::Operations::BackupInfo backup2(SyncSource::Operations::BackupInfo::BACKUP_OTHER,
+                                                   "SyncSourceTest/two", node2, store);
+        mkdir_p(backup2.m_dirname);
+        cache.init(SyncSource::Operations::ConstBackupInfo(backup1.m_mode, backup1.m_dirname, node1),
+                   backup2, true);
+        cache.backupItem("second", "uid2", "rev2");
+        cache.finalize(report);
+        CPPUNIT_ASSERT_EQUAL((nlink_t)3, numLinks(stored2));
+        CPPUNIT_ASSERT_EQUAL((nlink_t)3, numLinks(backup2.m_dirname + "/1"));
+    }
 };
 
 SYNCEVOLUTION_TEST_SUITE_REGISTRATION(SyncSourceTest);
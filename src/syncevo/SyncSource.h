@@ -1152,13 +1152,23 @@ class SyncSourceBase : public Logger {
             } m_mode;
             string m_dirname;
             boost::shared_ptr<ConfigNode> m_node;
+            /**
+             * Directory shared by all backups in the same log
+             * directory, empty if not available. Item files are
+             * stored there under a name derived from their content,
+             * so that identical items are only stored once, regardless
+             * of which backup they were found in first.
+             */
+            string m_storeDir;
             BackupInfo() {}
             BackupInfo(Mode mode,
                        const string &dirname,
-                       const boost::shared_ptr<ConfigNode> &node) :
+                       const boost::shared_ptr<ConfigNode> &node,
+                       const string &storeDir = "") :
                 m_mode(mode),
                 m_dirname(dirname),
-                m_node(node)
+                m_node(node),
+                m_storeDir(storeDir)
             {}
         };
         struct ConstBackupInfo {
@@ -1241,6 +1251,22 @@ class SyncSourceBase : public Logger {
         typedef bool (IsEmpty_t)();
         boost::function<IsEmpty_t> m_isEmpty;
 
+        /**
+         * Start watching the database for changes made while the
+         * source is open. The callback must be invoked from the
+         * main loop each time a change is detected. Changes made
+         * through the source itself may also trigger it. Watching
+         * ends when the source is closed.
+         *
+         * Used by the D-Bus server to run automatic syncs soon after
+         * local changes. Sources which cannot detect changes
+         * cheaply don't provide the operation; automatic syncs for
+         * them only run at regular intervals.
+         */
+        typedef boost::function<void ()> ChangeCallback_t;
+        typedef void (WatchChanges_t)(const ChangeCallback_t &callback);
+        boost::function<WatchChanges_t> m_watchChanges;
+
         /**
          * Synthesis DB API callbacks. For documentation see the
          * Synthesis API specification (PDF and/or sync_dbapi.h).
@@ -1945,6 +1971,36 @@ class SyncSourceRaw : virtual public SyncSourceBase {
 
     /** same as SyncSourceSerialize::readItem(), but with internal format */
     virtual void readItemRaw(const std::string &luid, std::string &item) = 0;
+
+    /**
+     * Reads several items at once, in the internal format. Used when
+     * many items are needed, for example while making a backup. The
+     * default implementation calls readItemRaw() for each item.
+     * Backends which can fetch several items with fewer round trips
+     * (or concurrently) should override it.
+     *
+     * @param luids    items to be read
+     * @retval items   item data, in the same order as luids
+     */
+    virtual void readItemsRaw(const std::vector<std::string> &luids,
+                              std::vector<std::string> &items);
+
+    /**
+     * Adds or updates several items at once, in the internal
+     * format. Items are stored in the given order. The default
+     * implementation calls insertItemRaw() for each item.
+     *
+     * If storing an item fails, the exception is passed on to the
+     * caller and results only contains the results of the items
+     * stored before the failed one.
+     *
+     * @param luids     LUID of each item, empty for creating it
+     * @param items     item data, same number of entries as luids
+     * @retval results  result of each insert, same order as luids
+     */
+    virtual void insertItemsRaw(const std::vector<std::string> &luids,
+                                const std::vector<std::string> &items,
+                                std::vector<InsertItemResult> &results);
 };
 
 /**
@@ -2085,6 +2141,10 @@ public:
      * Hashes are also not verified. Users should better
      * not edit them or file contents...
      *
+     * UID and revision of each old item are remembered, so that
+     * unchanged items can reuse their old file without comparing
+     * the content.
+     *
      * @param oldBackup     existing backup to read; may be empty
      * @param newBackup     new backup to be created
      * @param legacy        legacy mode includes a bug
@@ -2099,6 +2159,12 @@ public:
      */
     string getFilename(Hash_t hash);
 
+    /**
+     * create file name for an item in the shared store,
+     * empty if no store is used
+     */
+    string getStoreFilename(Hash_t hash, size_t size);
+
     /**
      * add a new item, reusing old one if possible
      *
@@ -2110,15 +2176,38 @@ public:
                     const std::string &uid,
                     const std::string &rev);
 
-    /** to be called after init() and all backupItem() calls */
+    /**
+     * to be called after init() and all backupItem() calls;
+     * also removes files from the shared store which were
+     * only referenced by a backup discarded with reset()
+     */
     void finalize(BackupReport &report);
 
     /** can be used to restart creating the backup after an intermediate failure */
     void reset();
 
 private:
+    /**
+     * true if an existing file with the same hash as the item may be
+     * reused for it; compares the content unless the hash is
+     * collision resistant
+     */
+    bool sameContent(const string &filename, const std::string &item);
+
+    /**
+     * true if the old backup contains the item with the given
+     * hash under the same UID and revision, which implies that
+     * its file has the same content
+     */
+    bool sameRevision(Hash_t hash, const std::string &uid, const std::string &rev);
+
     typedef std::map<Hash_t, Counter_t> Map_t;
     Map_t m_hash2counter;
+    /** UID and revision of items in the old backup */
+    typedef std::map<Counter_t, std::pair<std::string, std::string> > Revisions_t;
+    Revisions_t m_counter2rev;
+    /** files in the shared store used by the new backup */
+    std::set<string> m_storeFiles;
     string m_dirname;
     SyncSource::Operations::BackupInfo m_backup;
     bool m_legacy;
@@ -2272,6 +2361,66 @@ class SyncSourceRevisions : virtual public SyncSourceChanges, virtual public Syn
      */
     void detectChanges(ConfigNode &trackingNode, ChangeMode mode);
 
+    /**
+     * A unique identifier for the current state of the complete database.
+     * The semantic is the following:
+     * - empty string implies "state unknown" or "identifier not supported" (the default implementation)
+     * - id not empty and id_1 == id_2 implies "nothing has changed";
+     *   the inverse is not true (ids may be different although nothing has changed)
+     *
+     * Backends which can provide such an identifier cheaply allow
+     * detectChanges() to skip listAllItems() entirely, see
+     * checkDatabaseRevision().
+     */
+    virtual std::string databaseRevision() { return ""; }
+
+    /**
+     * Compares databaseRevision() against the value stored in the
+     * meta node by storeDatabaseRevision() at the end of the previous
+     * successful sync. Returns CHANGES_NONE if both are identical and
+     * CHANGES_FULL otherwise, ready to be passed to detectChanges().
+     *
+     * @param metaNode    node which holds the "databaseRevision" property,
+     *                    typically shared with the tracking node
+     * @param reset       clear the stored revision: if anything goes wrong
+     *                    in the rest of the session, then we don't want
+     *                    to rely on a possibly incorrect optimization
+     */
+    ChangeMode checkDatabaseRevision(ConfigNode &metaNode, bool reset);
+
+    /**
+     * Stores the current databaseRevision() in the meta node. Only to be
+     * called at the end of a successful sync, when the tracking node
+     * is known to match the database.
+     */
+    void storeDatabaseRevision(ConfigNode &metaNode);
+
+    /**
+     * Called by detectChanges() for an item whose current revision
+     * string differs from the one recorded for it. Allows backends to
+     * change the format of their revision strings (for example, by
+     * adding more precision) without reporting all items as updated
+     * once: the new revision is recorded, but the item is not listed
+     * as updated if this returns true.
+     *
+     * @param tracked     revision recorded in the tracking node
+     * @param current     revision returned by listAllItems()
+     * @return true if both refer to the same version of the item
+     */
+    virtual bool sameRevision(const std::string &tracked,
+                              const std::string &current) { return false; }
+
+    /**
+     * Overrides the granularity passed to init(), for backends which
+     * only find out after opening the database how precise their
+     * revision strings are. 0 if each modification is guaranteed to
+     * change the revision string, in which case the end of the session
+     * is not delayed at all.
+     *
+     * @param seconds    same meaning as granularity in init(), may be fractional
+     */
+    void setRevisionAccuracy(double seconds) { m_revisionAccuracySeconds = seconds; }
+
     /**
      * record that an item was added or updated
      *
@@ -2309,7 +2458,7 @@ class SyncSourceRevisions : virtual public SyncSourceChanges, virtual public Syn
  private:
     SyncSourceRaw *m_raw;
     SyncSourceDelete *m_del;
-    int m_revisionAccuracySeconds;
+    double m_revisionAccuracySeconds;
 
     /** buffers the result of the initial listAllItems() call */
     RevisionMap_t m_revisions;
@@ -2403,6 +2552,17 @@ class SyncSourceLogging : public virtual SyncSourceBase
  * Implements Load/SaveAdminData and MapItem handling in a SyncML
  * server. Uses a single property for the admin data in the "internal"
  * node and a complete node for the map items.
+ *
+ * Rewriting the complete mapping node after each map change is
+ * O(number of map items). Therefore changes are appended to a journal
+ * file (if one is configured) and only merged into the mapping node
+ * at the end of the session, after which the journal is removed. When
+ * loading the mapping, a journal left behind by an aborted session is
+ * replayed on top of the mapping node. Replaying is idempotent, so a
+ * crash between writing the node and removing the journal is
+ * harmless. An incomplete last record is ignored during replay and
+ * removed before appending to the journal again. The journal is
+ * synced to disk when saving the admin data and before compacting it.
  */
 class SyncSourceAdmin : public virtual SyncSourceBase
 {
@@ -2411,6 +2571,11 @@ class SyncSourceAdmin : public virtual SyncSourceBase
     boost::shared_ptr<ConfigNode> m_mappingNode;
     bool m_mappingLoaded;
 
+    /** file name of the mapping journal, empty if not used */
+    std::string m_mappingJournal;
+    /** append-only file descriptor for m_mappingJournal, -1 if not open */
+    int m_mappingJournalFD;
+
     ConfigProps m_mapping;
     ConfigProps::const_iterator m_mappingIterator;
 
@@ -2428,16 +2593,48 @@ class SyncSourceAdmin : public virtual SyncSourceBase
     void mapid2entry(sysync::cMapID mID, string &key, string &value);
     void entry2mapid(const string &key, const string &value, sysync::MapID mID);
 
+    /**
+     * record a change of m_mapping, either in the journal or
+     * by rewriting the whole mapping node
+     *
+     * @param key       the key which was modified
+     * @param value     new value, NULL if the key was removed
+     */
+    void storeMapChange(const string &key, const string *value);
+
+    /** open m_mappingJournalFD, truncate an incomplete last record */
+    void openMapJournal();
+
+    /** fsync() the journal, if open */
+    void syncMapJournal();
+
+    /** apply changes stored in the journal to m_mapping */
+    void replayMapJournal();
+
+    /** close and remove the journal, called once m_mappingNode is up-to-date */
+    void removeMapJournal();
+
  public:
-    /** flexible initialization */
+    SyncSourceAdmin();
+    ~SyncSourceAdmin();
+
+    /**
+     * flexible initialization
+     *
+     * @param journal    file used for recording map changes since the last
+     *                   time that the mapping node was written; empty for
+     *                   writing each change directly into the mapping node
+     */
     void init(SyncSource::Operations &ops,
               const boost::shared_ptr<ConfigNode> &config,
               const std::string adminPropertyName,
-              const boost::shared_ptr<ConfigNode> &mapping);
+              const boost::shared_ptr<ConfigNode> &mapping,
+              const std::string &journal = "");
 
     /**
      * simpler initialization, using the default placement of data
-     * inside the SyncSourceConfig base class
+     * inside the SyncSourceConfig base class; the journal is
+     * kept in the cache directory of the source, if there is one
      */
     void init(SyncSource::Operations &ops, SyncSource *source);
 };
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2012 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ */
+
+#include <syncevo/TimezoneCache.h>
+#include <syncevo/Logging.h>
+#include <syncevo/util.h>
+#include <test.h>
+
+#include <boost/functional/hash.hpp>
+
+#include <syncevo/declarations.h>
+SE_BEGIN_CXX
+
+namespace {
+
+/** holds the mutex while in scope */
+class Lock : private boost::noncopyable
+{
+    pthread_mutex_t &m_mutex;
+public:
+    Lock(pthread_mutex_t &mutex) : m_mutex(mutex) { pthread_mutex_lock(&m_mutex); }
+    ~Lock() { pthread_mutex_unlock(&m_mutex); }
+};
+
+}
+
+TimezoneCache::TimezoneCache() :
+    m_hits(0),
+    m_misses(0)
+{
+    pthread_mutex_init(&m_mutex, NULL);
+}
+
+TimezoneCache::~TimezoneCache()
+{
+    pthread_mutex_destroy(&m_mutex);
+}
+
+TimezoneCache &TimezoneCache::instance()
+{
+    // never freed, might still be in use by other threads
+    // while the process shuts down
+    static TimezoneCache *cache = new TimezoneCache;
+    return *cache;
+}
+
+std::string TimezoneCache::getKey(const std::string &scope,
+                                  const std::string &tzid,
+                                  const std::string &definition)
+{
+    boost::hash<std::string> hash;
+    std::string key;
+    key.reserve(scope.size() + tzid.size() + 20);
+    key += scope;
+    key += '\0';
+    key += tzid;
+    key += '\0';
+    key += StringPrintf("%lx", (unsigned long)hash(definition));
+    return key;
+}
+
+bool TimezoneCache::lookup(const std::string &scope,
+                           const std::string &tzid,
+                           const std::string &definition)
+{
+    std::string key = getKey(scope, tzid, definition);
+    Lock lock(m_mutex);
+    Entries_t::const_iterator it = m_entries.find(key);
+    if (it == m_entries.end() ||
+        it->second != definition) {
+        m_misses++;
+        return false;
+    }
+    m_hits++;
+    return true;
+}
+
+void TimezoneCache::store(const std::string &scope,
+                          const std::string &tzid,
+                          const std::string &definition)
+{
+    std::string key = getKey(scope, tzid, definition);
+    Lock lock(m_mutex);
+    // In the unlikely case of a hash collision the older entry
+    // gets replaced.
+    m_entries[key] = definition;
+}
+
+bool TimezoneCache::lookupResolved(const std::string &scope,
+                                   const std::string &tzid,
+                                   std::string &definition)
+{
+    std::string key = scope;
+    key += '\0';
+    key += tzid;
+    Lock lock(m_mutex);
+    Entries_t::const_iterator it = m_resolved.find(key);
+    if (it == m_resolved.end()) {
+        m_misses++;
+        return false;
+    }
+    m_hits++;
+    definition = it->second;
+    return true;
+}
+
+void TimezoneCache::storeResolved(const std::string &scope,
+                                  const std::string &tzid,
+                                  const std::string &definition)
+{
+    std::string key = scope;
+    key += '\0';
+    key += tzid;
+    Lock lock(m_mutex);
+    m_resolved[key] = definition;
+}
+
+static void clearEntries(std::map<std::string, std::string> &entries,
+                         const std::string &prefix)
+{
+    std::map<std::string, std::string>::iterator it = entries.lower_bound(prefix);
+    while (it != entries.end() &&
+           !it->first.compare(0, prefix.size(), prefix)) {
+        entries.erase(it++);
+    }
+}
+
+void TimezoneCache::clear(const std::string &scope)
+{
+    std::string prefix = scope;
+    prefix += '\0';
+    Lock lock(m_mutex);
+    clearEntries(m_entries, prefix);
+    clearEntries(m_resolved, prefix);
+}
+
+unsigned long TimezoneCache::getHits() const
+{
+    Lock lock(m_mutex);
+    return m_hits;
+}
+
+unsigned long TimezoneCache::getMisses() const
+{
+    Lock lock(m_mutex);
+    return m_misses;
+}
+
+void TimezoneCache::logStatistics()
+{
+    Lock lock(m_mutex);
+    SE_LOG_DEBUG(NULL, NULL, "time zone cache: %lu definitions, %lu resolved TZIDs, %lu hits, %lu misses",
+                 (unsigned long)m_entries.size(), (unsigned long)m_resolved.size(),
+                 m_hits, m_misses);
+}
+
+#ifdef ENABLE_UNIT_TESTS
+
+class TimezoneCacheTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(TimezoneCacheTest);
+    CPPUNIT_TEST(lookup);
+    CPPUNIT_TEST(resolved);
+    CPPUNIT_TEST(clear);
+    CPPUNIT_TEST_SUITE_END();
+
+    static const char *berlin()
+    {
+        return
+            "BEGIN:VTIMEZONE\n"
+            "TZID:Europe/Berlin\n"
+            "BEGIN:STANDARD\n"
+            "DTSTART:19701025T030000\n"
+            "TZOFFSETFROM:+0200\n"
+            "TZOFFSETTO:+0100\n"
+            "END:STANDARD\n"
+            "END:VTIMEZONE\n";
+    }
+
+public:
+    void lookup()
+    {
+        TimezoneCache cache;
+        CPPUNIT_ASSERT(!cache.lookup("db", "Europe/Berlin", berlin()));
+        cache.store("db", "Europe/Berlin", berlin());
+        CPPUNIT_ASSERT(cache.lookup("db", "Europe/Berlin", berlin()));
+
+        // different definition, TZID or scope
+        std::string other = berlin();
+        other.replace(other.find("+0100"), 5, "+0000");
+        CPPUNIT_ASSERT(!cache.lookup("db", "Europe/Berlin", other));
+        CPPUNIT_ASSERT(!cache.lookup("db", "Europe/Paris", berlin()));
+        CPPUNIT_ASSERT(!cache.lookup("db2", "Europe/Berlin", berlin()));
+
+        CPPUNIT_ASSERT_EQUAL(1ul, cache.getHits());
+        CPPUNIT_ASSERT_EQUAL(4ul, cache.getMisses());
+    }
+
+    void resolved()
+    {
+        TimezoneCache cache;
+        std::string definition = "unchanged";
+        CPPUNIT_ASSERT(!cache.lookupResolved("db", "Europe/Berlin", definition));
+        CPPUNIT_ASSERT_EQUAL(std::string("unchanged"), definition);
+
+        // not found is remembered, too
+        cache.storeResolved("db", "Europe/Berlin", "");
+        CPPUNIT_ASSERT(cache.lookupResolved("db", "Europe/Berlin", definition));
+        CPPUNIT_ASSERT_EQUAL(std::string(""), definition);
+
+        cache.storeResolved("db", "Europe/Berlin", berlin());
+        CPPUNIT_ASSERT(cache.lookupResolved("db", "Europe/Berlin", definition));
+        CPPUNIT_ASSERT_EQUAL(std::string(berlin()), definition);
+        CPPUNIT_ASSERT(!cache.lookupResolved("db2", "Europe/Berlin", definition));
+
+        // independent of stored definitions
+        CPPUNIT_ASSERT(!cache.lookup("db", "Europe/Berlin", berlin()));
+
+        CPPUNIT_ASSERT_EQUAL(2ul, cache.getHits());
+        CPPUNIT_ASSERT_EQUAL(3ul, cache.getMisses());
+    }
+
+    void clear()
+    {
+        TimezoneCache cache;
+        std::string definition;
+        cache.store("db", "Europe/Berlin", berlin());
+        cache.store("db2", "Europe/Berlin", berlin());
+        cache.store("d", "Europe/Berlin", berlin());
+        cache.storeResolved("db", "Europe/Berlin", berlin());
+        cache.storeResolved("db2", "Europe/Berlin", berlin());
+        cache.clear("db");
+        CPPUNIT_ASSERT(!cache.lookup("db", "Europe/Berlin", berlin()));
+        CPPUNIT_ASSERT(cache.lookup("db2", "Europe/Berlin", berlin()));
+        CPPUNIT_ASSERT(cache.lookup("d", "Europe/Berlin", berlin()));
+        CPPUNIT_ASSERT(!cache.lookupResolved("db", "Europe/Berlin", definition));
+        CPPUNIT_ASSERT(cache.lookupResolved("db2", "Europe/Berlin", definition));
+    }
+};
+
+SYNCEVOLUTION_TEST_SUITE_REGISTRATION(TimezoneCacheTest);
+
+#endif // ENABLE_UNIT_TESTS
+
+SE_END_CXX
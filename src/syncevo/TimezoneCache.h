@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2012 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) version 3.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ */
+
+#ifndef INCL_SYNCEVOLUTION_TIMEZONECACHE
+# define INCL_SYNCEVOLUTION_TIMEZONECACHE
+
+#include <boost/noncopyable.hpp>
+
+#include <string>
+#include <map>
+
+#include <pthread.h>
+
+#include <syncevo/declarations.h>
+SE_BEGIN_CXX
+
+/**
+ * Remembers how calendar backends have processed VTIMEZONE
+ * definitions. When importing many events, the same handful of time
+ * zones gets sent again and again, and resolving them usually
+ * involves calls into the storage.
+ *
+ * Two kinds of entries are kept, both identified by a scope chosen
+ * by the backend (for example, the database that the time zone was
+ * stored in) and the TZID:
+ * - definitions which were stored in the scope, with a hash of
+ *   the VTIMEZONE definition as additional key; the definition
+ *   itself is kept to detect collisions
+ * - the result of resolving a TZID in the scope, which is the
+ *   definition found there or nothing
+ *
+ * The backend has to clear() the scope when the cached information
+ * might have become invalid, for example because the database was
+ * recreated.
+ *
+ * There is one process-wide instance, which may be used by
+ * different threads concurrently.
+ */
+class TimezoneCache : private boost::noncopyable
+{
+ public:
+    TimezoneCache();
+    ~TimezoneCache();
+
+    /** the process-wide instance */
+    static TimezoneCache &instance();
+
+    /** @return true if stored for the scope */
+    bool lookup(const std::string &scope,
+                const std::string &tzid,
+                const std::string &definition);
+
+    /** add or replace entry */
+    void store(const std::string &scope,
+               const std::string &tzid,
+               const std::string &definition);
+
+    /**
+     * @retval definition   VTIMEZONE found for the TZID in the scope,
+     *                      empty if it was not found there
+     * @return true if the TZID was resolved before
+     */
+    bool lookupResolved(const std::string &scope,
+                        const std::string &tzid,
+                        std::string &definition);
+
+    /** store result of resolving the TZID, empty definition if not found */
+    void storeResolved(const std::string &scope,
+                       const std::string &tzid,
+                       const std::string &definition);
+
+    /** forget about all entries in the scope, for example because the database was reopened */
+    void clear(const std::string &scope);
+
+    /** counters for both kinds of lookups since the cache was created */
+    unsigned long getHits() const;
+    unsigned long getMisses() const;
+
+    /** log number of entries and counters at debug level */
+    void logStatistics();
+
+ private:
+    /** scope, TZID, hash of definition -> definition */
+    typedef std::map<std::string, std::string> Entries_t;
+    Entries_t m_entries;
+    /** scope, TZID -> definition */
+    Entries_t m_resolved;
+    unsigned long m_hits, m_misses;
+    mutable pthread_mutex_t m_mutex;
+
+    static std::string getKey(const std::string &scope,
+                              const std::string &tzid,
+                              const std::string &definition);
+};
+
+SE_END_CXX
+
+#endif // INCL_SYNCEVOLUTION_TIMEZONECACHE
@@ -41,22 +41,9 @@ TrackingSyncSource::TrackingSyncSource(const SyncSourceParams &params,
 
 void TrackingSyncSource::checkStatus(SyncSourceReport &changes)
 {
-    // use the most reliable (and most expensive) method by default
-    ChangeMode mode = CHANGES_FULL;
-
     // assume that we do a regular sync, with reusing stored information
     // if possible
-    string oldRevision = m_metaNode->readProperty("databaseRevision");
-    if (!oldRevision.empty()) {
-        string newRevision = databaseRevision();
-        SE_LOG_DEBUG(this, NULL, "old database revision '%s', new revision '%s'",
-                     oldRevision.c_str(),
-                     newRevision.c_str());
-        if (newRevision == oldRevision) {
-            SE_LOG_DEBUG(this, NULL, "revisions match, no item changes");
-            mode = CHANGES_NONE;
-        }
-    }
+    ChangeMode mode = checkDatabaseRevision(*m_metaNode, false);
     if (mode == CHANGES_FULL) {
         SE_LOG_DEBUG(this, NULL, "using full item scan to detect changes");
     }
@@ -89,22 +76,9 @@ void TrackingSyncSource::beginSync(const std::string &lastToken, const std::stri
         SE_LOG_DEBUG(this, NULL, "slow sync or testing, do full item scan to detect changes");
         mode = CHANGES_SLOW;
     } else {
-        string oldRevision = m_metaNode->readProperty("databaseRevision");
-        if (!oldRevision.empty()) {
-            string newRevision = databaseRevision();
-            SE_LOG_DEBUG(this, NULL, "old database revision '%s', new revision '%s'",
-                         oldRevision.c_str(),
-                         newRevision.c_str());
-            if (newRevision == oldRevision) {
-                SE_LOG_DEBUG(this, NULL, "revisions match, no item changes");
-                mode = CHANGES_NONE;
-            }
-
-            // Reset old revision. If anything goes wrong, then we
-            // don't want to rely on a possibly incorrect optimization.
-            m_metaNode->setProperty("databaseRevision", "");
-            m_metaNode->flush();
-        }
+        // Resets the old revision. If anything goes wrong, then we
+        // don't want to rely on a possibly incorrect optimization.
+        mode = checkDatabaseRevision(*m_metaNode, true);
     }
     if (mode == CHANGES_FULL) {
         SE_LOG_DEBUG(this, NULL, "using full item scan to detect changes");
@@ -119,8 +93,7 @@ std::string TrackingSyncSource::endSync(bool success)
     flush();
 
     if (success) {
-        string updatedRevision = databaseRevision();
-        m_metaNode->setProperty("databaseRevision", updatedRevision);
+        storeDatabaseRevision(*m_metaNode);
         // flush both nodes, just in case; in practice, the properties
         // end up in the same file and only get flushed once
         m_trackingNode->flush();
@@ -155,6 +128,42 @@ TrackingSyncSource::InsertItemResult TrackingSyncSource::insertItemRaw(const std
     return res;
 }
 
+void TrackingSyncSource::insertItems(const std::vector<std::string> &luids,
+                                     const std::vector<std::string> &items,
+                                     bool raw,
+                                     std::vector<InsertItemResult> &results)
+{
+    results.clear();
+    results.reserve(luids.size());
+    for (size_t i = 0; i < luids.size(); i++) {
+        results.push_back(insertItem(luids[i], items[i], raw));
+    }
+}
+
+void TrackingSyncSource::insertItemsRaw(const std::vector<std::string> &luids,
+                                        const std::vector<std::string> &items,
+                                        std::vector<InsertItemResult> &results)
+{
+    try {
+        insertItems(luids, items, true, results);
+    } catch (...) {
+        // items stored before the failure must be tracked, too
+        updateRevisions(luids, results);
+        throw;
+    }
+    updateRevisions(luids, results);
+}
+
+void TrackingSyncSource::updateRevisions(const std::vector<std::string> &luids,
+                                         const std::vector<InsertItemResult> &results)
+{
+    for (size_t i = 0; i < results.size() && i < luids.size(); i++) {
+        if (results[i].m_state != ITEM_NEEDS_MERGE) {
+            updateRevision(*m_trackingNode, luids[i], results[i].m_luid, results[i].m_revision);
+        }
+    }
+}
+
 void TrackingSyncSource::readItem(const std::string &luid, std::string &item)
 {
     readItem(luid, item, false);
@@ -119,15 +119,6 @@ class TrackingSyncSource : public TestingSyncSource,
      */
     virtual bool isEmpty() = 0;
 
-    /**
-     * A unique identifier for the current state of the complete database.
-     * The semantic is the following:
-     * - empty string implies "state unknown" or "identifier not supported" (the default implementation)
-     * - id not empty and id_1 == id_2 implies "nothing has changed";
-     *   the inverse is not true (ids may be different although nothing has changed)
-     */
-    virtual std::string databaseRevision() { return ""; }
-
     /**
      * fills the complete mapping from LUID to revision string of all
      * currently existing items
@@ -208,6 +199,22 @@ class TrackingSyncSource : public TestingSyncSource,
      */
     virtual void readItem(const std::string &luid, std::string &item, bool raw) = 0;
 
+    /**
+     * Adds or updates several items at once, with the same semantic
+     * as SyncSourceRaw::insertItemsRaw(). Backends which can store
+     * several items with fewer round trips should override it. The
+     * default implementation calls insertItem() for each item.
+     *
+     * @param luids     identifies the items to be modified, empty for creating
+     * @param items     contains the new content of the items
+     * @param raw       items have internal format instead of engine format
+     * @retval results  result of each insert, same order as luids
+     */
+    virtual void insertItems(const std::vector<std::string> &luids,
+                             const std::vector<std::string> &items,
+                             bool raw,
+                             std::vector<InsertItemResult> &results);
+
     /**
      * delete the item (renamed so that it can be wrapped by deleteItem())
      *
@@ -251,6 +258,10 @@ class TrackingSyncSource : public TestingSyncSource,
 
   private:
     void checkStatus(SyncSourceReport &changes);
+
+    /** updates change tracking after insertItems() */
+    void updateRevisions(const std::vector<std::string> &luids,
+                         const std::vector<InsertItemResult> &results);
     boost::shared_ptr<ConfigNode> m_trackingNode;
 
     /**
@@ -264,6 +275,14 @@ class TrackingSyncSource : public TestingSyncSource,
     boost::shared_ptr<ConfigNode> m_metaNode;
 
  protected:
+    /**
+     * Key/value store for additional information which a derived
+     * class wants to keep together with the change tracking
+     * information. Keys must not start with "item-" and must not
+     * be "databaseRevision".
+     */
+    ConfigNode &getMetaNode() { return *m_metaNode; }
+
     /* implementations of SyncSource callbacks */
     virtual void beginSync(const std::string &lastToken, const std::string &resumeToken);
     virtual std::string endSync(bool success);
@@ -272,6 +291,9 @@ class TrackingSyncSource : public TestingSyncSource,
     virtual void readItem(const std::string &luid, std::string &item);
     virtual InsertItemResult insertItemRaw(const std::string &luid, const std::string &item);
     virtual void readItemRaw(const std::string &luid, std::string &item);
+    virtual void insertItemsRaw(const std::vector<std::string> &luids,
+                                const std::vector<std::string> &items,
+                                std::vector<InsertItemResult> &results);
     virtual void enableServerMode();
     virtual bool serverModeEnabled() const;
     virtual std::string getPeerMimeType() const;
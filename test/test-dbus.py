@@ -4126,8 +4126,8 @@ def injectValues(config):
 
 def filterConfig(config):
     '''remove pure comment lines from buffer, also empty lines, also
-    defaultPeer/keyring (because reference properties do not include global
-    props)'''
+    global properties like defaultPeer/keyring (because reference properties
+    do not include global props)'''
     config_lines = config.splitlines()
     out = ''
 
@@ -4135,6 +4135,8 @@ def filterConfig(config):
         if line and \
                 "defaultPeer =" not in line and \
                 "keyring =" not in line and \
+                "dbusHelperPool =" not in line and \
+                "dbusMaxSessions =" not in line and \
                 (line.startswith("# ") == False or \
                      isPropAssignment(line[2:])):
             out += line + "\n"
@@ -4439,6 +4441,7 @@ config.ini:# maxlogdirs = 10
 peers/scheduleworld/config.ini:# autoSync = 0
 peers/scheduleworld/config.ini:# autoSyncInterval = 30M
 peers/scheduleworld/config.ini:# autoSyncDelay = 5M
+peers/scheduleworld/config.ini:# autoSyncChangeDelay = 0
 peers/scheduleworld/config.ini:# preventSlowSync = 1
 peers/scheduleworld/config.ini:# useProxy = 0
 peers/scheduleworld/config.ini:# proxyHost = 
@@ -4645,6 +4648,7 @@ spds/syncml/config.txt:# maxlogdirs = 10
 spds/syncml/config.txt:# autoSync = 0
 spds/syncml/config.txt:# autoSyncInterval = 30M
 spds/syncml/config.txt:# autoSyncDelay = 5M
+spds/syncml/config.txt:# autoSyncChangeDelay = 0
 spds/syncml/config.txt:# preventSlowSync = 1
 spds/syncml/config.txt:# useProxy = 0
 spds/syncml/config.txt:# proxyHost = 
@@ -5629,6 +5633,8 @@ autoSyncInterval (30M, unshared)
 
 autoSyncDelay (5M, unshared)
 
+autoSyncChangeDelay (0, unshared)
+
 preventSlowSync (TRUE, unshared)
 
 useProxy (FALSE, unshared)
@@ -5680,6 +5686,10 @@ peerType (no default, unshared)
 defaultPeer (no default, global)
 
 keyring (yes, global)
+
+dbusHelperPool (0, global)
+
+dbusMaxSessions (1, global)
 """.format(self.getSSLServerCertificates())
 
         sourceproperties = """sync (disabled, unshared, required)